@@ -0,0 +1,196 @@
+/* acpi.c - ACPI table lookup for JoshOS */
+
+#include "acpi.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/* Where the RSDP may be */
+#define BDA_EBDA_SEGMENT 0x40E            /* Word: EBDA segment */
+#define EBDA_SEARCH_SIZE 1024             /* First 1KB of the EBDA */
+#define BIOS_ROM_START   0xE0000
+#define BIOS_ROM_END     0x100000
+
+/* MADT entry types */
+#define MADT_LOCAL_APIC  0
+#define MADT_IO_APIC     1
+#define MADT_LAPIC_OVERRIDE 5
+
+/* MADT flags */
+#define MADT_PCAT_COMPAT 0x01             /* 8259 PICs present */
+
+/* Local APIC entry flags */
+#define LAPIC_ENABLED    0x01             /* Present and usable now */
+
+/* Root system description pointer (hardware layout) */
+typedef struct {
+    char signature[8];                    /* "RSD PTR " */
+    uint8_t checksum;                     /* Over the first 20 bytes */
+    char oem_id[6];
+    uint8_t revision;                     /* 0 for ACPI 1.0, 2 and up has an XSDT */
+    uint32_t rsdt_address;
+    uint32_t length;                      /* ACPI 2.0+ fields */
+    uint32_t xsdt_address_low;
+    uint32_t xsdt_address_high;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) AcpiRsdp;
+
+/* Header shared by all system description tables */
+typedef struct {
+    char signature[4];
+    uint32_t length;                      /* Including this header */
+    uint8_t revision;
+    uint8_t checksum;                     /* Whole table sums to 0 */
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) AcpiHeader;
+
+/* MADT fixed part, followed by variable-length entries */
+typedef struct {
+    AcpiHeader header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed)) AcpiMadt;
+
+/* Check that length bytes sum to zero */
+static uint8_t acpi_checksum(const void* data, uint32_t length) {
+    const uint8_t* bytes = (const uint8_t*) data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+/* Compare a table signature */
+static uint8_t acpi_signature(const char* a, const char* b, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        if (a[i] != b[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Scan a range on 16-byte boundaries for a valid RSDP */
+static const AcpiRsdp* rsdp_scan(uint32_t start, uint32_t end) {
+    for (uint32_t addr = start; addr + 20 <= end; addr += 16) {
+        const AcpiRsdp* rsdp = (const AcpiRsdp*) addr;
+        if (acpi_signature(rsdp->signature, "RSD PTR ", 8) && acpi_checksum(rsdp, 20)) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+/* Find the RSDP - EBDA first, then the BIOS ROM area */
+static const AcpiRsdp* rsdp_find(void) {
+    /* GCC assumes nothing lives in the first page - hide the address */
+    const volatile uint16_t* bda = (const volatile uint16_t*) BDA_EBDA_SEGMENT;
+    __asm__ ("" : "+r" (bda));
+    uint32_t ebda = (uint32_t)(*bda) << 4;
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        const AcpiRsdp* rsdp = rsdp_scan(ebda, ebda + EBDA_SEARCH_SIZE);
+        if (rsdp != NULL) {
+            return rsdp;
+        }
+    }
+    return rsdp_scan(BIOS_ROM_START, BIOS_ROM_END);
+}
+
+/* Return a table if its signature and checksum are right */
+static const AcpiHeader* table_check(uint32_t addr, const char* signature) {
+    const AcpiHeader* table = (const AcpiHeader*) addr;
+    if (addr == 0 || !acpi_signature(table->signature, signature, 4)) {
+        return NULL;
+    }
+    return acpi_checksum(table, table->length) ? table : NULL;
+}
+
+/* Find a table through the XSDT (preferred) or the RSDT */
+static const AcpiHeader* table_find(const AcpiRsdp* rsdp, const char* signature) {
+    /* XSDT entries are 64-bit - usable only below 4GB, which is all we map */
+    if (rsdp->revision >= 2 && rsdp->xsdt_address_high == 0) {
+        const AcpiHeader* xsdt = table_check(rsdp->xsdt_address_low, "XSDT");
+        if (xsdt != NULL) {
+            const uint32_t* entries = (const uint32_t*)(xsdt + 1);
+            uint32_t count = (xsdt->length - sizeof(AcpiHeader)) / 8;
+            for (uint32_t i = 0; i < count; i++) {
+                if (entries[i * 2 + 1] == 0) {
+                    const AcpiHeader* table = table_check(entries[i * 2], signature);
+                    if (table != NULL) {
+                        return table;
+                    }
+                }
+            }
+            return NULL;
+        }
+    }
+
+    const AcpiHeader* rsdt = table_check(rsdp->rsdt_address, "RSDT");
+    if (rsdt == NULL) {
+        return NULL;
+    }
+    const uint32_t* entries = (const uint32_t*)(rsdt + 1);
+    uint32_t count = (rsdt->length - sizeof(AcpiHeader)) / 4;
+    for (uint32_t i = 0; i < count; i++) {
+        const AcpiHeader* table = table_check(entries[i], signature);
+        if (table != NULL) {
+            return table;
+        }
+    }
+    return NULL;
+}
+
+/* Find and parse the MADT */
+uint8_t acpi_read_madt(MadtInfo* info) {
+    info->lapic_base = 0;
+    info->ioapic_base = 0;
+    info->cpu_count = 0;
+    info->has_pic = 1;
+
+    const AcpiRsdp* rsdp = rsdp_find();
+    if (rsdp == NULL) {
+        return 0;
+    }
+    const AcpiMadt* madt = (const AcpiMadt*) table_find(rsdp, "APIC");
+    if (madt == NULL) {
+        return 0;
+    }
+    info->lapic_base = madt->lapic_address;
+    info->has_pic = (madt->flags & MADT_PCAT_COMPAT) != 0;
+
+    /* Walk the entries: type, length, then type-specific fields */
+    const uint8_t* entry = (const uint8_t*)(madt + 1);
+    const uint8_t* end = (const uint8_t*) madt + madt->header.length;
+    while (entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end) {
+        switch (entry[0]) {
+            case MADT_LOCAL_APIC:
+                /* processor id, APIC id, 32-bit flags */
+                if ((*(const uint32_t*)(entry + 4) & LAPIC_ENABLED) &&
+                    info->cpu_count < SMP_MAX_CPUS) {
+                    info->apic_ids[info->cpu_count++] = entry[3];
+                }
+                break;
+            case MADT_IO_APIC:
+                /* id, reserved, 32-bit address, GSI base */
+                if (info->ioapic_base == 0) {
+                    info->ioapic_base = *(const uint32_t*)(entry + 4);
+                }
+                break;
+            case MADT_LAPIC_OVERRIDE:
+                /* reserved word, 64-bit address - only usable below 4GB */
+                if (*(const uint32_t*)(entry + 8) == 0) {
+                    info->lapic_base = *(const uint32_t*)(entry + 4);
+                }
+                break;
+        }
+        entry += entry[1];
+    }
+    return info->cpu_count > 0;
+}
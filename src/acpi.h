@@ -0,0 +1,26 @@
+/* acpi.h - ACPI table lookup for JoshOS
+ *
+ * Only what SMP bring-up needs: find the RSDP in the BIOS areas, walk
+ * the RSDT (or XSDT) to the MADT, and list the local APICs of the usable
+ * CPUs. Tables are read in place - they sit in identity-mapped memory
+ * the firmware reserved.
+ */
+
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "percpu.h"
+
+/* What the MADT says about interrupt controllers */
+typedef struct {
+    uint32_t lapic_base;                  /* Physical address of the local APICs */
+    uint32_t ioapic_base;                 /* First I/O APIC (0 if none) */
+    uint32_t cpu_count;                   /* Usable CPUs found */
+    uint8_t apic_ids[SMP_MAX_CPUS];       /* Their local APIC ids, firmware order */
+    uint8_t has_pic;                      /* Legacy 8259 PICs present too */
+} MadtInfo;
+
+/* Find and parse the MADT - returns 0 if there is no usable one */
+uint8_t acpi_read_madt(MadtInfo* info);
+
+#endif /* ACPI_H */
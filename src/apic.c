@@ -0,0 +1,161 @@
+/* apic.c - Local APIC for JoshOS
+ *
+ * Registers are 32 bits wide, 16-byte aligned, and must be accessed with
+ * single aligned 32-bit loads and stores, hence the volatile pointer.
+ */
+
+#include "apic.h"
+#include "cpu.h"
+#include "idt.h"
+#include "paging.h"
+#include "timer.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/* Register offsets (in bytes) */
+#define LAPIC_ID        0x020
+#define LAPIC_TPR       0x080             /* Task priority */
+#define LAPIC_EOI       0x0B0
+#define LAPIC_SVR       0x0F0             /* Spurious vector / enable */
+#define LAPIC_ESR       0x280             /* Error status */
+#define LAPIC_ICR_LOW   0x300             /* Interrupt command */
+#define LAPIC_ICR_HIGH  0x310             /* Destination in bits 24-31 */
+#define LAPIC_LVT_TIMER 0x320             /* Timer vector and mode */
+#define LAPIC_TIMER_INIT  0x380           /* Timer initial count */
+#define LAPIC_TIMER_COUNT 0x390           /* Timer current count */
+#define LAPIC_TIMER_DIVIDE 0x3E0          /* Timer clock divider */
+
+/* SVR bits */
+#define LAPIC_SVR_ENABLE   0x100
+
+/* ICR bits */
+#define ICR_FIXED          0x00000000
+#define ICR_INIT           0x00000500
+#define ICR_STARTUP        0x00000600
+#define ICR_PENDING        0x00001000     /* Delivery status: not yet accepted */
+#define ICR_ASSERT         0x00004000
+#define ICR_LEVEL          0x00008000
+
+/* Timer bits */
+#define LVT_MASKED         0x00010000
+#define LVT_TIMER_PERIODIC 0x00020000
+#define TIMER_DIVIDE_16    0x3
+
+/* How long to count timer ticks for lapic_timer_hz */
+#define TIMER_CALIBRATE_NS (10 * NS_PER_MS)
+
+/* Memory-mapped registers (identity mapped) */
+static volatile uint32_t* lapic = NULL;
+
+/* APIC timer rate with TIMER_DIVIDE_16 (0 until measured) */
+static uint32_t timer_hz = 0;
+
+/* Read a register */
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+/* Write a register */
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+}
+
+/* Spurious interrupts need no EOI and no work */
+static void lapic_spurious(InterruptFrame* frame) {
+    (void)frame;
+}
+
+/* Use the local APIC at phys_base */
+uint8_t lapic_init(uint32_t phys_base) {
+    if (!cpu_has(CPU_FEATURE_APIC) || phys_base == 0) {
+        return 0;
+    }
+    lapic = (volatile uint32_t*) phys_base;
+    paging_set_memory_type(phys_base, 4096, PAGING_UNCACHED);
+    interrupt_install_handler(APIC_SPURIOUS_VECTOR, lapic_spurious);
+    lapic_enable();
+    return 1;
+}
+
+/* Software-enable the calling CPU's local APIC */
+void lapic_enable(void) {
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_TPR, 0);            /* Accept every vector */
+    lapic_write(LAPIC_ESR, 0);            /* Clear errors left by the firmware */
+}
+
+/* Check if lapic_init succeeded */
+uint8_t lapic_available(void) {
+    return lapic != NULL;
+}
+
+/* The calling CPU's APIC id */
+uint32_t lapic_id(void) {
+    return lapic != NULL ? lapic_read(LAPIC_ID) >> 24 : 0;
+}
+
+/* Signal end of interrupt */
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+/* Issue one interrupt command and wait until the target accepts it */
+static void lapic_command(uint32_t apic_id, uint32_t command) {
+    uint32_t flags = interrupts_save();   /* ICR high/low must not be split */
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) {
+        __asm__ volatile ("pause");
+    }
+    interrupts_restore(flags);
+}
+
+/* Send a fixed-vector interrupt to one CPU */
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    lapic_command(apic_id, ICR_FIXED | ICR_ASSERT | vector);
+}
+
+/* Send INIT */
+void lapic_send_init(uint32_t apic_id) {
+    lapic_command(apic_id, ICR_INIT | ICR_ASSERT | ICR_LEVEL);
+}
+
+/* Send STARTUP */
+void lapic_send_startup(uint32_t apic_id, uint8_t page) {
+    lapic_command(apic_id, ICR_STARTUP | page);
+}
+
+/* Measure the APIC timer with the TSC on the calling CPU */
+uint32_t lapic_timer_hz(void) {
+    if (timer_hz != 0 || lapic == NULL || timer_tsc_hz() == 0) {
+        return timer_hz;
+    }
+    uint32_t flags = interrupts_save();
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED | APIC_SPURIOUS_VECTOR);
+    uint64_t start = now_ns();
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    while (now_ns() - start < TIMER_CALIBRATE_NS) {
+        __asm__ volatile ("pause");
+    }
+    uint32_t ticks = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_COUNT);
+    uint64_t elapsed = now_ns() - start;
+    lapic_write(LAPIC_TIMER_INIT, 0);     /* Stop counting */
+    interrupts_restore(flags);
+    
+    timer_hz = (uint32_t) udiv64((uint64_t) ticks * NS_PER_SEC, (uint32_t) elapsed, NULL);
+    return timer_hz;
+}
+
+/* Start the calling CPU's APIC timer in periodic mode */
+void lapic_timer_start(uint8_t vector, uint32_t hz) {
+    uint32_t count = lapic_timer_hz() / hz;
+    if (count == 0) {
+        return;                           /* Not measured, or too fast */
+    }
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_TIMER_PERIODIC | vector);
+    lapic_write(LAPIC_TIMER_INIT, count);
+}
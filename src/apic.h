@@ -0,0 +1,56 @@
+/* apic.h - Local APIC for JoshOS
+ *
+ * Each CPU has a local APIC, mapped at the same physical address on all
+ * of them; accesses always reach the APIC of the CPU making them. The
+ * kernel uses it to send inter-processor interrupts: INIT and STARTUP
+ * to bring up the other CPUs, and fixed vectors to ask a CPU to
+ * reschedule. Device IRQs still come through the PIC to the bootstrap
+ * CPU. The APIC's own timer gives every CPU a private periodic interrupt,
+ * which the sampling profiler uses.
+ */
+
+#ifndef APIC_H
+#define APIC_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned short     uint16_t;
+typedef unsigned int       uint32_t;
+
+/* Vectors owned by the local APIC (above the PIC range) */
+#define APIC_RESCHEDULE_VECTOR 0xF0       /* Run the scheduler */
+#define APIC_PROFILE_VECTOR    0xF1       /* Sampling profiler tick */
+#define APIC_SPURIOUS_VECTOR   0xFF       /* Spurious interrupt (no EOI) */
+
+/* Use the local APIC at phys_base - returns 0 if the CPU has none */
+uint8_t lapic_init(uint32_t phys_base);
+
+/* Software-enable the calling CPU's local APIC */
+void lapic_enable(void);
+
+/* Check if lapic_init succeeded */
+uint8_t lapic_available(void);
+
+/* The calling CPU's APIC id */
+uint32_t lapic_id(void);
+
+/* Signal end of interrupt for a fixed-vector IPI */
+void lapic_eoi(void);
+
+/* Send a fixed-vector interrupt to one CPU */
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+/* Send INIT, putting a CPU into wait-for-STARTUP */
+void lapic_send_init(uint32_t apic_id);
+
+/* Send STARTUP - the CPU begins in real mode at page * 4KB */
+void lapic_send_startup(uint32_t apic_id, uint8_t page);
+
+/* APIC timer ticks per second, measured once against the TSC - 0 if
+ * there is no local APIC. All CPUs share the bus clock it counts */
+uint32_t lapic_timer_hz(void);
+
+/* Interrupt the calling CPU on vector hz times a second */
+void lapic_timer_start(uint8_t vector, uint32_t hz);
+
+#endif /* APIC_H */
@@ -0,0 +1,73 @@
+/* arena.c - Arena (bump) allocator for JoshOS
+ *
+ * Chunks come from kmalloc_aligned so their data starts ARENA_ALIGN
+ * aligned (the header is a multiple of it). A request that doesn't fit
+ * the current chunk moves on to the next chunk of the chain that can take
+ * it; only when none can does the arena get a new chunk, added at the
+ * end - big enough for the request if that is larger than chunk_size.
+ */
+
+#include "arena.h"
+
+/* Get a chunk with size data bytes from the heap */
+static ArenaChunk* chunk_new(uint32_t size) {
+    ArenaChunk* chunk = (ArenaChunk*) kmalloc_aligned(sizeof(ArenaChunk) + size, ARENA_ALIGN);
+    if (chunk != NULL) {
+        chunk->next = NULL;
+        chunk->size = size;
+    }
+    return chunk;
+}
+
+/* Create an arena */
+Arena* arena_create(uint32_t chunk_size) {
+    Arena* arena = (Arena*) kmalloc(sizeof(Arena));
+    if (arena == NULL) {
+        return NULL;
+    }
+    arena->chunk_size = (chunk_size + ARENA_ALIGN - 1) & ~(uint32_t)(ARENA_ALIGN - 1);
+    arena->first = chunk_new(arena->chunk_size);
+    if (arena->first == NULL) {
+        kfree(arena);
+        return NULL;
+    }
+    arena_reset(arena);
+    return arena;
+}
+
+/* Free an arena and its chunks */
+void arena_destroy(Arena* arena) {
+    ArenaChunk* chunk = arena->first;
+    while (chunk != NULL) {
+        ArenaChunk* next = chunk->next;
+        kfree(chunk);
+        chunk = next;
+    }
+    kfree(arena);
+}
+
+/* Continue in a later chunk - the rest of the current one stays unused
+ * until the next reset */
+void* arena_alloc_chunk(Arena* arena, uint32_t size) {
+    ArenaChunk* last = arena->chunk;
+    ArenaChunk* chunk = last->next;
+    while (chunk != NULL && chunk->size < size) {
+        last = chunk;
+        chunk = chunk->next;
+    }
+    if (chunk == NULL) {
+        chunk = chunk_new(size > arena->chunk_size ? size : arena->chunk_size);
+        if (chunk == NULL) {
+            return NULL;                  /* Heap exhausted */
+        }
+        while (last->next != NULL) {
+            last = last->next;            /* Keep the chain in order of use */
+        }
+        last->next = chunk;
+    }
+
+    arena->chunk = chunk;
+    arena->next = (uintptr_t)(chunk + 1) + size;
+    arena->end = (uintptr_t)(chunk + 1) + chunk->size;
+    return chunk + 1;
+}
@@ -0,0 +1,64 @@
+/* arena.h - Arena (bump) allocator for JoshOS
+ *
+ * For memory that all dies at the same time, like everything a frame
+ * allocates while it is drawn. Allocating bumps a pointer through a chunk
+ * taken from the kernel heap; nothing is freed on its own, and
+ * arena_reset releases everything at once by rewinding to the first
+ * chunk. Chunks are kept across resets, so an arena that has reached its
+ * working size no longer touches the heap at all.
+ *
+ * An arena has no lock - it belongs to one thread.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "memory.h"
+
+/* Alignment of every allocation */
+#define ARENA_ALIGN 8
+
+/* Chunk of arena memory - the data follows the header */
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;              /* Chunk used after this one */
+    uint32_t size;                        /* Data bytes */
+} ArenaChunk;
+
+/* Arena */
+typedef struct {
+    ArenaChunk* first;                    /* Chunk chain, kept across resets */
+    ArenaChunk* chunk;                    /* Chunk being allocated from */
+    uintptr_t next;                       /* Next free byte in it */
+    uintptr_t end;                        /* One past its last byte */
+    uint32_t chunk_size;                  /* Data bytes in a new chunk */
+} Arena;
+
+/* Create an arena that grows chunk_size bytes at a time - NULL if the
+ * heap is out of memory */
+Arena* arena_create(uint32_t chunk_size);
+
+/* Free an arena and all of its chunks */
+void arena_destroy(Arena* arena);
+
+/* Move on to a chunk that can hold size bytes (arena_alloc's slow path) */
+void* arena_alloc_chunk(Arena* arena, uint32_t size);
+
+/* Allocate size bytes, ARENA_ALIGN aligned - NULL if out of memory */
+static inline void* arena_alloc(Arena* arena, uint32_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(uint32_t)(ARENA_ALIGN - 1);
+    if (arena->end - arena->next < size) {
+        return arena_alloc_chunk(arena, size);
+    }
+    void* ptr = (void*) arena->next;
+    arena->next += size;
+    return ptr;
+}
+
+/* Release everything allocated from an arena */
+static inline void arena_reset(Arena* arena) {
+    arena->chunk = arena->first;
+    arena->next = (uintptr_t)(arena->first + 1);
+    arena->end = arena->next + arena->first->size;
+}
+
+#endif /* ARENA_H */
@@ -0,0 +1,100 @@
+/* assets.c - Asset bundle for NEBULA OS
+ *
+ * The bundle is whichever boot module starts with ASSET_MAGIC. It is
+ * checked once in assets_init - header, version and that every entry lies
+ * inside the module - so asset_get can trust the index and only has to
+ * look up the entry. Uncompressed assets are returned in place; an LZ4
+ * entry is expanded on its first use and the copy is published with a
+ * compare-and-swap, so threads racing for it agree on one buffer and the
+ * loser frees its own.
+ */
+
+#include "assets.h"
+#include "lz4.h"
+#include "memory.h"
+
+/* Bundle found at boot */
+static const uint8_t* bundle = NULL;
+static const AssetEntry* asset_index = NULL;
+static uint32_t index_count = 0;
+
+/* Decompressed copies of LZ4 entries, filled on first use */
+static void* expanded[ASSET_COUNT];
+
+/* Check a bundle header and index - 1 if it can be used */
+static uint8_t bundle_valid(const uint8_t* start, uint32_t size) {
+    const AssetHeader* header = (const AssetHeader*) start;
+    if (size < sizeof(AssetHeader) || header->magic != ASSET_MAGIC ||
+        header->version != ASSET_VERSION || header->size > size) {
+        return 0;
+    }
+    if (header->count > (header->size - sizeof(AssetHeader)) / sizeof(AssetEntry)) {
+        return 0;                         /* Index runs past the end */
+    }
+    const AssetEntry* entries = (const AssetEntry*)(header + 1);
+    for (uint32_t i = 0; i < header->count; i++) {
+        if (entries[i].offset > header->size || entries[i].size > header->size - entries[i].offset) {
+            return 0;                     /* Data outside the bundle */
+        }
+    }
+    return 1;
+}
+
+/* Find the bundle among the boot modules */
+void assets_init(const MultibootInfo* mbi) {
+    if (mbi == NULL || !(mbi->flags & MULTIBOOT_INFO_MODS)) {
+        return;
+    }
+    const MultibootModule* mods = (const MultibootModule*)(uintptr_t) mbi->mods_addr;
+    for (uint32_t i = 0; i < mbi->mods_count; i++) {
+        const uint8_t* start = (const uint8_t*)(uintptr_t) mods[i].mod_start;
+        if (mods[i].mod_end > mods[i].mod_start && bundle_valid(start, mods[i].mod_end - mods[i].mod_start)) {
+            bundle = start;
+            asset_index = (const AssetEntry*)((const AssetHeader*) start + 1);
+            index_count = ((const AssetHeader*) start)->count;
+            return;
+        }
+    }
+}
+
+/* Decompress an LZ4 entry into the heap - NULL if it is corrupt */
+static void* expand(const AssetEntry* entry) {
+    uint8_t* data = (uint8_t*) kmalloc(entry->raw_size);
+    if (data == NULL) {
+        return NULL;
+    }
+    int32_t written = lz4_decompress(bundle + entry->offset, entry->size, data, entry->raw_size);
+    if (written != (int32_t) entry->raw_size) {
+        kfree(data);
+        return NULL;
+    }
+    return data;
+}
+
+/* Look up an asset */
+const void* asset_get(uint32_t id, uint32_t* size) {
+    if (bundle == NULL || id >= index_count || id >= ASSET_COUNT || asset_index[id].size == 0) {
+        return NULL;
+    }
+    const AssetEntry* entry = &asset_index[id];
+    if (!(entry->flags & ASSET_FLAG_LZ4)) {
+        *size = entry->size;
+        return bundle + entry->offset;    /* Zero copy - straight from the module */
+    }
+
+    void* data = __atomic_load_n(&expanded[id], __ATOMIC_ACQUIRE);
+    if (data == NULL) {
+        void* fresh = expand(entry);
+        if (fresh == NULL) {
+            return NULL;
+        }
+        if (__atomic_compare_exchange_n(&expanded[id], &data, fresh, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            data = fresh;
+        } else {
+            kfree(fresh);                 /* Another thread got there first */
+        }
+    }
+    *size = entry->raw_size;
+    return data;
+}
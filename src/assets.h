@@ -0,0 +1,76 @@
+/* assets.h - Asset bundle for NEBULA OS
+ *
+ * Fonts and interface data can come from a Multiboot module instead of
+ * the kernel image. GRUB loads the bundle (built by tools/assets_gen.c)
+ * next to the kernel, and assets are read where GRUB put them: the
+ * bundle starts with an index that has one entry per asset id, so
+ * finding an asset is a single array access and nothing is copied.
+ *
+ * An entry may be LZ4 compressed. It is then expanded into the heap the
+ * first time it is asked for and served from there afterwards.
+ *
+ * Bundle layout (little endian, every entry 4-byte aligned):
+ *
+ *     AssetHeader
+ *     AssetEntry[count]              (indexed by ASSET_*)
+ *     data
+ *
+ * Asset formats:
+ *
+ *     ASSET_FONT_8X8  AssetFont, then count * height row bytes (bit 7 left)
+ *     ASSET_UI_MENU   uint32 count, then count NUL-terminated labels
+ *     ASSET_UI_APPS   uint32 count, then count × (uint8 icon, NUL-terminated name)
+ */
+
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include "multiboot.h"
+
+/* Bundle identification */
+#define ASSET_MAGIC   0x5341424E          /* "NBAS" */
+#define ASSET_VERSION 1
+
+/* Entry flags */
+#define ASSET_FLAG_LZ4 0x01               /* Data is an LZ4 block */
+
+/* Asset ids - ids are index positions, so they must never be reused */
+enum {
+    ASSET_FONT_8X8,
+    ASSET_UI_MENU,
+    ASSET_UI_APPS,
+    ASSET_COUNT
+};
+
+/* Bundle header */
+typedef struct {
+    uint32_t magic;                       /* ASSET_MAGIC */
+    uint16_t version;                     /* ASSET_VERSION */
+    uint16_t count;                       /* Index entries */
+    uint32_t size;                        /* Bytes in the whole bundle */
+} AssetHeader;
+
+/* Index entry - size 0 means the bundle doesn't have that asset */
+typedef struct {
+    uint32_t offset;                      /* From the start of the bundle */
+    uint32_t size;                        /* Bytes stored */
+    uint32_t raw_size;                    /* Bytes once decompressed */
+    uint32_t flags;                       /* ASSET_FLAG_* */
+} AssetEntry;
+
+/* Font header */
+typedef struct {
+    uint8_t first;                        /* First character */
+    uint8_t count;                        /* Characters */
+    uint8_t width;                        /* Pixels per row (at most 8) */
+    uint8_t height;                       /* Rows per character */
+} AssetFont;
+
+/* Find the bundle among the boot modules (after memory_init) */
+void assets_init(const MultibootInfo* mbi);
+
+/* An asset's data and size - NULL if there is no bundle, no such asset
+ * or it could not be decompressed. The data stays valid forever */
+const void* asset_get(uint32_t id, uint32_t* size);
+
+#endif /* ASSETS_H */
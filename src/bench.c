@@ -0,0 +1,273 @@
+/* bench.c - In-kernel benchmark suite for NEBULA OS
+ *
+ * Each benchmark times single operations with rdtsc and keeps one sample
+ * per operation, so the report shows the spread (p50/p90/p99/max) and
+ * not just an average; a slow path that only triggers now and then, like
+ * growing the heap, shows up in the tail. The cost of reading the TSC
+ * itself is measured first and taken off every sample.
+ *
+ * It runs before the scheduler starts and with interrupts off, on the
+ * boot CPU only, so nothing else competes for the caches.
+ *
+ * Allocator patterns:
+ *   LIFO    - allocate a batch of random sizes, free it newest first
+ *   FIFO    - allocate a batch, free it oldest first
+ *   random  - allocate or free a random slot of a pool, random sizes
+ *   fragmented - free every other block of a batch, then allocate blocks
+ *             too big for the holes
+ */
+
+#include "bench.h"
+#include "graphics.h"
+#include "io.h"
+#include "memory.h"
+#include "nebula_ui.h"
+#include "serial.h"
+#include "timer.h"
+
+/* Samples per allocator and raster benchmark, and full UI renders */
+#define BENCH_SAMPLES     2048
+#define BENCH_BATCH       1024            /* Blocks live at once in LIFO/FIFO */
+#define BENCH_POOL        256             /* Slots in the random pattern */
+#define BENCH_UI_SAMPLES  64
+
+/* QEMU isa-debug-exit device - QEMU exits with status (value << 1) | 1 */
+#define QEMU_EXIT_PORT    0xF4
+
+static uint32_t samples[BENCH_SAMPLES];
+static uint32_t free_samples[BENCH_SAMPLES];
+static void* blocks[BENCH_BATCH];
+static uint32_t tsc_overhead = 0;         /* Cycles between two back-to-back reads */
+static uint32_t rng_state = 0x2545F491;
+
+/* Read the TSC - the memory clobber keeps the timed code between reads */
+static inline uint64_t bench_tsc(void) {
+    uint32_t low, high;
+    __asm__ volatile ("rdtsc" : "=a" (low), "=d" (high) : : "memory");
+    return ((uint64_t) high << 32) | low;
+}
+
+/* Cycles since start, less the cost of reading the TSC */
+static inline uint32_t bench_elapsed(uint64_t start) {
+    uint32_t cycles = (uint32_t)(bench_tsc() - start);
+    return cycles > tsc_overhead ? cycles - tsc_overhead : 0;
+}
+
+/* xorshift32 */
+static uint32_t bench_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/* Random allocation size in [min, max] */
+static uint32_t random_size(uint32_t min, uint32_t max) {
+    return min + bench_random() % (max - min + 1);
+}
+
+/* Shell sort (Ciura's gaps) - fine for a few thousand samples */
+static void sort_samples(uint32_t* values, uint32_t count) {
+    static const uint32_t gaps[] = { 701, 301, 132, 57, 23, 10, 4, 1 };
+    for (uint32_t g = 0; g < sizeof(gaps) / sizeof(gaps[0]); g++) {
+        uint32_t gap = gaps[g];
+        for (uint32_t i = gap; i < count; i++) {
+            uint32_t value = values[i];
+            uint32_t j = i;
+            for (; j >= gap && values[j - gap] > value; j -= gap) {
+                values[j] = values[j - gap];
+            }
+            values[j] = value;
+        }
+    }
+}
+
+/* Send text padded with spaces to width columns */
+static void write_padded(const char* text, uint32_t width) {
+    char line[40];
+    uint32_t i = 0;
+    for (; text[i] != '\0' && i < sizeof(line) - 1; i++) {
+        line[i] = text[i];
+    }
+    for (; i < width && i < sizeof(line) - 1; i++) {
+        line[i] = ' ';
+    }
+    line[i] = '\0';
+    serial_write(line);
+}
+
+/* Print one result line: ops, mean and percentiles in cycles */
+static void report(const char* name, uint32_t* values, uint32_t count) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        total += values[i];
+    }
+    sort_samples(values, count);
+    
+    write_padded(name, 24);
+    serial_write_dec(count, 6);
+    serial_write_dec(udiv64(total, count, NULL), 10);
+    serial_write_dec(values[count / 2], 10);
+    serial_write_dec(values[count * 90 / 100], 10);
+    serial_write_dec(values[count * 99 / 100], 10);
+    serial_write_dec(values[count - 1], 10);
+    serial_write("\n");
+}
+
+/* Smallest TSC read-to-read time */
+static void measure_overhead(void) {
+    uint32_t best = 0xFFFFFFFF;
+    for (int i = 0; i < 256; i++) {
+        uint64_t start = bench_tsc();
+        uint32_t cycles = (uint32_t)(bench_tsc() - start);
+        if (cycles < best) best = cycles;
+    }
+    tsc_overhead = best;
+}
+
+/* Allocate a batch of random sizes, timing each kmalloc */
+static void alloc_batch(uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t size = random_size(16, 1024);
+        uint64_t start = bench_tsc();
+        blocks[i] = kmalloc(size);
+        samples[i] = bench_elapsed(start);
+    }
+}
+
+/* Batch freed newest first */
+static void bench_lifo(void) {
+    alloc_batch(BENCH_BATCH);
+    for (uint32_t i = BENCH_BATCH; i-- > 0;) {
+        uint64_t start = bench_tsc();
+        kfree(blocks[i]);
+        free_samples[BENCH_BATCH - 1 - i] = bench_elapsed(start);
+    }
+    report("kmalloc LIFO", samples, BENCH_BATCH);
+    report("kfree LIFO", free_samples, BENCH_BATCH);
+}
+
+/* Batch freed oldest first */
+static void bench_fifo(void) {
+    alloc_batch(BENCH_BATCH);
+    for (uint32_t i = 0; i < BENCH_BATCH; i++) {
+        uint64_t start = bench_tsc();
+        kfree(blocks[i]);
+        free_samples[i] = bench_elapsed(start);
+    }
+    report("kmalloc FIFO", samples, BENCH_BATCH);
+    report("kfree FIFO", free_samples, BENCH_BATCH);
+}
+
+/* Random slot of a pool: allocate if empty, free if full */
+static void bench_random_churn(void) {
+    uint32_t allocs = 0;
+    uint32_t frees = 0;
+    for (uint32_t i = 0; i < BENCH_POOL; i++) {
+        blocks[i] = NULL;
+    }
+    while (allocs < BENCH_SAMPLES && frees < BENCH_SAMPLES) {
+        uint32_t slot = bench_random() % BENCH_POOL;
+        if (blocks[slot] == NULL) {
+            uint32_t size = random_size(16, 4096);
+            uint64_t start = bench_tsc();
+            blocks[slot] = kmalloc(size);
+            samples[allocs++] = bench_elapsed(start);
+        } else {
+            uint64_t start = bench_tsc();
+            kfree(blocks[slot]);
+            free_samples[frees++] = bench_elapsed(start);
+            blocks[slot] = NULL;
+        }
+    }
+    for (uint32_t i = 0; i < BENCH_POOL; i++) {
+        kfree(blocks[i]);
+    }
+    report("kmalloc random", samples, allocs);
+    report("kfree random", free_samples, frees);
+}
+
+/* Swiss-cheese the heap, then ask for blocks that fit none of the holes */
+static void bench_fragmented(void) {
+    for (uint32_t i = 0; i < BENCH_BATCH; i++) {
+        blocks[i] = kmalloc(random_size(64, 256));
+    }
+    for (uint32_t i = 0; i < BENCH_BATCH; i += 2) {
+        kfree(blocks[i]);
+        blocks[i] = NULL;
+    }
+    uint32_t count = BENCH_BATCH / 2;
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t start = bench_tsc();
+        blocks[2 * i] = kmalloc(2048);
+        samples[i] = bench_elapsed(start);
+    }
+    for (uint32_t i = 0; i < BENCH_BATCH; i++) {
+        kfree(blocks[i]);
+    }
+    report("kmalloc fragmented", samples, count);
+}
+
+/* Raster primitives, drawn into the back buffer */
+static void bench_graphics(void) {
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        uint64_t start = bench_tsc();
+        graphics_fill_rect(40, 40, 100, 100, (uint8_t) i);
+        samples[i] = bench_elapsed(start);
+    }
+    report("fill_rect 100x100", samples, BENCH_SAMPLES);
+    
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        uint64_t start = bench_tsc();
+        graphics_draw_text(10, 60, "The quick brown fox", (uint8_t) i);
+        samples[i] = bench_elapsed(start);
+    }
+    report("draw_text 19 chars", samples, BENCH_SAMPLES);
+    
+    for (uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        uint64_t start = bench_tsc();
+        graphics_fill_circle(100, 100, 40, (uint8_t) i);
+        samples[i] = bench_elapsed(start);
+    }
+    report("fill_circle r=40", samples, BENCH_SAMPLES);
+    
+    for (uint32_t i = 0; i < BENCH_UI_SAMPLES; i++) {
+        uint64_t start = bench_tsc();
+        nebula_render_ui();
+        samples[i] = bench_elapsed(start);
+    }
+    report("nebula_render_ui", samples, BENCH_UI_SAMPLES);
+}
+
+/* Run every benchmark */
+void bench_run(void) {
+    measure_overhead();
+    
+    serial_write("NEBULA OS benchmarks - TSC ");
+    serial_write_dec(udiv64(timer_tsc_hz(), 1000000, NULL), 0);
+    serial_write(" MHz, screen ");
+    serial_write_dec(gfx.width, 0);
+    serial_write("x");
+    serial_write_dec(gfx.height, 0);
+    serial_write("x");
+    serial_write_dec(gfx.bpp, 0);
+    serial_write(", TSC read overhead ");
+    serial_write_dec(tsc_overhead, 0);
+    serial_write(" cycles\n\n");
+    write_padded("benchmark (cycles/op)", 24);
+    serial_write("   ops      mean       p50       p90       p99       max\n");
+    
+    bench_lifo();
+    bench_fifo();
+    bench_random_churn();
+    bench_fragmented();
+    bench_graphics();
+    
+    serial_write("\nbench: done\n");
+    outb(QEMU_EXIT_PORT, 0);
+    
+    /* Not under QEMU - stop here */
+    while (1) {
+        __asm__ volatile ("cli; hlt");
+    }
+}
@@ -0,0 +1,15 @@
+/* bench.h - In-kernel benchmark suite for NEBULA OS
+ *
+ * Only linked into the benchmark kernel (make bench, which defines
+ * NEBULA_BENCH). kernel_main calls bench_run once everything is set up;
+ * it times the allocator and raster hot paths with the TSC, prints
+ * cycles per operation and percentiles to COM1 and leaves QEMU.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Run every benchmark, report over serial and exit QEMU */
+void bench_run(void) __attribute__((noreturn));
+
+#endif /* BENCH_H */
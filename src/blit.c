@@ -0,0 +1,346 @@
+/* blit.c - Row compositing kernels for JoshOS
+ *
+ * Like kstring.c, the vector loops are inline assembly in functions
+ * compiled for their instruction set only, so generic code stays i686.
+ * Every kernel splits a row into a scalar head (until the destination is
+ * aligned), a vector body and a scalar tail. Sources are read with
+ * unaligned loads: they are aligned whenever the two buffers have the
+ * same pitch, and an unaligned load of aligned data costs nothing extra.
+ *
+ * Thread switches save only the SSE half of the vector registers
+ * (FXSAVE), so the AVX2 bodies run with interrupts off and finish with
+ * vzeroupper - one row at a time keeps that window short.
+ */
+
+#include "blit.h"
+#include "cpu.h"
+#include "idt.h"
+#include "kstring.h"
+
+/* Kernel sets */
+#define BLIT_SCALAR 0
+#define BLIT_SSE2   1
+#define BLIT_AVX2   2
+
+/* Rows shorter than this (in bytes) are not worth a vector setup */
+#define BLIT_VECTOR_MIN 64
+
+/* Selected at boot by blit_init */
+static uint8_t blit_level = BLIT_SCALAR;
+
+#define SSE2_FUNCTION __attribute__((target("sse2")))
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+
+/* Bytes until p reaches an align-byte boundary, at most limit */
+static inline uint32_t head_bytes(const void* p, uint32_t align, uint32_t limit) {
+    uint32_t head = (0u - (uint32_t) p) & (align - 1);
+    return head < limit ? head : limit;
+}
+
+/* Pick the fastest kernels for this CPU */
+void blit_init(void) {
+    if (cpu_has(CPU_FEATURE_AVX2)) {
+        blit_level = BLIT_AVX2;
+    } else if (cpu_has(CPU_FEATURE_SSE2)) {
+        blit_level = BLIT_SSE2;
+    } else {
+        blit_level = BLIT_SCALAR;
+    }
+}
+
+/* --- Copy --- */
+
+/* Copy blocks of 64 bytes to 32-byte aligned d */
+AVX2_FUNCTION static void copy_avx2(uint8_t* d, const uint8_t* s, uint32_t blocks) {
+    uint32_t flags = interrupts_save();
+    __asm__ volatile (
+        "1:\n\t"
+        "vmovdqu (%1), %%ymm0\n\t"
+        "vmovdqu 32(%1), %%ymm1\n\t"
+        "vmovdqa %%ymm0, (%0)\n\t"
+        "vmovdqa %%ymm1, 32(%0)\n\t"
+        "add $64, %1\n\t"
+        "add $64, %0\n\t"
+        "dec %2\n\t"
+        "jnz 1b\n\t"
+        "vzeroupper"
+        : "+r" (d), "+r" (s), "+r" (blocks)
+        :
+        : "xmm0", "xmm1", "memory", "cc");
+    interrupts_restore(flags);
+}
+
+/* Copy bytes of a row into normal memory */
+void blit_copy(void* dst, const void* src, uint32_t bytes) {
+    uint8_t* d = (uint8_t*) dst;
+    const uint8_t* s = (const uint8_t*) src;
+
+    /* kmemcpy already has the SSE2 loop - only AVX2 adds anything */
+    if (blit_level == BLIT_AVX2 && bytes >= BLIT_VECTOR_MIN * 4) {
+        uint32_t head = head_bytes(d, 32, bytes);
+        kmemcpy(d, s, head);
+        d += head;
+        s += head;
+        bytes -= head;
+        copy_avx2(d, s, bytes >> 6);
+        d += bytes & ~63u;
+        s += bytes & ~63u;
+        bytes &= 63;
+    }
+    kmemcpy(d, s, bytes);
+}
+
+/* Stream blocks of 64 bytes to 16-byte aligned d */
+SSE2_FUNCTION static void stream_sse2(uint8_t* d, const uint8_t* s, uint32_t blocks) {
+    __asm__ volatile (
+        "1:\n\t"
+        "movdqu (%1), %%xmm0\n\t"
+        "movdqu 16(%1), %%xmm1\n\t"
+        "movdqu 32(%1), %%xmm2\n\t"
+        "movdqu 48(%1), %%xmm3\n\t"
+        "movntdq %%xmm0, (%0)\n\t"
+        "movntdq %%xmm1, 16(%0)\n\t"
+        "movntdq %%xmm2, 32(%0)\n\t"
+        "movntdq %%xmm3, 48(%0)\n\t"
+        "add $64, %1\n\t"
+        "add $64, %0\n\t"
+        "dec %2\n\t"
+        "jnz 1b"
+        : "+r" (d), "+r" (s), "+r" (blocks)
+        :
+        : "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc");
+}
+
+/* Stream blocks of 64 bytes to 32-byte aligned d */
+AVX2_FUNCTION static void stream_avx2(uint8_t* d, const uint8_t* s, uint32_t blocks) {
+    uint32_t flags = interrupts_save();
+    __asm__ volatile (
+        "1:\n\t"
+        "vmovdqu (%1), %%ymm0\n\t"
+        "vmovdqu 32(%1), %%ymm1\n\t"
+        "vmovntdq %%ymm0, (%0)\n\t"
+        "vmovntdq %%ymm1, 32(%0)\n\t"
+        "add $64, %1\n\t"
+        "add $64, %0\n\t"
+        "dec %2\n\t"
+        "jnz 1b\n\t"
+        "vzeroupper"
+        : "+r" (d), "+r" (s), "+r" (blocks)
+        :
+        : "xmm0", "xmm1", "memory", "cc");
+    interrupts_restore(flags);
+}
+
+/* Copy bytes of a row into a framebuffer with non-temporal stores */
+void blit_stream(void* dst, const void* src, uint32_t bytes) {
+    uint8_t* d = (uint8_t*) dst;
+    const uint8_t* s = (const uint8_t*) src;
+
+    if (blit_level != BLIT_SCALAR && bytes >= BLIT_VECTOR_MIN * 2) {
+        uint32_t align = blit_level == BLIT_AVX2 ? 32 : 16;
+        uint32_t head = head_bytes(d, align, bytes);
+        kmemcpy(d, s, head);
+        d += head;
+        s += head;
+        bytes -= head;
+        if (blit_level == BLIT_AVX2) {
+            stream_avx2(d, s, bytes >> 6);
+        } else {
+            stream_sse2(d, s, bytes >> 6);
+        }
+        d += bytes & ~63u;
+        s += bytes & ~63u;
+        bytes &= 63;
+    }
+    kmemcpy(d, s, bytes);
+}
+
+/* --- Color-keyed copy --- */
+
+/* Scalar: one select per pixel */
+static void key_scalar(uint32_t* d, const uint32_t* s, uint32_t count, uint32_t key) {
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t keep = 0u - (s[i] == key);   /* All ones where src is the key */
+        d[i] = (d[i] & keep) | (s[i] & ~keep);
+    }
+}
+
+/* Four pixels per step to 16-byte aligned d */
+SSE2_FUNCTION static void key_sse2(uint32_t* d, const uint32_t* s, uint32_t steps, uint32_t key) {
+    __asm__ volatile (
+        "movd %3, %%xmm7\n\t"
+        "pshufd $0, %%xmm7, %%xmm7\n\t"   /* Key in every lane */
+        "1:\n\t"
+        "movdqu (%1), %%xmm0\n\t"
+        "movdqa (%0), %%xmm1\n\t"
+        "movdqa %%xmm0, %%xmm2\n\t"
+        "pcmpeqd %%xmm7, %%xmm2\n\t"      /* Lanes to keep */
+        "pand %%xmm2, %%xmm1\n\t"
+        "pandn %%xmm0, %%xmm2\n\t"
+        "por %%xmm1, %%xmm2\n\t"
+        "movdqa %%xmm2, (%0)\n\t"
+        "add $16, %1\n\t"
+        "add $16, %0\n\t"
+        "dec %2\n\t"
+        "jnz 1b"
+        : "+r" (d), "+r" (s), "+r" (steps)
+        : "r" (key)
+        : "xmm0", "xmm1", "xmm2", "xmm7", "memory", "cc");
+}
+
+/* Eight pixels per step to 32-byte aligned d */
+AVX2_FUNCTION static void key_avx2(uint32_t* d, const uint32_t* s, uint32_t steps, uint32_t key) {
+    uint32_t flags = interrupts_save();
+    __asm__ volatile (
+        "vmovd %3, %%xmm7\n\t"
+        "vpbroadcastd %%xmm7, %%ymm7\n\t"
+        "1:\n\t"
+        "vmovdqu (%1), %%ymm0\n\t"
+        "vpcmpeqd %%ymm7, %%ymm0, %%ymm1\n\t"
+        "vpblendvb %%ymm1, (%0), %%ymm0, %%ymm2\n\t" /* dst where key, else src */
+        "vmovdqa %%ymm2, (%0)\n\t"
+        "add $32, %1\n\t"
+        "add $32, %0\n\t"
+        "dec %2\n\t"
+        "jnz 1b\n\t"
+        "vzeroupper"
+        : "+r" (d), "+r" (s), "+r" (steps)
+        : "r" (key)
+        : "xmm0", "xmm1", "xmm2", "xmm7", "memory", "cc");
+    interrupts_restore(flags);
+}
+
+/* Copy count 32-bit pixels, leaving dst alone where src equals key */
+void blit_key32(uint32_t* dst, const uint32_t* src, uint32_t count, uint32_t key) {
+    if (blit_level != BLIT_SCALAR && count * 4 >= BLIT_VECTOR_MIN) {
+        uint32_t align = blit_level == BLIT_AVX2 ? 32 : 16;
+        uint32_t head = head_bytes(dst, align, count * 4) >> 2;
+        key_scalar(dst, src, head, key);
+        dst += head;
+        src += head;
+        count -= head;
+
+        uint32_t lanes = align >> 2;
+        uint32_t steps = count / lanes;
+        if (steps != 0) {
+            if (blit_level == BLIT_AVX2) {
+                key_avx2(dst, src, steps, key);
+            } else {
+                key_sse2(dst, src, steps, key);
+            }
+            dst += steps * lanes;
+            src += steps * lanes;
+            count -= steps * lanes;
+        }
+    }
+    key_scalar(dst, src, count, key);
+}
+
+/* --- Alpha blend --- */
+
+/* Scalar: two channels per multiply */
+static void tint_scalar(uint32_t* d, uint32_t count, uint32_t pixel, uint32_t a) {
+    uint32_t src_rb = (pixel & 0x00FF00FF) * a;
+    uint32_t src_ag = ((pixel >> 8) & 0x00FF00FF) * a;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t rb = ((src_rb + (d[i] & 0x00FF00FF) * (256 - a)) >> 8) & 0x00FF00FF;
+        uint32_t ag = (src_ag + ((d[i] >> 8) & 0x00FF00FF) * (256 - a)) & 0xFF00FF00;
+        d[i] = rb | ag;
+    }
+}
+
+/* Four pixels per step to 16-byte aligned d - channels widened to words */
+SSE2_FUNCTION static void tint_sse2(uint32_t* d, uint32_t steps, uint32_t pixel, uint32_t a) {
+    __asm__ volatile (
+        "pxor %%xmm6, %%xmm6\n\t"
+        "movd %3, %%xmm4\n\t"
+        "pshuflw $0, %%xmm4, %%xmm4\n\t"
+        "punpcklqdq %%xmm4, %%xmm4\n\t"   /* a in every word */
+        "movd %4, %%xmm3\n\t"
+        "pshuflw $0, %%xmm3, %%xmm3\n\t"
+        "punpcklqdq %%xmm3, %%xmm3\n\t"   /* 256 - a in every word */
+        "movd %2, %%xmm5\n\t"
+        "punpcklbw %%xmm6, %%xmm5\n\t"
+        "punpcklqdq %%xmm5, %%xmm5\n\t"   /* Two pixels of words */
+        "pmullw %%xmm4, %%xmm5\n\t"       /* pixel * a */
+        "1:\n\t"
+        "movdqa (%0), %%xmm0\n\t"
+        "movdqa %%xmm0, %%xmm1\n\t"
+        "punpcklbw %%xmm6, %%xmm0\n\t"
+        "punpckhbw %%xmm6, %%xmm1\n\t"
+        "pmullw %%xmm3, %%xmm0\n\t"
+        "pmullw %%xmm3, %%xmm1\n\t"
+        "paddw %%xmm5, %%xmm0\n\t"
+        "paddw %%xmm5, %%xmm1\n\t"
+        "psrlw $8, %%xmm0\n\t"
+        "psrlw $8, %%xmm1\n\t"
+        "packuswb %%xmm1, %%xmm0\n\t"
+        "movdqa %%xmm0, (%0)\n\t"
+        "add $16, %0\n\t"
+        "dec %1\n\t"
+        "jnz 1b"
+        : "+r" (d), "+r" (steps)
+        : "r" (pixel), "r" (a), "r" (256 - a)
+        : "xmm0", "xmm1", "xmm3", "xmm4", "xmm5", "xmm6", "memory", "cc");
+}
+
+/* Eight pixels per step to 32-byte aligned d */
+AVX2_FUNCTION static void tint_avx2(uint32_t* d, uint32_t steps, uint32_t pixel, uint32_t a) {
+    uint32_t flags = interrupts_save();
+    __asm__ volatile (
+        "vpxor %%ymm6, %%ymm6, %%ymm6\n\t"
+        "vmovd %3, %%xmm4\n\t"
+        "vpbroadcastw %%xmm4, %%ymm4\n\t"
+        "vmovd %4, %%xmm3\n\t"
+        "vpbroadcastw %%xmm3, %%ymm3\n\t"
+        "vmovd %2, %%xmm5\n\t"
+        "vpbroadcastd %%xmm5, %%ymm5\n\t"
+        "vpunpcklbw %%ymm6, %%ymm5, %%ymm5\n\t"
+        "vpmullw %%ymm4, %%ymm5, %%ymm5\n\t"
+        "1:\n\t"
+        "vmovdqa (%0), %%ymm0\n\t"
+        "vpunpcklbw %%ymm6, %%ymm0, %%ymm1\n\t" /* Unpack and pack stay in-lane */
+        "vpunpckhbw %%ymm6, %%ymm0, %%ymm2\n\t"
+        "vpmullw %%ymm3, %%ymm1, %%ymm1\n\t"
+        "vpmullw %%ymm3, %%ymm2, %%ymm2\n\t"
+        "vpaddw %%ymm5, %%ymm1, %%ymm1\n\t"
+        "vpaddw %%ymm5, %%ymm2, %%ymm2\n\t"
+        "vpsrlw $8, %%ymm1, %%ymm1\n\t"
+        "vpsrlw $8, %%ymm2, %%ymm2\n\t"
+        "vpackuswb %%ymm2, %%ymm1, %%ymm0\n\t"
+        "vmovdqa %%ymm0, (%0)\n\t"
+        "add $32, %0\n\t"
+        "dec %1\n\t"
+        "jnz 1b\n\t"
+        "vzeroupper"
+        : "+r" (d), "+r" (steps)
+        : "r" (pixel), "r" (a), "r" (256 - a)
+        : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "memory", "cc");
+    interrupts_restore(flags);
+}
+
+/* Blend a 32-bit pixel over count pixels at alpha 0-255 */
+void blit_tint32(uint32_t* dst, uint32_t count, uint32_t pixel, uint32_t alpha) {
+    uint32_t a = alpha + (alpha >> 7);    /* 0-256, so 255 is fully opaque */
+
+    if (blit_level != BLIT_SCALAR && count * 4 >= BLIT_VECTOR_MIN) {
+        uint32_t align = blit_level == BLIT_AVX2 ? 32 : 16;
+        uint32_t head = head_bytes(dst, align, count * 4) >> 2;
+        tint_scalar(dst, head, pixel, a);
+        dst += head;
+        count -= head;
+
+        uint32_t lanes = align >> 2;
+        uint32_t steps = count / lanes;
+        if (steps != 0) {
+            if (blit_level == BLIT_AVX2) {
+                tint_avx2(dst, steps, pixel, a);
+            } else {
+                tint_sse2(dst, steps, pixel, a);
+            }
+            dst += steps * lanes;
+            count -= steps * lanes;
+        }
+    }
+    tint_scalar(dst, count, pixel, a);
+}
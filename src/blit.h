@@ -0,0 +1,33 @@
+/* blit.h - Row compositing kernels for JoshOS
+ *
+ * Copy, color-keyed copy and alpha blend of pixel rows, the inner loops
+ * of the graphics compositor. Each has a scalar version and SSE2 and
+ * AVX2 versions picked once at boot from CPUID; the vector loops align
+ * the destination first so every store is an aligned full-width store.
+ */
+
+#ifndef BLIT_H
+#define BLIT_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned int       uint32_t;
+
+/* Pick the fastest kernels for this CPU (after cpu_init) */
+void blit_init(void);
+
+/* Copy bytes of a row into normal (cached) memory */
+void blit_copy(void* dst, const void* src, uint32_t bytes);
+
+/* Copy bytes of a row into a framebuffer with non-temporal stores - the
+ * caller drains them with paging_flush_writes */
+void blit_stream(void* dst, const void* src, uint32_t bytes);
+
+/* Copy count 32-bit pixels, leaving dst alone where src equals key */
+void blit_key32(uint32_t* dst, const uint32_t* src, uint32_t count, uint32_t key);
+
+/* Blend a 32-bit pixel (8 bits per channel) over count pixels at
+ * alpha 0-255 */
+void blit_tint32(uint32_t* dst, uint32_t count, uint32_t pixel, uint32_t alpha);
+
+#endif /* BLIT_H */
@@ -0,0 +1,112 @@
+/* cpu.c - CPU feature detection for JoshOS
+ * 
+ * Every CPU that can run this kernel (i686 and later) has CPUID, so the
+ * feature bits are read unconditionally.
+ */
+
+#include "cpu.h"
+
+/* CPUID leaf 1 EDX bits */
+#define CPUID_EDX_PSE   (1u << 3)
+#define CPUID_EDX_TSC   (1u << 4)
+#define CPUID_EDX_PAE   (1u << 6)
+#define CPUID_EDX_APIC  (1u << 9)
+#define CPUID_EDX_PAT   (1u << 16)
+#define CPUID_EDX_FXSR  (1u << 24)
+#define CPUID_EDX_SSE   (1u << 25)
+#define CPUID_EDX_SSE2  (1u << 26)
+
+/* CPUID leaf 1 ECX and leaf 7 EBX bits */
+#define CPUID_ECX_XSAVE (1u << 26)
+#define CPUID_ECX_AVX   (1u << 28)
+#define CPUID_EBX7_AVX2 (1u << 5)
+
+/* Control register bits */
+#define CR0_MP          (1u << 1)         /* Monitor coprocessor */
+#define CR0_EM          (1u << 2)         /* x87 emulation */
+#define CR4_OSFXSR      (1u << 9)         /* OS supports FXSAVE/SSE */
+#define CR4_OSXMMEXCPT  (1u << 10)        /* OS handles SSE exceptions */
+#define CR4_OSXSAVE     (1u << 18)        /* XSETBV and AVX allowed */
+
+/* XCR0 state components: x87, SSE, AVX */
+#define XCR0_AVX_STATE  0x7
+
+/* Detected features */
+static uint32_t cpu_features = 0;
+
+/* Enable the FPU and SSE so SSE instructions don't fault */
+static void cpu_enable_sse(void) {
+    uint32_t cr0, cr4;
+    __asm__ volatile ("mov %%cr0, %0" : "=r" (cr0));
+    cr0 &= ~CR0_EM;                       /* Real FPU present */
+    cr0 |= CR0_MP;
+    __asm__ volatile ("mov %0, %%cr0" : : "r" (cr0));
+    
+    __asm__ volatile ("mov %%cr4, %0" : "=r" (cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    __asm__ volatile ("mov %0, %%cr4" : : "r" (cr4));
+    
+    __asm__ volatile ("fninit");          /* Reset x87 state */
+}
+
+/* Enable the YMM register state so AVX instructions don't fault */
+static void cpu_enable_avx(void) {
+    uint32_t cr4;
+    __asm__ volatile ("mov %%cr4, %0" : "=r" (cr4));
+    cr4 |= CR4_OSXSAVE;
+    __asm__ volatile ("mov %0, %%cr4" : : "r" (cr4));
+    __asm__ volatile ("xsetbv" : : "c" (0), "a" (XCR0_AVX_STATE), "d" (0));
+}
+
+/* Detect CPU features and enable the ones the kernel uses */
+void cpu_init(void) {
+    uint32_t a, b, c, d;
+    
+    cpu_cpuid(0, 0, &a, &b, &c, &d);
+    if (a < 1) {
+        return;                           /* No feature leaf */
+    }
+    uint32_t max_leaf = a;
+    
+    cpu_cpuid(1, 0, &a, &b, &c, &d);
+    if (d & CPUID_EDX_TSC)  cpu_features |= CPU_FEATURE_TSC;
+    if (d & CPUID_EDX_PSE)  cpu_features |= CPU_FEATURE_PSE;
+    if (d & CPUID_EDX_PAE)  cpu_features |= CPU_FEATURE_PAE;
+    if (d & CPUID_EDX_APIC) cpu_features |= CPU_FEATURE_APIC;
+    if (d & CPUID_EDX_PAT)  cpu_features |= CPU_FEATURE_PAT;
+    
+    /* SSE needs FXSAVE support before the OS may turn it on */
+    if ((d & CPUID_EDX_FXSR) && (d & CPUID_EDX_SSE)) {
+        cpu_enable_sse();
+        cpu_features |= CPU_FEATURE_FXSR | CPU_FEATURE_SSE;
+        if (d & CPUID_EDX_SSE2) cpu_features |= CPU_FEATURE_SSE2;
+        
+        /* AVX needs XSAVE so the OS can enable the YMM state */
+        if ((c & CPUID_ECX_XSAVE) && (c & CPUID_ECX_AVX)) {
+            cpu_enable_avx();
+            cpu_features |= CPU_FEATURE_AVX;
+            if (max_leaf >= 7) {
+                cpu_cpuid(7, 0, &a, &b, &c, &d);
+                if (b & CPUID_EBX7_AVX2) cpu_features |= CPU_FEATURE_AVX2;
+            }
+        }
+    }
+}
+
+/* Turn on the same features on an application processor - control
+ * registers are per CPU, detection was done once by cpu_init */
+void cpu_init_ap(void) {
+    if (cpu_features & CPU_FEATURE_SSE) {
+        cpu_enable_sse();
+        if (cpu_features & CPU_FEATURE_AVX) {
+            cpu_enable_avx();
+        }
+    } else {
+        __asm__ volatile ("fninit");
+    }
+}
+
+/* Check if the CPU has a feature */
+uint8_t cpu_has(uint32_t feature) {
+    return (cpu_features & feature) == feature;
+}
@@ -0,0 +1,57 @@
+/* cpu.h - CPU feature detection for JoshOS
+ * 
+ * Reads CPUID once at boot and enables optional instruction set
+ * extensions (SSE, AVX) that the rest of the kernel can then select.
+ *
+ * Thread switches save FPU state with FXSAVE, which does not cover the
+ * upper halves of the YMM registers: AVX code must run with interrupts
+ * off and end with vzeroupper.
+ */
+
+#ifndef CPU_H
+#define CPU_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned int       uint32_t;
+typedef unsigned long long uint64_t;
+
+/* CPU feature bits (our own numbering, not CPUID's) */
+#define CPU_FEATURE_TSC    0x00000001     /* Time stamp counter */
+#define CPU_FEATURE_PSE    0x00000002     /* 4MB pages */
+#define CPU_FEATURE_PAE    0x00000004     /* Physical address extension */
+#define CPU_FEATURE_APIC   0x00000008     /* On-chip local APIC */
+#define CPU_FEATURE_PAT    0x00000010     /* Page attribute table */
+#define CPU_FEATURE_FXSR   0x00000020     /* FXSAVE/FXRSTOR */
+#define CPU_FEATURE_SSE    0x00000040     /* SSE */
+#define CPU_FEATURE_SSE2   0x00000080     /* SSE2 */
+#define CPU_FEATURE_AVX    0x00000100     /* AVX, with YMM state enabled */
+#define CPU_FEATURE_AVX2   0x00000200     /* AVX2 */
+
+/* Detect CPU features and enable the ones the kernel uses */
+void cpu_init(void);
+
+/* Enable the features cpu_init found on another CPU */
+void cpu_init_ap(void);
+
+/* Check if the CPU has (and the kernel enabled) a feature */
+uint8_t cpu_has(uint32_t feature);
+
+/* Execute CPUID for a leaf */
+static inline void cpu_cpuid(uint32_t leaf, uint32_t sub, uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d) {
+    __asm__ volatile ("cpuid" : "=a" (*a), "=b" (*b), "=c" (*c), "=d" (*d) : "a" (leaf), "c" (sub));
+}
+
+/* Read a model-specific register */
+static inline uint64_t cpu_read_msr(uint32_t msr) {
+    uint32_t low, high;
+    __asm__ volatile ("rdmsr" : "=a" (low), "=d" (high) : "c" (msr));
+    return ((uint64_t) high << 32) | low;
+}
+
+/* Write a model-specific register */
+static inline void cpu_write_msr(uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr" : : "c" (msr), "a" ((uint32_t) value), "d" ((uint32_t)(value >> 32)));
+}
+
+#endif /* CPU_H */
@@ -0,0 +1,196 @@
+/* event.c - Kernel event queue for NEBULA OS
+ * 
+ * The queue is a bounded lock-free ring that any number of producers and
+ * consumers can share. Every slot carries a sequence number: a slot is
+ * free for the producer that claims position pos when its sequence is
+ * pos, and holds an event for the consumer at pos once the producer sets
+ * it to pos + 1. Claiming a position is one compare-and-swap on the
+ * shared index, so an interrupt handler posting on top of a thread that
+ * is halfway through posting just takes the next slot - nobody spins.
+ * 
+ * Waiting consumers sleep on a wait queue. Producers wake it after
+ * publishing, and consumers check the ring with its lock held, so a post
+ * between the check and the sleep is never missed.
+ * 
+ * Repaint requests are not queued one by one. They are merged into a
+ * pending damage rectangle, and only the first one since the last
+ * EVENT_REDRAW was taken out queues an event; the rectangle is attached
+ * to the event when it is taken out.
+ */
+
+#include "event.h"
+#include "sched.h"
+#include "spinlock.h"
+
+#define EVENT_QUEUE_MASK (EVENT_QUEUE_SIZE - 1)
+
+/* Ring slot */
+typedef struct {
+    uint32_t sequence;                    /* Which position may use the slot next */
+    Event event;
+} EventSlot;
+
+static EventSlot slots[EVENT_QUEUE_SIZE];
+static uint32_t enqueue_pos = 0;          /* Next position to post to */
+static uint32_t dequeue_pos = 0;          /* Next position to take from */
+static uint32_t dropped = 0;              /* Events lost to a full queue */
+static WaitQueue event_waiters = WAIT_QUEUE_INIT;
+
+/* Pending repaint - union of requests since the last EVENT_REDRAW was taken */
+static Spinlock damage_lock = SPINLOCK_INIT;
+static uint32_t damage_x0, damage_y0, damage_x1, damage_y1; /* Exclusive end */
+static uint8_t redraw_queued = 0;         /* An EVENT_REDRAW is in the ring */
+
+/* Set up the queue */
+void event_init(void) {
+    for (uint32_t i = 0; i < EVENT_QUEUE_SIZE; i++) {
+        slots[i].sequence = i;
+    }
+    enqueue_pos = 0;
+    dequeue_pos = 0;
+}
+
+/* Put an event in the ring - returns 0 if it is full */
+static uint8_t ring_push(const Event* event) {
+    uint32_t pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    EventSlot* slot;
+    while (1) {
+        slot = &slots[pos & EVENT_QUEUE_MASK];
+        int32_t diff = (int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            /* Free - claim it (a failed CAS reloads pos) */
+            if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0;                     /* Still holds an event from a lap ago */
+        } else {
+            pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    slot->event = *event;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* Take an event from the ring - returns 0 if it is empty */
+static uint8_t ring_pop(Event* event) {
+    uint32_t pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+    EventSlot* slot;
+    while (1) {
+        slot = &slots[pos & EVENT_QUEUE_MASK];
+        int32_t diff = (int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&dequeue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0;                     /* Not published yet */
+        } else {
+            pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    *event = slot->event;
+    __atomic_store_n(&slot->sequence, pos + EVENT_QUEUE_SIZE, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* Queue an event and wake a waiting consumer */
+uint8_t event_post(const Event* event) {
+    if (!ring_push(event)) {
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    thread_wake_all(&event_waiters);
+    return 1;
+}
+
+/* Queue a key event */
+uint8_t event_post_key(uint8_t type, uint16_t key, char ascii, uint8_t modifiers) {
+    Event event = { 0 };
+    event.type = type;
+    event.key = key;
+    event.ascii = ascii;
+    event.modifiers = modifiers;
+    return event_post(&event);
+}
+
+/* Queue a timer event */
+uint8_t event_post_timer(uint32_t timer) {
+    Event event = { 0 };
+    event.type = EVENT_TIMER;
+    event.timer = timer;
+    return event_post(&event);
+}
+
+/* Ask for an area to be repainted */
+void event_post_redraw(uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
+    if (w == 0 || h == 0) {
+        return;
+    }
+    
+    /* Grow the pending rectangle - only the first request queues an event */
+    uint32_t flags = spin_lock_irqsave(&damage_lock);
+    uint8_t first = !redraw_queued;
+    if (first) {
+        damage_x0 = x;
+        damage_y0 = y;
+        damage_x1 = (uint32_t) x + w;
+        damage_y1 = (uint32_t) y + h;
+        redraw_queued = 1;
+    } else {
+        if (x < damage_x0) damage_x0 = x;
+        if (y < damage_y0) damage_y0 = y;
+        if ((uint32_t) x + w > damage_x1) damage_x1 = (uint32_t) x + w;
+        if ((uint32_t) y + h > damage_y1) damage_y1 = (uint32_t) y + h;
+    }
+    spin_unlock_irqrestore(&damage_lock, flags);
+    
+    if (first) {
+        Event event = { 0 };
+        event.type = EVENT_REDRAW;
+        if (!event_post(&event)) {
+            /* Dropped - let the next request try again, damage and all */
+            flags = spin_lock_irqsave(&damage_lock);
+            redraw_queued = 0;
+            spin_unlock_irqrestore(&damage_lock, flags);
+        }
+    }
+}
+
+/* Take the next event without waiting */
+uint8_t event_poll(Event* event) {
+    if (!ring_pop(event)) {
+        return 0;
+    }
+    
+    /* Hand over everything requested so far - later requests queue anew */
+    if (event->type == EVENT_REDRAW) {
+        uint32_t flags = spin_lock_irqsave(&damage_lock);
+        if (redraw_queued) {
+            event->x = damage_x0;
+            event->y = damage_y0;
+            event->w = damage_x1 - damage_x0 > 0xFFFF ? 0xFFFF : damage_x1 - damage_x0;
+            event->h = damage_y1 - damage_y0 > 0xFFFF ? 0xFFFF : damage_y1 - damage_y0;
+            redraw_queued = 0;
+        }
+        spin_unlock_irqrestore(&damage_lock, flags);
+    }
+    return 1;
+}
+
+/* Take the next event, sleeping until one is posted */
+void event_wait(Event* event) {
+    uint32_t flags = wait_queue_lock(&event_waiters);
+    while (!event_poll(event)) {
+        thread_wait(&event_waiters);
+    }
+    wait_queue_unlock(&event_waiters, flags);
+}
+
+/* Number of events dropped because the queue was full */
+uint32_t event_get_dropped(void) {
+    return dropped;
+}
@@ -0,0 +1,72 @@
+/* event.h - Kernel event queue for NEBULA OS
+ * 
+ * Interrupt handlers, timer callbacks and threads post typed events into
+ * one bounded queue; the event loop in kernel_main takes them out and
+ * routes them to whoever handles them (the UI, mostly). Posting never
+ * blocks and is safe from any CPU and from interrupt context.
+ * 
+ * Redraw requests are coalesced: however many are posted before the
+ * event loop gets to them, it sees one EVENT_REDRAW covering all of them.
+ */
+
+#ifndef EVENT_H
+#define EVENT_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned short     uint16_t;
+typedef unsigned int       uint32_t;
+typedef signed int         int32_t;
+
+/* Event types */
+#define EVENT_NONE      0
+#define EVENT_KEY_DOWN  1                 /* Key pressed (or repeated) */
+#define EVENT_KEY_UP    2                 /* Key released */
+#define EVENT_TIMER     3                 /* A timer fired - timer is the poster's id */
+#define EVENT_REDRAW    4                 /* Area of the screen needs a repaint */
+
+/* Modifier state during a key event - the low three bits select the
+ * keymap table (see keyboard.c), so their order is fixed */
+#define KEY_MOD_SHIFT   0x01
+#define KEY_MOD_CTRL    0x02
+#define KEY_MOD_CAPS    0x04              /* Caps Lock is on */
+#define KEY_MOD_ALT     0x08
+
+/* Queue capacity - must be a power of two */
+#define EVENT_QUEUE_SIZE 256
+
+/* One event */
+typedef struct {
+    uint8_t type;                         /* EVENT_* */
+    uint8_t modifiers;                    /* Key events: KEY_MOD_* held */
+    uint16_t key;                         /* Key events: KEY_* code (keyboard.h) */
+    char ascii;                           /* Key events: character typed, 0 if none */
+    uint32_t timer;                       /* EVENT_TIMER: which timer */
+    uint16_t x, y, w, h;                  /* EVENT_REDRAW: union of requested areas */
+} Event;
+
+/* Set up the queue (before anything posts) */
+void event_init(void);
+
+/* Queue an event - returns 0 if the queue is full and it was dropped */
+uint8_t event_post(const Event* event);
+
+/* Queue a key event */
+uint8_t event_post_key(uint8_t type, uint16_t key, char ascii, uint8_t modifiers);
+
+/* Queue a timer event */
+uint8_t event_post_timer(uint32_t timer);
+
+/* Ask for an area to be repainted - merged into any request still queued */
+void event_post_redraw(uint16_t x, uint16_t y, uint16_t w, uint16_t h);
+
+/* Take the next event without waiting - returns 0 if there is none */
+uint8_t event_poll(Event* event);
+
+/* Take the next event, blocking the calling thread until there is one */
+void event_wait(Event* event);
+
+/* Number of events dropped because the queue was full */
+uint32_t event_get_dropped(void);
+
+#endif /* EVENT_H */
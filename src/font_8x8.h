@@ -0,0 +1,136 @@
+/* font_8x8.h - Built-in 8x8 font for NEBULA OS
+ *
+ * One byte per row, bit 7 leftmost, for the characters from
+ * FONT_8X8_FIRST on. Included by graphics.c as the font used when the
+ * asset bundle brings none, and by tools/assets_gen.c, which packs the
+ * same glyphs into the bundle - so there is only one copy to edit.
+ */
+
+#ifndef FONT_8X8_H
+#define FONT_8X8_H
+
+/* First character in the table */
+#define FONT_8X8_FIRST 0x20
+
+static const unsigned char font_8x8[][8] = {
+    /* Space (0x20) */
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+    /* '!' */
+    {0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00},
+    /* '"' */
+    {0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+    /* '#' */
+    {0x36, 0x7F, 0x36, 0x36, 0x7F, 0x36, 0x36, 0x00},
+    /* '$' */
+    {0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00},
+    /* '%' */
+    {0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00},
+    /* '&' */
+    {0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00},
+    /* ''' */
+    {0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00},
+    /* '(' */
+    {0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00},
+    /* ')' */
+    {0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00},
+    /* '*' */
+    {0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00},
+    /* '+' */
+    {0x00, 0x0C, 0x0C, 0x7F, 0x0C, 0x0C, 0x00, 0x00},
+    /* ',' */
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x06, 0x00},
+    /* '-' */
+    {0x00, 0x00, 0x00, 0x7F, 0x00, 0x00, 0x00, 0x00},
+    /* '.' */
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00},
+    /* '/' */
+    {0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00},
+    /* '0' */
+    {0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00},
+    /* '1' */
+    {0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00},
+    /* '2' */
+    {0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00},
+    /* '3' */
+    {0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00},
+    /* '4' */
+    {0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00},
+    /* '5' */
+    {0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00},
+    /* '6' */
+    {0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00},
+    /* '7' */
+    {0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00},
+    /* '8' */
+    {0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00},
+    /* '9' */
+    {0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00},
+    /* ':' */
+    {0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00},
+    /* ';' */
+    {0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x06, 0x00},
+    /* '<' */
+    {0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00},
+    /* '=' */
+    {0x00, 0x00, 0x7F, 0x00, 0x00, 0x7F, 0x00, 0x00},
+    /* '>' */
+    {0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00},
+    /* '?' */
+    {0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00},
+    /* '@' */
+    {0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00},
+    /* 'A' */
+    {0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00},
+    /* 'B' */
+    {0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00},
+    /* 'C' */
+    {0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00},
+    /* 'D' */
+    {0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00},
+    /* 'E' */
+    {0x7F, 0x06, 0x06, 0x3E, 0x06, 0x06, 0x7F, 0x00},
+    /* 'F' */
+    {0x7F, 0x06, 0x06, 0x3E, 0x06, 0x06, 0x06, 0x00},
+    /* 'G' */
+    {0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00},
+    /* 'H' */
+    {0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00},
+    /* 'I' */
+    {0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00},
+    /* 'J' */
+    {0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00},
+    /* 'K' */
+    {0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00},
+    /* 'L' */
+    {0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x7F, 0x00},
+    /* 'M' */
+    {0x63, 0x77, 0x7F, 0x6B, 0x63, 0x63, 0x63, 0x00},
+    /* 'N' */
+    {0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00},
+    /* 'O' */
+    {0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00},
+    /* 'P' */
+    {0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x06, 0x00},
+    /* 'Q' */
+    {0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00},
+    /* 'R' */
+    {0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00},
+    /* 'S' */
+    {0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00},
+    /* 'T' */
+    {0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00},
+    /* 'U' */
+    {0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x00},
+    /* 'V' */
+    {0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00},
+    /* 'W' */
+    {0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00},
+    /* 'X' */
+    {0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00},
+    /* 'Y' */
+    {0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00},
+    /* 'Z' */
+    {0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00},
+};
+
+#endif /* FONT_8X8_H */
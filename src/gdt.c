@@ -0,0 +1,126 @@
+/* gdt.c - Global descriptor table for JoshOS
+ *
+ * Only flat ring 0 segments, plus a TSS and a %gs segment per CPU, are
+ * needed - the kernel does not use segmentation for protection.
+ */
+
+#include "gdt.h"
+#include "percpu.h"
+
+/* Number of descriptors: null, code, data, then two per CPU */
+#define GDT_ENTRIES (3 + SMP_MAX_CPUS * 2)
+
+/* Access byte bits */
+#define GDT_PRESENT     0x80              /* Segment present */
+#define GDT_DESCRIPTOR  0x10              /* Code/data (not system) segment */
+#define GDT_EXECUTABLE  0x08              /* Code segment */
+#define GDT_READ_WRITE  0x02              /* Readable code / writable data */
+#define GDT_TSS_32BIT   0x09              /* System segment: available 32-bit TSS */
+
+/* Flags nibble */
+#define GDT_GRANULARITY 0x08              /* Limit is in 4KB units */
+#define GDT_32BIT       0x04              /* 32-bit default operand size */
+
+/* Segment descriptor (hardware layout) */
+typedef struct {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t base_middle;
+    uint8_t access;
+    uint8_t limit_flags;                  /* Limit bits 16-19, flags in high nibble */
+    uint8_t base_high;
+} __attribute__((packed)) GdtEntry;
+
+/* Operand of lgdt */
+typedef struct {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) GdtPointer;
+
+/* Task state segment (hardware layout) */
+typedef struct {
+    uint32_t link;
+    uint32_t esp0;                        /* Stack for entering ring 0 */
+    uint32_t ss0;
+    uint32_t esp1, ss1, esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;                  /* Offset of I/O bitmap (none) */
+} __attribute__((packed)) TaskStateSegment;
+
+/* The table itself */
+static GdtEntry gdt[GDT_ENTRIES] __attribute__((aligned(8)));
+static TaskStateSegment tss[SMP_MAX_CPUS] __attribute__((aligned(16)));
+
+/* Fill in one descriptor */
+static void gdt_set_entry(uint32_t index, uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    gdt[index].limit_low = limit & 0xFFFF;
+    gdt[index].base_low = base & 0xFFFF;
+    gdt[index].base_middle = (base >> 16) & 0xFF;
+    gdt[index].access = access;
+    gdt[index].limit_flags = ((limit >> 16) & 0x0F) | (flags << 4);
+    gdt[index].base_high = (base >> 24) & 0xFF;
+}
+
+/* Build the kernel GDT and load it on the bootstrap CPU */
+void gdt_init(void) {
+    gdt_set_entry(0, 0, 0, 0, 0);         /* Null descriptor */
+    gdt_set_entry(GDT_KERNEL_CODE >> 3, 0, 0xFFFFF,
+                  GDT_PRESENT | GDT_DESCRIPTOR | GDT_EXECUTABLE | GDT_READ_WRITE,
+                  GDT_GRANULARITY | GDT_32BIT);
+    gdt_set_entry(GDT_KERNEL_DATA >> 3, 0, 0xFFFFF,
+                  GDT_PRESENT | GDT_DESCRIPTOR | GDT_READ_WRITE,
+                  GDT_GRANULARITY | GDT_32BIT);
+    gdt_load();
+}
+
+/* Load the kernel GDT on another CPU and reload its segment registers */
+void gdt_load(void) {
+    GdtPointer pointer;
+
+    pointer.limit = sizeof(gdt) - 1;
+    pointer.base = (uint32_t) gdt;
+
+    /* Load the table, then far jump to reload CS and reload the data segments */
+    __asm__ volatile (
+        "lgdt %0\n\t"
+        "ljmp %1, $1f\n"
+        "1:\n\t"
+        "mov %2, %%ax\n\t"
+        "mov %%ax, %%ds\n\t"
+        "mov %%ax, %%es\n\t"
+        "mov %%ax, %%fs\n\t"
+        "mov %%ax, %%gs\n\t"
+        "mov %%ax, %%ss\n\t"
+        : : "m" (pointer), "i" (GDT_KERNEL_CODE), "i" (GDT_KERNEL_DATA) : "eax", "memory");
+}
+
+/* Install and load the calling CPU's TSS and %gs segment */
+void gdt_load_cpu(uint32_t cpu, uint32_t percpu_base, uint32_t percpu_size) {
+    TaskStateSegment* task = &tss[cpu];
+
+    /* TSS - ring 0 stack only, no I/O bitmap */
+    uint8_t* bytes = (uint8_t*) task;
+    for (uint32_t i = 0; i < sizeof(*task); i++) {
+        bytes[i] = 0;
+    }
+    task->ss0 = GDT_KERNEL_DATA;
+    task->iomap_base = sizeof(*task);
+    gdt_set_entry(GDT_TSS(cpu) >> 3, (uint32_t) task, sizeof(*task) - 1,
+                  GDT_PRESENT | GDT_TSS_32BIT, 0);
+
+    /* Byte-granular data segment covering just the per-CPU structure */
+    gdt_set_entry(GDT_PERCPU(cpu) >> 3, percpu_base, percpu_size - 1,
+                  GDT_PRESENT | GDT_DESCRIPTOR | GDT_READ_WRITE, GDT_32BIT);
+
+    __asm__ volatile ("ltr %w0" : : "r" (GDT_TSS(cpu)));
+    __asm__ volatile ("mov %w0, %%gs" : : "r" (GDT_PERCPU(cpu)) : "memory");
+}
+
+/* Stack a CPU switches to when entering ring 0 from a lower ring */
+void gdt_set_kernel_stack(uint32_t cpu, uint32_t esp0) {
+    tss[cpu].esp0 = esp0;
+}
@@ -0,0 +1,41 @@
+/* gdt.h - Global descriptor table for JoshOS
+ *
+ * GRUB leaves us in protected mode with flat segments, but the GDT it
+ * used may live anywhere in memory, so the kernel installs its own before
+ * pointing interrupt gates at a code selector.
+ *
+ * Each CPU has its own TSS, used only for its ring 0 stack pointer
+ * (which the scheduler keeps pointing at the running thread's stack),
+ * and its own data segment based at its per-CPU data, loaded into %gs.
+ */
+
+#ifndef GDT_H
+#define GDT_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned short     uint16_t;
+typedef unsigned int       uint32_t;
+
+/* Segment selectors */
+#define GDT_KERNEL_CODE  0x08             /* Flat 4GB ring 0 code */
+#define GDT_KERNEL_DATA  0x10             /* Flat 4GB ring 0 data */
+#define GDT_CPU_BASE     0x18             /* Per-CPU TSS and %gs pairs follow */
+
+/* Selectors of one CPU's TSS and per-CPU data segment */
+#define GDT_TSS(cpu)     (GDT_CPU_BASE + (cpu) * 16)
+#define GDT_PERCPU(cpu)  (GDT_CPU_BASE + (cpu) * 16 + 8)
+
+/* Build the kernel GDT and load it on the bootstrap CPU */
+void gdt_init(void);
+
+/* Load the kernel GDT on another CPU and reload its segment registers */
+void gdt_load(void);
+
+/* Install and load the calling CPU's TSS and %gs segment */
+void gdt_load_cpu(uint32_t cpu, uint32_t percpu_base, uint32_t percpu_size);
+
+/* Stack a CPU switches to when entering ring 0 from a lower ring */
+void gdt_set_kernel_stack(uint32_t cpu, uint32_t esp0);
+
+#endif /* GDT_H */
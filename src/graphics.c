@@ -1,12 +1,84 @@
 /* graphics.c - Graphics subsystem implementation for NEBULA OS
  * 
- * Implements VGA Mode 13h graphics with drawing primitives.
+ * Drives the linear framebuffer GRUB set up from the Multiboot video
+ * request, or programs VGA Mode 13h when there is none.
+ * 
+ * All primitives draw into a back buffer in RAM, in the screen's own
+ * pixel format; the framebuffer is slow to access, so it is only written
+ * by graphics_present, which copies the rows that changed since the last
+ * present. The changed area is tracked as one [x0, x1] extent per
+ * scanline, which keeps marking a single pixel O(1).
+ * 
+ * Filled shapes are clipped once and then emitted as horizontal spans.
+ * Spans, columns, blends and glyphs go through the raster core for the
+ * screen's depth (graphics_raster.h), chosen once in graphics_init. Layer
+ * blits and the upload in graphics_present are whole-row copies done by
+ * the vector kernels in blit.c.
+ * 
+ * On a Bochs/QEMU display adapter the framebuffer holds two or three
+ * screen-sized pages and the visible one is picked with the display start
+ * (Y offset) register. graphics_present then writes a hidden page and
+ * queues it to be shown at the next refresh, instead of updating the
+ * visible page while it is being scanned out. Drawing itself stays in the
+ * RAM back buffer - blends and keyed blits read the destination, and
+ * framebuffer reads are uncached - so each page keeps its own damage and
+ * gets just what changed since it was last written. With three pages the
+ * render thread never waits for a flip; with two it waits for the queued
+ * page to reach the screen before reusing the other.
+ * Coordinates are taken as signed so shapes hanging off the left or top
+ * edge are clipped, not wrapped.
  */
 
 #include "graphics.h"
+#include "assets.h"
+#include "blit.h"
+#include "font_8x8.h"
+#include "idt.h"
+#include "kstring.h"
+#include "memory.h"
+#include "paging.h"
+#include "pmm.h"
+#include "sched.h"
+#include "timer.h"
+#include "trace.h"
 
 /* Graphics context */
-static Graphics gfx;
+Graphics gfx;
+
+/* Dirty region - per-row changed extent, empty when x0 > x1 */
+static int16_t dirty_x0[GRAPHICS_MAX_HEIGHT];
+static int16_t dirty_x1[GRAPHICS_MAX_HEIGHT];
+static int16_t dirty_y0 = 0;              /* First row with changes */
+static int16_t dirty_y1 = -1;             /* Last row with changes */
+static uint8_t track_dirty = 1;           /* Off while drawing into a layer */
+static uint8_t* screen_buffer = NULL;     /* Back buffer while a layer is active */
+
+/* Page flipping - what each hardware page is missing, like the dirty region */
+static int16_t page_x0[GRAPHICS_MAX_PAGES][GRAPHICS_MAX_HEIGHT];
+static int16_t page_x1[GRAPHICS_MAX_PAGES][GRAPHICS_MAX_HEIGHT];
+static int16_t page_y0[GRAPHICS_MAX_PAGES];
+static int16_t page_y1[GRAPHICS_MAX_PAGES];
+static uint8_t page_front = 0;            /* Page being scanned out */
+static int16_t page_queued = -1;          /* Page shown at the next refresh, -1 if none */
+static uint32_t vsync_period = 0;         /* Refresh interval in ns, 0 = flip at once */
+static uint64_t vsync_base = 0;           /* Time of a refresh - flips land on this grid */
+static uint8_t vsync_locked = 0;          /* vsync_base follows the adapter's retrace */
+static uint8_t vsync_retries = 0;         /* Polls so far for the current flip */
+static Timer vsync_timer;
+static WaitQueue flip_waiters = WAIT_QUEUE_INIT;  /* Guards the flip state */
+
+/* Retrace locking - refresh intervals believed, and how long a flip
+ * polls for the retrace (a little over one refresh) before giving up */
+#define VSYNC_MIN_PERIOD_NS (NS_PER_SEC / 120)
+#define VSYNC_MAX_PERIOD_NS (NS_PER_SEC / 40)
+#define VSYNC_RETRY_NS      (250 * NS_PER_US)
+#define VSYNC_MAX_RETRIES   80
+
+/* Clip rectangle (inclusive) - every primitive is clipped against it */
+static int16_t clip_x0 = 0;
+static int16_t clip_y0 = 0;
+static int16_t clip_x1 = -1;
+static int16_t clip_y1 = -1;
 
 /* VGA port addresses */
 #define VGA_AC_INDEX    0x3C0
@@ -22,6 +94,8 @@ static Graphics gfx;
 #define VGA_GC_DATA     0x3CF
 #define VGA_CRTC_INDEX  0x3D4
 #define VGA_CRTC_DATA   0x3D5
+#define VGA_STATUS      0x3DA             /* Input status 1 */
+#define VGA_STATUS_RETRACE 0x08           /* In vertical retrace */
 
 /* Write to VGA port */
 static inline void outb(uint16_t port, uint8_t value) {
@@ -35,6 +109,46 @@ static inline uint8_t inb(uint16_t port) {
     return ret;
 }
 
+/* Bochs/QEMU display interface (VBE DISPI) ports and registers */
+#define BGA_INDEX           0x1CE
+#define BGA_DATA            0x1CF
+#define BGA_REG_ID          0x0
+#define BGA_REG_XRES        0x1
+#define BGA_REG_YRES        0x2
+#define BGA_REG_BPP         0x3
+#define BGA_REG_ENABLE      0x4
+#define BGA_REG_VIRT_WIDTH  0x6
+#define BGA_REG_X_OFFSET    0x8
+#define BGA_REG_Y_OFFSET    0x9
+#define BGA_ID_MIN          0xB0C1        /* First version with display offsets */
+#define BGA_ID_MAX          0xB0C5
+#define BGA_ENABLED         0x01
+#define BGA_LFB_ENABLED     0x40
+
+/* Write a 16-bit port */
+static inline void outw(uint16_t port, uint16_t value) {
+    __asm__ volatile ("outw %0, %1" : : "a" (value), "Nd" (port));
+}
+
+/* Read a 16-bit port */
+static inline uint16_t inw(uint16_t port) {
+    uint16_t ret;
+    __asm__ volatile ("inw %1, %0" : "=a" (ret) : "Nd" (port));
+    return ret;
+}
+
+/* Read a display adapter register */
+static inline uint16_t bga_read(uint16_t reg) {
+    outw(BGA_INDEX, reg);
+    return inw(BGA_DATA);
+}
+
+/* Write a display adapter register */
+static inline void bga_write(uint16_t reg, uint16_t value) {
+    outw(BGA_INDEX, reg);
+    outw(BGA_DATA, value);
+}
+
 /* Wait for VGA to be ready */
 static void vga_wait(void) {
     /* Wait for vertical retrace */
@@ -42,15 +156,213 @@ static void vga_wait(void) {
     while (!(inb(0x3DA) & 0x08));
 }
 
-/* Initialize VGA Mode 13h */
-void graphics_init(void) {
-    /* Setup framebuffer */
-    gfx.framebuffer = (uint8_t*) VGA_MEMORY;
-    gfx.width = SCREEN_WIDTH;
-    gfx.height = SCREEN_HEIGHT;
+/* Blend tables - blend_tables[level - 1][src][dst] is the palette index
+ * closest to level/GRAPHICS_ALPHA_LEVELS of src over dst (8 bpp only) */
+static uint8_t* blend_tables = NULL;
+
+/* Glyph cache - each font row pre-expanded into an 8-byte pixel mask
+ * (0xFF where the glyph has ink), so a glyph row is drawn with masked
+ * stores instead of eight bit tests */
+#define GLYPH_SIZE      8                 /* Glyphs are 8x8 pixels */
+#define LINE_HEIGHT     10                /* Distance between text lines */
+
+/* 32-bit framebuffer access that may alias byte access */
+typedef uint32_t __attribute__((may_alias)) fb_word_t;
+
+/* Pre-expanded glyph */
+typedef struct {
+    uint32_t mask[GLYPH_SIZE][2];         /* Pixel masks for columns 0-3, 4-7 */
+    uint8_t known;                        /* Character has a font entry */
+    uint8_t ink;                          /* Glyph has at least one pixel */
+} Glyph;
+
+/* Raster core for one pixel format - rows are byte addresses, pixels are
+ * native values */
+typedef struct {
+    void (*put)(uint8_t* row, int32_t x, uint32_t pixel);
+    uint32_t (*get)(const uint8_t* row, int32_t x);
+    void (*fill)(uint8_t* row, int32_t x0, int32_t x1, uint32_t pixel);
+    void (*key)(uint8_t* dst, const uint8_t* src, int32_t count, uint32_t key);
+    void (*column)(uint8_t* dst, uint32_t pitch, int32_t count, uint32_t pixel);
+    void (*blend)(uint8_t* row, int32_t x0, int32_t x1, uint32_t pixel, uint32_t alpha);
+    void (*glyph)(uint8_t* dst, uint32_t pitch, const Glyph* glyph, uint32_t pixel);
+} Raster;
+
+#define RASTER_BPP 8
+#include "graphics_raster.h"
+#undef RASTER_BPP
+#define RASTER_BPP 16
+#include "graphics_raster.h"
+#undef RASTER_BPP
+#define RASTER_BPP 32
+#include "graphics_raster.h"
+#undef RASTER_BPP
+
+/* Raster core for the screen's depth */
+static const Raster* raster = &raster_ops_8;
+
+/* Start of row y of the drawing target */
+static inline uint8_t* row_at(int32_t y) {
+    return gfx.framebuffer + y * gfx.pitch;
+}
+
+/* Bytes per pixel */
+static inline uint32_t pixel_bytes(void) {
+    return gfx.bpp >> 3;
+}
+
+/* Reset dirty region to empty */
+static void dirty_reset(void) {
+    for (uint16_t row = 0; row < gfx.height; row++) {
+        dirty_x0[row] = SCREEN_WIDTH;
+        dirty_x1[row] = -1;
+    }
+    dirty_y0 = SCREEN_HEIGHT;
+    dirty_y1 = -1;
+}
+
+/* Mark all of a hardware page as out of date */
+static void page_damage_all(uint8_t page) {
+    for (uint16_t row = 0; row < gfx.height; row++) {
+        page_x0[page][row] = 0;
+        page_x1[page][row] = SCREEN_WIDTH - 1;
+    }
+    page_y0[page] = 0;
+    page_y1[page] = SCREEN_HEIGHT - 1;
+}
+
+/* Start of hardware page n in vram */
+static inline uint8_t* page_at(uint32_t page) {
+    return gfx.vram + page * gfx.vram_pitch * gfx.height;
+}
+
+/* Grow the dirty region to include span [x0, x1] of row y - caller clips */
+static inline void dirty_span(int16_t x0, int16_t x1, int16_t y) {
+    if (!track_dirty) return;             /* Layers are not on screen */
+    if (x0 < dirty_x0[y]) dirty_x0[y] = x0;
+    if (x1 > dirty_x1[y]) dirty_x1[y] = x1;
+    if (y < dirty_y0) dirty_y0 = y;
+    if (y > dirty_y1) dirty_y1 = y;
+}
+
+/* Fill span [x0, x1] of row y - caller clips */
+static inline void span_fill_unclipped(int16_t x0, int16_t x1, int16_t y, uint8_t color) {
+    raster->fill(row_at(y), x0, x1, gfx.colors[color]);
+    dirty_span(x0, x1, y);
+}
+
+/* Clip span [x0, x1] of row y and fill it */
+static inline void span_fill(int32_t x0, int32_t x1, int32_t y, uint8_t color) {
+    if (y < clip_y0 || y > clip_y1) return;
+    if (x0 < clip_x0) x0 = clip_x0;
+    if (x1 > clip_x1) x1 = clip_x1;
+    if (x0 > x1) return;
+    span_fill_unclipped(x0, x1, y, color);
+}
+
+/* Screen-sized buffer from the page allocator (NULL if none) */
+static uint8_t* screen_buffer_alloc(void) {
+    uint32_t size = gfx.pitch * gfx.height;
+    uint32_t order = page_order_for_size(size);
+    if (((uint32_t) PAGE_SIZE << order) < size) {
+        return NULL;                      /* Larger than the biggest block */
+    }
+    return (uint8_t*) page_alloc(order);
+}
+
+/* Use the framebuffer GRUB set up - returns 0 if there is none we can use */
+static uint8_t lfb_setup(const MultibootInfo* mbi) {
+    if (mbi == NULL || !(mbi->flags & MULTIBOOT_INFO_FRAMEBUFFER)) {
+        return 0;
+    }
+    uint32_t bpp = mbi->framebuffer_bpp;
+    uint32_t width = mbi->framebuffer_width;
+    uint32_t height = mbi->framebuffer_height;
+    if (mbi->framebuffer_type == MULTIBOOT_FRAMEBUFFER_INDEXED) {
+        if (bpp != 8) return 0;
+    } else if (mbi->framebuffer_type == MULTIBOOT_FRAMEBUFFER_RGB) {
+        if (bpp != 16 && bpp != 32) return 0;
+    } else {
+        return 0;                         /* Text mode */
+    }
+    if (width == 0 || height == 0 || width > GRAPHICS_MAX_WIDTH || height > GRAPHICS_MAX_HEIGHT ||
+        mbi->framebuffer_pitch < width * (bpp >> 3) ||
+        mbi->framebuffer_addr + (uint64_t) mbi->framebuffer_pitch * height > 0x100000000ULL) {
+        return 0;
+    }
+    
+    gfx.bpp = bpp;
+    if (bpp != 8) {
+        gfx.red_shift = mbi->red_field_position;
+        gfx.red_bits = mbi->red_mask_size;
+        gfx.green_shift = mbi->green_field_position;
+        gfx.green_bits = mbi->green_mask_size;
+        gfx.blue_shift = mbi->blue_field_position;
+        gfx.blue_bits = mbi->blue_mask_size;
+        
+        /* The packed blends assume green in the middle, and 8-bit channels
+         * at 32 bpp - which is every mode VBE actually offers */
+        uint8_t red_low = gfx.red_shift < gfx.blue_shift;
+        uint8_t green_middle = red_low ? (gfx.green_shift > gfx.red_shift && gfx.green_shift < gfx.blue_shift)
+                                       : (gfx.green_shift > gfx.blue_shift && gfx.green_shift < gfx.red_shift);
+        if (!green_middle || (bpp == 32 && (gfx.red_bits != 8 || gfx.green_bits != 8 || gfx.blue_bits != 8))) {
+            return 0;
+        }
+        uint32_t red_mask = ((1u << gfx.red_bits) - 1) << gfx.red_shift;
+        uint32_t green_mask = ((1u << gfx.green_bits) - 1) << gfx.green_shift;
+        uint32_t blue_mask = ((1u << gfx.blue_bits) - 1) << gfx.blue_shift;
+        gfx.blend_mask = red_mask | blue_mask | (green_mask << 16);
+    }
+    gfx.vram = (uint8_t*)(uint32_t) mbi->framebuffer_addr;
+    gfx.vram_pitch = mbi->framebuffer_pitch;
+    gfx.width = width;
+    gfx.height = height;
+    gfx.linear = 1;
+    return 1;
+}
+
+/* Find out how many screen-sized pages the display adapter can flip
+ * between - 1 unless it is a Bochs/QEMU adapter in the mode GRUB set */
+static uint8_t bga_setup(void) {
+    uint16_t id = bga_read(BGA_REG_ID);
+    if (!gfx.linear || id < BGA_ID_MIN || id > BGA_ID_MAX) {
+        return 1;
+    }
+    uint16_t enable = bga_read(BGA_REG_ENABLE);
+    if ((enable & (BGA_ENABLED | BGA_LFB_ENABLED)) != (BGA_ENABLED | BGA_LFB_ENABLED) ||
+        bga_read(BGA_REG_XRES) != gfx.width || bga_read(BGA_REG_YRES) != gfx.height ||
+        bga_read(BGA_REG_BPP) != gfx.bpp ||
+        (uint32_t) bga_read(BGA_REG_VIRT_WIDTH) * pixel_bytes() != gfx.vram_pitch) {
+        return 1;
+    }
+    
+    /* The adapter clamps the Y offset to what its memory holds - keep as
+     * many pages as the offset can actually reach */
+    uint8_t pages = GRAPHICS_MAX_PAGES;
+    while (pages > 1) {
+        uint16_t offset = (pages - 1) * gfx.height;
+        bga_write(BGA_REG_Y_OFFSET, offset);
+        if (bga_read(BGA_REG_Y_OFFSET) == offset) {
+            break;
+        }
+        pages--;
+    }
+    bga_write(BGA_REG_X_OFFSET, 0);
+    bga_write(BGA_REG_Y_OFFSET, 0);
+    return pages;
+}
+
+/* Program VGA Mode 13h */
+static void vga_setup(void) {
+    gfx.vram = (uint8_t*) VGA_MEMORY;
+    gfx.vram_pitch = VGA_WIDTH;
+    gfx.width = VGA_WIDTH;
+    gfx.height = VGA_HEIGHT;
+    gfx.bpp = 8;
+    gfx.linear = 0;
     
     /* Disable interrupts during mode switch */
-    __asm__ volatile ("cli");
+    uint32_t flags = interrupts_save();
     
     /* Unlock CRTC registers */
     outb(VGA_CRTC_INDEX, 0x11);
@@ -115,48 +427,527 @@ void graphics_init(void) {
     }
     outb(VGA_AC_INDEX, 0x20);  /* Enable attribute controller */
     
-    /* Re-enable interrupts */
-    __asm__ volatile ("sti");
+    /* Back to the caller's interrupt state (still off during boot) */
+    interrupts_restore(flags);
+}
+
+/* Initialize graphics - bootloader framebuffer or VGA Mode 13h */
+void graphics_init(const MultibootInfo* mbi) {
+    if (!lfb_setup(mbi)) {
+        vga_setup();
+    }
+    
+    switch (gfx.bpp) {
+        case 16: raster = &raster_ops_16; break;
+        case 32: raster = &raster_ops_32; break;
+        default: raster = &raster_ops_8; break;
+    }
+    
+    /* Setup framebuffer - draw into a RAM back buffer when we can get one */
+    gfx.pitch = gfx.width * pixel_bytes();
+    gfx.framebuffer = screen_buffer_alloc();
+    if (gfx.framebuffer == NULL) {
+        gfx.framebuffer = gfx.vram;       /* No memory - draw straight to the screen */
+        gfx.pitch = gfx.vram_pitch;
+    }
+    
+    /* Flipping needs the back buffer - every page is written from it */
+    gfx.pages = gfx.framebuffer != gfx.vram ? bga_setup() : 1;
+    page_front = 0;
+    for (uint8_t page = 0; page < gfx.pages; page++) {
+        page_damage_all(page);
+    }
+    paging_set_memory_type((uint32_t) gfx.vram, gfx.vram_pitch * gfx.height * gfx.pages,
+                           PAGING_WRITE_COMBINING);
+    graphics_reset_clip();
+    dirty_reset();
     
     /* Setup custom palette */
     graphics_setup_palette();
     
-    /* Clear screen */
+    /* Clear the back buffer - the first present is the first real frame,
+     * so no time goes on showing a black one */
     graphics_clear(COLOR_BLACK);
 }
 
+/* Standard EGA colors (6-bit DAC values) */
+static const uint8_t ega_colors[16][3] = {
+    { 0,  0,  0}, { 0,  0, 42}, { 0, 42,  0}, { 0, 42, 42},
+    {42,  0,  0}, {42,  0, 42}, {42, 21,  0}, {42, 42, 42},
+    {21, 21, 21}, {21, 21, 63}, {21, 63, 21}, {21, 63, 63},
+    {63, 21, 21}, {63, 21, 63}, {63, 63, 21}, {63, 63, 63},
+};
+
+/* NEBULA colors at COLOR_NEBULA_DARK_BLUE (6-bit DAC values) */
+static const uint8_t nebula_colors[8][3] = {
+    { 4,  6, 20},                         /* Dark blue */
+    {30, 12, 44},                         /* Purple */
+    {12, 24, 56},                         /* Blue */
+    {32, 44, 63},                         /* Light blue */
+    {40, 48, 60},                         /* Glass tint */
+    {56, 24, 48},                         /* Pink */
+    { 8, 40, 44},                         /* Teal */
+    { 2,  2,  8},                         /* Deep space */
+};
+
+/* Current palette (6-bit DAC values) */
+static uint8_t palette[NUM_COLORS][3];
+
+/* Fill in the palette table */
+static void palette_build(void) {
+    for (int i = 0; i < 16; i++) {
+        palette[i][0] = ega_colors[i][0];
+        palette[i][1] = ega_colors[i][1];
+        palette[i][2] = ega_colors[i][2];
+    }
+    for (int i = 0; i < 16; i++) {
+        uint8_t level = i * 63 / 15;      /* Black to white */
+        palette[COLOR_GREY_BASE + i][0] = level;
+        palette[COLOR_GREY_BASE + i][1] = level;
+        palette[COLOR_GREY_BASE + i][2] = level;
+    }
+    for (int i = 0; i < 8; i++) {
+        palette[COLOR_NEBULA_DARK_BLUE + i][0] = nebula_colors[i][0];
+        palette[COLOR_NEBULA_DARK_BLUE + i][1] = nebula_colors[i][1];
+        palette[COLOR_NEBULA_DARK_BLUE + i][2] = nebula_colors[i][2];
+    }
+    for (int r = 0; r < COLOR_CUBE_LEVELS; r++) {
+        for (int g = 0; g < COLOR_CUBE_LEVELS; g++) {
+            for (int b = 0; b < COLOR_CUBE_LEVELS; b++) {
+                uint8_t* entry = palette[COLOR_CUBE_BASE + 36 * r + 6 * g + b];
+                entry[0] = r * 63 / (COLOR_CUBE_LEVELS - 1);
+                entry[1] = g * 63 / (COLOR_CUBE_LEVELS - 1);
+                entry[2] = b * 63 / (COLOR_CUBE_LEVELS - 1);
+            }
+        }
+    }
+}
+
+/* Squared distance between an RGB value and a palette entry */
+static inline int32_t palette_distance(int32_t r, int32_t g, int32_t b, uint8_t index) {
+    int32_t dr = r - palette[index][0];
+    int32_t dg = g - palette[index][1];
+    int32_t db = b - palette[index][2];
+    return dr * dr + dg * dg + db * db;
+}
+
+/* Closest palette index to an RGB value - O(1) thanks to the cube and ramp */
+static uint8_t palette_nearest(int32_t r, int32_t g, int32_t b) {
+    uint8_t cube = COLOR_CUBE_BASE
+        + 36 * ((r * (COLOR_CUBE_LEVELS - 1) + 31) / 63)
+        + 6 * ((g * (COLOR_CUBE_LEVELS - 1) + 31) / 63)
+        + ((b * (COLOR_CUBE_LEVELS - 1) + 31) / 63);
+    uint8_t grey = COLOR_GREY_BASE + ((r + g + b) * 15 + 94) / 189;
+    return palette_distance(r, g, b, grey) < palette_distance(r, g, b, cube) ? grey : cube;
+}
+
+/* Build the blend tables from the palette */
+static void blend_tables_build(void) {
+    if (blend_tables == NULL) {
+        blend_tables = (uint8_t*) kmalloc((GRAPHICS_ALPHA_LEVELS - 1) * NUM_COLORS * NUM_COLORS);
+        if (blend_tables == NULL) {
+            return;                       /* No memory - panels stay opaque */
+        }
+    }
+    
+    uint8_t* entry = blend_tables;
+    for (int level = 1; level < GRAPHICS_ALPHA_LEVELS; level++) {
+        int32_t a = level;
+        int32_t inv = GRAPHICS_ALPHA_LEVELS - level;
+        for (int src = 0; src < NUM_COLORS; src++) {
+            for (int dst = 0; dst < NUM_COLORS; dst++) {
+                int32_t r = (palette[src][0] * a + palette[dst][0] * inv) / GRAPHICS_ALPHA_LEVELS;
+                int32_t g = (palette[src][1] * a + palette[dst][1] * inv) / GRAPHICS_ALPHA_LEVELS;
+                int32_t b = (palette[src][2] * a + palette[dst][2] * inv) / GRAPHICS_ALPHA_LEVELS;
+                *entry++ = palette_nearest(r, g, b);
+            }
+        }
+    }
+}
+
+/* Scale a 6-bit DAC value to a channel of the given width */
+static inline uint32_t channel_value(uint8_t level, uint8_t bits) {
+    uint32_t full = (level << 2) | (level >> 4);  /* 8 bits */
+    return full >> (8 - bits);
+}
+
 /* Setup custom color palette for NEBULA OS */
 void graphics_setup_palette(void) {
-    /* Set up VGA palette - we'll use standard colors plus some custom ones */
-    /* For simplicity, we'll map custom colors to available palette indices */
-    /* In a real implementation, you'd modify the DAC palette */
+    palette_build();
+    
+    /* Direct color - just translate every index to a pixel value */
+    if (gfx.bpp != 8) {
+        for (int i = 0; i < NUM_COLORS; i++) {
+            gfx.colors[i] = (channel_value(palette[i][0], gfx.red_bits) << gfx.red_shift)
+                          | (channel_value(palette[i][1], gfx.green_bits) << gfx.green_shift)
+                          | (channel_value(palette[i][2], gfx.blue_bits) << gfx.blue_shift);
+        }
+        return;
+    }
+    
+    /* Program all 256 DAC entries starting at index 0 */
+    outb(VGA_DAC_WRITE, 0);
+    for (int i = 0; i < NUM_COLORS; i++) {
+        outb(VGA_DAC_DATA, palette[i][0]);
+        outb(VGA_DAC_DATA, palette[i][1]);
+        outb(VGA_DAC_DATA, palette[i][2]);
+        gfx.colors[i] = i;
+    }
+    
+    blend_tables_build();
 }
 
 /* Set a pixel at (x, y) */
 void graphics_set_pixel(uint16_t x, uint16_t y, uint8_t color) {
-    if (x >= SCREEN_WIDTH || y >= SCREEN_HEIGHT) return;
-    gfx.framebuffer[y * SCREEN_WIDTH + x] = color;
+    int16_t sx = (int16_t)x;
+    int16_t sy = (int16_t)y;
+    if (sx < clip_x0 || sx > clip_x1 || sy < clip_y0 || sy > clip_y1) return;
+    raster->put(row_at(sy), sx, gfx.colors[color]);
+    dirty_span(sx, sx, sy);
 }
 
-/* Get pixel color at (x, y) */
+/* Get pixel color at (x, y) - direct-color pixels are looked up in the
+ * color table, so only colors drawn by index are found */
 uint8_t graphics_get_pixel(uint16_t x, uint16_t y) {
     if (x >= SCREEN_WIDTH || y >= SCREEN_HEIGHT) return 0;
-    return gfx.framebuffer[y * SCREEN_WIDTH + x];
+    uint32_t pixel = raster->get(row_at(y), x);
+    if (gfx.bpp == 8) {
+        return pixel;
+    }
+    for (int i = 0; i < NUM_COLORS; i++) {
+        if (gfx.colors[i] == pixel) {
+            return i;
+        }
+    }
+    return 0;
 }
 
 /* Clear screen */
 void graphics_clear(uint8_t color) {
-    for (uint32_t i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
-        gfx.framebuffer[i] = color;
+    /* Clipped clear only touches the clip rectangle */
+    if (clip_x0 != 0 || clip_y0 != 0 || clip_x1 != SCREEN_WIDTH - 1 || clip_y1 != SCREEN_HEIGHT - 1) {
+        graphics_fill_rect(clip_x0, clip_y0, clip_x1 - clip_x0 + 1, clip_y1 - clip_y0 + 1, color);
+        return;
+    }
+    for (int32_t row = 0; row < SCREEN_HEIGHT; row++) {
+        raster->fill(row_at(row), 0, SCREEN_WIDTH - 1, gfx.colors[color]);
+    }
+    graphics_mark_dirty(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+/* Restrict drawing to a rectangle */
+void graphics_set_clip(uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
+    int32_t x1 = (int32_t)x + w - 1;
+    int32_t y1 = (int32_t)y + h - 1;
+    clip_x0 = (x < SCREEN_WIDTH) ? x : SCREEN_WIDTH;
+    clip_y0 = (y < SCREEN_HEIGHT) ? y : SCREEN_HEIGHT;
+    clip_x1 = (x1 < SCREEN_WIDTH) ? x1 : SCREEN_WIDTH - 1;
+    clip_y1 = (y1 < SCREEN_HEIGHT) ? y1 : SCREEN_HEIGHT - 1;
+}
+
+/* Allow drawing anywhere on screen again */
+void graphics_reset_clip(void) {
+    clip_x0 = 0;
+    clip_y0 = 0;
+    clip_x1 = SCREEN_WIDTH - 1;
+    clip_y1 = SCREEN_HEIGHT - 1;
+}
+
+/* Mark a region of the back buffer as changed */
+void graphics_mark_dirty(uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
+    if (!track_dirty) return;             /* Layers are not on screen */
+    
+    /* Clip to screen */
+    if (x >= SCREEN_WIDTH || y >= SCREEN_HEIGHT || w == 0 || h == 0) return;
+    uint16_t x1 = (w > SCREEN_WIDTH - x) ? SCREEN_WIDTH - 1 : x + w - 1;
+    uint16_t y1 = (h > SCREEN_HEIGHT - y) ? SCREEN_HEIGHT - 1 : y + h - 1;
+    
+    for (uint16_t row = y; row <= y1; row++) {
+        if (x < dirty_x0[row]) dirty_x0[row] = x;
+        if ((int16_t)x1 > dirty_x1[row]) dirty_x1[row] = x1;
+    }
+    if ((int16_t)y < dirty_y0) dirty_y0 = y;
+    if ((int16_t)y1 > dirty_y1) dirty_y1 = y1;
+}
+
+/* Point the display at a hardware page (flip lock held) - only tear-free
+ * when called during the vertical retrace */
+static void page_show(uint8_t page) {
+    bga_write(BGA_REG_Y_OFFSET, page * gfx.height);
+    page_front = page;
+}
+
+/* Refresh - show the queued page (timer callback - runs in the timer
+ * interrupt). When the timer is locked to the retrace, the flip waits
+ * for the retrace bit, polling every VSYNC_RETRY_NS, and the grid is
+ * moved to where the retrace was seen so timer drift can't build up */
+static void vsync_flip(void* arg) {
+    (void)arg;
+    uint32_t flags = wait_queue_lock(&flip_waiters);
+    if (page_queued >= 0) {
+        uint8_t in_retrace = vsync_locked && (inb(VGA_STATUS) & VGA_STATUS_RETRACE);
+        if (vsync_locked && !in_retrace && vsync_retries < VSYNC_MAX_RETRIES &&
+            timer_start(&vsync_timer, VSYNC_RETRY_NS, 0, vsync_flip, NULL)) {
+            vsync_retries++;
+            wait_queue_unlock(&flip_waiters, flags);
+            return;                       /* Not in the retrace yet */
+        }
+        if (in_retrace) {
+            vsync_base = now_ns();        /* Follow the adapter's refresh */
+        }
+        page_show(page_queued);
+        page_queued = -1;
+        vsync_retries = 0;
     }
+    wait_queue_unlock(&flip_waiters, flags);
+    thread_wake_all(&flip_waiters);
+}
+
+/* Write the frame to a hidden page and queue it for the next refresh */
+static void present_flip(void) {
+    /* Pick a page that is neither shown nor queued - with only two pages,
+     * wait for the queued one to reach the screen first */
+    uint32_t flags = wait_queue_lock(&flip_waiters);
+    while (gfx.pages == 2 && page_queued >= 0) {
+        thread_wait(&flip_waiters);
+    }
+    uint8_t target = 0;
+    while (target == page_front || target == page_queued) {
+        target++;
+    }
+    wait_queue_unlock(&flip_waiters, flags);
+    
+    /* Every page is now missing this frame's changes */
+    for (int16_t row = dirty_y0; row <= dirty_y1; row++) {
+        if (dirty_x0[row] > dirty_x1[row]) {
+            continue;                     /* Row unchanged */
+        }
+        for (uint8_t page = 0; page < gfx.pages; page++) {
+            if (dirty_x0[row] < page_x0[page][row]) page_x0[page][row] = dirty_x0[row];
+            if (dirty_x1[row] > page_x1[page][row]) page_x1[page][row] = dirty_x1[row];
+        }
+        dirty_x0[row] = SCREEN_WIDTH;     /* Row is clean again */
+        dirty_x1[row] = -1;
+    }
+    for (uint8_t page = 0; page < gfx.pages; page++) {
+        if (dirty_y0 < page_y0[page]) page_y0[page] = dirty_y0;
+        if (dirty_y1 > page_y1[page]) page_y1[page] = dirty_y1;
+    }
+    dirty_y0 = SCREEN_HEIGHT;
+    dirty_y1 = -1;
+    
+    /* Bring the hidden page up to date - nobody else touches it */
+    uint8_t* base = page_at(target);
+    uint32_t bytes = pixel_bytes();
+    for (int16_t row = page_y0[target]; row <= page_y1[target]; row++) {
+        int16_t x0 = page_x0[target][row];
+        int16_t x1 = page_x1[target][row];
+        if (x0 > x1) {
+            continue;                     /* Row already current */
+        }
+        blit_stream(base + row * gfx.vram_pitch + x0 * bytes, gfx.framebuffer + row * gfx.pitch + x0 * bytes,
+                    (x1 - x0 + 1) * bytes);
+        page_x0[target][row] = SCREEN_WIDTH;
+        page_x1[target][row] = -1;
+    }
+    page_y0[target] = SCREEN_HEIGHT;
+    page_y1[target] = -1;
+    paging_flush_writes();                /* The whole page must be in vram before it is shown */
+    
+    /* Show it at the next refresh - a newer frame replaces one still queued */
+    flags = wait_queue_lock(&flip_waiters);
+    if (vsync_period == 0) {
+        page_show(target);                /* Not paced yet */
+    } else if (page_queued >= 0) {
+        page_queued = target;             /* Timer already armed */
+    } else {
+        uint32_t phase;
+        udiv64(now_ns() - vsync_base, vsync_period, &phase);
+        if (timer_start(&vsync_timer, vsync_period - phase, 0, vsync_flip, NULL)) {
+            page_queued = target;
+        } else {
+            page_show(target);            /* No timer - flip now rather than never */
+        }
+    }
+    wait_queue_unlock(&flip_waiters, flags);
+}
+
+/* Put a changed frame on the screen */
+static void present_frame(void) {
+    /* Hardware pages - no writes to the visible one */
+    if (gfx.pages > 1) {
+        present_flip();
+        return;
+    }
+    
+    /* Drawing straight to VGA memory - nothing to copy */
+    if (gfx.framebuffer == gfx.vram) {
+        paging_flush_writes();
+        dirty_reset();
+        return;
+    }
+    
+    /* Upload during vertical retrace so the frame doesn't tear - the
+     * retrace bit is only reliable in the VGA mode */
+    if (!gfx.linear) {
+        vga_wait();
+    }
+    uint32_t bytes = pixel_bytes();
+    for (int16_t row = dirty_y0; row <= dirty_y1; row++) {
+        if (dirty_x0[row] > dirty_x1[row]) {
+            continue;                     /* Row unchanged */
+        }
+        uint32_t x = dirty_x0[row] * bytes;
+        blit_stream(gfx.vram + row * gfx.vram_pitch + x, gfx.framebuffer + row * gfx.pitch + x,
+                    (dirty_x1[row] - dirty_x0[row] + 1) * bytes);
+        dirty_x0[row] = SCREEN_WIDTH;     /* Row is clean again */
+        dirty_x1[row] = -1;
+    }
+    paging_flush_writes();                /* Don't leave the frame in WC buffers */
+    dirty_y0 = SCREEN_HEIGHT;
+    dirty_y1 = -1;
+}
+
+/* Copy changed parts of the back buffer to the screen */
+void graphics_present(void) {
+    if (dirty_y0 > dirty_y1) {
+        return;                           /* Nothing changed */
+    }
+    TRACE_BEGIN(TRACE_PRESENT);
+    present_frame();
+    TRACE_END(TRACE_PRESENT);
+}
+
+/* Time the start of the next vertical retrace - 0 if none is seen
+ * within timeout_ns */
+static uint64_t retrace_start(uint64_t timeout_ns) {
+    uint64_t deadline = now_ns() + timeout_ns;
+    while (inb(VGA_STATUS) & VGA_STATUS_RETRACE) {
+        if (now_ns() > deadline) return 0;
+    }
+    while (!(inb(VGA_STATUS) & VGA_STATUS_RETRACE)) {
+        if (now_ns() > deadline) return 0;
+    }
+    return now_ns();
+}
+
+/* Pace page flips to the display refresh - locked to the retrace when the
+ * adapter reports one at a plausible rate (QEMU's default VGA toggles the
+ * bit on every read), free running at GRAPHICS_REFRESH_HZ otherwise */
+void graphics_start_vsync(void) {
+    if (gfx.pages < 2) {
+        return;                           /* Nothing to flip */
+    }
+    uint64_t first = retrace_start(2 * VSYNC_MAX_PERIOD_NS);
+    uint64_t second = first != 0 ? retrace_start(2 * VSYNC_MAX_PERIOD_NS) : 0;
+    uint64_t period = second - first;
+    
+    uint32_t flags = wait_queue_lock(&flip_waiters);
+    if (second != 0 && period >= VSYNC_MIN_PERIOD_NS && period <= VSYNC_MAX_PERIOD_NS) {
+        vsync_base = second;
+        vsync_period = (uint32_t) period;
+        vsync_locked = 1;
+    } else {
+        vsync_base = now_ns();
+        vsync_period = NS_PER_SEC / GRAPHICS_REFRESH_HZ;
+        vsync_locked = 0;
+    }
+    wait_queue_unlock(&flip_waiters, flags);
+}
+
+/* Allocate a screen-sized off-screen layer */
+GraphicsLayer* graphics_layer_create(void) {
+    GraphicsLayer* layer = (GraphicsLayer*) kmalloc(sizeof(GraphicsLayer));
+    if (layer == NULL) {
+        return NULL;                      /* Out of memory */
+    }
+    layer->pitch = SCREEN_WIDTH * pixel_bytes();
+    layer->pixels = screen_buffer_alloc();
+    if (layer->pixels == NULL) {
+        kfree(layer);
+        return NULL;                      /* Out of memory */
+    }
+    return layer;
+}
+
+/* Redirect all drawing into a layer */
+void graphics_begin_layer(GraphicsLayer* layer) {
+    if (screen_buffer == NULL) {
+        screen_buffer = gfx.framebuffer;  /* Remember the real target */
+    }
+    gfx.framebuffer = layer->pixels;
+    track_dirty = 0;
+}
+
+/* Draw to the back buffer again */
+void graphics_end_layer(void) {
+    if (screen_buffer != NULL) {
+        gfx.framebuffer = screen_buffer;
+        screen_buffer = NULL;
+    }
+    track_dirty = 1;
+}
+
+/* Copy a rectangle of a layer to the same place on screen */
+void graphics_blit_layer(const GraphicsLayer* layer, uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
+    /* Clip once */
+    int32_t x0 = x;
+    int32_t y0 = y;
+    int32_t x1 = x0 + w - 1;
+    int32_t y1 = y0 + h - 1;
+    if (x0 < clip_x0) x0 = clip_x0;
+    if (y0 < clip_y0) y0 = clip_y0;
+    if (x1 > clip_x1) x1 = clip_x1;
+    if (y1 > clip_y1) y1 = clip_y1;
+    if (x0 > x1 || y0 > y1) return;
+    
+    /* One row copy per scanline */
+    for (int32_t row = y0; row <= y1; row++) {
+        blit_copy(row_at(row) + x0 * pixel_bytes(), layer->pixels + row * layer->pitch + x0 * pixel_bytes(),
+                  (x1 - x0 + 1) * pixel_bytes());
+    }
+    graphics_mark_dirty(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+}
+
+/* Copy a rectangle of a layer to the same place on screen, skipping
+ * pixels of the key color */
+void graphics_blit_layer_keyed(const GraphicsLayer* layer, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t key) {
+    /* Clip once */
+    int32_t x0 = x;
+    int32_t y0 = y;
+    int32_t x1 = x0 + w - 1;
+    int32_t y1 = y0 + h - 1;
+    if (x0 < clip_x0) x0 = clip_x0;
+    if (y0 < clip_y0) y0 = clip_y0;
+    if (x1 > clip_x1) x1 = clip_x1;
+    if (y1 > clip_y1) y1 = clip_y1;
+    if (x0 > x1 || y0 > y1) return;
+    
+    /* One keyed row copy per scanline */
+    uint32_t pixel = gfx.colors[key];
+    for (int32_t row = y0; row <= y1; row++) {
+        raster->key(row_at(row) + x0 * pixel_bytes(), layer->pixels + row * layer->pitch + x0 * pixel_bytes(),
+                    x1 - x0 + 1, pixel);
+    }
+    graphics_mark_dirty(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
 }
 
 /* Draw filled rectangle */
 void graphics_fill_rect(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t color) {
-    for (uint16_t py = y; py < y + h && py < SCREEN_HEIGHT; py++) {
-        for (uint16_t px = x; px < x + w && px < SCREEN_WIDTH; px++) {
-            graphics_set_pixel(px, py, color);
-        }
+    /* Clip once */
+    int32_t x0 = (int16_t)x;
+    int32_t y0 = (int16_t)y;
+    int32_t x1 = x0 + w - 1;
+    int32_t y1 = y0 + h - 1;
+    if (x0 < clip_x0) x0 = clip_x0;
+    if (y0 < clip_y0) y0 = clip_y0;
+    if (x1 > clip_x1) x1 = clip_x1;
+    if (y1 > clip_y1) y1 = clip_y1;
+    if (x0 > x1 || y0 > y1) return;
+    
+    /* One span per row */
+    for (int32_t py = y0; py <= y1; py++) {
+        span_fill_unclipped(x0, x1, py, color);
     }
 }
 
@@ -170,11 +961,25 @@ void graphics_draw_rect(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t
 
 /* Draw filled circle */
 void graphics_fill_circle(uint16_t x, uint16_t y, uint16_t radius, uint8_t color) {
-    for (int16_t dy = -radius; dy <= radius; dy++) {
-        for (int16_t dx = -radius; dx <= radius; dx++) {
-            if (dx * dx + dy * dy <= radius * radius) {
-                graphics_set_pixel(x + dx, y + dy, color);
-            }
+    int32_t cx = (int16_t)x;
+    int32_t cy = (int16_t)y;
+    int32_t r = radius;
+    
+    /* Skip circles entirely outside the clip rectangle */
+    if (cx + r < clip_x0 || cx - r > clip_x1 || cy + r < clip_y0 || cy - r > clip_y1) return;
+    
+    /* Walk dy outwards, shrinking the half-width so that
+     * half_width^2 + dy^2 <= r^2 stays true (same pixels as the
+     * per-pixel distance test, without testing every pixel) */
+    int32_t r2 = r * r;
+    int32_t half_width = r;
+    for (int32_t dy = 0; dy <= r; dy++) {
+        while (half_width * half_width + dy * dy > r2) {
+            half_width--;
+        }
+        span_fill(cx - half_width, cx + half_width, cy + dy, color);
+        if (dy != 0) {
+            span_fill(cx - half_width, cx + half_width, cy - dy, color);
         }
     }
 }
@@ -207,192 +1012,221 @@ void graphics_draw_circle(uint16_t x, uint16_t y, uint16_t radius, uint8_t color
 
 /* Draw horizontal line */
 void graphics_draw_line_h(uint16_t x, uint16_t y, uint16_t length, uint8_t color) {
-    for (uint16_t i = 0; i < length; i++) {
-        graphics_set_pixel(x + i, y, color);
-    }
+    if (length == 0) return;
+    int32_t x0 = (int16_t)x;
+    span_fill(x0, x0 + length - 1, (int16_t)y, color);
 }
 
 /* Draw vertical line */
 void graphics_draw_line_v(uint16_t x, uint16_t y, uint16_t length, uint8_t color) {
-    for (uint16_t i = 0; i < length; i++) {
-        graphics_set_pixel(x, y + i, color);
-    }
-}
-
-/* Simple 8x8 font data for ASCII characters */
-static const uint8_t font_8x8[][8] = {
-    /* Space (0x20) */
-    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-    /* '!' */
-    {0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00},
-    /* '"' */
-    {0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
-    /* '#' */
-    {0x36, 0x7F, 0x36, 0x36, 0x7F, 0x36, 0x36, 0x00},
-    /* '$' */
-    {0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00},
-    /* '%' */
-    {0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00},
-    /* '&' */
-    {0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00},
-    /* ''' */
-    {0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00},
-    /* '(' */
-    {0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00},
-    /* ')' */
-    {0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00},
-    /* '*' */
-    {0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00},
-    /* '+' */
-    {0x00, 0x0C, 0x0C, 0x7F, 0x0C, 0x0C, 0x00, 0x00},
-    /* ',' */
-    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x06, 0x00},
-    /* '-' */
-    {0x00, 0x00, 0x00, 0x7F, 0x00, 0x00, 0x00, 0x00},
-    /* '.' */
-    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00},
-    /* '/' */
-    {0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00},
-    /* '0' */
-    {0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00},
-    /* '1' */
-    {0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00},
-    /* '2' */
-    {0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00},
-    /* '3' */
-    {0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00},
-    /* '4' */
-    {0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00},
-    /* '5' */
-    {0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00},
-    /* '6' */
-    {0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00},
-    /* '7' */
-    {0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00},
-    /* '8' */
-    {0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00},
-    /* '9' */
-    {0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00},
-    /* ':' */
-    {0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00},
-    /* ';' */
-    {0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x06, 0x00},
-    /* '<' */
-    {0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00},
-    /* '=' */
-    {0x00, 0x00, 0x7F, 0x00, 0x00, 0x7F, 0x00, 0x00},
-    /* '>' */
-    {0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00},
-    /* '?' */
-    {0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00},
-    /* '@' */
-    {0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00},
-    /* 'A' */
-    {0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00},
-    /* 'B' */
-    {0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00},
-    /* 'C' */
-    {0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00},
-    /* 'D' */
-    {0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00},
-    /* 'E' */
-    {0x7F, 0x06, 0x06, 0x3E, 0x06, 0x06, 0x7F, 0x00},
-    /* 'F' */
-    {0x7F, 0x06, 0x06, 0x3E, 0x06, 0x06, 0x06, 0x00},
-    /* 'G' */
-    {0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00},
-    /* 'H' */
-    {0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00},
-    /* 'I' */
-    {0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00},
-    /* 'J' */
-    {0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00},
-    /* 'K' */
-    {0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00},
-    /* 'L' */
-    {0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x7F, 0x00},
-    /* 'M' */
-    {0x63, 0x77, 0x7F, 0x6B, 0x63, 0x63, 0x63, 0x00},
-    /* 'N' */
-    {0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00},
-    /* 'O' */
-    {0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00},
-    /* 'P' */
-    {0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x06, 0x00},
-    /* 'Q' */
-    {0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00},
-    /* 'R' */
-    {0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00},
-    /* 'S' */
-    {0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00},
-    /* 'T' */
-    {0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00},
-    /* 'U' */
-    {0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x00},
-    /* 'V' */
-    {0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00},
-    /* 'W' */
-    {0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00},
-    /* 'X' */
-    {0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00},
-    /* 'Y' */
-    {0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00},
-    /* 'Z' */
-    {0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00},
-};
+    /* Clip once */
+    int32_t px = (int16_t)x;
+    int32_t y0 = (int16_t)y;
+    int32_t y1 = y0 + length - 1;
+    if (px < clip_x0 || px > clip_x1) return;
+    if (y0 < clip_y0) y0 = clip_y0;
+    if (y1 > clip_y1) y1 = clip_y1;
+    if (y0 > y1) return;
+    
+    /* Step down one row at a time */
+    raster->column(row_at(y0) + px * pixel_bytes(), gfx.pitch, y1 - y0 + 1, gfx.colors[color]);
+    for (int32_t py = y0; py <= y1; py++) {
+        dirty_span(px, px, py);
+    }
+}
 
-/* Draw text using simple 8x8 font */
-void graphics_draw_text(uint16_t x, uint16_t y, const char* text, uint8_t color) {
-    uint16_t cx = x;
-    uint16_t cy = y;
+static Glyph glyph_cache[256];
+static uint8_t glyph_cache_ready = 0;
+
+/* Text layout cursor */
+typedef struct {
+    uint16_t x;                           /* Left margin */
+    uint16_t cx;                          /* Current column */
+    uint16_t cy;                          /* Current line */
+} TextCursor;
+
+/* Build the glyph cache for every byte value - from the asset bundle's
+ * font if it has a usable one, otherwise from the built-in font */
+static void glyph_cache_init(void) {
+    const uint8_t* rows = &font_8x8[0][0];
+    int first = FONT_8X8_FIRST;
+    int last = FONT_8X8_FIRST + (int)(sizeof(font_8x8) / sizeof(font_8x8[0])) - 1;
     
-    for (size_t i = 0; text[i] != '\0'; i++) {
-        char c = text[i];
-        
-        if (c == '\n') {
-            cx = x;
-            cy += 10;  /* Line height */
-            continue;
-        }
-        
-        /* Convert lowercase to uppercase */
-        if (c >= 'a' && c <= 'z') {
-            c = c - 'a' + 'A';
-        }
+    uint32_t size;
+    const AssetFont* font = (const AssetFont*) asset_get(ASSET_FONT_8X8, &size);
+    if (font != NULL && size >= sizeof(AssetFont) && font->count > 0 &&
+        font->width <= GLYPH_SIZE && font->height == GLYPH_SIZE &&
+        font->count * GLYPH_SIZE <= size - sizeof(AssetFont)) {
+        rows = (const uint8_t*)(font + 1);
+        first = font->first;
+        last = font->first + font->count - 1;
+    }
+    
+    for (int c = 0; c < 256; c++) {
+        Glyph* glyph = &glyph_cache[c];
+        int ch = c;
         
-        if (c < 0x20 || c > 0x5A) {
-            cx += 8;  /* Space for unknown characters */
-            continue;
+        /* Lowercase falls back to uppercase until the font has its own */
+        if (ch >= 'a' && ch <= 'z' && ch > last) {
+            ch = ch - 'a' + 'A';
         }
         
-        /* Get font data for character */
-        const uint8_t* font_data = font_8x8[c - 0x20];
-        
-        /* Draw character */
-        for (uint8_t row = 0; row < 8; row++) {
-            for (uint8_t col = 0; col < 8; col++) {
-                if (font_data[row] & (1 << (7 - col))) {
-                    graphics_set_pixel(cx + col, cy + row, color);
+        glyph->known = (ch >= first && ch <= last);
+        glyph->ink = 0;
+        for (int row = 0; row < GLYPH_SIZE; row++) {
+            uint8_t bits = glyph->known ? rows[(ch - first) * GLYPH_SIZE + row] : 0;
+            uint32_t m0 = 0, m1 = 0;
+            for (int col = 0; col < GLYPH_SIZE; col++) {
+                if (bits & (0x80 >> col)) {
+                    if (col < 4) {
+                        m0 |= 0xFFu << (8 * col);
+                    } else {
+                        m1 |= 0xFFu << (8 * (col - 4));
+                    }
                 }
             }
+            glyph->mask[row][0] = m0;
+            glyph->mask[row][1] = m1;
+            if (bits) glyph->ink = 1;
         }
-        
-        cx += 8;  /* Move to next character */
-        
-        if (cx >= SCREEN_WIDTH - 8) {
-            cx = x;
-            cy += 10;
+    }
+    glyph_cache_ready = 1;
+}
+
+/* Advance the cursor over one character - returns the glyph to draw at
+ * (*gx, *gy) or NULL if nothing is drawn */
+static inline const Glyph* text_step(TextCursor* t, uint8_t c, int32_t* gx, int32_t* gy) {
+    if (c == '\n') {
+        t->cx = t->x;
+        t->cy += LINE_HEIGHT;
+        return NULL;
+    }
+    
+    const Glyph* glyph = &glyph_cache[c];
+    if (!glyph->known) {
+        t->cx += GLYPH_SIZE;              /* Space for unknown characters */
+        return NULL;
+    }
+    
+    *gx = (int16_t)t->cx;
+    *gy = (int16_t)t->cy;
+    t->cx += GLYPH_SIZE;                  /* Move to next character */
+    if (t->cx >= SCREEN_WIDTH - GLYPH_SIZE) {
+        t->cx = t->x;
+        t->cy += LINE_HEIGHT;
+    }
+    return glyph->ink ? glyph : NULL;
+}
+
+/* Draw a glyph that lies fully inside the clip rectangle */
+static inline void glyph_draw_fast(const Glyph* glyph, int32_t gx, int32_t gy, uint32_t pixel) {
+    raster->glyph(row_at(gy) + gx * pixel_bytes(), gfx.pitch, glyph, pixel);
+}
+
+/* Draw a glyph pixel by pixel against the clip rectangle */
+static void glyph_draw_clipped(const Glyph* glyph, int32_t gx, int32_t gy, uint8_t color) {
+    for (int row = 0; row < GLYPH_SIZE; row++) {
+        for (int col = 0; col < GLYPH_SIZE; col++) {
+            uint32_t mask = glyph->mask[row][col >> 2] >> (8 * (col & 3));
+            if (mask & 0xFF) {
+                graphics_set_pixel(gx + col, gy + row, color);
+            }
+        }
+    }
+}
+
+/* Draw text using the 8x8 font */
+void graphics_draw_text(uint16_t x, uint16_t y, const char* text, uint8_t color) {
+    if (!glyph_cache_ready) {
+        glyph_cache_init();
+    }
+    
+    /* Pass 1: lay the string out to find the box its ink covers */
+    TextCursor t = { x, x, y };
+    int32_t gx, gy;
+    int32_t bx0 = 0x7FFF, by0 = 0x7FFF, bx1 = -0x8000, by1 = -0x8000;
+    for (size_t i = 0; text[i] != '\0'; i++) {
+        if (text_step(&t, (uint8_t)text[i], &gx, &gy) != NULL) {
+            if (gx < bx0) bx0 = gx;
+            if (gy < by0) by0 = gy;
+            if (gx + GLYPH_SIZE - 1 > bx1) bx1 = gx + GLYPH_SIZE - 1;
+            if (gy + GLYPH_SIZE - 1 > by1) by1 = gy + GLYPH_SIZE - 1;
+        }
+    }
+    
+    /* Clip once for the whole string */
+    if (bx0 > bx1 || bx1 < clip_x0 || bx0 > clip_x1 || by1 < clip_y0 || by0 > clip_y1) {
+        return;                           /* No visible ink */
+    }
+    uint8_t inside = (bx0 >= clip_x0 && bx1 <= clip_x1 && by0 >= clip_y0 && by1 <= clip_y1);
+    
+    /* Pass 2: draw whole glyph rows */
+    uint32_t pixel = gfx.colors[color];
+    t.cx = x;
+    t.cy = y;
+    for (size_t i = 0; text[i] != '\0'; i++) {
+        const Glyph* glyph = text_step(&t, (uint8_t)text[i], &gx, &gy);
+        if (glyph == NULL) {
+            continue;
+        }
+        if (inside) {
+            glyph_draw_fast(glyph, gx, gy, pixel);
+        } else {
+            glyph_draw_clipped(glyph, gx, gy, color);
         }
     }
+    
+    /* Fast path doesn't track dirty pixels - mark the string's box */
+    if (inside) {
+        graphics_mark_dirty(bx0, by0, bx1 - bx0 + 1, by1 - by0 + 1);
+    }
+}
+
+/* Check if translucent drawing is possible (8 bpp needs the blend tables) */
+uint8_t graphics_can_blend(void) {
+    return gfx.bpp != 8 || blend_tables != NULL;
+}
+
+/* Draw a filled rectangle blended over what is already there */
+void graphics_blend_rect(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t color, uint8_t alpha) {
+    /* The palette blends in GRAPHICS_ALPHA_LEVELS steps, direct color exactly */
+    uint32_t level = gfx.bpp == 8 ? (alpha * GRAPHICS_ALPHA_LEVELS + 128) >> 8 : alpha;
+    uint32_t opaque = gfx.bpp == 8 ? GRAPHICS_ALPHA_LEVELS : 255;
+    if (level == 0) {
+        return;                           /* Fully transparent */
+    }
+    if (level >= opaque || !graphics_can_blend()) {
+        graphics_fill_rect(x, y, w, h, color); /* Opaque */
+        return;
+    }
+    
+    /* Clip once */
+    int32_t x0 = (int16_t)x;
+    int32_t y0 = (int16_t)y;
+    int32_t x1 = x0 + w - 1;
+    int32_t y1 = y0 + h - 1;
+    if (x0 < clip_x0) x0 = clip_x0;
+    if (y0 < clip_y0) y0 = clip_y0;
+    if (x1 > clip_x1) x1 = clip_x1;
+    if (y1 > clip_y1) y1 = clip_y1;
+    if (x0 > x1 || y0 > y1) return;
+    
+    /* One blended span per row */
+    uint32_t pixel = gfx.colors[color];
+    for (int32_t py = y0; py <= y1; py++) {
+        raster->blend(row_at(py), x0, x1, pixel, alpha);
+        dirty_span(x0, x1, py);
+    }
 }
 
 /* Draw glassmorphism panel (translucent with border) */
 void graphics_draw_glass_panel(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t alpha) {
-    /* Draw semi-transparent background (simulated by using a lighter color) */
-    /* Note: alpha parameter is for future use - real transparency would require blending */
-    (void)alpha;  /* Suppress unused parameter warning */
-    uint8_t glass_color = COLOR_DARK_GREY;
-    graphics_fill_rect(x, y, w, h, glass_color);
+    /* Tint whatever is behind the panel */
+    if (graphics_can_blend()) {
+        graphics_blend_rect(x, y, w, h, COLOR_GLASS_TRANSPARENT, alpha);
+    } else {
+        graphics_fill_rect(x, y, w, h, COLOR_DARK_GREY); /* No blend tables */
+    }
     
     /* Draw white border */
     graphics_draw_rect(x, y, w, h, COLOR_WHITE);
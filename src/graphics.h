@@ -1,7 +1,10 @@
 /* graphics.h - Graphics subsystem for NEBULA OS
  * 
- * Provides VGA graphics mode (Mode 13h - 320x200, 256 colors) support
- * and drawing functions for the NEBULA OS interface.
+ * Provides drawing functions for the NEBULA OS interface on either a
+ * linear framebuffer set up by the bootloader (any size, 8/16/32 bpp) or,
+ * failing that, VGA Mode 13h (320x200, 256 colors). Colors are always
+ * given as palette indices; in direct-color modes they are translated to
+ * pixel values through the descriptor's color table.
  */
 
 #ifndef GRAPHICS_H
@@ -15,12 +18,33 @@ typedef signed short       int16_t;
 typedef signed int         int32_t;
 typedef uint32_t           size_t;
 
+#include "multiboot.h"
+
+/* NULL pointer definition */
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
 /* VGA Mode 13h constants */
-#define SCREEN_WIDTH  320
-#define SCREEN_HEIGHT 200
+#define VGA_WIDTH     320
+#define VGA_HEIGHT    200
 #define VGA_MEMORY    0xA0000     /* VGA graphics memory address */
 #define NUM_COLORS    256
 
+/* Largest linear framebuffer mode used - bigger ones fall back to VGA */
+#define GRAPHICS_MAX_WIDTH  2048
+#define GRAPHICS_MAX_HEIGHT 1536
+
+/* Hardware pages used for page flipping, at most (3 = triple buffering) */
+#define GRAPHICS_MAX_PAGES  3
+
+/* Refresh rate page flips are paced to */
+#define GRAPHICS_REFRESH_HZ 60
+
+/* Current screen size (set by graphics_init) */
+#define SCREEN_WIDTH  ((int32_t) gfx.width)
+#define SCREEN_HEIGHT ((int32_t) gfx.height)
+
 /* Color definitions - VGA palette colors */
 #define COLOR_BLACK       0x00
 #define COLOR_BLUE        0x01
@@ -47,26 +71,65 @@ typedef uint32_t           size_t;
 #define COLOR_NEBULA_WHITE       0x0F
 #define COLOR_GLASS_TRANSPARENT  0x24
 #define COLOR_GLASS_BORDER       0x0F
+#define COLOR_NEBULA_PINK        0x25
+#define COLOR_NEBULA_TEAL        0x26
+#define COLOR_NEBULA_DEEP_SPACE  0x27
 
-/* Graphics context structure */
+/* Palette layout: 16 EGA colors, a 16-step grey ramp, 8 NEBULA colors
+ * at 0x20, then a 6x6x6 color cube (index = base + 36r + 6g + b) */
+#define COLOR_GREY_BASE          0x10
+#define COLOR_CUBE_BASE          0x28
+#define COLOR_CUBE_LEVELS        6
+
+/* Translucency is quantized to this many steps (1 = 25%, 2 = 50% ...) */
+#define GRAPHICS_ALPHA_LEVELS    4
+
+/* Graphics context - describes the screen the kernel draws on */
 typedef struct {
-    uint8_t* framebuffer;    /* Pointer to VGA framebuffer */
-    uint16_t width;           /* Screen width */
-    uint16_t height;          /* Screen height */
+    uint8_t* framebuffer;    /* Buffer primitives draw into (back buffer) */
+    uint8_t* vram;            /* Visible framebuffer (LFB or VGA window) */
+    uint16_t width;           /* Screen width in pixels */
+    uint16_t height;          /* Screen height in pixels */
+    uint32_t pitch;           /* Bytes per row of framebuffer */
+    uint32_t vram_pitch;      /* Bytes per row of vram */
+    uint8_t bpp;              /* Bits per pixel: 8, 16 or 32 */
+    uint8_t linear;           /* Bootloader-set linear framebuffer, not Mode 13h */
+    uint8_t pages;            /* Hardware pages in vram (1 = no page flipping) */
+    uint8_t red_shift, red_bits;     /* Direct-color channel layout */
+    uint8_t green_shift, green_bits;
+    uint8_t blue_shift, blue_bits;
+    uint32_t blend_mask;      /* 16 bpp: channels spread apart for blending */
+    uint32_t colors[NUM_COLORS];     /* Pixel value of each palette index */
 } Graphics;
 
-/* Initialize VGA Mode 13h (320x200, 256 colors) */
-void graphics_init(void);
+/* The screen */
+extern Graphics gfx;
+
+/* Off-screen layer - a screen-sized buffer primitives can draw into */
+typedef struct {
+    uint8_t* pixels;          /* Layer contents */
+    uint32_t pitch;           /* Bytes per row */
+} GraphicsLayer;
+
+/* Initialize graphics - the framebuffer GRUB set up if mbi describes a
+ * usable one, VGA Mode 13h otherwise (mbi may be NULL) */
+void graphics_init(const MultibootInfo* mbi);
 
 /* Set a pixel at (x, y) to color */
 void graphics_set_pixel(uint16_t x, uint16_t y, uint8_t color);
 
-/* Get pixel color at (x, y) */
+/* Get pixel color at (x, y) - the palette index drawn there */
 uint8_t graphics_get_pixel(uint16_t x, uint16_t y);
 
-/* Clear screen with color */
+/* Clear screen (or the clip rectangle, if one is set) with color */
 void graphics_clear(uint8_t color);
 
+/* Restrict all drawing to a rectangle */
+void graphics_set_clip(uint16_t x, uint16_t y, uint16_t w, uint16_t h);
+
+/* Allow drawing anywhere on screen again */
+void graphics_reset_clip(void);
+
 /* Draw a filled rectangle */
 void graphics_fill_rect(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t color);
 
@@ -88,11 +151,43 @@ void graphics_draw_line_v(uint16_t x, uint16_t y, uint16_t length, uint8_t color
 /* Draw text (simple 8x8 font) */
 void graphics_draw_text(uint16_t x, uint16_t y, const char* text, uint8_t color);
 
+/* Draw a filled rectangle blended over what is already there (alpha 0-255) */
+void graphics_blend_rect(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t color, uint8_t alpha);
+
+/* Check if translucent drawing is possible */
+uint8_t graphics_can_blend(void);
+
 /* Draw a translucent (glassmorphism) panel */
 void graphics_draw_glass_panel(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t alpha);
 
 /* Setup custom color palette */
 void graphics_setup_palette(void);
 
+/* Mark a region of the back buffer as changed */
+void graphics_mark_dirty(uint16_t x, uint16_t y, uint16_t w, uint16_t h);
+
+/* Copy changed parts of the back buffer to the screen - with page
+ * flipping, to a hidden page that is then shown at the next refresh */
+void graphics_present(void);
+
+/* Pace page flips to the display refresh (after timer_init and sched_init;
+ * until then flips take effect at once) */
+void graphics_start_vsync(void);
+
+/* Allocate a screen-sized off-screen layer (NULL if out of memory) */
+GraphicsLayer* graphics_layer_create(void);
+
+/* Redirect all drawing into a layer until graphics_end_layer */
+void graphics_begin_layer(GraphicsLayer* layer);
+
+/* Draw to the back buffer again */
+void graphics_end_layer(void);
+
+/* Copy a rectangle of a layer to the same place on screen */
+void graphics_blit_layer(const GraphicsLayer* layer, uint16_t x, uint16_t y, uint16_t w, uint16_t h);
+
+/* Same, but pixels of the key color in the layer are left out */
+void graphics_blit_layer_keyed(const GraphicsLayer* layer, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t key);
+
 #endif /* GRAPHICS_H */
 
@@ -0,0 +1,154 @@
+/* graphics_raster.h - Pixel-format specific raster core for NEBULA OS
+ *
+ * Included by graphics.c once per supported depth, with RASTER_BPP set to
+ * 8, 16 or 32. Each function gets the depth as a suffix (raster_fill_32)
+ * and is written for exactly one pixel size, so the inner loops carry no
+ * per-pixel format tests; graphics.c picks one set at boot through a
+ * table of function pointers. There is deliberately no include guard.
+ *
+ * Pixels are native framebuffer values (gfx.colors[index]). Blending in
+ * 16 bpp works on whole packed pixels: the channels are spread apart by a
+ * mask so one multiply blends all of them at once. The 32 bpp variants
+ * hand whole rows to the vector kernels in blit.c.
+ */
+
+#if RASTER_BPP == 8
+#define RASTER_PIXEL uint8_t
+#elif RASTER_BPP == 16
+#define RASTER_PIXEL uint16_t
+#elif RASTER_BPP == 32
+#define RASTER_PIXEL uint32_t
+#else
+#error "RASTER_BPP must be 8, 16 or 32"
+#endif
+
+#define RASTER_JOIN2(name, bpp) name##_##bpp
+#define RASTER_JOIN(name, bpp)  RASTER_JOIN2(name, bpp)
+#define RASTER_FN(name)         RASTER_JOIN(name, RASTER_BPP)
+
+/* Pixel access that may alias byte access */
+typedef RASTER_PIXEL __attribute__((may_alias)) RASTER_FN(raster_pixel_t);
+#define RASTER_AT(row, x) ((RASTER_FN(raster_pixel_t)*)(row) + (x))
+
+/* Store one pixel */
+static void RASTER_FN(raster_put)(uint8_t* row, int32_t x, uint32_t pixel) {
+    *RASTER_AT(row, x) = (RASTER_PIXEL) pixel;
+}
+
+/* Load one pixel */
+static uint32_t RASTER_FN(raster_get)(const uint8_t* row, int32_t x) {
+    return *RASTER_AT(row, x);
+}
+
+/* Fill pixels [x0, x1] of a row */
+static void RASTER_FN(raster_fill)(uint8_t* row, int32_t x0, int32_t x1, uint32_t pixel) {
+#if RASTER_BPP == 8
+    kmemset(row + x0, (uint8_t) pixel, x1 - x0 + 1);
+#elif RASTER_BPP == 16
+    /* Pairs of pixels as words - one pixel on each side to align */
+    RASTER_FN(raster_pixel_t)* p = RASTER_AT(row, x0);
+    uint32_t count = x1 - x0 + 1;
+    if (((uint32_t) p & 2) != 0) {
+        *p++ = (uint16_t) pixel;
+        count--;
+    }
+    kmemset32(p, pixel * 0x00010001u, count >> 1);
+    if (count & 1) {
+        p[count - 1] = (uint16_t) pixel;
+    }
+#else
+    kmemset32(RASTER_AT(row, x0), pixel, x1 - x0 + 1);
+#endif
+}
+
+/* Copy count pixels except those equal to key */
+static void RASTER_FN(raster_key)(uint8_t* dst, const uint8_t* src, int32_t count, uint32_t key) {
+#if RASTER_BPP == 32
+    blit_key32((uint32_t*) dst, (const uint32_t*) src, count, key);
+#else
+    RASTER_FN(raster_pixel_t)* d = RASTER_AT(dst, 0);
+    const RASTER_FN(raster_pixel_t)* s = (const RASTER_FN(raster_pixel_t)*) src;
+    for (int32_t i = 0; i < count; i++) {
+        RASTER_PIXEL keep = (RASTER_PIXEL)(0u - (s[i] == (RASTER_PIXEL) key));
+        d[i] = (d[i] & keep) | (s[i] & (RASTER_PIXEL) ~keep);
+    }
+#endif
+}
+
+/* Fill count pixels down a column */
+static void RASTER_FN(raster_column)(uint8_t* dst, uint32_t pitch, int32_t count, uint32_t pixel) {
+    for (; count > 0; count--) {
+        *RASTER_AT(dst, 0) = (RASTER_PIXEL) pixel;
+        dst += pitch;
+    }
+}
+
+/* Blend pixel over [x0, x1] of a row at alpha (1-254) */
+static void RASTER_FN(raster_blend)(uint8_t* row, int32_t x0, int32_t x1, uint32_t pixel, uint32_t alpha) {
+    RASTER_FN(raster_pixel_t)* p = RASTER_AT(row, x0);
+    int32_t count = x1 - x0 + 1;
+#if RASTER_BPP == 8
+    /* Palette - one table lookup per pixel */
+    uint32_t level = (alpha * GRAPHICS_ALPHA_LEVELS + 128) >> 8;
+    const uint8_t* lut = blend_tables + ((level - 1) * NUM_COLORS + pixel) * NUM_COLORS;
+    for (int32_t i = 0; i < count; i++) {
+        p[i] = lut[p[i]];
+    }
+#elif RASTER_BPP == 16
+    /* Spread the pixel as ..gggggg.....rrrrr......bbbbb so that each
+     * channel has room for a 5-bit product */
+    uint32_t mask = gfx.blend_mask;
+    uint32_t a = alpha >> 3;              /* 0-31 */
+    uint32_t src = ((pixel | (pixel << 16)) & mask) * a;
+    for (int32_t i = 0; i < count; i++) {
+        uint32_t dst = (p[i] | ((uint32_t) p[i] << 16)) & mask;
+        uint32_t mixed = ((src + dst * (32 - a)) >> 5) & mask;
+        p[i] = (uint16_t)(mixed | (mixed >> 16));
+    }
+#else
+    blit_tint32((uint32_t*) p, count, pixel, alpha);
+#endif
+}
+
+/* Draw one glyph (fully inside the clip rectangle) */
+static void RASTER_FN(raster_glyph)(uint8_t* dst, uint32_t pitch, const Glyph* glyph, uint32_t pixel) {
+#if RASTER_BPP == 8
+    /* Four pixels per masked 32-bit store */
+    uint32_t pattern = pixel * 0x01010101u;
+    for (int row = 0; row < GLYPH_SIZE; row++) {
+        uint32_t m0 = glyph->mask[row][0];
+        uint32_t m1 = glyph->mask[row][1];
+        fb_word_t* d = (fb_word_t*) dst;
+        d[0] = (d[0] & ~m0) | (pattern & m0);
+        d[1] = (d[1] & ~m1) | (pattern & m1);
+        dst += pitch;
+    }
+#else
+    /* Each mask byte sign-extends to an all-ones or all-zeros pixel */
+    for (int row = 0; row < GLYPH_SIZE; row++) {
+        RASTER_FN(raster_pixel_t)* d = RASTER_AT(dst, 0);
+        for (int col = 0; col < GLYPH_SIZE; col++) {
+            RASTER_PIXEL m = (RASTER_PIXEL)(signed char)(glyph->mask[row][col >> 2] >> (8 * (col & 3)));
+            d[col] = (d[col] & ~m) | ((RASTER_PIXEL) pixel & m);
+        }
+        dst += pitch;
+    }
+#endif
+}
+
+/* Operations for this depth */
+static const Raster RASTER_FN(raster_ops) = {
+    RASTER_FN(raster_put),
+    RASTER_FN(raster_get),
+    RASTER_FN(raster_fill),
+    RASTER_FN(raster_key),
+    RASTER_FN(raster_column),
+    RASTER_FN(raster_blend),
+    RASTER_FN(raster_glyph),
+};
+
+#undef RASTER_AT
+#undef RASTER_FN
+#undef RASTER_JOIN
+#undef RASTER_JOIN2
+#undef RASTER_PIXEL
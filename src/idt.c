@@ -0,0 +1,115 @@
+/* idt.c - Interrupt descriptor table and dispatch for JoshOS
+ *
+ * All 256 vectors get an interrupt gate, so handlers always run with
+ * interrupts disabled. PIC IRQs are acknowledged before their handler
+ * runs so a handler that never returns to this frame (a context switch)
+ * does not leave the PIC blocked.
+ */
+
+#include "idt.h"
+#include "gdt.h"
+#include "pic.h"
+#include "sched.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/* Gate type: present, ring 0, 32-bit interrupt gate */
+#define IDT_INTERRUPT_GATE 0x8E
+
+/* Gate descriptor (hardware layout) */
+typedef struct {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t zero;
+    uint8_t type_attr;
+    uint16_t offset_high;
+} __attribute__((packed)) IdtEntry;
+
+/* Operand of lidt */
+typedef struct {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) IdtPointer;
+
+/* Entry stubs from interrupts.S */
+extern const uint32_t interrupt_stubs[IDT_ENTRIES];
+
+/* The table and the C handler for each vector */
+static IdtEntry idt[IDT_ENTRIES] __attribute__((aligned(8)));
+static interrupt_handler_t handlers[IDT_ENTRIES];
+
+/* Fill in one gate */
+static void idt_set_gate(uint32_t vector, uint32_t offset) {
+    idt[vector].offset_low = offset & 0xFFFF;
+    idt[vector].selector = GDT_KERNEL_CODE;
+    idt[vector].zero = 0;
+    idt[vector].type_attr = IDT_INTERRUPT_GATE;
+    idt[vector].offset_high = (offset >> 16) & 0xFFFF;
+}
+
+/* Install gates for all vectors and remap the PIC */
+void idt_init(void) {
+    for (uint32_t vector = 0; vector < IDT_ENTRIES; vector++) {
+        idt_set_gate(vector, interrupt_stubs[vector]);
+        handlers[vector] = NULL;
+    }
+    idt_load();
+
+    pic_init();
+}
+
+/* Load the shared table on the calling CPU */
+void idt_load(void) {
+    IdtPointer pointer;
+    pointer.limit = sizeof(idt) - 1;
+    pointer.base = (uint32_t) idt;
+    __asm__ volatile ("lidt %0" : : "m" (pointer));
+}
+
+/* Register a handler for any vector */
+void interrupt_install_handler(uint8_t vector, interrupt_handler_t handler) {
+    handlers[vector] = handler;
+}
+
+/* Register a handler for a PIC IRQ and unmask it */
+void irq_install_handler(uint8_t irq, interrupt_handler_t handler) {
+    if (irq >= PIC_IRQ_COUNT) {
+        return;
+    }
+    handlers[IRQ_VECTOR(irq)] = handler;
+    pic_unmask(irq);
+}
+
+/* Called from interrupt_common with the saved CPU state */
+void interrupt_dispatch(InterruptFrame* frame) {
+    uint32_t vector = frame->vector;
+
+    /* PIC IRQ - acknowledge first, drop spurious ones */
+    if (vector >= IRQ_VECTOR(0) && vector < IRQ_VECTOR(PIC_IRQ_COUNT)) {
+        if (!pic_acknowledge(vector - IRQ_VECTOR(0))) {
+            return;
+        }
+        if (handlers[vector] != NULL) {
+            handlers[vector](frame);
+        }
+        sched_irq_exit();                 /* The IRQ may have woken someone */
+        return;
+    }
+
+    if (handlers[vector] != NULL) {
+        handlers[vector](frame);
+        if (vector >= IDT_EXCEPTIONS) {
+            sched_irq_exit();             /* An IPI may have asked for a switch */
+        }
+        return;
+    }
+
+    /* An exception nobody handles cannot be resumed - stop here */
+    if (vector < IDT_EXCEPTIONS) {
+        while (1) {
+            __asm__ volatile ("cli; hlt");
+        }
+    }
+}
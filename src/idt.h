@@ -0,0 +1,71 @@
+/* idt.h - Interrupt descriptor table and dispatch for JoshOS
+ *
+ * Every vector has an assembly stub (interrupts.S) that saves the CPU
+ * state as an InterruptFrame and calls into C, which runs the handler
+ * registered for that vector.
+ */
+
+#ifndef IDT_H
+#define IDT_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned short     uint16_t;
+typedef unsigned int       uint32_t;
+
+/* Vector layout */
+#define IDT_ENTRIES        256
+#define IDT_EXCEPTIONS     32             /* Vectors 0-31 are CPU exceptions */
+#define IRQ_VECTOR(irq)    (0x20 + (irq)) /* PIC IRQs follow the exceptions */
+
+/* CPU state saved by the interrupt stubs (lowest address first) */
+typedef struct {
+    uint32_t gs, fs, es, ds;              /* Segment registers */
+    uint32_t edi, esi, ebp, esp_unused;   /* pusha */
+    uint32_t ebx, edx, ecx, eax;
+    uint32_t vector;                      /* Interrupt vector */
+    uint32_t error_code;                  /* CPU error code (or 0) */
+    uint32_t eip, cs, eflags;             /* Pushed by the CPU */
+} InterruptFrame;
+
+/* Interrupt handler */
+typedef void (*interrupt_handler_t)(InterruptFrame* frame);
+
+/* Install gates for all vectors and remap the PIC (interrupts stay off) */
+void idt_init(void);
+
+/* Load the same table on another CPU */
+void idt_load(void);
+
+/* Register a handler for any vector */
+void interrupt_install_handler(uint8_t vector, interrupt_handler_t handler);
+
+/* Register a handler for a PIC IRQ and unmask it */
+void irq_install_handler(uint8_t irq, interrupt_handler_t handler);
+
+/* Enable/disable maskable interrupts on this CPU */
+static inline void interrupts_enable(void) {
+    __asm__ volatile ("sti" : : : "memory");
+}
+
+static inline void interrupts_disable(void) {
+    __asm__ volatile ("cli" : : : "memory");
+}
+
+/* Disable interrupts, returning the previous state for interrupts_restore */
+static inline uint32_t interrupts_save(void) {
+    uint32_t flags;
+    __asm__ volatile ("pushf\n\tpop %0\n\tcli" : "=r" (flags) : : "memory");
+    return flags;
+}
+
+static inline void interrupts_restore(uint32_t flags) {
+    __asm__ volatile ("push %0\n\tpopf" : : "r" (flags) : "memory", "cc");
+}
+
+/* Sleep until the next interrupt - interrupts must already be enabled */
+static inline void cpu_idle(void) {
+    __asm__ volatile ("hlt" : : : "memory");
+}
+
+#endif /* IDT_H */
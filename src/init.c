@@ -0,0 +1,127 @@
+/* init.c - Boot sequencing and boot-time profile for JoshOS
+ *
+ * init_run makes passes over a table, running each step whose
+ * dependencies are done; a table listed in a valid order finishes in one
+ * pass. A pass that runs nothing means a step depends on itself, a cycle
+ * or a position outside the table - that is reported and the remaining
+ * steps are run in table order, so a bad table costs a warning rather
+ * than the boot.
+ *
+ * Records are only added by the bootstrap CPU while it boots, so they
+ * need no lock.
+ */
+
+#include "init.h"
+#include "sched.h"
+#include "serial.h"
+
+/* Steps and marks kept for the report */
+#define INIT_MAX_RECORDS 64
+
+/* Microseconds per second */
+#define US_PER_SEC 1000000ULL
+
+/* Boot profile record - a mark has start == end */
+typedef struct {
+    const char* name;
+    uint64_t start;                       /* TSC */
+    uint64_t end;
+} InitRecord;
+
+static InitRecord records[INIT_MAX_RECORDS];
+static uint32_t record_count = 0;
+
+/* Keep a record (the oldest ones win if there are too many) */
+static void record(const char* name, uint64_t start, uint64_t end) {
+    if (record_count < INIT_MAX_RECORDS) {
+        records[record_count].name = name;
+        records[record_count].start = start;
+        records[record_count].end = end;
+        record_count++;
+    }
+}
+
+/* Run one step and time it */
+static void run_step(const InitStep* step) {
+    uint64_t start = timer_read_tsc();
+    step->run();
+    record(step->name, start, timer_read_tsc());
+}
+
+/* Run a table's steps in dependency order */
+void init_run(const InitStep* steps, uint32_t count) {
+    if (count > INIT_MAX_STEPS) {
+        count = INIT_MAX_STEPS;
+    }
+    uint32_t all = count == 32 ? 0xFFFFFFFFu : (1u << count) - 1;
+    uint32_t done = 0;
+
+    while (done != all) {
+        uint8_t progress = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if ((done & (1u << i)) || (steps[i].after & ~done) != 0) {
+                continue;                 /* Done, or still waiting */
+            }
+            run_step(&steps[i]);
+            done |= 1u << i;
+            progress = 1;
+        }
+        if (progress) {
+            continue;
+        }
+
+        /* Nothing can run - the table is wrong */
+        for (uint32_t i = 0; i < count; i++) {
+            if (!(done & (1u << i))) {
+                serial_write("init: unmet dependencies for ");
+                serial_write(steps[i].name);
+                serial_write("\n");
+                run_step(&steps[i]);
+                done |= 1u << i;
+            }
+        }
+    }
+}
+
+/* Note a point in the boot */
+void init_mark(const char* name) {
+    uint64_t now = timer_read_tsc();
+    record(name, now, now);
+}
+
+/* TSC cycles since _start as microseconds */
+static uint64_t boot_us(uint64_t tsc, uint32_t hz) {
+    return udiv64((tsc - boot_tsc) * US_PER_SEC, hz, NULL);
+}
+
+/* Write the boot profile (runs once) */
+static void init_report_thread(void* arg) {
+    (void)arg;
+    uint32_t hz = (uint32_t) timer_tsc_hz();
+
+    serial_write("B begin ");
+    serial_write_dec(record_count, 0);
+    serial_write("\n");
+    for (uint32_t i = 0; i < record_count; i++) {
+        serial_write("B ");
+        serial_write_dec(boot_us(records[i].start, hz), 0);
+        serial_write(" ");
+        serial_write_dec(boot_us(records[i].end, hz) - boot_us(records[i].start, hz), 0);
+        serial_write(" ");
+        serial_write(records[i].name);
+        serial_write("\n");
+    }
+    serial_write("B end\n");
+}
+
+/* Send the boot profile to COM1 */
+void init_report(void) {
+    if (!serial_present()) {
+        return;                           /* Nowhere to send it */
+    }
+    if (timer_tsc_hz() == 0) {
+        serial_write("init: no TSC - no boot profile\n");
+        return;
+    }
+    thread_create("boot", init_report_thread, NULL, SCHED_PRIORITY_LOW);
+}
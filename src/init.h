@@ -0,0 +1,50 @@
+/* init.h - Boot sequencing and boot-time profile for JoshOS
+ *
+ * kernel_main brings the kernel up from tables of steps. Each step names
+ * the steps it needs (INIT_AFTER bits of their positions in the same
+ * table). init_run goes through the table in order and holds a step
+ * back until those have finished, so a step cannot run before what it
+ * needs, wherever it is listed.
+ *
+ * Every step is timed with the TSC, counting from the stamp boot.S takes
+ * at _start. The clock rate is only known once timer_init has calibrated
+ * it, so the raw stamps are kept and converted when init_report sends
+ * the profile to COM1:
+ *
+ *     B begin <records>
+ *     B <start us> <duration us> <name>     (one line per step or mark)
+ *     B end
+ */
+
+#ifndef INIT_H
+#define INIT_H
+
+#include "timer.h"
+
+/* Steps per table (dependencies are bits of a 32-bit mask) */
+#define INIT_MAX_STEPS 32
+
+/* Dependency on the step at position n of the same table */
+#define INIT_AFTER(n) (1u << (n))
+
+/* Boot step */
+typedef struct {
+    const char* name;
+    void (*run)(void);
+    uint32_t after;                       /* INIT_AFTER bits of steps to finish first */
+} InitStep;
+
+/* TSC at _start (set by boot.S) */
+extern uint64_t boot_tsc;
+
+/* Run a table's steps in dependency order (on the calling CPU) */
+void init_run(const InitStep* steps, uint32_t count);
+
+/* Note that the boot has reached a point, e.g. the first frame on screen */
+void init_mark(const char* name);
+
+/* Send the boot profile to COM1 (after timer_init and sched_init - it is
+ * written by a low-priority thread, off the boot path) */
+void init_report(void);
+
+#endif /* INIT_H */
@@ -0,0 +1,32 @@
+/* io.h - x86 port I/O helpers for JoshOS
+ *
+ * Small inline wrappers around the in/out instructions, shared by the
+ * drivers that talk to legacy PC hardware.
+ */
+
+#ifndef IO_H
+#define IO_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned short     uint16_t;
+typedef unsigned int       uint32_t;
+
+/* Write a byte to a port */
+static inline void outb(uint16_t port, uint8_t value) {
+    __asm__ volatile ("outb %0, %1" : : "a" (value), "Nd" (port));
+}
+
+/* Read a byte from a port */
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile ("inb %1, %0" : "=a" (ret) : "Nd" (port));
+    return ret;
+}
+
+/* Short delay for slow devices - port 0x80 is the unused POST port */
+static inline void io_wait(void) {
+    outb(0x80, 0);
+}
+
+#endif /* IO_H */
@@ -7,9 +7,31 @@
 
 /* Include headers */
 #include "keyboard.h"
+#include "event.h"
 #include "memory.h"
+#include "multiboot.h"
+#include "assets.h"
+#include "pmm.h"
+#include "paging.h"
+#include "cpu.h"
+#include "gdt.h"
+#include "idt.h"
+#include "percpu.h"
+#include "timer.h"
+#include "rtc.h"
+#include "sched.h"
+#include "smp.h"
+#include "kstring.h"
+#include "blit.h"
+#include "serial.h"
+#include "trace.h"
+#include "profile.h"
 #include "graphics.h"
 #include "nebula_ui.h"
+#include "init.h"
+#ifdef NEBULA_BENCH
+#include "bench.h"
+#endif
 
 /* Stub function for keyboard driver (not used in graphics mode) */
 void terminal_putchar(char c) {
@@ -17,22 +39,250 @@ void terminal_putchar(char c) {
     (void)c;  /* Suppress unused parameter warning */
 }
 
+/* UI frame pacing - at most one redraw per interval */
+#define FRAME_INTERVAL_NS (NS_PER_SEC / 60)
+
+/* Render thread wakes up here when the UI changes */
+static WaitQueue ui_waiters = WAIT_QUEUE_INIT;
+
+/* Top bar clock - wall time at boot plus time since */
+static uint32_t boot_seconds = 0;         /* Seconds since midnight just before timer_init */
+static Timer clock_timer;
+
+/* Timer ids in EVENT_TIMER events */
+#define TIMER_EVENT_CLOCK 1
+
+/* Seconds since midnight */
+static uint32_t clock_seconds(void) {
+    return (boot_seconds + (uint32_t) udiv64(now_ns(), NS_PER_SEC, NULL)) % 86400;
+}
+
+/* Show the current time in the top bar */
+static void clock_show(void) {
+    char text[9];
+    uint32_t now = clock_seconds();
+    uint32_t hour = now / 3600;
+    uint32_t minute = (now / 60) % 60;
+    uint32_t hour12 = hour % 12 == 0 ? 12 : hour % 12;
+    uint32_t i = 0;
+    
+    /* "h:mm AM" / "hh:mm PM" */
+    if (hour12 >= 10) {
+        text[i++] = '1';
+    }
+    text[i++] = '0' + hour12 % 10;
+    text[i++] = ':';
+    text[i++] = '0' + minute / 10;
+    text[i++] = '0' + minute % 10;
+    text[i++] = ' ';
+    text[i++] = hour < 12 ? 'A' : 'P';
+    text[i++] = 'M';
+    text[i] = '\0';
+    nebula_set_clock(text);
+}
+
+/* Minute boundary - have the event loop update the clock, and fire again
+ * at the next one (timer callback - runs in the timer interrupt) */
+static void clock_tick(void* arg) {
+    (void)arg;
+    event_post_timer(TIMER_EVENT_CLOCK);
+    timer_start(&clock_timer, (60 - clock_seconds() % 60) * NS_PER_SEC, 0, clock_tick, NULL);
+}
+
+/* Hand an event to whoever handles it (event loop only) */
+static void event_dispatch(const Event* event) {
+    if (event->type == EVENT_TIMER) {
+        if (event->timer == TIMER_EVENT_CLOCK) {
+            clock_show();
+        }
+        return;
+    }
+    nebula_ui_handle_event(event);
+}
+
+/* Render thread - redraw damaged UI, at most once per frame interval */
+static void render_thread(void* arg) {
+    (void)arg;
+    uint64_t last_frame = now_ns();
+    
+    while (1) {
+        /* Sleep until something changes */
+        uint32_t flags = wait_queue_lock(&ui_waiters);
+        while (!nebula_ui_needs_update()) {
+            thread_wait(&ui_waiters);
+        }
+        wait_queue_unlock(&ui_waiters, flags);
+        
+        /* Too soon after the last frame - wait for the next frame slot */
+        uint64_t now = now_ns();
+        if (now - last_frame < FRAME_INTERVAL_NS) {
+            thread_sleep(last_frame + FRAME_INTERVAL_NS - now);
+        }
+        
+        last_frame = now_ns();
+        nebula_ui_update();
+    }
+}
+
+/* Multiboot info - NULL if not booted by a Multiboot loader */
+static const MultibootInfo* boot_info = NULL;
+
+/* Boot steps that take arguments or return a status */
+static void boot_percpu(void) {
+    percpu_init(0);
+}
+
+static void boot_serial(void) {
+    serial_init();                        /* COM1 for diagnostics */
+}
+
+static void boot_pmm(void) {
+    pmm_init(boot_info);
+}
+
+static void boot_paging(void) {
+    paging_init();
+}
+
+static void boot_assets(void) {
+    assets_init(boot_info);
+}
+
+static void boot_graphics(void) {
+    graphics_init(boot_info);
+}
+
+static void boot_clock(void) {
+    RtcTime rtc;
+    rtc_read(&rtc);
+    boot_seconds = rtc.hour * 3600 + rtc.minute * 60 + rtc.second;
+    clock_show();
+}
+
+static void boot_timer(void) {
+    timer_init();
+    timer_start(&clock_timer, (60 - clock_seconds() % 60) * NS_PER_SEC, 0, clock_tick, NULL);
+}
+
+static void boot_smp(void) {
+    smp_init();
+}
+
+static void boot_render(void) {
+    thread_create("render", render_thread, NULL, SCHED_PRIORITY_NORMAL);
+}
+
+static void boot_keyboard(void) {
+    keyboard_init();
+    keyboard_enable_events();
+}
+
+/* Up to the first frame - only what the first picture needs, with
+ * interrupts off and on the bootstrap CPU alone */
+enum {
+    BOOT_GDT,
+    BOOT_PERCPU,
+    BOOT_IDT,
+    BOOT_SERIAL,
+    BOOT_CPU,
+    BOOT_KSTRING,
+    BOOT_BLIT,
+    BOOT_PMM,
+    BOOT_PAGING,
+    BOOT_MEMORY,
+    BOOT_ASSETS,
+    BOOT_GRAPHICS,
+    BOOT_SCENE,
+    BOOT_EVENT,
+    BOOT_CLOCK,
+    BOOT_UI,
+    BOOT_STEPS
+};
+
+static const InitStep boot_steps[BOOT_STEPS] = {
+    [BOOT_GDT]      = { "gdt",      gdt_init,         0 },
+    [BOOT_PERCPU]   = { "percpu",   boot_percpu,      INIT_AFTER(BOOT_GDT) },
+    [BOOT_IDT]      = { "idt",      idt_init,         INIT_AFTER(BOOT_GDT) },
+    [BOOT_SERIAL]   = { "serial",   boot_serial,      0 },
+    [BOOT_CPU]      = { "cpu",      cpu_init,         0 },
+    [BOOT_KSTRING]  = { "kstring",  kstring_init,     INIT_AFTER(BOOT_CPU) },
+    [BOOT_BLIT]     = { "blit",     blit_init,        INIT_AFTER(BOOT_CPU) },
+    [BOOT_PMM]      = { "pmm",      boot_pmm,         0 },
+    [BOOT_PAGING]   = { "paging",   boot_paging,      INIT_AFTER(BOOT_CPU) | INIT_AFTER(BOOT_PMM) },
+    [BOOT_MEMORY]   = { "memory",   memory_init,      INIT_AFTER(BOOT_PERCPU) | INIT_AFTER(BOOT_KSTRING) |
+                                                      INIT_AFTER(BOOT_PAGING) },
+    [BOOT_ASSETS]   = { "assets",   boot_assets,      INIT_AFTER(BOOT_MEMORY) },
+    [BOOT_GRAPHICS] = { "graphics", boot_graphics,    INIT_AFTER(BOOT_BLIT) | INIT_AFTER(BOOT_MEMORY) },
+    [BOOT_SCENE]    = { "scene",    nebula_ui_init,   INIT_AFTER(BOOT_ASSETS) | INIT_AFTER(BOOT_GRAPHICS) },
+    [BOOT_EVENT]    = { "event",    event_init,       0 },
+    [BOOT_CLOCK]    = { "rtc",      boot_clock,       0 },
+    [BOOT_UI]       = { "ui",       nebula_render_ui, INIT_AFTER(BOOT_SCENE) | INIT_AFTER(BOOT_EVENT) |
+                                                      INIT_AFTER(BOOT_CLOCK) },
+};
+
+/* After the first frame - the time base (calibrating it takes tens of
+ * milliseconds), threads, the other CPUs and input */
+enum {
+    LATE_TIMER,
+#ifdef NEBULA_BENCH
+    LATE_BENCH,
+#endif
+    LATE_SCHED,
+    LATE_VSYNC,
+    LATE_TRACE,
+    LATE_HEAP_DEBUG,
+    LATE_SMP,
+    LATE_PROFILE,
+    LATE_RENDER,
+    LATE_KEYBOARD,
+    LATE_STEPS
+};
+
+static const InitStep late_steps[LATE_STEPS] = {
+    [LATE_TIMER]      = { "timer",      boot_timer,           0 },
+#ifdef NEBULA_BENCH
+    /* Benchmark kernel - measure with nothing else running, then exit */
+    [LATE_BENCH]      = { "bench",      bench_run,            INIT_AFTER(LATE_TIMER) },
+#endif
+    [LATE_SCHED]      = { "sched",      sched_init,           INIT_AFTER(LATE_TIMER) },
+    [LATE_VSYNC]      = { "vsync",      graphics_start_vsync, INIT_AFTER(LATE_SCHED) },
+    [LATE_TRACE]      = { "trace",      trace_start,          INIT_AFTER(LATE_SCHED) },
+    [LATE_HEAP_DEBUG] = { "heap debug", memory_debug_start,   INIT_AFTER(LATE_SCHED) },
+    [LATE_SMP]        = { "smp",        boot_smp,             INIT_AFTER(LATE_SCHED) },
+    [LATE_PROFILE]    = { "profile",    profile_start,        INIT_AFTER(LATE_SMP) },
+    [LATE_RENDER]     = { "render",     boot_render,          INIT_AFTER(LATE_SCHED) },
+    [LATE_KEYBOARD]   = { "keyboard",   boot_keyboard,        0 },
+};
+
 /* Kernel main function - entry point from boot.S */
-void kernel_main(void) {
-    /* Initialize memory manager first */
-    memory_init();
+void kernel_main(uint32_t magic, const MultibootInfo* mbi) {
+    /* Ignore the info block if not booted by Multiboot */
+    boot_info = magic == MULTIBOOT_BOOTLOADER_MAGIC ? mbi : NULL;
     
-    /* Initialize graphics subsystem (VGA Mode 13h) */
-    graphics_init();
+    /* Get the interface on screen first, then bring up everything else */
+    init_run(boot_steps, BOOT_STEPS);
+    init_mark("first frame");
+    init_run(late_steps, LATE_STEPS);
+    init_mark("ready");
+    init_report();                        /* Boot profile to COM1 */
     
-    /* Render the NEBULA OS interface */
-    nebula_render_ui();
+    /* Start taking interrupts - keys arrive as events */
+    interrupts_enable();
     
-    /* Main loop - keep rendering UI */
+    /* Event loop - runs above the render thread so a slow redraw never
+     * delays input. Everything queued is handled before the render thread
+     * is woken, so a burst of events costs one redraw, not one each */
+    thread_set_priority(SCHED_PRIORITY_HIGH);
     while (1) {
-        /* For now, just keep the UI displayed */
-        /* In the future, this could handle input, updates, etc. */
-        __asm__ volatile ("hlt");  /* Halt CPU to save power */
+        Event event;
+        event_wait(&event);               /* Blocks until something is posted */
+        do {
+            event_dispatch(&event);
+        } while (event_poll(&event));
+        
+        if (nebula_ui_needs_update()) {
+            thread_wake_all(&ui_waiters);
+        }
     }
 }
 
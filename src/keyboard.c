@@ -2,9 +2,31 @@
  * 
  * Handles PS/2 keyboard input by reading scan codes from port 0x60.
  * Implements basic key mapping and input buffer.
+ * 
+ * Scancode bytes go through a small state machine: E0 marks the next key
+ * as extended (arrows, right Ctrl/Alt, keypad Enter ...), E1 starts the
+ * six-byte Pause sequence, and the fake shifts some keyboards send around
+ * extended keys are dropped. It tracks which keys are down, so Caps Lock
+ * toggles once per press however long it is held. Characters come from
+ * tables generated at build time by tools/keymap_gen.c - one per layout
+ * and combination of Shift, Ctrl and Caps Lock - so turning a key into a
+ * character is one indexed load with no per-key tests.
+ * 
+ * The IRQ 1 handler is the only writer of the scancode ring and the code
+ * reading keys is the only reader, so the ring needs no lock: each side
+ * owns one index and publishes it with a release store after touching
+ * the slots.
+ * 
+ * Once keyboard_enable_events is called the ring is bypassed: the handler
+ * decodes bytes itself and posts every press and release straight to the
+ * kernel event queue.
  */
 
 #include "keyboard.h"
+#include "event.h"
+#include "idt.h"
+#include "io.h"
+#include "sched.h"
 
 /* Keyboard status register port */
 #define KEYBOARD_STATUS_PORT 0x64
@@ -17,66 +39,207 @@
 
 /* Scan code constants */
 #define KEY_RELEASE_MASK 0x80              /* Bit set when key is released */
-#define SCANCODE_ENTER   0x1C              /* Enter key scan code */
-#define SCANCODE_BACKSPACE 0x0E            /* Backspace key scan code */
+#define SCANCODE_EXTENDED 0xE0             /* Next byte is an extended key */
+#define SCANCODE_PAUSE   0xE1              /* Start of the Pause sequence */
+#define SCANCODE_ACK     0xFA              /* Controller replies, not keys */
+#define SCANCODE_RESEND  0xFE
+#define PAUSE_LENGTH     6                 /* Bytes in E1 1D 45 E1 9D C5 */
+
+/* Left and right modifier keys held */
+#define HELD_LSHIFT 0x01
+#define HELD_RSHIFT 0x02
+#define HELD_LCTRL  0x04
+#define HELD_RCTRL  0x08
+#define HELD_LALT   0x10
+#define HELD_RALT   0x20
+
+/* Keyboard IRQ line */
+#define KEYBOARD_IRQ 1
+
+/* Scancode ring - size must be a power of two */
+#define SCANCODE_RING_SIZE 256
+#define SCANCODE_RING_MASK (SCANCODE_RING_SIZE - 1)
 
 /* Keyboard state */
-static char input_buffer[256];             /* Input buffer */
+static uint8_t scancode_ring[SCANCODE_RING_SIZE]; /* Scancodes from IRQ 1 */
+static uint32_t ring_head = 0;             /* Next slot to write (IRQ handler) */
+static uint32_t ring_tail = 0;             /* Next slot to read (consumer) */
+static uint32_t ring_dropped = 0;          /* Scancodes lost to a full ring */
+static WaitQueue ring_waiters = WAIT_QUEUE_INIT; /* Threads waiting for a key */
 static uint32_t buffer_index = 0;          /* Current position in buffer */
+static uint8_t events_enabled = 0;         /* Post events instead of filling the ring */
+
+/* Decoder state - fed by IRQ 1 in event mode, by keyboard_getchar otherwise */
+static uint8_t prefix = 0;                 /* KEY_EXTENDED right after an E0 byte */
+static uint8_t pause_bytes = 0;            /* Rest of the Pause sequence to skip */
+static uint8_t held = 0;                   /* HELD_* modifier keys down */
+static uint8_t modifiers = 0;              /* KEY_MOD_* state */
+static uint32_t keys_down[256 / 32];       /* Bitmap of KEY_* codes held */
 
 /* Forward declaration for terminal function */
 extern void terminal_putchar(char c);
 
-/* Read a byte from a port (inline assembly) */
-static inline uint8_t inb(uint16_t port) {
-    uint8_t result;                       /* Result variable */
-    /* Read byte from port into result */
-    __asm__ volatile("inb %1, %0" : "=a"(result) : "Nd"(port));
-    return result;                         /* Return read value */
-}
+/* Keymap tables - generated at build time by tools/keymap_gen.c */
+#include "keymap_tables.h"
+
+/* Tables of the current layout, one per KEY_MOD_* combination */
+static const char (*keymap)[256] = keymap_tables[KEYBOARD_LAYOUT_US];
 
-/* US QWERTY keyboard layout - maps scan codes to ASCII */
-static const char scan_code_to_ascii[128] = {
-    0,  27, '1', '2', '3', '4', '5', '6', '7', '8',  /* 0-9 */
-    '9', '0', '-', '=', '\b',                          /* Backspace */
-    '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', /* Tab, q-o */
-    'p', '[', ']', '\n',                               /* Enter */
-    0,  'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l',  /* Ctrl, a-l */
-    ';', '\'', '`', 0,                                 /* Backslash */
-    '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm',           /* z-m */
-    ',', '.', '/', 0,                                  /* Slash */
-    '*', 0, ' ',                                       /* Space */
+/* HELD_* bit of each modifier key */
+static const uint8_t held_bits[256] = {
+    [KEY_LSHIFT] = HELD_LSHIFT,
+    [KEY_RSHIFT] = HELD_RSHIFT,
+    [KEY_LCTRL] = HELD_LCTRL,
+    [KEY_RCTRL] = HELD_RCTRL,
+    [KEY_LALT] = HELD_LALT,
+    [KEY_RALT] = HELD_RALT,
 };
 
-/* Check if keyboard has data available */
-uint8_t keyboard_has_data(void) {
-    /* Read status register */
-    uint8_t status = inb(KEYBOARD_STATUS_PORT);
-    /* Check if output buffer is full (data ready) */
-    return (status & KEYBOARD_STATUS_OUTPUT_FULL) != 0;
+/* Feed one byte from the controller - returns 1 once it completes a key
+ * press or release, with the key's code */
+static uint8_t decode_byte(uint8_t byte, uint8_t* key, uint8_t* released) {
+    if (pause_bytes > 0) {
+        pause_bytes--;                    /* Inside E1 1D 45 E1 9D C5 */
+        return 0;
+    }
+    if (byte == SCANCODE_EXTENDED) {
+        prefix = KEY_EXTENDED;
+        return 0;
+    }
+    if (byte == SCANCODE_PAUSE) {
+        /* Pause sends make and break at once and never repeats */
+        pause_bytes = PAUSE_LENGTH - 1;
+        *key = KEY_PAUSE;
+        *released = 0;
+        return 1;
+    }
+    if (prefix == 0 && (byte == SCANCODE_ACK || byte == SCANCODE_RESEND)) {
+        return 0;
+    }
+    
+    uint8_t code = (byte & ~KEY_RELEASE_MASK) | prefix;
+    prefix = 0;
+    if (code == (KEY_EXTENDED | KEY_LSHIFT) || code == (KEY_EXTENDED | KEY_RSHIFT)) {
+        return 0;                         /* Fake shifts around extended keys */
+    }
+    uint8_t up = (byte & KEY_RELEASE_MASK) != 0;
+    uint32_t mask = 1u << (code & 31);
+    uint8_t was_down = (keys_down[code >> 5] & mask) != 0;
+    if (up) {
+        keys_down[code >> 5] &= ~mask;
+        held &= ~held_bits[code];
+    } else {
+        keys_down[code >> 5] |= mask;
+        held |= held_bits[code];
+        if (code == KEY_CAPS_LOCK && !was_down) {
+            modifiers ^= KEY_MOD_CAPS;    /* Toggles on the press, not on repeats */
+        }
+    }
+    modifiers = (modifiers & KEY_MOD_CAPS) |
+                ((held & (HELD_LSHIFT | HELD_RSHIFT)) ? KEY_MOD_SHIFT : 0) |
+                ((held & (HELD_LCTRL | HELD_RCTRL)) ? KEY_MOD_CTRL : 0) |
+                ((held & (HELD_LALT | HELD_RALT)) ? KEY_MOD_ALT : 0);
+    *key = code;
+    *released = up;
+    return 1;
 }
 
-/* Get the next key press (blocking) */
-char keyboard_getchar(void) {
-    /* Wait until keyboard has data */
-    while (!keyboard_has_data()) {
-        /* Busy wait for key press */
+/* Character a key types in the current state - 0 for releases and keys
+ * that type nothing. One load from the table for the modifier state */
+static inline char key_ascii(uint8_t key, uint8_t released) {
+    return keymap[modifiers & KEYMAP_MOD_MASK][key] & (char)(released - 1);
+}
+
+/* Turn a scancode byte into a key event (IRQ 1 only) */
+static void keyboard_post_event(uint8_t scancode) {
+    uint8_t key, released;
+    if (!decode_byte(scancode, &key, &released)) {
+        return;                           /* Part of a longer sequence */
+    }
+    if (!event_post_key(released ? EVENT_KEY_UP : EVENT_KEY_DOWN, key, key_ascii(key, released), modifiers)) {
+        ring_dropped++;                   /* Event queue full */
     }
+}
+
+/* IRQ 1 - move the scancode from the controller into the ring */
+static void keyboard_irq(InterruptFrame* frame) {
+    (void)frame;
     
-    /* Read scan code from keyboard data port */
     uint8_t scancode = inb(KEYBOARD_DATA_PORT);
-    
-    /* Check if key was released (not pressed) */
-    if (scancode & KEY_RELEASE_MASK) {
-        return 0;                          /* Return 0 for key release */
+    if (events_enabled) {
+        keyboard_post_event(scancode);
+        return;
     }
     
-    /* Convert scan code to ASCII character */
-    if (scancode < 128) {                 /* Valid scan code range */
-        return scan_code_to_ascii[scancode]; /* Return ASCII character */
+    uint32_t head = ring_head;            /* Only we write head */
+    uint32_t tail = __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE);
+    
+    if (head - tail >= SCANCODE_RING_SIZE) {
+        ring_dropped++;                   /* Full - drop the newest */
+        return;
+    }
+    scancode_ring[head & SCANCODE_RING_MASK] = scancode;
+    __atomic_store_n(&ring_head, head + 1, __ATOMIC_RELEASE);
+    thread_wake_all(&ring_waiters);
+}
+
+/* Install the IRQ handler - call after idt_init */
+void keyboard_init(void) {
+    /* Discard anything the controller latched before we were listening */
+    while (inb(KEYBOARD_STATUS_PORT) & KEYBOARD_STATUS_OUTPUT_FULL) {
+        inb(KEYBOARD_DATA_PORT);
+    }
+    irq_install_handler(KEYBOARD_IRQ, keyboard_irq);
+}
+
+/* Post key events from now on */
+void keyboard_enable_events(void) {
+    __atomic_store_n(&events_enabled, 1, __ATOMIC_RELEASE);
+}
+
+/* Pick the layout keys are translated with */
+void keyboard_set_layout(uint8_t layout) {
+    if (layout < KEYMAP_LAYOUTS) {
+        keymap = keymap_tables[layout];
     }
+}
+
+/* Check if a key is held down */
+uint8_t keyboard_key_down(uint8_t key) {
+    return (keys_down[key >> 5] >> (key & 31)) & 1;
+}
+
+/* Check if keyboard has data available */
+uint8_t keyboard_has_data(void) {
+    return __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE) != ring_tail;
+}
+
+/* Take the next scancode from the ring without waiting */
+uint8_t keyboard_read_scancode(uint8_t* scancode) {
+    uint32_t tail = ring_tail;            /* Only we write tail */
+    if (__atomic_load_n(&ring_head, __ATOMIC_ACQUIRE) == tail) {
+        return 0;                         /* Empty */
+    }
+    *scancode = scancode_ring[tail & SCANCODE_RING_MASK];
+    __atomic_store_n(&ring_tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* Get the next key press (blocking) */
+char keyboard_getchar(void) {
+    uint8_t scancode, key, released;
+    
+    /* Block until IRQ 1 delivers a whole key. The queue lock is held while
+     * the ring is checked, so an IRQ arriving in between still wakes us */
+    uint32_t flags = wait_queue_lock(&ring_waiters);
+    do {
+        while (!keyboard_read_scancode(&scancode)) {
+            thread_wait(&ring_waiters);
+        }
+    } while (!decode_byte(scancode, &key, &released));
+    wait_queue_unlock(&ring_waiters, flags);
     
-    return 0;                              /* Invalid scan code */
+    return key_ascii(key, released);      /* 0 for releases */
 }
 
 /* Read a line of input (up to buffer size) */
@@ -123,9 +286,14 @@ void keyboard_readline(char* buffer, uint32_t max_len) {
 /* Clear input buffer */
 void keyboard_clear_buffer(void) {
     buffer_index = 0;                     /* Reset buffer index */
-    /* Clear buffer memory */
-    for (uint32_t i = 0; i < 256; i++) {
-        input_buffer[i] = 0;               /* Zero out each byte */
-    }
+    prefix = 0;                           /* Don't glue a stale E0 onto the next key */
+    pause_bytes = 0;
+    /* Drop pending scancodes - the consumer owns the tail */
+    __atomic_store_n(&ring_tail, __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+/* Get the number of scancodes dropped because the ring was full */
+uint32_t keyboard_get_dropped(void) {
+    return ring_dropped;
 }
 
@@ -8,12 +8,65 @@ typedef unsigned char      uint8_t;
 typedef unsigned short     uint16_t;
 typedef unsigned int       uint32_t;
 
+/* Key codes - scancode set 1 with the release bit clear; keys sent with
+ * an E0 prefix get KEY_EXTENDED added */
+#define KEY_EXTENDED   0x80
+#define KEY_ESCAPE     0x01
+#define KEY_BACKSPACE  0x0E
+#define KEY_TAB        0x0F
+#define KEY_ENTER      0x1C
+#define KEY_LCTRL      0x1D
+#define KEY_LSHIFT     0x2A
+#define KEY_RSHIFT     0x36
+#define KEY_LALT       0x38
+#define KEY_SPACE      0x39
+#define KEY_CAPS_LOCK  0x3A
+#define KEY_F1         0x3B               /* F1-F10 are consecutive */
+#define KEY_NUM_LOCK   0x45
+#define KEY_SCROLL_LOCK 0x46
+#define KEY_F11        0x57
+#define KEY_F12        0x58
+#define KEY_KP_ENTER   (KEY_EXTENDED | 0x1C)
+#define KEY_RCTRL      (KEY_EXTENDED | 0x1D)
+#define KEY_RALT       (KEY_EXTENDED | 0x38)
+#define KEY_PAUSE      (KEY_EXTENDED | 0x45) /* Sent as E1 1D 45 E1 9D C5 */
+#define KEY_HOME       (KEY_EXTENDED | 0x47)
+#define KEY_UP         (KEY_EXTENDED | 0x48)
+#define KEY_PAGE_UP    (KEY_EXTENDED | 0x49)
+#define KEY_LEFT       (KEY_EXTENDED | 0x4B)
+#define KEY_RIGHT      (KEY_EXTENDED | 0x4D)
+#define KEY_END        (KEY_EXTENDED | 0x4F)
+#define KEY_DOWN       (KEY_EXTENDED | 0x50)
+#define KEY_PAGE_DOWN  (KEY_EXTENDED | 0x51)
+#define KEY_INSERT     (KEY_EXTENDED | 0x52)
+#define KEY_DELETE     (KEY_EXTENDED | 0x53)
+
+/* Keyboard layouts - order matches tools/keymap_gen.c */
+#define KEYBOARD_LAYOUT_US      0
+#define KEYBOARD_LAYOUT_DVORAK  1
+
 /* Forward declaration for terminal functions */
 void terminal_putchar(char c);
 
+/* Install the IRQ 1 handler (after idt_init) */
+void keyboard_init(void);
+
+/* Deliver keys as EVENT_KEY_DOWN/EVENT_KEY_UP events (after event_init)
+ * instead of through the scancode ring behind keyboard_getchar */
+void keyboard_enable_events(void);
+
+/* Pick the layout keys are translated with */
+void keyboard_set_layout(uint8_t layout);
+
+/* Check if a key (KEY_* code) is held down */
+uint8_t keyboard_key_down(uint8_t key);
+
 /* Check if keyboard has data available */
 uint8_t keyboard_has_data(void);
 
+/* Take the next raw scancode without waiting - returns 0 if none */
+uint8_t keyboard_read_scancode(uint8_t* scancode);
+
 /* Get a single character from keyboard (blocking) */
 char keyboard_getchar(void);
 
@@ -23,5 +76,8 @@ void keyboard_readline(char* buffer, uint32_t max_len);
 /* Clear the input buffer */
 void keyboard_clear_buffer(void);
 
+/* Get the number of scancodes dropped because the ring was full */
+uint32_t keyboard_get_dropped(void);
+
 #endif /* KEYBOARD_H */
 
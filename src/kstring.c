@@ -0,0 +1,208 @@
+/* kstring.c - Memory fill and copy routines for JoshOS
+ * 
+ * The kernel is built with -fno-builtin, so GCC never vectorizes or
+ * inlines these for us. Small buffers use rep stosd/movsd for the aligned
+ * middle; large buffers use 64-byte SSE2 loops with aligned stores when
+ * the CPU supports them.
+ */
+
+#include "kstring.h"
+#include "cpu.h"
+
+/* Buffers at least this large take the SSE2 path */
+#define SSE2_THRESHOLD 256
+
+/* Selected at boot by kstring_init */
+static uint8_t use_sse2 = 0;
+
+/* Fill bytes with rep stosb */
+static inline uint8_t* rep_stosb(uint8_t* d, uint8_t value, uint32_t n) {
+    __asm__ volatile ("rep stosb" : "+D" (d), "+c" (n) : "a" (value) : "memory");
+    return d;
+}
+
+/* Fill 32-bit words with rep stosd */
+static inline uint8_t* rep_stosd(uint8_t* d, uint32_t value, uint32_t n) {
+    __asm__ volatile ("rep stosl" : "+D" (d), "+c" (n) : "a" (value) : "memory");
+    return d;
+}
+
+/* Copy bytes with rep movsb */
+static inline void rep_movsb(uint8_t** d, const uint8_t** s, uint32_t n) {
+    __asm__ volatile ("rep movsb" : "+D" (*d), "+S" (*s), "+c" (n) : : "memory");
+}
+
+/* Copy 32-bit words with rep movsd */
+static inline void rep_movsd(uint8_t** d, const uint8_t** s, uint32_t n) {
+    __asm__ volatile ("rep movsl" : "+D" (*d), "+S" (*s), "+c" (n) : : "memory");
+}
+
+/* Only the SSE2 helpers are compiled for SSE2 so generic code stays i686 */
+#define SSE2_FUNCTION __attribute__((target("sse2")))
+
+/* Fill blocks of 64 bytes at 16-byte aligned d with a 32-bit pattern */
+SSE2_FUNCTION static void fill_sse2(uint8_t* d, uint32_t pattern, uint32_t blocks) {
+    __asm__ volatile (
+        "movd %2, %%xmm0\n\t"
+        "pshufd $0, %%xmm0, %%xmm0\n\t"   /* Broadcast pattern to 16 bytes */
+        "1:\n\t"
+        "movdqa %%xmm0, (%0)\n\t"
+        "movdqa %%xmm0, 16(%0)\n\t"
+        "movdqa %%xmm0, 32(%0)\n\t"
+        "movdqa %%xmm0, 48(%0)\n\t"
+        "add $64, %0\n\t"
+        "dec %1\n\t"
+        "jnz 1b"
+        : "+r" (d), "+r" (blocks)
+        : "r" (pattern)
+        : "xmm0", "memory", "cc");
+}
+
+/* Copy blocks of 64 bytes to 16-byte aligned d from any s */
+SSE2_FUNCTION static void copy_sse2(uint8_t* d, const uint8_t* s, uint32_t blocks) {
+    __asm__ volatile (
+        "1:\n\t"
+        "movdqu (%1), %%xmm0\n\t"
+        "movdqu 16(%1), %%xmm1\n\t"
+        "movdqu 32(%1), %%xmm2\n\t"
+        "movdqu 48(%1), %%xmm3\n\t"
+        "movdqa %%xmm0, (%0)\n\t"
+        "movdqa %%xmm1, 16(%0)\n\t"
+        "movdqa %%xmm2, 32(%0)\n\t"
+        "movdqa %%xmm3, 48(%0)\n\t"
+        "add $64, %1\n\t"
+        "add $64, %0\n\t"
+        "dec %2\n\t"
+        "jnz 1b"
+        : "+r" (d), "+r" (s), "+r" (blocks)
+        :
+        : "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc");
+}
+
+/* Pick the fastest implementation for this CPU */
+void kstring_init(void) {
+    use_sse2 = cpu_has(CPU_FEATURE_SSE2);
+}
+
+/* Fill n bytes with a repeating 32-bit pattern */
+static void fill_pattern(uint8_t* d, uint32_t pattern, uint32_t n) {
+    /* Large fills: align to 16 bytes and stream 64-byte blocks */
+    if (use_sse2 && n >= SSE2_THRESHOLD) {
+        uint32_t head = (0u - (uint32_t)d) & 15;
+        d = rep_stosb(d, (uint8_t)pattern, head);
+        n -= head;
+        fill_sse2(d, pattern, n >> 6);
+        d += n & ~63u;
+        n &= 63;
+    }
+    
+    /* Word-wide fill of the aligned middle */
+    uint32_t head = (0u - (uint32_t)d) & 3;
+    if (head > n) {
+        head = n;
+    }
+    d = rep_stosb(d, (uint8_t)pattern, head);
+    n -= head;
+    d = rep_stosd(d, pattern, n >> 2);
+    rep_stosb(d, (uint8_t)pattern, n & 3);
+}
+
+/* Fill n bytes at dst with value */
+void* kmemset(void* dst, uint8_t value, uint32_t n) {
+    fill_pattern((uint8_t*)dst, value * 0x01010101u, n);
+    return dst;
+}
+
+/* Fill count 32-bit words at dst with value */
+void kmemset32(void* dst, uint32_t value, uint32_t count) {
+    uint8_t* d = (uint8_t*)dst;
+    if (use_sse2 && count >= SSE2_THRESHOLD / 4 && ((uint32_t)d & 3) == 0) {
+        /* Word-align up to 16 bytes first so the pattern stays in phase */
+        while (((uint32_t)d & 15) != 0) {
+            *(uint32_t*)d = value;
+            d += 4;
+            count--;
+        }
+        fill_sse2(d, value, count >> 4);
+        d += (count & ~15u) << 2;
+        count &= 15;
+    }
+    rep_stosd(d, value, count);
+}
+
+/* Copy n bytes from src to dst (buffers must not overlap) */
+void* kmemcpy(void* dst, const void* src, uint32_t n) {
+    uint8_t* d = (uint8_t*)dst;
+    const uint8_t* s = (const uint8_t*)src;
+    
+    /* Large copies: align destination and move 64-byte blocks */
+    if (use_sse2 && n >= SSE2_THRESHOLD) {
+        uint32_t head = (0u - (uint32_t)d) & 15;
+        rep_movsb(&d, &s, head);
+        n -= head;
+        copy_sse2(d, s, n >> 6);
+        d += n & ~63u;
+        s += n & ~63u;
+        n &= 63;
+    }
+    
+    /* Word-wide copy of the aligned middle */
+    uint32_t head = (0u - (uint32_t)d) & 3;
+    if (head > n) {
+        head = n;
+    }
+    rep_movsb(&d, &s, head);
+    n -= head;
+    rep_movsd(&d, &s, n >> 2);
+    rep_movsb(&d, &s, n & 3);
+    return dst;
+}
+
+/* Copy n bytes from src to dst (buffers may overlap) */
+void* kmemmove(void* dst, const void* src, uint32_t n) {
+    uint8_t* d = (uint8_t*)dst;
+    const uint8_t* s = (const uint8_t*)src;
+    
+    /* Forward copy is safe unless dst starts inside src */
+    if (d <= s || d >= s + n) {
+        return kmemcpy(dst, src, n);
+    }
+    
+    /* Backward copy: odd tail bytes first, then words top-down */
+    while (n & 3) {
+        n--;
+        d[n] = s[n];
+    }
+    uint32_t words = n >> 2;
+    if (words != 0) {
+        uint8_t* dp = d + n - 4;
+        const uint8_t* sp = s + n - 4;
+        __asm__ volatile ("std\n\trep movsl\n\tcld"
+                          : "+D" (dp), "+S" (sp), "+c" (words) : : "memory");
+    }
+    return dst;
+}
+
+/* GCC may emit calls to these even in freestanding code */
+void* memset(void* dst, int value, uint32_t n) {
+    return kmemset(dst, (uint8_t)value, n);
+}
+
+void* memcpy(void* dst, const void* src, uint32_t n) {
+    return kmemcpy(dst, src, n);
+}
+
+void* memmove(void* dst, const void* src, uint32_t n) {
+    return kmemmove(dst, src, n);
+}
+
+int memcmp(const void* a, const void* b, uint32_t n) {
+    const uint8_t* pa = (const uint8_t*)a;
+    const uint8_t* pb = (const uint8_t*)b;
+    for (uint32_t i = 0; i < n; i++) {
+        if (pa[i] != pb[i]) {
+            return pa[i] - pb[i];
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,29 @@
+/* kstring.h - Memory fill and copy routines for JoshOS
+ * 
+ * Word-wide (rep stosd/movsd) implementations with SSE2 paths for large
+ * buffers, selected once at boot.
+ */
+
+#ifndef KSTRING_H
+#define KSTRING_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned int       uint32_t;
+
+/* Pick the fastest implementation for this CPU (after cpu_init) */
+void kstring_init(void);
+
+/* Fill n bytes at dst with value */
+void* kmemset(void* dst, uint8_t value, uint32_t n);
+
+/* Copy n bytes from src to dst (buffers must not overlap) */
+void* kmemcpy(void* dst, const void* src, uint32_t n);
+
+/* Copy n bytes from src to dst (buffers may overlap) */
+void* kmemmove(void* dst, const void* src, uint32_t n);
+
+/* Fill n 32-bit words at dst with value */
+void kmemset32(void* dst, uint32_t value, uint32_t count);
+
+#endif /* KSTRING_H */
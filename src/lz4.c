@@ -0,0 +1,80 @@
+/* lz4.c - LZ4 block decompression for JoshOS
+ *
+ * A sequence is a token byte - literal count in the high nibble, match
+ * length minus 4 in the low one, 15 meaning "more length bytes follow" -
+ * then the literals, then a 16-bit little-endian match offset. The last
+ * sequence has literals only.
+ */
+
+#include "lz4.h"
+
+/* Minimum match length (the token stores length - 4) */
+#define LZ4_MIN_MATCH 4
+
+/* Read a length that continued past its nibble - 0 on truncation */
+static uint8_t read_length(const uint8_t** src, const uint8_t* end, uint32_t* length) {
+    uint8_t byte;
+    do {
+        if (*src >= end) {
+            return 0;
+        }
+        byte = *(*src)++;
+        *length += byte;
+    } while (byte == 255);
+    return 1;
+}
+
+/* Decompress an LZ4 block */
+int32_t lz4_decompress(const uint8_t* src, uint32_t src_size, uint8_t* dst, uint32_t dst_size) {
+    const uint8_t* in = src;
+    const uint8_t* in_end = src + src_size;
+    uint8_t* out = dst;
+    uint8_t* out_end = dst + dst_size;
+
+    while (in < in_end) {
+        uint8_t token = *in++;
+
+        /* Literals */
+        uint32_t literals = token >> 4;
+        if (literals == 15 && !read_length(&in, in_end, &literals)) {
+            return -1;
+        }
+        if (literals > (uint32_t)(in_end - in) || literals > (uint32_t)(out_end - out)) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < literals; i++) {
+            out[i] = in[i];
+        }
+        in += literals;
+        out += literals;
+        if (in == in_end) {
+            break;                        /* Last sequence has no match */
+        }
+
+        /* Match */
+        if (in_end - in < 2) {
+            return -1;
+        }
+        uint32_t offset = in[0] | ((uint32_t) in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (uint32_t)(out - dst)) {
+            return -1;
+        }
+        uint32_t length = token & 0x0F;
+        if (length == 15 && !read_length(&in, in_end, &length)) {
+            return -1;
+        }
+        length += LZ4_MIN_MATCH;
+        if (length > (uint32_t)(out_end - out)) {
+            return -1;
+        }
+
+        /* Byte by byte - the match may overlap what it is copying */
+        const uint8_t* match = out - offset;
+        for (uint32_t i = 0; i < length; i++) {
+            out[i] = match[i];
+        }
+        out += length;
+    }
+    return (int32_t)(out - dst);
+}
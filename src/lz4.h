@@ -0,0 +1,21 @@
+/* lz4.h - LZ4 block decompression for JoshOS
+ *
+ * Decodes the LZ4 block format (no frame header): sequences of a token,
+ * literals and a back reference into what was already written. Every
+ * length and offset is checked, so a corrupt block fails instead of
+ * writing outside the buffer.
+ */
+
+#ifndef LZ4_H
+#define LZ4_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned int       uint32_t;
+typedef signed int         int32_t;
+
+/* Decompress src into dst - returns the bytes written, or -1 if the block
+ * is corrupt or doesn't fit dst_size */
+int32_t lz4_decompress(const uint8_t* src, uint32_t src_size, uint8_t* dst, uint32_t dst_size);
+
+#endif /* LZ4_H */
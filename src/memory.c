@@ -1,36 +1,176 @@
 /* memory.c - Memory management for JoshOS
  * 
- * Implements a simple heap allocator using a linked list of free blocks.
- * This is a basic implementation suitable for kernel use.
+ * Implements a segregated-fit heap allocator. Every block (free or used)
+ * sits in a doubly linked physical list so kfree can find both neighbours
+ * in constant time for coalescing, and free blocks are also
+ * kept in one of several size-class free lists so allocation does not
+ * have to walk the whole heap.
+ * 
+ * The heap is made of regions of pages obtained from the page frame
+ * allocator. It starts with one region and grows by requesting more pages
+ * whenever no free block is large enough.
+ * 
+ * Threads can be preempted in the middle of an allocation, so the public
+ * entry points hold the heap lock (interrupts off) around the internal
+ * heap_alloc/heap_free, which must only be called with it held.
+ *
+ * Small allocations are served by per-CPU magazines in front of the heap:
+ * each CPU keeps two bounded stacks (a loaded and a previous magazine) of
+ * recently freed blocks per magazine class, and kmalloc/kfree touch only
+ * those, with interrupts off but no lock. When both are empty (or both
+ * full) the CPU trades a magazine with the class's depot, which holds
+ * full and empty magazines for all CPUs, so one CPU's frees refill
+ * another's allocations. Blocks in magazines stay allocated as far as the
+ * heap is concerned - they are not coalesced until flushed back.
+ *
+ * Telemetry is kept as it happens instead of by walking the heap: the
+ * free lists keep the free byte count and each class's largest block
+ * (its list is only walked when the last block of that size leaves), the
+ * heap the block count (so used bytes fall out by subtraction), and each
+ * CPU counts the blocks it hands out and takes back per size class,
+ * without a lock. With
+ * NEBULA_HEAP_DEBUG every block also remembers which caller allocated it,
+ * and per-caller counts show leaks and churn.
  */
 
 #include "memory.h"
+#include "pmm.h"
+#include "kstring.h"
+#include "spinlock.h"
+#include "percpu.h"
+#include "trace.h"
+#include "timer.h"
+#ifdef NEBULA_HEAP_DEBUG
+#include "sched.h"
+#include "serial.h"
+#endif
 
 /* Memory block structure - forms a linked list */
 typedef struct MemoryBlock {
     struct MemoryBlock* next;             /* Pointer to next block */
+    struct MemoryBlock* prev;             /* Pointer to previous block */
     uint32_t size;                        /* Size of this block (in bytes) */
     uint8_t free;                         /* 1 if free, 0 if allocated */
+    uint16_t site;                        /* Allocating caller's slot (heap debug) */
 } MemoryBlock;
 
-/* Heap start and end addresses */
-#define HEAP_START 0x1000000              /* Start of heap at 16MB */
-#define HEAP_SIZE  0x100000               /* Heap size: 1MB */
-#define HEAP_END   (HEAP_START + HEAP_SIZE) /* End of heap */
+/* Free list links - stored in the data area of a free block */
+typedef struct FreeLinks {
+    MemoryBlock* next_free;               /* Next free block in same class */
+    MemoryBlock* prev_free;               /* Previous free block in same class */
+} FreeLinks;
 
-/* Initial heap block */
-static MemoryBlock* heap_start = (MemoryBlock*)HEAP_START;
+/* Heap region sizing (page orders) */
+#define HEAP_INITIAL_ORDER  8             /* First region: 1MB */
+#define HEAP_GROW_MIN_ORDER 6             /* Grow by at least 256KB */
+#define HEAP_MAX_REGIONS    32            /* Regions the heap can span */
 
-/* Initialize memory manager */
-void memory_init(void) {
-    /* Initialize first block as one large free block */
-    heap_start->next = NULL;              /* No next block */
-    heap_start->size = HEAP_SIZE - sizeof(MemoryBlock); /* Size minus header */
-    heap_start->free = 1;                 /* Mark as free */
+/* Heap region - a run of pages holding its own chain of blocks */
+typedef struct HeapRegion {
+    uintptr_t start;                      /* First block header */
+    uintptr_t end;                        /* One past the last byte */
+} HeapRegion;
+
+/* krealloc trims a block in place when shrinking by at least this much */
+#define REALLOC_TRIM_MIN 64
+
+/* Classes below this index are served from the next class up without
+ * scanning, so small allocations are O(1) */
+#define SMALL_CLASS_LIMIT 6               /* Sizes below 512 bytes */
+
+/* Magazine classes - class n caches blocks for requests of up to
+ * 2^(n+MIN_SHIFT) bytes; larger requests always go to the heap */
+#define MAGAZINE_MIN_SHIFT 4              /* 16 bytes */
+#define MAGAZINE_CLASSES   6              /* Up to 512 bytes */
+#define MAGAZINE_MAX_SIZE  (1u << (MAGAZINE_MIN_SHIFT + MAGAZINE_CLASSES - 1))
+#define MAGAZINE_CLASS_SIZE(cls) (1u << (MAGAZINE_MIN_SHIFT + (cls)))
+#define MAGAZINE_ROUNDS    14             /* Blocks per magazine (64-byte magazine) */
+#define DEPOT_MAX_FULL     8              /* Full magazines a depot keeps per class */
+
+/* Magazine - a bounded stack of free blocks of one class */
+typedef struct Magazine {
+    struct Magazine* next;                /* Depot list link */
+    uint32_t rounds;                      /* Blocks held */
+    void* objects[MAGAZINE_ROUNDS];
+} Magazine;
+
+/* One CPU's magazines for one class */
+typedef struct {
+    Magazine* loaded;                     /* Allocate from / free to this one */
+    Magazine* previous;                   /* Full or empty, swapped in before the depot */
+} MagazineSlot;
+
+/* One CPU's magazine layer - a cache line of its own, never shared */
+typedef struct {
+    MagazineSlot slots[MAGAZINE_CLASSES];
+    uint32_t hits;                        /* Served from a magazine */
+    uint32_t misses;                      /* Fell through to the heap */
+} __attribute__((aligned(64))) MagazineCpu;
+
+/* Full and empty magazines shared by all CPUs for one class */
+typedef struct {
+    Spinlock lock;
+    Magazine* full;
+    Magazine* empty;
+    uint32_t full_count;
+} __attribute__((aligned(64))) Depot;
+
+static MagazineCpu magazine_cpus[SMP_MAX_CPUS];
+static Depot depots[MAGAZINE_CLASSES];
+
+/* One CPU's allocation counters. A block freed on another CPU than the
+ * one that allocated it drives that CPU's counts negative; only the sum
+ * over all CPUs means anything */
+typedef struct {
+    int32_t live[MEMORY_NUM_CLASSES];     /* Blocks handed out minus taken back */
+    int32_t live_bytes;                   /* Bytes in those blocks */
+} __attribute__((aligned(64))) AllocCpu;
+
+static AllocCpu alloc_cpus[SMP_MAX_CPUS];
+static Magazine* magazine_pool = NULL;    /* Never-used magazines */
+static Spinlock magazine_pool_lock = SPINLOCK_INIT;
+
+/* Heap regions */
+static HeapRegion regions[HEAP_MAX_REGIONS];
+static uint32_t region_count = 0;
+
+/* Size-class free lists */
+static MemoryBlock* free_lists[MEMORY_NUM_CLASSES]; /* Head of each class */
+static uint32_t free_counts[MEMORY_NUM_CLASSES];    /* Blocks in each class */
+static uint32_t nonempty_classes = 0;     /* Bit n set if class n has blocks */
+static uint32_t class_largest[MEMORY_NUM_CLASSES];       /* Biggest block in each class */
+static uint32_t class_largest_count[MEMORY_NUM_CLASSES]; /* Blocks of that size */
+
+/* Heap totals, kept up to date by every operation */
+static uint32_t heap_total = 0;           /* Bytes in all regions */
+static uint32_t heap_free_bytes = 0;      /* Bytes in free blocks (data areas) */
+static uint32_t heap_blocks = 0;          /* Block headers, free or not */
+static uint32_t heap_peak = 0;            /* Most bytes ever in use */
+
+/* krealloc counters */
+static uint32_t realloc_grown = 0;        /* Grown by absorbing next block */
+static uint32_t realloc_trimmed = 0;      /* Shrunk in place */
+static uint32_t realloc_moved = 0;        /* Copied to a new block */
+
+/* Heap lock - interrupts off too, since IRQ handlers may allocate */
+static Spinlock heap_spinlock = SPINLOCK_INIT;
+
+/* Take/release the heap lock */
+static inline uint32_t heap_lock(void) {
+    return spin_lock_irqsave(&heap_spinlock);
 }
 
-/* Allocate memory block of specified size */
-void* kmalloc(uint32_t size) {
+static inline void heap_unlock(uint32_t flags) {
+    spin_unlock_irqrestore(&heap_spinlock, flags);
+}
+
+/* Get free list links stored in a free block's data area */
+static inline FreeLinks* block_links(MemoryBlock* block) {
+    return (FreeLinks*)((uint8_t*)block + sizeof(MemoryBlock));
+}
+
+/* Round a request up to the allocation granularity */
+static inline uint32_t request_size(uint32_t size) {
     /* Align size to 4 bytes (word alignment) */
     size = (size + 3) & ~3;
     
@@ -38,44 +178,341 @@ void* kmalloc(uint32_t size) {
     if (size < sizeof(MemoryBlock)) {
         size = sizeof(MemoryBlock);       /* Minimum size */
     }
+    return size;
+}
+
+/* Map a block size to its size class */
+static inline uint32_t size_class(uint32_t size) {
+    uint32_t log2 = 31 - __builtin_clz(size); /* Index of highest set bit */
+    if (log2 < MEMORY_CLASS_MIN_SHIFT) {
+        return 0;                         /* Smallest class */
+    }
+    log2 -= MEMORY_CLASS_MIN_SHIFT;
+    if (log2 >= MEMORY_NUM_CLASSES) {
+        return MEMORY_NUM_CLASSES - 1;    /* Last class holds everything larger */
+    }
+    return log2;
+}
+
+/* Add a free block to the head of its class list */
+static void free_list_insert(MemoryBlock* block) {
+    uint32_t cls = size_class(block->size);
+    FreeLinks* links = block_links(block);
+    
+    links->prev_free = NULL;              /* New head has no predecessor */
+    links->next_free = free_lists[cls];   /* Old head follows */
+    if (free_lists[cls] != NULL) {
+        block_links(free_lists[cls])->prev_free = block;
+    }
+    free_lists[cls] = block;
     
-    /* Start from beginning of heap */
-    MemoryBlock* current = heap_start;
+    heap_free_bytes += block->size;
+    free_counts[cls]++;
+    nonempty_classes |= 1u << cls;        /* Class now has a block */
+    if (block->size > class_largest[cls]) {
+        class_largest[cls] = block->size; /* New biggest */
+        class_largest_count[cls] = 1;
+    } else if (block->size == class_largest[cls]) {
+        class_largest_count[cls]++;
+    }
+}
+
+/* Find a class's biggest block again after the last one of that size
+ * left - the only time a class list is walked for it */
+static void class_largest_update(uint32_t cls) {
+    class_largest[cls] = 0;
+    class_largest_count[cls] = 0;
+    for (MemoryBlock* current = free_lists[cls]; current != NULL; current = block_links(current)->next_free) {
+        if (current->size > class_largest[cls]) {
+            class_largest[cls] = current->size;
+            class_largest_count[cls] = 1;
+        } else if (current->size == class_largest[cls]) {
+            class_largest_count[cls]++;
+        }
+    }
+}
+
+/* Remove a free block from its class list */
+static void free_list_remove(MemoryBlock* block) {
+    uint32_t cls = size_class(block->size);
+    FreeLinks* links = block_links(block);
     
-    /* Search for free block large enough */
+    if (links->prev_free != NULL) {
+        block_links(links->prev_free)->next_free = links->next_free;
+    } else {
+        free_lists[cls] = links->next_free; /* Block was the head */
+    }
+    if (links->next_free != NULL) {
+        block_links(links->next_free)->prev_free = links->prev_free;
+    }
+    
+    heap_free_bytes -= block->size;
+    free_counts[cls]--;
+    if (free_lists[cls] == NULL) {
+        nonempty_classes &= ~(1u << cls); /* Class is now empty */
+    }
+    if (block->size == class_largest[cls] && --class_largest_count[cls] == 0) {
+        class_largest_update(cls);
+    }
+}
+
+/* First free block of a class that holds at least size bytes, or NULL */
+static MemoryBlock* class_first_fit(uint32_t cls, uint32_t size) {
+    MemoryBlock* current = free_lists[cls];
     while (current != NULL) {
-        /* Check if block is free and large enough */
-        if (current->free && current->size >= size) {
-            /* Check if we can split this block */
-            if (current->size >= size + sizeof(MemoryBlock) + 4) {
-                /* Split block - create new free block after allocation */
-                MemoryBlock* new_block = (MemoryBlock*)((uint8_t*)current + sizeof(MemoryBlock) + size);
-                new_block->next = current->next; /* Link new block */
-                new_block->size = current->size - size - sizeof(MemoryBlock);
-                new_block->free = 1;      /* Mark as free */
-                
-                /* Update current block */
-                current->next = new_block; /* Link to new block */
-                current->size = size;      /* Set allocated size */
-            }
-            
-            /* Mark block as allocated */
-            current->free = 0;            /* 0 = allocated */
-            
-            /* Return pointer to data area (after block header) */
-            return (void*)((uint8_t*)current + sizeof(MemoryBlock));
+        if (current->size >= size) {
+            return current;               /* Found a fit */
+        }
+        current = block_links(current)->next_free;
+    }
+    return NULL;
+}
+
+/* Find a free block of at least size bytes, or NULL */
+static MemoryBlock* find_free_block(uint32_t size) {
+    uint32_t cls = size_class(size);
+    
+    /* Larger classes: first-fit scan of the request's own class only */
+    if (cls >= SMALL_CLASS_LIMIT) {
+        MemoryBlock* block = class_first_fit(cls, size);
+        if (block != NULL) {
+            return block;
         }
-        
-        /* Move to next block */
-        current = current->next;
     }
     
-    /* No free block found - out of memory */
-    return NULL;                          /* Return NULL on failure */
+    /* Every block in a higher class is large enough - take the first one */
+    uint32_t mask = (cls + 1 < MEMORY_NUM_CLASSES) ? nonempty_classes & ~((2u << cls) - 1) : 0;
+    if (mask != 0) {
+        return free_lists[__builtin_ctz(mask)]; /* Lowest non-empty larger class */
+    }
+    
+    /* Small request with nothing larger free - its own class may still fit */
+    if (cls < SMALL_CLASS_LIMIT) {
+        return class_first_fit(cls, size);
+    }
+    return NULL;                          /* No class can satisfy request */
 }
 
-/* Free previously allocated memory */
-void kfree(void* ptr) {
+/* Split block so it holds exactly size bytes, freeing the remainder */
+static void split_block(MemoryBlock* block, uint32_t size) {
+    /* Only split if the remainder can hold a header plus free links */
+    if (block->size < size + sizeof(MemoryBlock) + sizeof(MemoryBlock)) {
+        return;                           /* Too small to split */
+    }
+    
+    /* Create new free block after allocation */
+    MemoryBlock* new_block = (MemoryBlock*)((uint8_t*)block + sizeof(MemoryBlock) + size);
+    new_block->next = block->next;        /* Link new block */
+    new_block->prev = block;
+    if (new_block->next != NULL) {
+        new_block->next->prev = new_block;
+    }
+    new_block->size = block->size - size - sizeof(MemoryBlock);
+    new_block->free = 1;                  /* Mark as free */
+    heap_blocks++;
+    
+    /* Trimming an allocated block can leave the remainder next to a free one */
+    MemoryBlock* after = new_block->next;
+    if (after != NULL && after->free) {
+        free_list_remove(after);
+        new_block->size += sizeof(MemoryBlock) + after->size;
+        new_block->next = after->next;
+        if (new_block->next != NULL) {
+            new_block->next->prev = new_block;
+        }
+        heap_blocks--;
+    }
+    free_list_insert(new_block);
+    
+    /* Update current block */
+    block->next = new_block;              /* Link to new block */
+    block->size = size;                   /* Set allocated size */
+}
+
+/* Check if a block header lies inside one of the heap regions */
+static int heap_contains(uintptr_t addr) {
+    for (uint32_t i = 0; i < region_count; i++) {
+        if (addr >= regions[i].start && addr < regions[i].end) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Add pages to the heap as a region holding one large free block */
+static int heap_add_region(void* base, uint32_t size) {
+    if (region_count >= HEAP_MAX_REGIONS) {
+        return 0;                         /* Region table full */
+    }
+    regions[region_count].start = (uintptr_t)base;
+    regions[region_count].end = (uintptr_t)base + size;
+    region_count++;
+    heap_total += size;
+    heap_blocks++;
+    
+    MemoryBlock* block = (MemoryBlock*)base;
+    block->next = NULL;                   /* No next block */
+    block->prev = NULL;                   /* No previous block */
+    block->size = size - sizeof(MemoryBlock); /* Size minus header */
+    block->free = 1;                      /* Mark as free */
+    free_list_insert(block);
+    return 1;
+}
+
+/* Grow the heap by enough pages to hold an allocation of size bytes */
+static int heap_grow(uint32_t size) {
+    if (region_count >= HEAP_MAX_REGIONS) {
+        return 0;                         /* Region table full */
+    }
+    
+    /* Ask for a generous block, settling for the minimum that fits */
+    uint32_t needed = page_order_for_size(size + sizeof(MemoryBlock));
+    if (((uint32_t)PAGE_SIZE << needed) < size + sizeof(MemoryBlock)) {
+        return 0;                         /* Larger than any page block */
+    }
+    uint32_t order = needed > HEAP_GROW_MIN_ORDER ? needed : HEAP_GROW_MIN_ORDER;
+    void* pages = page_alloc(order);
+    while (pages == NULL && order > needed) {
+        order--;
+        pages = page_alloc(order);
+    }
+    if (pages == NULL) {
+        return 0;                         /* Physical memory exhausted */
+    }
+    
+    return heap_add_region(pages, (uint32_t)PAGE_SIZE << order);
+}
+
+/* Initialize memory manager */
+void memory_init(void) {
+    /* Reset size-class free lists */
+    for (uint32_t i = 0; i < MEMORY_NUM_CLASSES; i++) {
+        free_lists[i] = NULL;
+        free_counts[i] = 0;
+        class_largest[i] = 0;
+        class_largest_count[i] = 0;
+    }
+    nonempty_classes = 0;
+    region_count = 0;
+    heap_total = 0;
+    heap_free_bytes = 0;
+    heap_blocks = 0;
+    heap_peak = 0;
+    kmemset(magazine_cpus, 0, sizeof(magazine_cpus));
+    kmemset(depots, 0, sizeof(depots));
+    magazine_pool = NULL;
+    
+    /* Take the initial heap region from the page allocator */
+    uint32_t order = HEAP_INITIAL_ORDER;
+    void* pages = page_alloc(order);
+    while (pages == NULL && order > 0) {
+        order--;                          /* Small machine - settle for less */
+        pages = page_alloc(order);
+    }
+    if (pages != NULL) {
+        heap_add_region(pages, (uint32_t)PAGE_SIZE << order);
+    }
+}
+
+static void heap_free(void* ptr);
+
+/* Bytes in allocated blocks (heap lock held) */
+static inline uint32_t heap_used(void) {
+    return heap_total - heap_free_bytes - heap_blocks * sizeof(MemoryBlock);
+}
+
+/* Raise the peak after the heap handed out memory (heap lock held) */
+static inline void heap_note_peak(void) {
+    uint32_t used = heap_used();
+    if (used > heap_peak) {
+        heap_peak = used;
+    }
+}
+
+/* Allocate memory block of specified size (heap lock held) */
+static void* heap_alloc(uint32_t size) {
+    /* Align and apply minimum size */
+    size = request_size(size);
+    
+    /* Look up a free block in the size-class lists */
+    MemoryBlock* current = find_free_block(size);
+    if (current == NULL) {
+        /* Nothing fits - request more pages and try again */
+        if (!heap_grow(size)) {
+            return NULL;                  /* Out of memory */
+        }
+        current = find_free_block(size);
+        if (current == NULL) {
+            return NULL;                  /* Out of memory */
+        }
+    }
+    free_list_remove(current);
+    
+    /* Split off whatever is not needed */
+    split_block(current, size);
+    
+    /* Mark block as allocated */
+    current->free = 0;                    /* 0 = allocated */
+    heap_note_peak();
+    
+    /* Return pointer to data area (after block header) */
+    return (void*)((uint8_t*)current + sizeof(MemoryBlock));
+}
+
+/* Allocate memory block whose data area is aligned (heap lock held) */
+static void* heap_alloc_aligned(uint32_t size, uint32_t align) {
+    /* Heap data is always word aligned */
+    if (align <= 4) {
+        return heap_alloc(size);
+    }
+    
+    /* Same size rounding as kmalloc */
+    size = request_size(size);
+    
+    /* Over-allocate so an aligned data area with room for a free block in
+     * front of it is guaranteed to exist */
+    void* ptr = heap_alloc(size + align + 2 * sizeof(MemoryBlock));
+    if (ptr == NULL) {
+        return NULL;                      /* Out of memory */
+    }
+    
+    uintptr_t data = (uintptr_t)ptr;
+    uintptr_t aligned = (data + align - 1) & ~(uintptr_t)(align - 1);
+    if (aligned == data) {
+        MemoryBlock* block = (MemoryBlock*)(data - sizeof(MemoryBlock));
+        split_block(block, size);         /* Already aligned - just trim */
+        return ptr;
+    }
+    
+    /* The gap in front must be able to become a free block */
+    while (aligned - data < 2 * sizeof(MemoryBlock)) {
+        aligned += align;
+    }
+    
+    /* Carve a new block header right before the aligned address */
+    MemoryBlock* front = (MemoryBlock*)(data - sizeof(MemoryBlock));
+    MemoryBlock* block = (MemoryBlock*)(aligned - sizeof(MemoryBlock));
+    uint32_t gap = aligned - data;
+    block->next = front->next;
+    block->prev = front;
+    if (block->next != NULL) {
+        block->next->prev = block;
+    }
+    block->size = front->size - gap;
+    block->free = 0;                      /* Allocated */
+    front->next = block;
+    front->size = gap - sizeof(MemoryBlock);
+    heap_blocks++;
+    
+    /* Give the front gap back to the heap and trim the tail */
+    heap_free(ptr);
+    split_block(block, size);
+    
+    return (void*)aligned;
+}
+
+/* Free previously allocated memory (heap lock held) */
+static void heap_free(void* ptr) {
     /* Check for NULL pointer */
     if (ptr == NULL) {
         return;                           /* Nothing to free */
@@ -84,13 +521,13 @@ void kfree(void* ptr) {
     /* Get block header (before data area) */
     MemoryBlock* block = (MemoryBlock*)((uint8_t*)ptr - sizeof(MemoryBlock));
     
-    /* Check if pointer is valid - use uintptr_t for safe pointer comparison */
-    /* Cast to void* first to avoid pointer-to-int cast warning on some compilers */
-    void* block_ptr = (void*)block;
-    uintptr_t addr = (uintptr_t)block_ptr;
-    if (addr < (uintptr_t)HEAP_START || addr >= (uintptr_t)HEAP_END) {
+    /* Check if pointer is valid */
+    if (!heap_contains((uintptr_t)block)) {
         return;                           /* Invalid pointer */
     }
+    if (block->free) {
+        return;                           /* Double free - ignore */
+    }
     
     /* Mark block as free */
     block->free = 1;                      /* 1 = free */
@@ -98,21 +535,379 @@ void kfree(void* ptr) {
     /* Try to merge with next block if it's also free */
     if (block->next != NULL && block->next->free) {
         /* Merge blocks */
+        free_list_remove(block->next);
         block->size += sizeof(MemoryBlock) + block->next->size;
         block->next = block->next->next;  /* Skip next block */
+        if (block->next != NULL) {
+            block->next->prev = block;
+        }
+        heap_blocks--;
     }
     
     /* Try to merge with previous block if it's free */
-    MemoryBlock* prev = heap_start;
-    while (prev != NULL && prev->next != block) {
-        prev = prev->next;                /* Find previous block */
-    }
-    
+    MemoryBlock* prev = block->prev;
     if (prev != NULL && prev->free) {
         /* Merge with previous block */
+        free_list_remove(prev);
         prev->size += sizeof(MemoryBlock) + block->size;
         prev->next = block->next;         /* Skip current block */
+        if (prev->next != NULL) {
+            prev->next->prev = prev;
+        }
+        heap_blocks--;
+        block = prev;
+    }
+    
+    /* Put the (possibly merged) block back in its class */
+    free_list_insert(block);
+}
+
+/* Smallest magazine class whose requests cover size bytes */
+static inline uint32_t magazine_class(uint32_t size) {
+    if (size <= MAGAZINE_CLASS_SIZE(0)) {
+        return 0;
+    }
+    return 32 - __builtin_clz(size - 1) - MAGAZINE_MIN_SHIFT;
+}
+
+/* Check if a block is what heap_alloc returns for a class-sized request -
+ * only those are cached, so a magazine never hoards oversized blocks */
+static uint8_t magazine_cacheable(MemoryBlock* block, uint32_t* cls) {
+    if (!heap_contains((uintptr_t)block) || block->free ||
+        block->size < MAGAZINE_CLASS_SIZE(0) || block->size >= 2 * MAGAZINE_MAX_SIZE) {
+        return 0;
     }
+    uint32_t floor = 31 - __builtin_clz(block->size) - MAGAZINE_MIN_SHIFT;
+    if (floor >= MAGAZINE_CLASSES) {
+        floor = MAGAZINE_CLASSES - 1;
+    }
+    if (block->size - MAGAZINE_CLASS_SIZE(floor) >= 2 * sizeof(MemoryBlock)) {
+        return 0;                         /* More slack than split_block leaves */
+    }
+    *cls = floor;
+    return 1;
+}
+
+/* Give every block in a magazine back to the heap */
+static void magazine_flush(Magazine* mag) {
+    uint32_t flags = heap_lock();
+    while (mag->rounds > 0) {
+        heap_free(mag->objects[--mag->rounds]);
+    }
+    heap_unlock(flags);
+}
+
+/* Get an empty magazine - they are carved from whole pages, not the
+ * heap, so they never pin heap blocks apart */
+static Magazine* magazine_new(void) {
+    spin_lock(&magazine_pool_lock);
+    if (magazine_pool == NULL) {
+        Magazine* page = (Magazine*) page_alloc(0);
+        for (uint32_t i = 0; page != NULL && i < PAGE_SIZE / sizeof(Magazine); i++) {
+            page[i].next = magazine_pool;
+            magazine_pool = &page[i];
+        }
+    }
+    Magazine* mag = magazine_pool;
+    if (mag != NULL) {
+        magazine_pool = mag->next;
+        mag->next = NULL;
+        mag->rounds = 0;
+    }
+    spin_unlock(&magazine_pool_lock);
+    return mag;
+}
+
+/* Both magazines empty - trade the empty previous one for a full one
+ * from the depot. Returns 0 if the depot has none */
+static uint8_t depot_take_full(uint32_t cls, MagazineSlot* slot) {
+    Depot* depot = &depots[cls];
+    spin_lock(&depot->lock);
+    Magazine* full = depot->full;
+    if (full == NULL) {
+        spin_unlock(&depot->lock);
+        return 0;
+    }
+    depot->full = full->next;
+    depot->full_count--;
+    if (slot->previous != NULL) {
+        slot->previous->next = depot->empty;
+        depot->empty = slot->previous;
+    }
+    spin_unlock(&depot->lock);
+
+    slot->previous = slot->loaded;
+    slot->loaded = full;
+    return 1;
+}
+
+/* Both magazines full - hand the full previous one to the depot and load
+ * an empty one. A depot already holding its limit gets nothing: the
+ * magazine is flushed to the heap and reused. Returns 0 if no magazine
+ * could be had */
+static uint8_t depot_take_empty(uint32_t cls, MagazineSlot* slot) {
+    Depot* depot = &depots[cls];
+    Magazine* previous = slot->previous;
+    Magazine* empty = NULL;
+
+    spin_lock(&depot->lock);
+    if (previous != NULL && depot->full_count < DEPOT_MAX_FULL) {
+        previous->next = depot->full;
+        depot->full = previous;
+        depot->full_count++;
+        previous = NULL;
+    }
+    if (previous == NULL && depot->empty != NULL) {
+        empty = depot->empty;
+        depot->empty = empty->next;
+    }
+    spin_unlock(&depot->lock);
+
+    if (previous != NULL) {
+        magazine_flush(previous);         /* Depot saturated */
+        empty = previous;
+    } else if (empty == NULL) {
+        empty = magazine_new();
+        if (empty == NULL) {
+            slot->previous = NULL;        /* Already handed to the depot */
+            return 0;
+        }
+    }
+
+    slot->previous = slot->loaded;
+    slot->loaded = empty;
+    return 1;
+}
+
+/* Take a block of a class from this CPU's magazines, or NULL */
+static void* magazine_alloc(uint32_t cls) {
+    uint32_t flags = interrupts_save();   /* Stay on this CPU, keep IRQs out */
+    MagazineCpu* mc = &magazine_cpus[cpu_index()];
+    MagazineSlot* slot = &mc->slots[cls];
+
+    if (slot->loaded == NULL || slot->loaded->rounds == 0) {
+        if (slot->previous != NULL && slot->previous->rounds > 0) {
+            Magazine* swap = slot->loaded;
+            slot->loaded = slot->previous;
+            slot->previous = swap;
+        } else if (!depot_take_full(cls, slot)) {
+            mc->misses++;
+            interrupts_restore(flags);
+            return NULL;
+        }
+    }
+
+    void* ptr = slot->loaded->objects[--slot->loaded->rounds];
+    mc->hits++;
+    interrupts_restore(flags);
+    return ptr;
+}
+
+/* Put a block of a class into this CPU's magazines - returns 0 if it
+ * must go to the heap instead */
+static uint8_t magazine_free(uint32_t cls, void* ptr) {
+    uint32_t flags = interrupts_save();
+    MagazineSlot* slot = &magazine_cpus[cpu_index()].slots[cls];
+
+    if (slot->loaded == NULL || slot->loaded->rounds == MAGAZINE_ROUNDS) {
+        if (slot->previous != NULL && slot->previous->rounds < MAGAZINE_ROUNDS) {
+            Magazine* swap = slot->loaded;
+            slot->loaded = slot->previous;
+            slot->previous = swap;
+        } else if (!depot_take_empty(cls, slot)) {
+            interrupts_restore(flags);
+            return 0;
+        }
+    }
+
+    slot->loaded->objects[slot->loaded->rounds++] = ptr;
+    interrupts_restore(flags);
+    return 1;
+}
+
+/* Flush this CPU's magazines and every full magazine in the depots back
+ * to the heap - used when the heap runs dry while blocks sit cached.
+ * Other CPUs' magazines are theirs alone and stay as they are */
+static uint8_t magazine_reclaim(void) {
+    uint8_t reclaimed = 0;
+    uint32_t flags = interrupts_save();
+    MagazineSlot* slots = magazine_cpus[cpu_index()].slots;
+    for (uint32_t cls = 0; cls < MAGAZINE_CLASSES; cls++) {
+        Magazine* mags[2] = { slots[cls].loaded, slots[cls].previous };
+        for (uint32_t i = 0; i < 2; i++) {
+            if (mags[i] != NULL && mags[i]->rounds > 0) {
+                magazine_flush(mags[i]);
+                reclaimed = 1;
+            }
+        }
+
+        Depot* depot = &depots[cls];
+        spin_lock(&depot->lock);
+        while (depot->full != NULL) {
+            Magazine* mag = depot->full;
+            depot->full = mag->next;
+            depot->full_count--;
+            magazine_flush(mag);
+            mag->next = depot->empty;
+            depot->empty = mag;
+            reclaimed = 1;
+        }
+        spin_unlock(&depot->lock);
+    }
+    interrupts_restore(flags);
+    return reclaimed;
+}
+
+/* Allocate from the magazines, falling back to the heap */
+static void* allocate(uint32_t size) {
+    if (size <= MAGAZINE_MAX_SIZE) {
+        uint32_t cls = magazine_class(size);
+        void* ptr = magazine_alloc(cls);
+        if (ptr != NULL) {
+            return ptr;
+        }
+        size = MAGAZINE_CLASS_SIZE(cls);  /* Sized so kfree can cache it */
+    }
+
+    uint32_t flags = heap_lock();
+    void* ptr = heap_alloc(size);
+    heap_unlock(flags);
+    if (ptr == NULL && magazine_reclaim()) {
+        flags = heap_lock();
+        ptr = heap_alloc(size);           /* Cached blocks may have coalesced */
+        heap_unlock(flags);
+    }
+    return ptr;
+}
+
+#ifdef NEBULA_HEAP_DEBUG
+/* Allocation sites - slot 0 takes the callers that found the table full */
+#define HEAP_SITE_BITS 8
+#define HEAP_SITES     (1u << HEAP_SITE_BITS)
+
+/* How often the site report is sent */
+#define HEAP_REPORT_INTERVAL_NS (10 * NS_PER_SEC)
+
+/* Counts for one allocating caller */
+typedef struct {
+    uint32_t caller;                      /* Return address of the allocating call */
+    uint32_t allocs;                      /* Blocks it allocated */
+    uint32_t frees;                       /* Of those, blocks freed again */
+    uint32_t live_bytes;                  /* Bytes still allocated */
+} HeapSite;
+
+static HeapSite heap_sites[HEAP_SITES];
+static Spinlock site_lock = SPINLOCK_INIT;
+
+/* Slot of a caller, claiming a free one if it is new (site lock held) */
+static uint16_t site_slot(uint32_t caller) {
+    uint32_t home = (caller * 2654435761u) >> (32 - HEAP_SITE_BITS);
+    for (uint32_t probe = 0; probe < HEAP_SITES; probe++) {
+        uint32_t i = (home + probe) & (HEAP_SITES - 1);
+        if (i == 0) {
+            continue;                     /* Overflow slot */
+        }
+        if (heap_sites[i].caller == caller) {
+            return i;
+        }
+        if (heap_sites[i].caller == 0) {
+            heap_sites[i].caller = caller;
+            return i;
+        }
+    }
+    return 0;
+}
+
+/* The caller of a public entry point is the allocation site */
+#define ALLOC_CALLER() ((uint32_t) __builtin_return_address(0))
+#else
+#define ALLOC_CALLER() 0
+#endif
+
+/* Count a block handed out to a caller */
+static void account_alloc(void* ptr, uint32_t caller) {
+    MemoryBlock* block = (MemoryBlock*)((uint8_t*)ptr - sizeof(MemoryBlock));
+    uint32_t flags = interrupts_save();   /* Stay on this CPU */
+    AllocCpu* ac = &alloc_cpus[cpu_index()];
+    ac->live[size_class(block->size)]++;
+    ac->live_bytes += block->size;
+    interrupts_restore(flags);
+#ifdef NEBULA_HEAP_DEBUG
+    flags = spin_lock_irqsave(&site_lock);
+    block->site = site_slot(caller);
+    heap_sites[block->site].allocs++;
+    heap_sites[block->site].live_bytes += block->size;
+    spin_unlock_irqrestore(&site_lock, flags);
+#else
+    (void)caller;
+#endif
+}
+
+/* Count a block given back - returns 0 if it isn't an allocated heap block */
+static uint8_t account_free(void* ptr) {
+    MemoryBlock* block = (MemoryBlock*)((uint8_t*)ptr - sizeof(MemoryBlock));
+    if (!heap_contains((uintptr_t)block) || block->free) {
+        return 0;
+    }
+    uint32_t flags = interrupts_save();
+    AllocCpu* ac = &alloc_cpus[cpu_index()];
+    ac->live[size_class(block->size)]--;
+    ac->live_bytes -= block->size;
+    interrupts_restore(flags);
+#ifdef NEBULA_HEAP_DEBUG
+    flags = spin_lock_irqsave(&site_lock);
+    heap_sites[block->site].frees++;
+    heap_sites[block->site].live_bytes -= block->size;
+    spin_unlock_irqrestore(&site_lock, flags);
+#endif
+    return 1;
+}
+
+/* Allocate memory block of specified size */
+void* kmalloc(uint32_t size) {
+    TRACE_BEGIN(TRACE_KMALLOC);
+    void* ptr = allocate(size);
+    if (ptr != NULL) {
+        account_alloc(ptr, ALLOC_CALLER());
+    }
+    TRACE_END(TRACE_KMALLOC);
+    return ptr;
+}
+
+/* Allocate memory block whose data area is aligned to align bytes */
+void* kmalloc_aligned(uint32_t size, uint32_t align) {
+    uint32_t flags = heap_lock();
+    void* ptr = heap_alloc_aligned(size, align);
+    heap_unlock(flags);
+    if (ptr != NULL) {
+        account_alloc(ptr, ALLOC_CALLER());
+    }
+    return ptr;
+}
+
+/* Return a block to its magazine or the heap */
+static void release(void* ptr) {
+    uint32_t cls;
+    if (magazine_cacheable((MemoryBlock*)((uint8_t*)ptr - sizeof(MemoryBlock)), &cls) &&
+        magazine_free(cls, ptr)) {
+        return;
+    }
+
+    uint32_t flags = heap_lock();
+    heap_free(ptr);
+    heap_unlock(flags);
+}
+
+/* Free previously allocated memory */
+void kfree(void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    TRACE_BEGIN(TRACE_KFREE);
+    if (account_free(ptr)) {
+        release(ptr);                     /* Anything else is not ours - ignore */
+    }
+    TRACE_END(TRACE_KFREE);
 }
 
 /* Allocate and zero-initialize memory */
@@ -121,24 +916,22 @@ void* kcalloc(uint32_t num, uint32_t size) {
     uint32_t total_size = num * size;
     
     /* Allocate memory */
-    void* ptr = kmalloc(total_size);
+    void* ptr = allocate(total_size);
     
     /* Zero out memory if allocation succeeded */
     if (ptr != NULL) {
-        uint8_t* byte_ptr = (uint8_t*)ptr;
-        for (uint32_t i = 0; i < total_size; i++) {
-            byte_ptr[i] = 0;              /* Set each byte to 0 */
-        }
+        account_alloc(ptr, ALLOC_CALLER());
+        kmemset(ptr, 0, total_size);
     }
     
     return ptr;                           /* Return pointer */
 }
 
-/* Reallocate memory block */
-void* krealloc(void* ptr, uint32_t new_size) {
+/* Reallocate memory block (heap lock held) */
+static void* heap_realloc(void* ptr, uint32_t new_size) {
     /* If NULL, same as malloc */
     if (ptr == NULL) {
-        return kmalloc(new_size);         /* Allocate new block */
+        return heap_alloc(new_size);      /* Allocate new block */
     }
     
     /* Get block header */
@@ -146,50 +939,218 @@ void* krealloc(void* ptr, uint32_t new_size) {
     
     /* If new size is 0, same as free */
     if (new_size == 0) {
-        kfree(ptr);                       /* Free block */
+        heap_free(ptr);                   /* Free block */
         return NULL;                      /* Return NULL */
     }
     
+    if (!heap_contains((uintptr_t)block) || block->free) {
+        return NULL;                      /* Invalid pointer */
+    }
+    new_size = request_size(new_size);
+    
     /* If new size is same or smaller, return same pointer */
     if (block->size >= new_size) {
+        /* Give a large enough tail back to the heap */
+        if (block->size - new_size >= REALLOC_TRIM_MIN) {
+            split_block(block, new_size);
+            realloc_trimmed++;
+        }
         return ptr;                       /* No need to reallocate */
     }
     
+    /* Grow in place by absorbing the next block if it is free and big enough */
+    MemoryBlock* next = block->next;
+    if (next != NULL && next->free && block->size + sizeof(MemoryBlock) + next->size >= new_size) {
+        free_list_remove(next);
+        block->size += sizeof(MemoryBlock) + next->size;
+        block->next = next->next;         /* Skip next block */
+        if (block->next != NULL) {
+            block->next->prev = block;
+        }
+        heap_blocks--;
+        split_block(block, new_size);     /* Return what is left over */
+        heap_note_peak();
+        realloc_grown++;
+        return ptr;
+    }
+    
     /* Allocate new block */
-    void* new_ptr = kmalloc(new_size);
+    void* new_ptr = heap_alloc(new_size);
     
     /* Copy data if allocation succeeded */
     if (new_ptr != NULL) {
-        uint8_t* old_byte = (uint8_t*)ptr;
-        uint8_t* new_byte = (uint8_t*)new_ptr;
-        
         /* Copy old data */
-        for (uint32_t i = 0; i < block->size && i < new_size; i++) {
-            new_byte[i] = old_byte[i];    /* Copy each byte */
-        }
+        kmemcpy(new_ptr, ptr, block->size < new_size ? block->size : new_size);
         
         /* Free old block */
-        kfree(ptr);
+        heap_free(ptr);
+        realloc_moved++;
     }
     
     return new_ptr;                       /* Return new pointer */
 }
 
-/* Get memory statistics */
+/* Reallocate memory block */
+void* krealloc(void* ptr, uint32_t new_size) {
+    /* Counted as a free and a new allocation, whether it moved or not */
+    uint8_t counted = ptr != NULL && account_free(ptr);
+    uint32_t flags = heap_lock();
+    void* new_ptr = heap_realloc(ptr, new_size);
+    heap_unlock(flags);
+    if (new_ptr != NULL) {
+        account_alloc(new_ptr, ALLOC_CALLER());
+    } else if (counted && new_size != 0) {
+        account_alloc(ptr, ALLOC_CALLER()); /* Failed - the old block is still live */
+    }
+    return new_ptr;
+}
+
+/* Size of the largest free block. Every block in the highest non-empty
+ * class is bigger than all those below it, so it is that class's biggest
+ * (heap lock held) */
+static inline uint32_t heap_largest_free(void) {
+    if (nonempty_classes == 0) {
+        return 0;
+    }
+    return class_largest[31 - __builtin_clz(nonempty_classes)];
+}
+
+/* Get memory statistics - read off the counters, nothing is walked */
 void memory_get_stats(uint32_t* total, uint32_t* used, uint32_t* free) {
-    *total = HEAP_SIZE;                   /* Total heap size */
-    *used = 0;                            /* Initialize used counter */
-    *free = 0;                            /* Initialize free counter */
+    uint32_t flags = heap_lock();
+    *total = heap_total;
+    *used = heap_used();
+    *free = heap_free_bytes;
+    heap_unlock(flags);
+}
+
+/* Get heap telemetry */
+void memory_get_telemetry(MemoryStats* stats) {
+    uint32_t flags = heap_lock();
+    stats->total = heap_total;
+    stats->used = heap_used();
+    stats->free = heap_free_bytes;
+    stats->peak = heap_peak;
+    stats->largest_free = heap_largest_free();
+    heap_unlock(flags);
     
-    /* Traverse all blocks */
-    MemoryBlock* current = heap_start;
-    while (current != NULL) {
-        if (current->free) {
-            *free += current->size;       /* Add to free counter */
-        } else {
-            *used += current->size;       /* Add to used counter */
+    /* Free memory outside the largest block, in parts per thousand */
+    stats->fragmentation = 0;
+    if (stats->free != 0) {
+        stats->fragmentation = (uint32_t) udiv64((uint64_t)(stats->free - stats->largest_free) * 1000,
+                                                 stats->free, NULL);
+    }
+    
+    /* Per-CPU counts change under us - a snapshot is enough */
+    int32_t bytes = 0;
+    int32_t blocks = 0;
+    for (uint32_t cls = 0; cls < MEMORY_NUM_CLASSES; cls++) {
+        int32_t live = 0;
+        for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            live += alloc_cpus[cpu].live[cls];
         }
-        current = current->next;          /* Move to next block */
+        stats->class_counts[cls] = live > 0 ? (uint32_t) live : 0;
+        blocks += live;
+    }
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        bytes += alloc_cpus[cpu].live_bytes;
+    }
+    stats->allocations = blocks > 0 ? (uint32_t) blocks : 0;
+    stats->allocated = bytes > 0 ? (uint32_t) bytes : 0;
+}
+
+
+/* Get number of free blocks in each size class */
+void memory_get_class_stats(uint32_t counts[MEMORY_NUM_CLASSES]) {
+    for (uint32_t i = 0; i < MEMORY_NUM_CLASSES; i++) {
+        counts[i] = free_counts[i];       /* Maintained on insert/remove */
     }
 }
 
+/* Get magazine layer statistics */
+void memory_get_magazine_stats(uint32_t* cached, uint32_t* hits, uint32_t* misses) {
+    *cached = 0;
+    *hits = 0;
+    *misses = 0;
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        MagazineCpu* mc = &magazine_cpus[cpu];
+        for (uint32_t cls = 0; cls < MAGAZINE_CLASSES; cls++) {
+            /* Other CPUs' magazines change under us - a snapshot is enough */
+            Magazine* loaded = mc->slots[cls].loaded;
+            Magazine* previous = mc->slots[cls].previous;
+            *cached += (loaded != NULL ? loaded->rounds : 0) + (previous != NULL ? previous->rounds : 0);
+        }
+        *hits += mc->hits;
+        *misses += mc->misses;
+    }
+    for (uint32_t cls = 0; cls < MAGAZINE_CLASSES; cls++) {
+        uint32_t flags = spin_lock_irqsave(&depots[cls].lock);
+        *cached += depots[cls].full_count * MAGAZINE_ROUNDS;
+        spin_unlock_irqrestore(&depots[cls].lock, flags);
+    }
+}
+
+/* Get krealloc statistics */
+void memory_get_realloc_stats(uint32_t* grown, uint32_t* trimmed, uint32_t* moved) {
+    *grown = realloc_grown;               /* Grew into next block */
+    *trimmed = realloc_trimmed;           /* Shrank in place */
+    *moved = realloc_moved;               /* Needed a new block and copy */
+}
+
+#ifdef NEBULA_HEAP_DEBUG
+/* Send the heap totals and every allocation site to serial */
+static void memory_report(void) {
+    MemoryStats stats;
+    memory_get_telemetry(&stats);
+    serial_write("H heap ");
+    serial_write_dec(stats.used, 0);
+    serial_write(" used ");
+    serial_write_dec(stats.peak, 0);
+    serial_write(" peak ");
+    serial_write_dec(stats.free, 0);
+    serial_write(" free ");
+    serial_write_dec(stats.largest_free, 0);
+    serial_write(" largest ");
+    serial_write_dec(stats.fragmentation, 0);
+    serial_write(" frag/1000 ");
+    serial_write_dec(stats.allocations, 0);
+    serial_write(" blocks\n");
+    
+    for (uint32_t i = 0; i < HEAP_SITES; i++) {
+        /* Copy under the lock, print without it */
+        uint32_t flags = spin_lock_irqsave(&site_lock);
+        HeapSite site = heap_sites[i];
+        spin_unlock_irqrestore(&site_lock, flags);
+        if (site.allocs == 0) {
+            continue;
+        }
+        serial_write("H site ");
+        serial_write_hex(site.caller);
+        serial_write(" ");
+        serial_write_dec(site.allocs, 0);
+        serial_write(" allocs ");
+        serial_write_dec(site.frees, 0);
+        serial_write(" frees ");
+        serial_write_dec(site.live_bytes, 0);
+        serial_write(" live\n");
+    }
+}
+
+/* Report the heap, forever */
+static void memory_report_thread(void* arg) {
+    (void)arg;
+    while (1) {
+        thread_sleep(HEAP_REPORT_INTERVAL_NS);
+        memory_report();
+    }
+}
+
+/* Start the allocation site reports */
+void memory_debug_start(void) {
+    if (!serial_present()) {
+        return;                           /* Sites are still counted */
+    }
+    serial_write("heap: site tracking on\n");
+    thread_create("heap", memory_report_thread, NULL, SCHED_PRIORITY_LOW);
+}
+#endif /* NEBULA_HEAP_DEBUG */
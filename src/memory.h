@@ -6,19 +6,42 @@
 /* Standard integer types */
 typedef unsigned char      uint8_t;
 typedef unsigned int       uint32_t;
-typedef unsigned long long uintptr_t;  /* Pointer-sized unsigned integer */
+typedef unsigned int       uintptr_t;  /* Pointer-sized unsigned integer */
 
 /* NULL pointer definition */
 #ifndef NULL
 #define NULL ((void*)0)
 #endif
 
+/* Size classes - class n holds free blocks of 2^(n+MIN_SHIFT) bytes up to
+ * (but not including) twice that; the last class holds everything larger */
+#define MEMORY_CLASS_MIN_SHIFT 3          /* Smallest class starts at 8 bytes */
+#define MEMORY_NUM_CLASSES     24         /* Last class starts at 64MB */
+
+/* Heap telemetry - every figure is kept up to date as memory is
+ * allocated and freed, so reading it costs the same however big the
+ * heap is. Block sizes are data bytes, headers not included */
+typedef struct {
+    uint32_t total;                       /* Bytes in heap regions */
+    uint32_t used;                        /* Bytes in allocated blocks (magazines included) */
+    uint32_t free;                        /* Bytes in free blocks */
+    uint32_t peak;                        /* Highest used so far */
+    uint32_t largest_free;                /* Biggest single free block */
+    uint32_t fragmentation;               /* Free bytes outside the largest block, per 1000 */
+    uint32_t allocations;                 /* Blocks held by callers (magazines excluded) */
+    uint32_t allocated;                   /* Bytes in those blocks */
+    uint32_t class_counts[MEMORY_NUM_CLASSES]; /* Blocks held by callers per size class */
+} MemoryStats;
+
 /* Initialize memory manager */
 void memory_init(void);
 
 /* Allocate memory block */
 void* kmalloc(uint32_t size);
 
+/* Allocate memory block with data aligned to align bytes (power of two) */
+void* kmalloc_aligned(uint32_t size, uint32_t align);
+
 /* Free previously allocated memory */
 void kfree(void* ptr);
 
@@ -28,8 +51,31 @@ void* kcalloc(uint32_t num, uint32_t size);
 /* Reallocate memory block */
 void* krealloc(void* ptr, uint32_t new_size);
 
-/* Get memory statistics */
+/* Get memory statistics (blocks cached in magazines count as used) */
 void memory_get_stats(uint32_t* total, uint32_t* used, uint32_t* free);
 
+/* Get the full heap telemetry */
+void memory_get_telemetry(MemoryStats* stats);
+
+/* Get number of free blocks in each size class */
+void memory_get_class_stats(uint32_t counts[MEMORY_NUM_CLASSES]);
+
+/* Get blocks cached in the per-CPU magazines and depots, and how many
+ * small allocations they served or missed */
+void memory_get_magazine_stats(uint32_t* cached, uint32_t* hits, uint32_t* misses);
+
+/* Get how often krealloc grew or shrank in place versus moving */
+void memory_get_realloc_stats(uint32_t* grown, uint32_t* trimmed, uint32_t* moved);
+
+#ifdef NEBULA_HEAP_DEBUG
+/* Report allocation sites and heap totals over serial every few seconds
+ * (after sched_init). Sites are return addresses - look them up with
+ * addr2line against the kernel */
+void memory_debug_start(void);
+#else
+static inline void memory_debug_start(void) {
+}
+#endif
+
 #endif /* MEMORY_H */
 
@@ -0,0 +1,85 @@
+/* multiboot.h - Multiboot (version 1) structures for JoshOS
+ * 
+ * Describes the information block GRUB passes to the kernel in %ebx.
+ */
+
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned short     uint16_t;
+typedef unsigned int       uint32_t;
+typedef unsigned long long uint64_t;
+
+/* Value left in %eax by a Multiboot-compliant bootloader */
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+/* Multiboot info flags - which fields are valid */
+#define MULTIBOOT_INFO_MEMORY   0x00000001  /* mem_lower/mem_upper */
+#define MULTIBOOT_INFO_MODS     0x00000008  /* mods_count/mods_addr */
+#define MULTIBOOT_INFO_MEM_MAP  0x00000040  /* mmap_length/mmap_addr */
+#define MULTIBOOT_INFO_FRAMEBUFFER 0x00001000 /* framebuffer_* */
+
+/* Framebuffer types */
+#define MULTIBOOT_FRAMEBUFFER_INDEXED  0    /* Palette */
+#define MULTIBOOT_FRAMEBUFFER_RGB      1    /* Direct color */
+#define MULTIBOOT_FRAMEBUFFER_EGA_TEXT 2    /* Text mode */
+
+/* Memory map entry types */
+#define MULTIBOOT_MEMORY_AVAILABLE 1        /* Usable RAM */
+
+/* Multiboot information structure */
+typedef struct {
+    uint32_t flags;                       /* Which fields below are valid */
+    uint32_t mem_lower;                   /* KB of memory below 1MB */
+    uint32_t mem_upper;                   /* KB of memory above 1MB */
+    uint32_t boot_device;                 /* BIOS boot device */
+    uint32_t cmdline;                     /* Kernel command line */
+    uint32_t mods_count;                  /* Number of boot modules */
+    uint32_t mods_addr;                   /* Address of module list */
+    uint32_t syms[4];                     /* Symbol table info (unused) */
+    uint32_t mmap_length;                 /* Size of memory map in bytes */
+    uint32_t mmap_addr;                   /* Address of memory map */
+    uint32_t drives_length;               /* Size of drive list */
+    uint32_t drives_addr;                 /* Address of drive list */
+    uint32_t config_table;                /* ROM configuration table */
+    uint32_t boot_loader_name;            /* Bootloader name string */
+    uint32_t apm_table;                   /* APM table */
+    uint32_t vbe_control_info;            /* VBE controller info */
+    uint32_t vbe_mode_info;               /* VBE mode info */
+    uint16_t vbe_mode;                    /* Current VBE mode */
+    uint16_t vbe_interface_seg;           /* VBE protected mode interface */
+    uint16_t vbe_interface_off;
+    uint16_t vbe_interface_len;
+    uint64_t framebuffer_addr;            /* Physical address of the framebuffer */
+    uint32_t framebuffer_pitch;           /* Bytes per row */
+    uint32_t framebuffer_width;           /* Pixels (characters in text mode) */
+    uint32_t framebuffer_height;
+    uint8_t framebuffer_bpp;
+    uint8_t framebuffer_type;
+    uint8_t red_field_position;           /* Direct-color layout (RGB type only) */
+    uint8_t red_mask_size;
+    uint8_t green_field_position;
+    uint8_t green_mask_size;
+    uint8_t blue_field_position;
+    uint8_t blue_mask_size;
+} __attribute__((packed)) MultibootInfo;
+
+/* Memory map entry - size does not include the size field itself */
+typedef struct {
+    uint32_t size;                        /* Size of rest of entry */
+    uint64_t addr;                        /* Start of region */
+    uint64_t len;                         /* Length of region */
+    uint32_t type;                        /* Region type */
+} __attribute__((packed)) MultibootMmapEntry;
+
+/* Boot module - one entry of the mods_addr list */
+typedef struct {
+    uint32_t mod_start;                   /* First byte of the module */
+    uint32_t mod_end;                     /* One past its last byte */
+    uint32_t string;                      /* Command line (NUL-terminated) */
+    uint32_t reserved;
+} __attribute__((packed)) MultibootModule;
+
+#endif /* MULTIBOOT_H */
@@ -1,13 +1,119 @@
 /* nebula_ui.c - NEBULA OS User Interface Implementation
  * 
  * Implements the complete NEBULA OS graphical interface.
+ * 
+ * The interface is kept as a retained scene: the background, top bar,
+ * sidebar, each app tile, the info panel and the dock are nodes with a
+ * bounding box and a dirty flag. State changes only dirty the nodes they
+ * affect, and nebula_ui_update redraws each damaged box by clipping to it
+ * and repainting the nodes that overlap it in back-to-front order.
+ * 
+ * The background never changes, so it is rendered once into an
+ * off-screen layer and damaged areas are restored from it with a blit.
+ * The app tiles' border, icon and label don't change either: they are
+ * rendered once over a key color into a second layer, and a tile is
+ * redrawn as its glass tint plus a color-keyed blit of that layer.
+ * 
+ * Menu labels and app names and icons default to the tables below; an
+ * asset bundle can override them, the strings staying in the bundle.
+ * 
+ * Key events go to the node that has the focus - the sidebar or one of
+ * the app tiles - through its key callback; redraw events dirty every
+ * node that overlaps the damaged area.
+ * 
+ * The event loop changes the scene while the render thread draws it,
+ * possibly on another CPU, so scene_lock guards the nodes and the state
+ * they show. It is held with interrupts disabled - the event loop
+ * preempting a render thread that holds it would spin forever - from
+ * taking a frame's damage until the frame is drawn, and dropped before
+ * it is presented, which may wait for a page flip.
  */
 
 #include "nebula_ui.h"
 #include "graphics.h"
+#include "event.h"
+#include "keyboard.h"
+#include "trace.h"
+#include "arena.h"
+#include "assets.h"
+#include "spinlock.h"
+
+/* Font metrics used for node bounding boxes */
+#define UI_GLYPH_WIDTH 8
+
+/* Scene node */
+typedef struct UiNode {
+    uint16_t x, y, w, h;                  /* Box covering everything node draws */
+    uint8_t dirty;                        /* Needs to be redrawn */
+    uint8_t arg;                          /* Node-specific argument (app index) */
+    void (*draw)(const struct UiNode* node);
+    uint8_t (*key)(struct UiNode* node, const Event* event); /* Returns 1 if handled */
+} UiNode;
+
+/* Scene nodes in back-to-front order */
+enum {
+    NODE_BACKGROUND,
+    NODE_TOP_BAR,
+    NODE_SIDEBAR,
+    NODE_APP_FIRST,
+    NODE_APP_LAST = NODE_APP_FIRST + 5,
+    NODE_INFO_PANEL,
+    NODE_DOCK,
+    NODE_COUNT
+};
+
+/* Sidebar menu - labels can be replaced by the asset bundle */
+#define SIDEBAR_ITEMS NEBULA_SIDEBAR_ITEMS
+static const char* menu_items[SIDEBAR_ITEMS] = {"Home", "Applications", "Files", "Files", "Settings", "Files", "Terminal"};
+
+/* App grid */
+#define APP_COUNT     6
+#define APP_COLUMNS   3
+#define APP_GRID_X    90
+#define APP_GRID_Y    40
+#define APP_TILE_SIZE 50
+#define APP_SPACING   60
+#define APP_ICONS     6                   /* Icon types app_tile_foreground draws */
+static struct {
+    const char* name;
+    uint8_t icon_type;
+} apps[APP_COUNT] = {
+    {"Browser", 0},
+    {"Settings", 1},
+    {"Files", 2},
+    {"Media", 3},
+    {"Notes", 4},
+    {"Cloud", 5}
+};
+
+/* UI state */
+static uint8_t sidebar_selection = 3;     /* Highlighted menu item */
+static uint8_t progress_percent = 75;     /* Info panel progress arc */
+static char clock_text[16] = "10:30 AM";  /* Top bar clock */
+static uint8_t focus_node = NODE_SIDEBAR; /* Node that gets key events */
+
+/* Scene */
+static UiNode nodes[NODE_COUNT];
+static Spinlock scene_lock = SPINLOCK_INIT; /* Guards the nodes and UI state */
+static GraphicsLayer* background_layer = NULL; /* Pre-rendered background */
+static GraphicsLayer* tile_layer = NULL;  /* Pre-rendered app tile foregrounds */
+
+/* Memory that lives as long as one frame. Frames take turns with the two
+ * arenas, so what a frame allocated is still there while the next one is
+ * drawn - a queued page flip may still be showing it */
+#define UI_FRAME_ARENA_SIZE 4096
+static Arena* frame_arenas[2] = { NULL, NULL };
+static uint8_t frame_parity = 0;
+
+/* Color that marks transparent pixels of tile_layer - never drawn on a tile */
+#define UI_KEY_COLOR COLOR_MAGENTA
+
+/* Glass panel translucency */
+#define UI_GLASS_ALPHA 128
 
 /* Draw nebula space background */
 void nebula_draw_background(void) {
+    TRACE_BEGIN(TRACE_DRAW_BACKGROUND);
     /* Fill with dark space color */
     graphics_clear(COLOR_BLACK);
     
@@ -45,46 +151,50 @@ void nebula_draw_background(void) {
             }
         }
     }
+    TRACE_END(TRACE_DRAW_BACKGROUND);
 }
 
 /* Draw top bar */
 void nebula_draw_top_bar(void) {
+    TRACE_BEGIN(TRACE_DRAW_TOP_BAR);
     /* Draw top bar background */
     graphics_fill_rect(0, 0, SCREEN_WIDTH, 25, COLOR_DARK_GREY);
     
     /* Draw "NEBULA OS" title on left */
     graphics_draw_text(10, 8, "NEBULA OS", COLOR_WHITE);
     
-    /* Draw time on right (simulated as "10:30 AM") */
-    graphics_draw_text(SCREEN_WIDTH - 70, 8, "10:30 AM", COLOR_WHITE);
+    /* Draw time on right */
+    graphics_draw_text(SCREEN_WIDTH - 70, 8, clock_text, COLOR_WHITE);
     
     /* Draw battery/signal indicator */
     graphics_fill_rect(SCREEN_WIDTH - 90, 10, 15, 8, COLOR_LIGHT_GREY);
     graphics_fill_rect(SCREEN_WIDTH - 90, 10, 12, 8, COLOR_WHITE);
+    TRACE_END(TRACE_DRAW_TOP_BAR);
 }
 
 /* Draw left sidebar */
 void nebula_draw_sidebar(void) {
+    TRACE_BEGIN(TRACE_DRAW_SIDEBAR);
     uint16_t sidebar_x = 5;
     uint16_t sidebar_y = 30;
     uint16_t sidebar_w = 70;
     uint16_t sidebar_h = 140;
     
     /* Draw glass panel */
-    graphics_draw_glass_panel(sidebar_x, sidebar_y, sidebar_w, sidebar_h, 128);
+    graphics_draw_glass_panel(sidebar_x, sidebar_y, sidebar_w, sidebar_h, UI_GLASS_ALPHA);
     
     /* Menu items */
-    const char* menu_items[] = {"Home", "Applications", "Files", "Files", "Settings", "Files", "Terminal"};
     uint16_t item_y = sidebar_y + 10;
     
-    for (int i = 0; i < 7; i++) {
+    for (int i = 0; i < SIDEBAR_ITEMS; i++) {
         /* Draw icon (simple circle/square) */
         uint16_t icon_x = sidebar_x + 10;
         uint16_t icon_y = item_y + 2;
         
-        if (i == 3) {
-            /* Highlighted item */
-            graphics_fill_rect(sidebar_x + 5, item_y - 2, sidebar_w - 10, 15, COLOR_LIGHT_BLUE);
+        if (i == sidebar_selection) {
+            /* Highlighted item - dimmer while the app grid has the focus */
+            uint8_t highlight = focus_node == NODE_SIDEBAR ? COLOR_LIGHT_BLUE : COLOR_BLUE;
+            graphics_fill_rect(sidebar_x + 5, item_y - 2, sidebar_w - 10, 15, highlight);
         }
         
         /* Draw simple icon */
@@ -95,6 +205,7 @@ void nebula_draw_sidebar(void) {
         
         item_y += 18;
     }
+    TRACE_END(TRACE_DRAW_SIDEBAR);
 }
 
 /* Draw simple icon shapes */
@@ -154,16 +265,13 @@ void nebula_draw_icon_terminal(uint16_t x, uint16_t y, uint8_t color) {
     graphics_fill_circle(x + 4, y - 2, 2, color);
 }
 
-/* Draw app icon in grid */
-void nebula_draw_app_icon(uint16_t x, uint16_t y, const char* name, uint8_t icon_type) {
-    uint16_t icon_size = 50;
+/* Draw the opaque parts of an app tile - border, icon and name */
+static void app_tile_foreground(uint16_t x, uint16_t y, const char* name, uint8_t icon_type) {
+    uint16_t icon_size = APP_TILE_SIZE;
     uint16_t icon_x = x + icon_size / 2;
     uint16_t icon_y = y + 15;
     
-    /* Draw glass panel for app tile */
-    graphics_draw_glass_panel(x, y, icon_size, icon_size, 128);
-    
-    (void)icon_size;  /* Suppress unused variable warning */
+    graphics_draw_rect(x, y, icon_size, icon_size, COLOR_WHITE);
     
     /* Draw icon based on type */
     switch (icon_type) {
@@ -180,47 +288,37 @@ void nebula_draw_app_icon(uint16_t x, uint16_t y, const char* name, uint8_t icon
     graphics_draw_text(text_x, y + icon_size - 10, name, COLOR_WHITE);
 }
 
+/* Draw app icon in grid */
+void nebula_draw_app_icon(uint16_t x, uint16_t y, const char* name, uint8_t icon_type) {
+    TRACE_BEGIN(TRACE_DRAW_APP_ICON);
+    /* Draw glass panel for app tile, then what sits on it */
+    graphics_draw_glass_panel(x, y, APP_TILE_SIZE, APP_TILE_SIZE, UI_GLASS_ALPHA);
+    app_tile_foreground(x, y, name, icon_type);
+    TRACE_END(TRACE_DRAW_APP_ICON);
+}
+
 /* Draw main application grid */
 void nebula_draw_app_grid(void) {
-    /* Center grid on screen */
-    uint16_t grid_start_x = 90;
-    uint16_t grid_start_y = 40;
-    uint16_t icon_size = 50;
-    uint16_t icon_spacing = 60;
-    
-    /* App definitions */
-    struct {
-        const char* name;
-        uint8_t icon_type;
-    } apps[] = {
-        {"Browser", 0},
-        {"Settings", 1},
-        {"Files", 2},
-        {"Media", 3},
-        {"Notes", 4},
-        {"Cloud", 5}
-    };
-    
+    TRACE_BEGIN(TRACE_DRAW_APP_GRID);
     /* Draw 3x2 grid */
-    for (int row = 0; row < 2; row++) {
-        for (int col = 0; col < 3; col++) {
-            int idx = row * 3 + col;
-            uint16_t x = grid_start_x + col * icon_spacing;
-            uint16_t y = grid_start_y + row * icon_spacing;
-            nebula_draw_app_icon(x, y, apps[idx].name, apps[idx].icon_type);
-        }
+    for (int idx = 0; idx < APP_COUNT; idx++) {
+        uint16_t x = APP_GRID_X + (idx % APP_COLUMNS) * APP_SPACING;
+        uint16_t y = APP_GRID_Y + (idx / APP_COLUMNS) * APP_SPACING;
+        nebula_draw_app_icon(x, y, apps[idx].name, apps[idx].icon_type);
     }
+    TRACE_END(TRACE_DRAW_APP_GRID);
 }
 
 /* Draw right-side information panel */
 void nebula_draw_info_panel(void) {
+    TRACE_BEGIN(TRACE_DRAW_INFO_PANEL);
     uint16_t panel_x = SCREEN_WIDTH - 80;
     uint16_t panel_y = 30;
     uint16_t panel_w = 75;
     uint16_t panel_h = 140;
     
     /* Draw glass panel */
-    graphics_draw_glass_panel(panel_x, panel_y, panel_w, panel_h, 128);
+    graphics_draw_glass_panel(panel_x, panel_y, panel_w, panel_h, UI_GLASS_ALPHA);
     
     /* Draw window controls (top right) */
     graphics_draw_text(panel_x + 5, panel_y + 5, "X", COLOR_WHITE);
@@ -230,7 +328,8 @@ void nebula_draw_info_panel(void) {
     uint16_t progress_y = panel_y + 20;
     graphics_draw_circle(progress_x, progress_y, 15, COLOR_LIGHT_BLUE);
     /* Fill part of circle (simplified - fill arc) */
-    for (int angle = 0; angle < 270; angle += 2) {
+    int arc_end = progress_percent * 360 / 100;
+    for (int angle = 0; angle < arc_end; angle += 2) {
         /* Use integer approximation for circle arc */
         int px, py;
         if (angle < 90) {
@@ -264,10 +363,12 @@ void nebula_draw_info_panel(void) {
         
         file_y += 12;
     }
+    TRACE_END(TRACE_DRAW_INFO_PANEL);
 }
 
 /* Draw dock icon */
 void nebula_draw_dock_icon(uint16_t x, uint16_t y, uint8_t icon_type, uint8_t color) {
+    TRACE_BEGIN(TRACE_DRAW_DOCK_ICON);
     uint16_t icon_size = 30;
     graphics_fill_circle(x, y, icon_size / 2, color);
     
@@ -287,15 +388,17 @@ void nebula_draw_dock_icon(uint16_t x, uint16_t y, uint8_t icon_type, uint8_t co
             graphics_fill_circle(x, y, 6, icon_color);
             break;
     }
+    TRACE_END(TRACE_DRAW_DOCK_ICON);
 }
 
 /* Draw bottom dock */
 void nebula_draw_dock(void) {
+    TRACE_BEGIN(TRACE_DRAW_DOCK);
     uint16_t dock_y = SCREEN_HEIGHT - 35;
     uint16_t dock_h = 30;
     
     /* Draw glass panel for dock */
-    graphics_draw_glass_panel(0, dock_y, SCREEN_WIDTH, dock_h, 128);
+    graphics_draw_glass_panel(0, dock_y, SCREEN_WIDTH, dock_h, UI_GLASS_ALPHA);
     
     /* Draw dock icons */
     uint16_t icon_spacing = 40;
@@ -321,16 +424,406 @@ void nebula_draw_dock(void) {
     /* Settings and power icons on right */
     nebula_draw_icon_settings(SCREEN_WIDTH - 40, icon_y, COLOR_WHITE);
     graphics_fill_circle(SCREEN_WIDTH - 20, icon_y, 8, COLOR_WHITE);
+    TRACE_END(TRACE_DRAW_DOCK);
+}
+
+/* String length */
+static uint16_t ui_strlen(const char* text) {
+    uint16_t len = 0;
+    while (text[len] != '\0') {
+        len++;
+    }
+    return len;
+}
+
+/* Node draw callbacks */
+static void node_draw_background(const UiNode* node) {
+    if (background_layer != NULL) {
+        /* Blit is clipped - only the damaged area is copied */
+        graphics_blit_layer(background_layer, node->x, node->y, node->w, node->h);
+    } else {
+        nebula_draw_background();         /* No memory for a layer */
+    }
+}
+
+static void node_draw_top_bar(const UiNode* node)    { (void)node; nebula_draw_top_bar(); }
+static void node_draw_sidebar(const UiNode* node)    { (void)node; nebula_draw_sidebar(); }
+static void node_draw_info_panel(const UiNode* node) { (void)node; nebula_draw_info_panel(); }
+static void node_draw_dock(const UiNode* node)       { (void)node; nebula_draw_dock(); }
+
+static void node_draw_app(const UiNode* node) {
+    TRACE_BEGIN(TRACE_DRAW_APP_TILE);
+    uint8_t idx = node->arg;
+    uint16_t x = APP_GRID_X + (idx % APP_COLUMNS) * APP_SPACING;
+    uint16_t y = APP_GRID_Y + (idx / APP_COLUMNS) * APP_SPACING;
+    if (tile_layer != NULL && graphics_can_blend()) {
+        /* Tint, then everything opaque in one keyed blit */
+        graphics_blend_rect(x, y, APP_TILE_SIZE, APP_TILE_SIZE, COLOR_GLASS_TRANSPARENT, UI_GLASS_ALPHA);
+        graphics_blit_layer_keyed(tile_layer, node->x, node->y, node->w, node->h, UI_KEY_COLOR);
+    } else {
+        nebula_draw_app_icon(x, y, apps[idx].name, apps[idx].icon_type);
+    }
+    if (node == &nodes[focus_node]) {
+        graphics_draw_rect(x + 2, y + 2, APP_TILE_SIZE - 4, APP_TILE_SIZE - 4, COLOR_YELLOW);
+    }
+    TRACE_END(TRACE_DRAW_APP_TILE);
+}
+
+/* Mark a node as needing a redraw (scene lock held) */
+static void scene_invalidate(uint8_t id) {
+    nodes[id].dirty = 1;
+}
+
+/* Highlight a sidebar menu item (scene lock held) */
+static void sidebar_select(uint8_t index) {
+    if (index >= SIDEBAR_ITEMS || index == sidebar_selection) {
+        return;                           /* Nothing changes */
+    }
+    sidebar_selection = index;
+    scene_invalidate(NODE_SIDEBAR);
+}
+
+/* Move the key focus to another node (scene lock held) */
+static void focus_set(uint8_t id) {
+    if (id == focus_node) {
+        return;
+    }
+    nodes[focus_node].dirty = 1;
+    focus_node = id;
+    nodes[id].dirty = 1;
+}
+
+/* Sidebar keys - Up/Down (or Tab) move the highlight, Right or Enter
+ * moves into the app grid */
+static uint8_t node_key_sidebar(UiNode* node, const Event* event) {
+    (void)node;
+    switch (event->key) {
+        case KEY_DOWN:
+        case KEY_TAB:
+            sidebar_select((sidebar_selection + 1) % SIDEBAR_ITEMS);
+            return 1;
+        case KEY_UP:
+            sidebar_select((sidebar_selection + SIDEBAR_ITEMS - 1) % SIDEBAR_ITEMS);
+            return 1;
+        case KEY_RIGHT:
+        case KEY_ENTER:
+            focus_set(NODE_APP_FIRST);
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* App tile keys - arrows move around the grid (Left off its edge goes
+ * back to the sidebar), Tab focuses the next tile, Escape leaves */
+static uint8_t node_key_app(UiNode* node, const Event* event) {
+    uint8_t idx = node->arg;
+    uint8_t column = idx % APP_COLUMNS;
+    switch (event->key) {
+        case KEY_TAB:
+            focus_set(NODE_APP_FIRST + (idx + 1) % APP_COUNT);
+            return 1;
+        case KEY_RIGHT:
+            if (column + 1 < APP_COLUMNS && idx + 1 < APP_COUNT) focus_set(NODE_APP_FIRST + idx + 1);
+            return 1;
+        case KEY_LEFT:
+            focus_set(column > 0 ? NODE_APP_FIRST + idx - 1 : NODE_SIDEBAR);
+            return 1;
+        case KEY_DOWN:
+            if (idx + APP_COLUMNS < APP_COUNT) focus_set(NODE_APP_FIRST + idx + APP_COLUMNS);
+            return 1;
+        case KEY_UP:
+            if (idx >= APP_COLUMNS) focus_set(NODE_APP_FIRST + idx - APP_COLUMNS);
+            return 1;
+        case KEY_ESCAPE:
+            focus_set(NODE_SIDEBAR);
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Set up one scene node */
+static void node_init(uint8_t id, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+                      void (*draw)(const UiNode*), uint8_t arg) {
+    nodes[id].x = x;
+    nodes[id].y = y;
+    nodes[id].w = w;
+    nodes[id].h = h;
+    nodes[id].dirty = 1;
+    nodes[id].arg = arg;
+    nodes[id].draw = draw;
+    nodes[id].key = NULL;
+}
+
+/* Next NUL-terminated string of an asset, or NULL if it runs past end */
+static const char* layout_string(const uint8_t** pos, const uint8_t* end) {
+    const uint8_t* start = *pos;
+    for (const uint8_t* p = start; p < end; p++) {
+        if (*p == '\0') {
+            *pos = p + 1;
+            return (const char*) start;
+        }
+    }
+    return NULL;
+}
+
+/* Take menu labels and app names and icons from the asset bundle - entries
+ * it doesn't have keep their defaults */
+static void ui_layout_load(void) {
+    uint32_t size;
+    const uint8_t* data = (const uint8_t*) asset_get(ASSET_UI_MENU, &size);
+    if (data != NULL && size >= sizeof(uint32_t)) {
+        const uint8_t* pos = data + sizeof(uint32_t);
+        uint32_t count = *(const uint32_t*) data;
+        for (uint32_t i = 0; i < count && i < SIDEBAR_ITEMS; i++) {
+            const char* label = layout_string(&pos, data + size);
+            if (label == NULL) break;
+            menu_items[i] = label;
+        }
+    }
+    
+    data = (const uint8_t*) asset_get(ASSET_UI_APPS, &size);
+    if (data != NULL && size >= sizeof(uint32_t)) {
+        const uint8_t* pos = data + sizeof(uint32_t);
+        uint32_t count = *(const uint32_t*) data;
+        for (uint32_t i = 0; i < count && i < APP_COUNT && pos < data + size; i++) {
+            uint8_t icon = *pos++;
+            const char* name = layout_string(&pos, data + size);
+            if (name == NULL) break;
+            apps[i].name = name;
+            apps[i].icon_type = icon < APP_ICONS ? icon : apps[i].icon_type;
+        }
+    }
+}
+
+/* Build the scene - boxes include text that runs past a panel's edge */
+void nebula_ui_init(void) {
+    ui_layout_load();
+    
+    node_init(NODE_BACKGROUND, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, node_draw_background, 0);
+    node_init(NODE_TOP_BAR, 0, 0, SCREEN_WIDTH, 25, node_draw_top_bar, 0);
+    
+    /* Sidebar labels can extend to the right of the panel */
+    uint16_t sidebar_w = 70;
+    for (int i = 0; i < SIDEBAR_ITEMS; i++) {
+        uint16_t w = 20 + ui_strlen(menu_items[i]) * UI_GLYPH_WIDTH;
+        if (w > sidebar_w) sidebar_w = w;
+    }
+    node_init(NODE_SIDEBAR, 5, 30, sidebar_w, 140, node_draw_sidebar, 0);
+    nodes[NODE_SIDEBAR].key = node_key_sidebar;
+    
+    /* App names can extend to the right of the tile */
+    for (int idx = 0; idx < APP_COUNT; idx++) {
+        uint16_t x = APP_GRID_X + (idx % APP_COLUMNS) * APP_SPACING;
+        uint16_t y = APP_GRID_Y + (idx / APP_COLUMNS) * APP_SPACING;
+        uint16_t w = (APP_TILE_SIZE - UI_GLYPH_WIDTH * 6) / 2 + ui_strlen(apps[idx].name) * UI_GLYPH_WIDTH;
+        if (w < APP_TILE_SIZE) w = APP_TILE_SIZE;
+        node_init(NODE_APP_FIRST + idx, x, y, w, APP_TILE_SIZE, node_draw_app, idx);
+        nodes[NODE_APP_FIRST + idx].key = node_key_app;
+    }
+    
+    node_init(NODE_INFO_PANEL, SCREEN_WIDTH - 80, 30, 75, 140, node_draw_info_panel, 0);
+    
+    /* Dock icon circles reach one pixel below the dock panel */
+    node_init(NODE_DOCK, 0, SCREEN_HEIGHT - 35, SCREEN_WIDTH, 31, node_draw_dock, 0);
+    
+    /* Render the background once */
+    background_layer = graphics_layer_create();
+    if (background_layer != NULL) {
+        graphics_begin_layer(background_layer);
+        nebula_draw_background();
+        graphics_end_layer();
+    }
+    
+    /* Render the tile foregrounds once, over the key color */
+    tile_layer = graphics_layer_create();
+    if (tile_layer != NULL) {
+        graphics_begin_layer(tile_layer);
+        graphics_clear(UI_KEY_COLOR);
+        for (int idx = 0; idx < APP_COUNT; idx++) {
+            uint16_t x = APP_GRID_X + (idx % APP_COLUMNS) * APP_SPACING;
+            uint16_t y = APP_GRID_Y + (idx / APP_COLUMNS) * APP_SPACING;
+            app_tile_foreground(x, y, apps[idx].name, apps[idx].icon_type);
+        }
+        graphics_end_layer();
+    }
+    
+    frame_arenas[0] = arena_create(UI_FRAME_ARENA_SIZE);
+    frame_arenas[1] = arena_create(UI_FRAME_ARENA_SIZE);
+}
+
+/* Switch to the other frame arena and empty it - NULL if there is none */
+static Arena* frame_begin(void) {
+    frame_parity ^= 1;
+    Arena* arena = frame_arenas[frame_parity];
+    if (arena != NULL) {
+        arena_reset(arena);
+    }
+    return arena;
+}
+
+/* Check if two node boxes overlap */
+static uint8_t nodes_overlap(const UiNode* a, const UiNode* b) {
+    return a->x < b->x + b->w && b->x < a->x + a->w &&
+           a->y < b->y + b->h && b->y < a->y + a->h;
+}
+
+/* Mark the whole interface as needing a redraw */
+void nebula_invalidate_all(void) {
+    uint32_t flags = spin_lock_irqsave(&scene_lock);
+    for (uint8_t id = 0; id < NODE_COUNT; id++) {
+        scene_invalidate(id);
+    }
+    spin_unlock_irqrestore(&scene_lock, flags);
+}
+
+/* Mark every node that overlaps an area as needing a redraw (scene lock held) */
+static void scene_damage(uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
+    UiNode area;
+    area.x = x;
+    area.y = y;
+    area.w = w;
+    area.h = h;
+    for (uint8_t id = 0; id < NODE_COUNT; id++) {
+        if (nodes_overlap(&area, &nodes[id])) {
+            nodes[id].dirty = 1;
+        }
+    }
+}
+
+/* Mark every node that overlaps an area as needing a redraw */
+void nebula_ui_damage(uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
+    uint32_t flags = spin_lock_irqsave(&scene_lock);
+    scene_damage(x, y, w, h);
+    spin_unlock_irqrestore(&scene_lock, flags);
+}
+
+/* Route an event to the part of the interface it is for */
+void nebula_ui_handle_event(const Event* event) {
+    uint32_t flags = spin_lock_irqsave(&scene_lock);
+    switch (event->type) {
+        case EVENT_KEY_DOWN: {
+            UiNode* node = &nodes[focus_node];
+            if (node->key != NULL) {
+                node->key(node, event);
+            }
+            break;
+        }
+        case EVENT_REDRAW:
+            scene_damage(event->x, event->y, event->w, event->h);
+            break;
+        default:
+            break;                        /* Not for the UI */
+    }
+    spin_unlock_irqrestore(&scene_lock, flags);
+}
+
+/* Check if any part of the interface is waiting to be redrawn */
+uint8_t nebula_ui_needs_update(void) {
+    uint8_t dirty = 0;
+    uint32_t flags = spin_lock_irqsave(&scene_lock);
+    for (uint8_t id = 0; id < NODE_COUNT && !dirty; id++) {
+        dirty = nodes[id].dirty;
+    }
+    spin_unlock_irqrestore(&scene_lock, flags);
+    return dirty;
+}
+
+/* Redraw damaged parts of the interface and show them
+ * 
+ * The scene lock is held from taking the frame's damage to the end of
+ * drawing it, so no node changes halfway through being drawn; a change
+ * made after that marks its node for the next update. */
+void nebula_ui_update(void) {
+    TRACE_BEGIN(TRACE_UI_UPDATE);
+    uint32_t flags = spin_lock_irqsave(&scene_lock);
+    Arena* frame = frame_begin();
+    
+    /* Damaged boxes, in the frame arena - without one, repaint it all */
+    UiNode* damage = frame != NULL ? (UiNode*) arena_alloc(frame, NODE_COUNT * sizeof(UiNode)) : NULL;
+    uint8_t full = damage == NULL || nodes[NODE_BACKGROUND].dirty;
+    uint8_t damage_count = 0;
+    for (uint8_t id = 0; id < NODE_COUNT; id++) {
+        if (nodes[id].dirty) {
+            nodes[id].dirty = 0;
+            if (!full) {
+                damage[damage_count++] = nodes[id];
+            }
+        }
+    }
+    
+    if (full) {
+        /* Full repaint - background covers every other node */
+        for (uint8_t id = 0; id < NODE_COUNT; id++) {
+            nodes[id].draw(&nodes[id]);
+        }
+    } else {
+        /* Repaint each damaged box with everything that overlaps it */
+        for (uint8_t i = 0; i < damage_count; i++) {
+            graphics_set_clip(damage[i].x, damage[i].y, damage[i].w, damage[i].h);
+            for (uint8_t other = 0; other < NODE_COUNT; other++) {
+                if (nodes_overlap(&damage[i], &nodes[other])) {
+                    nodes[other].draw(&nodes[other]);
+                }
+            }
+        }
+        graphics_reset_clip();
+    }
+    spin_unlock_irqrestore(&scene_lock, flags);
+    
+    /* Show the finished frame */
+    graphics_present();
+    TRACE_END(TRACE_UI_UPDATE);
+}
+
+/* Currently highlighted sidebar item */
+uint8_t nebula_get_sidebar_selection(void) {
+    return sidebar_selection;
+}
+
+/* Highlight a sidebar menu item */
+void nebula_set_sidebar_selection(uint8_t index) {
+    uint32_t flags = spin_lock_irqsave(&scene_lock);
+    sidebar_select(index);
+    spin_unlock_irqrestore(&scene_lock, flags);
+}
+
+/* Set the info panel progress arc (0-100) */
+void nebula_set_progress(uint8_t percent) {
+    if (percent > 100) {
+        percent = 100;
+    }
+    uint32_t flags = spin_lock_irqsave(&scene_lock);
+    if (percent != progress_percent) {
+        progress_percent = percent;
+        scene_invalidate(NODE_INFO_PANEL);
+    }
+    spin_unlock_irqrestore(&scene_lock, flags);
+}
+
+/* Set the top bar clock text */
+void nebula_set_clock(const char* text) {
+    uint8_t changed = 0;
+    uint16_t i = 0;
+    uint32_t flags = spin_lock_irqsave(&scene_lock);
+    for (; text[i] != '\0' && i < sizeof(clock_text) - 1; i++) {
+        if (clock_text[i] != text[i]) changed = 1;
+        clock_text[i] = text[i];
+    }
+    if (clock_text[i] != '\0') changed = 1;
+    clock_text[i] = '\0';
+    if (changed) {
+        scene_invalidate(NODE_TOP_BAR);
+    }
+    spin_unlock_irqrestore(&scene_lock, flags);
 }
 
 /* Render complete UI */
 void nebula_render_ui(void) {
-    /* Draw all components in order */
-    nebula_draw_background();
-    nebula_draw_top_bar();
-    nebula_draw_sidebar();
-    nebula_draw_app_grid();
-    nebula_draw_info_panel();
-    nebula_draw_dock();
+    TRACE_BEGIN(TRACE_RENDER_UI);
+    /* Repaint every node */
+    nebula_invalidate_all();
+    nebula_ui_update();
+    TRACE_END(TRACE_RENDER_UI);
 }
-
@@ -8,10 +8,42 @@
 #define NEBULA_UI_H
 
 #include "graphics.h"
+#include "event.h"
+
+/* Number of sidebar menu items */
+#define NEBULA_SIDEBAR_ITEMS 7
+
+/* Build the scene (after assets_init and graphics_init) - before any
+ * other nebula_ui call except the state changes */
+void nebula_ui_init(void);
 
 /* Render the complete NEBULA OS interface */
 void nebula_render_ui(void);
 
+/* Redraw only the parts of the interface that changed */
+void nebula_ui_update(void);
+
+/* Check if any part of the interface is waiting to be redrawn */
+uint8_t nebula_ui_needs_update(void);
+
+/* Mark the whole interface as needing a redraw */
+void nebula_invalidate_all(void);
+
+/* Mark the parts of the interface that overlap an area as needing a redraw */
+void nebula_ui_damage(uint16_t x, uint16_t y, uint16_t w, uint16_t h);
+
+/* Handle an event - key presses go to the focused node (sidebar or an
+ * app tile), redraw requests dirty what they cover */
+void nebula_ui_handle_event(const Event* event);
+
+/* Currently highlighted sidebar item */
+uint8_t nebula_get_sidebar_selection(void);
+
+/* State changes - each marks only the affected part for redraw */
+void nebula_set_sidebar_selection(uint8_t index);
+void nebula_set_progress(uint8_t percent);
+void nebula_set_clock(const char* text);
+
 /* Draw nebula space background */
 void nebula_draw_background(void);
 
@@ -0,0 +1,212 @@
+/* paging.c - Paging and memory types for JoshOS
+ *
+ * With PAE the tables are a 4-entry page-directory-pointer table and four
+ * directories of 512 2MB entries; without it one directory of 1024 4MB
+ * entries (PSE). Either way each directory entry maps a large page, and
+ * a split page table has the same number of 4KB entries as a directory,
+ * so the code below only differs in the entry width and the page shift.
+ *
+ * The PAT MSR is reprogrammed so entry 4 (PAT bit set, PCD and PWT clear)
+ * selects write-combining. The other seven entries keep their power-on
+ * meaning, so a plain PCD|PWT entry is still uncached.
+ */
+
+#include "paging.h"
+#include "cpu.h"
+#include "pmm.h"
+#include "spinlock.h"
+
+/* Page table entry bits */
+#define PAGE_PRESENT     0x001
+#define PAGE_WRITABLE    0x002
+#define PAGE_WRITE_THRU  0x008            /* PWT */
+#define PAGE_NO_CACHE    0x010            /* PCD */
+#define PAGE_LARGE       0x080            /* PS in a directory entry */
+#define PAGE_PAT_SMALL   0x080            /* PAT bit of a 4KB entry */
+#define PAGE_PAT_LARGE   0x1000           /* PAT bit of a large entry */
+#define PAGE_FRAME       0xFFFFF000ULL    /* Physical address bits we use */
+
+/* Control register bits */
+#define CR0_PG           0x80000000
+#define CR4_PSE          0x00000010
+#define CR4_PAE          0x00000020
+
+/* PAT MSR - power-on layout with entry 4 changed from WB to WC */
+#define MSR_PAT          0x277
+#define PAT_VALUE        0x0007040100070406ULL
+
+/* Paging modes */
+#define PAGING_OFF       0
+#define PAGING_PSE       1
+#define PAGING_PAE       2
+
+/* Small pages per large page - also the entries per directory */
+#define PAE_ENTRIES      512
+#define PSE_ENTRIES      1024
+
+/* PAE tables - four directories back to back cover 4GB */
+static uint64_t pae_pdpt[4] __attribute__((aligned(32)));
+static uint64_t pae_dirs[4 * PAE_ENTRIES] __attribute__((aligned(4096)));
+
+/* Non-PAE directory */
+static uint32_t pse_dir[PSE_ENTRIES] __attribute__((aligned(4096)));
+
+static uint8_t paging_mode = PAGING_OFF;
+static Spinlock paging_lock = SPINLOCK_INIT; /* Guards the tables */
+
+/* log2 of the large page size */
+static inline uint32_t large_shift(void) {
+    return paging_mode == PAGING_PAE ? 21 : 22;
+}
+
+/* Entries in a directory or page table */
+static inline uint32_t table_entries(void) {
+    return paging_mode == PAGING_PAE ? PAE_ENTRIES : PSE_ENTRIES;
+}
+
+/* Read and write entry index of a directory or page table */
+static inline uint64_t entry_get(void* table, uint32_t index) {
+    return paging_mode == PAGING_PAE ? ((uint64_t*) table)[index] : ((uint32_t*) table)[index];
+}
+
+static inline void entry_set(void* table, uint32_t index, uint64_t value) {
+    if (paging_mode == PAGING_PAE) {
+        ((uint64_t*) table)[index] = value;
+    } else {
+        ((uint32_t*) table)[index] = (uint32_t) value;
+    }
+}
+
+/* The directory covering all of memory */
+static inline void* directory(void) {
+    return paging_mode == PAGING_PAE ? (void*) pae_dirs : (void*) pse_dir;
+}
+
+/* Entry bits selecting a memory type */
+static uint64_t type_bits(uint8_t type, uint8_t large) {
+    switch (type) {
+        case PAGING_WRITE_COMBINING:
+            return large ? PAGE_PAT_LARGE : PAGE_PAT_SMALL;
+        case PAGING_UNCACHED:
+            return PAGE_NO_CACHE | PAGE_WRITE_THRU;
+        default:
+            return 0;
+    }
+}
+
+/* Switch the calling CPU to the tables */
+static void paging_enable(void) {
+    uint32_t cr0, cr4;
+
+    if (cpu_has(CPU_FEATURE_PAT)) {
+        cpu_write_msr(MSR_PAT, PAT_VALUE);
+    }
+    __asm__ volatile ("mov %%cr4, %0" : "=r" (cr4));
+    cr4 |= paging_mode == PAGING_PAE ? CR4_PAE : CR4_PSE;
+    __asm__ volatile ("mov %0, %%cr4" : : "r" (cr4));
+    __asm__ volatile ("mov %0, %%cr3" : : "r" (paging_mode == PAGING_PAE ? (uint32_t) pae_pdpt : (uint32_t) pse_dir) : "memory");
+    __asm__ volatile ("mov %%cr0, %0" : "=r" (cr0));
+    __asm__ volatile ("mov %0, %%cr0" : : "r" (cr0 | CR0_PG) : "memory");
+}
+
+/* Build the identity map and turn paging on */
+uint8_t paging_init(void) {
+    if (cpu_has(CPU_FEATURE_PAE)) {
+        paging_mode = PAGING_PAE;
+        for (uint32_t i = 0; i < 4; i++) {
+            pae_pdpt[i] = (uint32_t) &pae_dirs[i * PAE_ENTRIES] | PAGE_PRESENT;
+        }
+    } else if (cpu_has(CPU_FEATURE_PSE)) {
+        paging_mode = PAGING_PSE;
+    } else {
+        return 0;                         /* Would need 4KB tables for all of memory */
+    }
+
+    uint32_t entries = paging_mode == PAGING_PAE ? 4 * PAE_ENTRIES : PSE_ENTRIES;
+    for (uint32_t i = 0; i < entries; i++) {
+        entry_set(directory(), i, ((uint64_t) i << large_shift()) | PAGE_PRESENT | PAGE_WRITABLE | PAGE_LARGE);
+    }
+    paging_enable();
+    return 1;
+}
+
+/* Turn paging on with the same tables on an application processor */
+void paging_init_ap(void) {
+    if (paging_mode != PAGING_OFF) {
+        paging_enable();
+    }
+}
+
+/* Check if paging_init enabled paging */
+uint8_t paging_enabled(void) {
+    return paging_mode != PAGING_OFF;
+}
+
+/* Replace the large page at a directory index with a page table mapping
+ * the same memory with the same type - returns 0 without memory */
+static uint8_t split_large_page(uint32_t index) {
+    uint64_t entry = entry_get(directory(), index);
+    void* table = page_alloc(0);
+    if (table == NULL) {
+        return 0;
+    }
+
+    /* Carry the type over - only the PAT bit moves */
+    uint64_t flags = PAGE_PRESENT | PAGE_WRITABLE | (entry & (PAGE_NO_CACHE | PAGE_WRITE_THRU));
+    if (entry & PAGE_PAT_LARGE) {
+        flags |= PAGE_PAT_SMALL;
+    }
+    uint64_t base = entry & PAGE_FRAME & ~(uint64_t) PAGE_PAT_LARGE;
+    for (uint32_t i = 0; i < table_entries(); i++) {
+        entry_set(table, i, (base + ((uint64_t) i << PAGE_SHIFT)) | flags);
+    }
+    entry_set(directory(), index, (uint32_t) table | PAGE_PRESENT | PAGE_WRITABLE);
+    return 1;
+}
+
+/* Set the memory type of the pages touching [phys, phys + size) */
+uint8_t paging_set_memory_type(uint32_t phys, uint32_t size, uint8_t type) {
+    if (paging_mode == PAGING_OFF || (type == PAGING_WRITE_COMBINING && !cpu_has(CPU_FEATURE_PAT))) {
+        return 0;
+    }
+
+    const uint64_t type_mask_large = PAGE_PAT_LARGE | PAGE_NO_CACHE | PAGE_WRITE_THRU;
+    const uint64_t type_mask_small = PAGE_PAT_SMALL | PAGE_NO_CACHE | PAGE_WRITE_THRU;
+    uint64_t large_size = 1ULL << large_shift();
+    uint64_t addr = phys & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t end = (uint64_t) phys + size;
+    uint8_t ok = 1;
+
+    uint32_t flags = spin_lock_irqsave(&paging_lock);
+    while (addr < end) {
+        uint32_t index = (uint32_t)(addr >> large_shift());
+        uint64_t entry = entry_get(directory(), index);
+
+        /* The whole large page changes - no need to split it */
+        if ((entry & PAGE_LARGE) && (addr & (large_size - 1)) == 0 && end - addr >= large_size) {
+            entry_set(directory(), index, (entry & ~type_mask_large) | type_bits(type, 1));
+            addr += large_size;
+            continue;
+        }
+
+        if (entry & PAGE_LARGE) {
+            if (!split_large_page(index)) {
+                ok = 0;
+                break;
+            }
+            entry = entry_get(directory(), index);
+        }
+        void* table = (void*)(uint32_t)(entry & PAGE_FRAME);
+        uint32_t slot = (uint32_t)(addr >> PAGE_SHIFT) & (table_entries() - 1);
+        entry_set(table, slot, (entry_get(table, slot) & ~type_mask_small) | type_bits(type, 0));
+        addr += PAGE_SIZE;
+    }
+
+    /* Drop stale translations, and cached lines of memory that is now
+     * uncached or write-combining */
+    uint32_t cr3;
+    __asm__ volatile ("mov %%cr3, %0; mov %0, %%cr3" : "=r" (cr3) : : "memory");
+    __asm__ volatile ("wbinvd" : : : "memory");
+    spin_unlock_irqrestore(&paging_lock, flags);
+    return ok;
+}
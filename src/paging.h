@@ -0,0 +1,48 @@
+/* paging.h - Paging and memory types for JoshOS
+ *
+ * All of the 32-bit physical address space is identity mapped with large
+ * pages (2MB with PAE, 4MB without), so the kernel keeps running at the
+ * addresses it was linked at and the mapping costs only a handful of TLB
+ * entries. Paging exists to set memory types: with PAT the framebuffer can
+ * be made write-combining, so streaming stores are batched into full
+ * bus bursts instead of going out one at a time.
+ *
+ * A large page whose range only partly gets a new type is split into a
+ * 4KB page table. Nothing shoots down other CPUs' TLBs, so memory types
+ * must be set before smp_init starts them.
+ */
+
+#ifndef PAGING_H
+#define PAGING_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned int       uint32_t;
+
+/* Memory types */
+#define PAGING_WRITE_BACK       0         /* Normal cached RAM */
+#define PAGING_WRITE_COMBINING  1         /* Buffered stores, no caching (framebuffers) */
+#define PAGING_UNCACHED         2         /* Device registers */
+
+/* Build the identity map and turn paging on - returns 0 if the CPU has
+ * neither PSE nor PAE, in which case paging stays off */
+uint8_t paging_init(void);
+
+/* Turn paging on with the same tables on an application processor */
+void paging_init_ap(void);
+
+/* Check if paging_init enabled paging */
+uint8_t paging_enabled(void);
+
+/* Set the memory type of the pages touching [phys, phys + size) -
+ * returns 0 if the type cannot be set (no paging, no PAT for
+ * write-combining, or no memory for a page table) */
+uint8_t paging_set_memory_type(uint32_t phys, uint32_t size, uint8_t type);
+
+/* Drain write-combining buffers so earlier stores reach the device - a
+ * locked instruction does it on every CPU, with or without SSE */
+static inline void paging_flush_writes(void) {
+    __asm__ volatile ("lock; orl $0, (%%esp)" : : : "memory");
+}
+
+#endif /* PAGING_H */
@@ -0,0 +1,16 @@
+/* percpu.c - Per-CPU data for JoshOS */
+
+#include "percpu.h"
+#include "gdt.h"
+
+/* All CPUs - only the bootstrap CPU until smp_init finds more */
+Cpu cpus[SMP_MAX_CPUS];
+uint32_t cpu_count = 1;
+
+/* Set up %gs and the TSS for the calling CPU */
+void percpu_init(uint32_t index) {
+    Cpu* cpu = &cpus[index];
+    cpu->self = cpu;
+    cpu->index = index;
+    gdt_load_cpu(index, (uint32_t) cpu, sizeof(Cpu));
+}
@@ -0,0 +1,56 @@
+/* percpu.h - Per-CPU data for JoshOS
+ *
+ * Each CPU has a Cpu structure and a GDT data segment based at it,
+ * loaded into %gs. A field is then read with a single %gs-relative load,
+ * which is also safe against preemption: the thread cannot migrate to
+ * another CPU halfway through the access.
+ */
+
+#ifndef PERCPU_H
+#define PERCPU_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned short     uint16_t;
+typedef unsigned int       uint32_t;
+
+/* Most CPUs the kernel will start */
+#define SMP_MAX_CPUS 16
+
+struct Thread;
+
+/* Per-CPU data - self must stay first */
+typedef struct Cpu {
+    struct Cpu* self;                     /* This structure (%gs:0) */
+    uint32_t index;                       /* 0 for the bootstrap CPU */
+    uint32_t apic_id;                     /* Local APIC id */
+    struct Thread* current;               /* Running thread */
+    uint8_t online;                       /* Started and scheduling */
+} Cpu;
+
+/* All CPUs, and how many were found */
+extern Cpu cpus[SMP_MAX_CPUS];
+extern uint32_t cpu_count;
+
+/* Set up %gs and the TSS for the calling CPU */
+void percpu_init(uint32_t index);
+
+/* Read a field of the calling CPU's structure */
+#define PERCPU_READ(field, out) \
+    __asm__ volatile ("mov %%gs:%c1, %0" : "=r" (out) : "i" (__builtin_offsetof(Cpu, field)))
+
+/* The calling CPU's structure */
+static inline Cpu* cpu_self(void) {
+    Cpu* cpu;
+    PERCPU_READ(self, cpu);
+    return cpu;
+}
+
+/* The calling CPU's index */
+static inline uint32_t cpu_index(void) {
+    uint32_t index;
+    PERCPU_READ(index, index);
+    return index;
+}
+
+#endif /* PERCPU_H */
@@ -0,0 +1,110 @@
+/* pic.c - 8259 programmable interrupt controller for JoshOS
+ *
+ * IRQs 8-15 arrive through the slave PIC, which is cascaded on master
+ * IRQ 2. Masks are cached so changing one IRQ costs a single port write.
+ */
+
+#include "pic.h"
+#include "io.h"
+
+/* PIC ports */
+#define PIC_MASTER_COMMAND  0x20
+#define PIC_MASTER_DATA     0x21
+#define PIC_SLAVE_COMMAND   0xA0
+#define PIC_SLAVE_DATA      0xA1
+
+/* Commands */
+#define PIC_ICW1_INIT       0x11          /* Initialize, expect ICW4 */
+#define PIC_ICW4_8086       0x01          /* 8086 mode */
+#define PIC_EOI             0x20          /* Non-specific end of interrupt */
+#define PIC_READ_ISR        0x0B          /* OCW3: read in-service register */
+
+/* The slave PIC's line on the master */
+#define PIC_CASCADE_IRQ     2
+
+/* Cached interrupt masks (bit set = masked) */
+static uint8_t master_mask = 0xFF;
+static uint8_t slave_mask = 0xFF;
+
+/* Remap both PICs to PIC_VECTOR_BASE and mask every IRQ */
+void pic_init(void) {
+    outb(PIC_MASTER_COMMAND, PIC_ICW1_INIT);
+    io_wait();
+    outb(PIC_SLAVE_COMMAND, PIC_ICW1_INIT);
+    io_wait();
+    outb(PIC_MASTER_DATA, PIC_VECTOR_BASE); /* ICW2: vector offsets */
+    io_wait();
+    outb(PIC_SLAVE_DATA, PIC_VECTOR_BASE + 8);
+    io_wait();
+    outb(PIC_MASTER_DATA, 1 << PIC_CASCADE_IRQ); /* ICW3: slave on IRQ 2 */
+    io_wait();
+    outb(PIC_SLAVE_DATA, PIC_CASCADE_IRQ);  /* ICW3: slave identity */
+    io_wait();
+    outb(PIC_MASTER_DATA, PIC_ICW4_8086);
+    io_wait();
+    outb(PIC_SLAVE_DATA, PIC_ICW4_8086);
+    io_wait();
+
+    /* Everything off until a driver installs a handler */
+    master_mask = 0xFF;
+    slave_mask = 0xFF;
+    outb(PIC_MASTER_DATA, master_mask);
+    outb(PIC_SLAVE_DATA, slave_mask);
+}
+
+/* Enable delivery of one IRQ */
+void pic_unmask(uint8_t irq) {
+    if (irq >= PIC_IRQ_COUNT) {
+        return;
+    }
+    if (irq < 8) {
+        master_mask &= ~(1 << irq);
+        outb(PIC_MASTER_DATA, master_mask);
+    } else {
+        slave_mask &= ~(1 << (irq - 8));
+        outb(PIC_SLAVE_DATA, slave_mask);
+        if (master_mask & (1 << PIC_CASCADE_IRQ)) {
+            master_mask &= ~(1 << PIC_CASCADE_IRQ); /* Slave needs the cascade */
+            outb(PIC_MASTER_DATA, master_mask);
+        }
+    }
+}
+
+/* Disable delivery of one IRQ */
+void pic_mask(uint8_t irq) {
+    if (irq >= PIC_IRQ_COUNT) {
+        return;
+    }
+    if (irq < 8) {
+        master_mask |= 1 << irq;
+        outb(PIC_MASTER_DATA, master_mask);
+    } else {
+        slave_mask |= 1 << (irq - 8);
+        outb(PIC_SLAVE_DATA, slave_mask);
+    }
+}
+
+/* Read the in-service register of one PIC */
+static uint8_t pic_in_service(uint16_t command_port) {
+    outb(command_port, PIC_READ_ISR);
+    return inb(command_port);
+}
+
+/* Acknowledge an IRQ - returns 0 if it was spurious and must be ignored */
+uint8_t pic_acknowledge(uint8_t irq) {
+    /* IRQ 7 and 15 fire spuriously when a request goes away before the
+     * CPU acknowledges it; the in-service bit tells the two apart */
+    if (irq == 7 && !(pic_in_service(PIC_MASTER_COMMAND) & 0x80)) {
+        return 0;                         /* No EOI for a spurious IRQ */
+    }
+    if (irq == 15 && !(pic_in_service(PIC_SLAVE_COMMAND) & 0x80)) {
+        outb(PIC_MASTER_COMMAND, PIC_EOI); /* Master did see the cascade */
+        return 0;
+    }
+
+    if (irq >= 8) {
+        outb(PIC_SLAVE_COMMAND, PIC_EOI);
+    }
+    outb(PIC_MASTER_COMMAND, PIC_EOI);
+    return 1;
+}
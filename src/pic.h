@@ -0,0 +1,29 @@
+/* pic.h - 8259 programmable interrupt controller for JoshOS
+ *
+ * The two cascaded PICs power up with IRQs 0-7 on vectors 8-15, which
+ * collide with CPU exceptions, so they are remapped to PIC_VECTOR_BASE.
+ */
+
+#ifndef PIC_H
+#define PIC_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned short     uint16_t;
+typedef unsigned int       uint32_t;
+
+/* Interrupt vectors used by the PICs */
+#define PIC_VECTOR_BASE  0x20             /* IRQ 0 */
+#define PIC_IRQ_COUNT    16               /* IRQs 0-15 */
+
+/* Remap both PICs to PIC_VECTOR_BASE and mask every IRQ */
+void pic_init(void);
+
+/* Enable/disable delivery of one IRQ */
+void pic_unmask(uint8_t irq);
+void pic_mask(uint8_t irq);
+
+/* Acknowledge an IRQ - returns 0 if it was spurious and must be ignored */
+uint8_t pic_acknowledge(uint8_t irq);
+
+#endif /* PIC_H */
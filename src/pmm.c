@@ -0,0 +1,325 @@
+/* pmm.c - Physical page frame allocator for JoshOS
+ * 
+ * Buddy allocator over the usable RAM in the Multiboot memory map. A
+ * one-byte state per page (placed after the kernel image and any boot
+ * modules GRUB loaded behind it) records
+ * whether the page heads a free block and of which order, so the buddy of
+ * a freed block can be checked in O(1). Free blocks are kept in one doubly
+ * linked list per order, threaded through the free pages themselves.
+ * page_alloc and page_free run under a lock (interrupts off) so threads
+ * can share the allocator.
+ */
+
+#include "pmm.h"
+#include "spinlock.h"
+
+/* Page state byte */
+#define PAGE_STATE_NONE      0x00         /* Reserved, used tail or free tail */
+#define PAGE_STATE_AVAILABLE 0x20         /* Usable, not yet handed to buddy */
+#define PAGE_STATE_USED      0x40         /* Head of an allocated block */
+#define PAGE_STATE_FREE      0x80         /* Head of a free block */
+#define PAGE_STATE_ORDER     0x0F         /* Order bits of a block head */
+
+/* Memory below 1MB is left to the BIOS, VGA and bootloader */
+#define PMM_LOW_LIMIT        0x100000
+
+/* Legacy heap window used when the bootloader gives no memory info */
+#define PMM_FALLBACK_START   0x1000000    /* 16MB */
+#define PMM_FALLBACK_SIZE    0x100000     /* 1MB */
+
+/* Free block links - stored in the first page of a free block */
+typedef struct PageBlock {
+    struct PageBlock* next;               /* Next free block of same order */
+    struct PageBlock* prev;               /* Previous free block of same order */
+} PageBlock;
+
+/* End of kernel image (from linker.ld) */
+extern uint8_t end[];
+
+/* Allocator state */
+static uint8_t* page_state = NULL;        /* One state byte per page */
+static uint32_t page_count = 0;           /* Pages covered by page_state */
+static PageBlock* free_areas[PMM_MAX_ORDER + 1]; /* Free list per order */
+static uint32_t total_pages = 0;          /* Pages managed by buddy */
+static uint32_t free_pages = 0;           /* Pages currently free */
+static Spinlock pmm_lock = SPINLOCK_INIT; /* Guards the free lists and page states */
+
+/* Convert between page frame numbers and addresses */
+static inline PageBlock* pfn_to_block(uint32_t pfn) {
+    return (PageBlock*)(uintptr_t)(pfn << PAGE_SHIFT);
+}
+
+static inline uint32_t addr_to_pfn(const void* addr) {
+    return (uint32_t)((uintptr_t)addr >> PAGE_SHIFT);
+}
+
+/* Add a free block to the list for its order */
+static void free_area_push(uint32_t pfn, uint32_t order) {
+    PageBlock* block = pfn_to_block(pfn);
+    block->prev = NULL;
+    block->next = free_areas[order];
+    if (free_areas[order] != NULL) {
+        free_areas[order]->prev = block;
+    }
+    free_areas[order] = block;
+    page_state[pfn] = PAGE_STATE_FREE | order;
+}
+
+/* Remove a free block from the list for its order */
+static void free_area_remove(uint32_t pfn, uint32_t order) {
+    PageBlock* block = pfn_to_block(pfn);
+    if (block->prev != NULL) {
+        block->prev->next = block->next;
+    } else {
+        free_areas[order] = block->next;  /* Block was the head */
+    }
+    if (block->next != NULL) {
+        block->next->prev = block->prev;
+    }
+    page_state[pfn] = PAGE_STATE_NONE;
+}
+
+/* Mark the pages of [start, end) as usable */
+static void mark_available(uint64_t start, uint64_t end) {
+    if (start < PMM_LOW_LIMIT) {
+        start = PMM_LOW_LIMIT;            /* Skip low memory */
+    }
+    if (end > ((uint64_t)page_count << PAGE_SHIFT)) {
+        end = (uint64_t)page_count << PAGE_SHIFT;
+    }
+    
+    /* Only whole pages inside the region are usable */
+    uint32_t first = (uint32_t)((start + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    uint32_t last = (uint32_t)(end >> PAGE_SHIFT);
+    for (uint32_t pfn = first; pfn < last; pfn++) {
+        page_state[pfn] = PAGE_STATE_AVAILABLE;
+    }
+}
+
+/* Mark the pages touching [start, end) as reserved */
+static void mark_reserved(uintptr_t start, uintptr_t end) {
+    uint32_t first = start >> PAGE_SHIFT;
+    uint32_t last = (end + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    for (uint32_t pfn = first; pfn < last && pfn < page_count; pfn++) {
+        page_state[pfn] = PAGE_STATE_NONE;
+    }
+}
+
+/* Hand a run of available pages to the buddy lists in aligned blocks */
+static void free_run(uint32_t pfn, uint32_t end_pfn) {
+    while (pfn < end_pfn) {
+        /* Largest block that is aligned at pfn and fits in the run */
+        uint32_t order = PMM_MAX_ORDER;
+        while (order > 0 && ((pfn & ((1u << order) - 1)) != 0 || pfn + (1u << order) > end_pfn)) {
+            order--;
+        }
+        free_area_push(pfn, order);
+        pfn += 1u << order;
+        total_pages += 1u << order;
+        free_pages += 1u << order;
+    }
+}
+
+/* Later of two end addresses */
+static inline uintptr_t max_end(uintptr_t a, uintptr_t b) {
+    return a > b ? a : b;
+}
+
+/* Bytes in a module command line, terminator included (0 if there is none) */
+static uint32_t string_size(uintptr_t addr) {
+    if (addr == 0) {
+        return 0;
+    }
+    const char* s = (const char*) addr;
+    uint32_t n = 0;
+    while (s[n] != '\0') {
+        n++;
+    }
+    return n + 1;
+}
+
+/* Initialize page allocator from Multiboot info */
+void pmm_init(const MultibootInfo* mbi) {
+    for (uint32_t i = 0; i <= PMM_MAX_ORDER; i++) {
+        free_areas[i] = NULL;
+    }
+    total_pages = 0;
+    free_pages = 0;
+    
+    int have_mmap = mbi != NULL && (mbi->flags & MULTIBOOT_INFO_MEM_MAP);
+    int have_mem = mbi != NULL && (mbi->flags & MULTIBOOT_INFO_MEMORY);
+    int have_mods = mbi != NULL && (mbi->flags & MULTIBOOT_INFO_MODS) && mbi->mods_count > 0;
+    
+    /* Find the highest usable address (limited to 32-bit physical space) */
+    uint64_t top = PMM_FALLBACK_START + PMM_FALLBACK_SIZE;
+    if (have_mmap) {
+        top = 0;
+        uintptr_t entry_addr = mbi->mmap_addr;
+        while (entry_addr < mbi->mmap_addr + mbi->mmap_length) {
+            const MultibootMmapEntry* entry = (const MultibootMmapEntry*)entry_addr;
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE && entry->addr + entry->len > top) {
+                top = entry->addr + entry->len;
+            }
+            entry_addr += entry->size + sizeof(entry->size);
+        }
+    } else if (have_mem) {
+        top = PMM_LOW_LIMIT + (uint64_t)mbi->mem_upper * 1024;
+    }
+    if (top > 0xFFFFF000ULL) {
+        top = 0xFFFFF000ULL;              /* No PAE - stay below 4GB */
+    }
+    page_count = (uint32_t)(top >> PAGE_SHIFT);
+    
+    /* Page state array lives after the kernel image - GRUB puts modules
+     * right behind it, so skip past those and their list too */
+    uintptr_t state_start = (uintptr_t)end;
+    if (have_mods) {
+        const MultibootModule* mods = (const MultibootModule*)(uintptr_t)mbi->mods_addr;
+        state_start = max_end(state_start, mbi->mods_addr + mbi->mods_count * sizeof(MultibootModule));
+        for (uint32_t i = 0; i < mbi->mods_count; i++) {
+            state_start = max_end(state_start, mods[i].mod_end);
+            state_start = max_end(state_start, mods[i].string + string_size(mods[i].string));
+        }
+    }
+    page_state = (uint8_t*)((state_start + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1));
+    for (uint32_t pfn = 0; pfn < page_count; pfn++) {
+        page_state[pfn] = PAGE_STATE_NONE;
+    }
+    
+    /* Collect usable RAM */
+    if (have_mmap) {
+        uintptr_t entry_addr = mbi->mmap_addr;
+        while (entry_addr < mbi->mmap_addr + mbi->mmap_length) {
+            const MultibootMmapEntry* entry = (const MultibootMmapEntry*)entry_addr;
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE) {
+                mark_available(entry->addr, entry->addr + entry->len);
+            }
+            entry_addr += entry->size + sizeof(entry->size);
+        }
+        
+        /* Reserved entries win where the map overlaps itself */
+        entry_addr = mbi->mmap_addr;
+        while (entry_addr < mbi->mmap_addr + mbi->mmap_length) {
+            const MultibootMmapEntry* entry = (const MultibootMmapEntry*)entry_addr;
+            if (entry->type != MULTIBOOT_MEMORY_AVAILABLE && entry->addr < top) {
+                uint64_t region_end = entry->addr + entry->len;
+                mark_reserved((uintptr_t)entry->addr, (uintptr_t)(region_end < top ? region_end : top));
+            }
+            entry_addr += entry->size + sizeof(entry->size);
+        }
+    } else if (have_mem) {
+        mark_available(PMM_LOW_LIMIT, top);
+    } else {
+        mark_available(PMM_FALLBACK_START, PMM_FALLBACK_START + PMM_FALLBACK_SIZE);
+    }
+    
+    /* Keep the kernel, its page state array and the boot info out of reach */
+    mark_reserved(PMM_LOW_LIMIT, (uintptr_t)page_state + page_count);
+    if (mbi != NULL) {
+        mark_reserved((uintptr_t)mbi, (uintptr_t)mbi + sizeof(MultibootInfo));
+    }
+    if (have_mmap) {
+        mark_reserved(mbi->mmap_addr, mbi->mmap_addr + mbi->mmap_length);
+    }
+    if (have_mods) {
+        const MultibootModule* mods = (const MultibootModule*)(uintptr_t)mbi->mods_addr;
+        mark_reserved(mbi->mods_addr, mbi->mods_addr + mbi->mods_count * sizeof(MultibootModule));
+        for (uint32_t i = 0; i < mbi->mods_count; i++) {
+            mark_reserved(mods[i].mod_start, mods[i].mod_end);
+            mark_reserved(mods[i].string, mods[i].string + string_size(mods[i].string));
+        }
+    }
+    
+    /* Hand every run of available pages to the buddy lists */
+    uint32_t pfn = 0;
+    while (pfn < page_count) {
+        if (page_state[pfn] != PAGE_STATE_AVAILABLE) {
+            pfn++;
+            continue;
+        }
+        uint32_t run_end = pfn;
+        while (run_end < page_count && page_state[run_end] == PAGE_STATE_AVAILABLE) {
+            page_state[run_end] = PAGE_STATE_NONE;
+            run_end++;
+        }
+        free_run(pfn, run_end);
+        pfn = run_end;
+    }
+}
+
+/* Allocate 2^order contiguous pages */
+void* page_alloc(uint32_t order) {
+    if (order > PMM_MAX_ORDER) {
+        return NULL;                      /* Larger than any block */
+    }
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    
+    /* Find the smallest free block that is big enough */
+    uint32_t current = order;
+    while (current <= PMM_MAX_ORDER && free_areas[current] == NULL) {
+        current++;
+    }
+    if (current > PMM_MAX_ORDER) {
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return NULL;                      /* Out of memory */
+    }
+    
+    uint32_t pfn = addr_to_pfn(free_areas[current]);
+    free_area_remove(pfn, current);
+    
+    /* Split down, returning the upper halves to the free lists */
+    while (current > order) {
+        current--;
+        free_area_push(pfn + (1u << current), current);
+    }
+    
+    page_state[pfn] = PAGE_STATE_USED | order;
+    free_pages -= 1u << order;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return (void*)pfn_to_block(pfn);
+}
+
+/* Free pages previously returned by page_alloc */
+void page_free(void* addr, uint32_t order) {
+    if (addr == NULL || order > PMM_MAX_ORDER) {
+        return;                           /* Nothing to free */
+    }
+    
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    uint32_t pfn = addr_to_pfn(addr);
+    if (pfn >= page_count || page_state[pfn] != (PAGE_STATE_USED | order)) {
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return;                           /* Not an allocated block of this order */
+    }
+    page_state[pfn] = PAGE_STATE_NONE;
+    free_pages += 1u << order;
+    
+    /* Merge with the buddy for as long as it is free and the same size */
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy = pfn ^ (1u << order);
+        if (buddy >= page_count || page_state[buddy] != (PAGE_STATE_FREE | order)) {
+            break;                        /* Buddy in use or split */
+        }
+        free_area_remove(buddy, order);
+        pfn &= ~(1u << order);            /* Merged block starts at lower half */
+        order++;
+    }
+    
+    free_area_push(pfn, order);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+/* Smallest order whose block holds at least size bytes */
+uint32_t page_order_for_size(uint32_t size) {
+    uint32_t order = 0;
+    while (order < PMM_MAX_ORDER && ((uint32_t)PAGE_SIZE << order) < size) {
+        order++;
+    }
+    return order;
+}
+
+/* Get page statistics */
+void pmm_get_stats(uint32_t* total, uint32_t* free) {
+    *total = total_pages;
+    *free = free_pages;
+}
@@ -0,0 +1,33 @@
+/* pmm.h - Physical page frame allocator for JoshOS
+ * 
+ * Manages all usable RAM reported by the bootloader in 4KB pages using a
+ * buddy system. Blocks are 2^order contiguous pages.
+ */
+
+#ifndef PMM_H
+#define PMM_H
+
+#include "memory.h"
+#include "multiboot.h"
+
+/* Page constants */
+#define PAGE_SIZE      4096               /* Bytes per page */
+#define PAGE_SHIFT     12                 /* log2(PAGE_SIZE) */
+#define PMM_MAX_ORDER  10                 /* Largest block: 2^10 pages (4MB) */
+
+/* Initialize page allocator from Multiboot info (NULL if not available) */
+void pmm_init(const MultibootInfo* mbi);
+
+/* Allocate 2^order contiguous pages, aligned to their size */
+void* page_alloc(uint32_t order);
+
+/* Free pages previously returned by page_alloc with the same order */
+void page_free(void* addr, uint32_t order);
+
+/* Smallest order whose block holds at least size bytes */
+uint32_t page_order_for_size(uint32_t size);
+
+/* Get page statistics (in pages) */
+void pmm_get_stats(uint32_t* total, uint32_t* free);
+
+#endif /* PMM_H */
@@ -0,0 +1,153 @@
+/* profile.c - Sampling profiler for NEBULA OS
+ *
+ * Each CPU owns a small open-addressed hash table from EIP to sample
+ * count. Only that CPU's timer handler writes it, so recording a sample
+ * takes no lock; the dump thread reads the tables of running CPUs and
+ * may see a count one sample short, which a statistical profile does
+ * not mind. Samples that find no free slot within a few probes are
+ * counted as dropped rather than evicting anything.
+ *
+ * The rate is deliberately not a divisor of the 60 Hz refresh or the
+ * scheduler tick, so sampling doesn't lock step with periodic work and
+ * keep hitting (or missing) the same code.
+ *
+ * Every PROFILE_DUMP_INTERVAL_NS the totals so far are sent as
+ *
+ *     P begin <cpus>
+ *     P cpu <cpu> <samples> <dropped>
+ *     P <cpu> <eip> <count>          (one line per distinct EIP)
+ *     P end
+ *
+ * Counts are cumulative, so the last complete dump is the whole profile.
+ */
+
+#include "profile.h"
+#include "apic.h"
+#include "idt.h"
+#include "percpu.h"
+#include "sched.h"
+#include "serial.h"
+#include "timer.h"
+
+/* Samples per second on each CPU */
+#define PROFILE_HZ 997
+
+/* Distinct EIPs per CPU */
+#define PROFILE_SLOT_BITS 10
+#define PROFILE_SLOTS     (1u << PROFILE_SLOT_BITS)
+#define PROFILE_MASK      (PROFILE_SLOTS - 1)
+
+/* Slots tried before a sample is dropped */
+#define PROFILE_PROBES 16
+
+/* Pause between dumps */
+#define PROFILE_DUMP_INTERVAL_NS (10 * NS_PER_SEC)
+
+/* One CPU's histogram */
+typedef struct {
+    uint8_t armed;                        /* APIC timer running */
+    uint32_t samples;                     /* Samples taken */
+    uint32_t dropped;                     /* Samples with no free slot */
+    uint32_t eips[PROFILE_SLOTS];         /* Sampled EIP, 0 if free */
+    uint32_t counts[PROFILE_SLOTS];       /* Samples at that EIP */
+} ProfileCpu;
+
+static ProfileCpu profile_cpus[SMP_MAX_CPUS];
+
+/* Home slot of an EIP (multiplicative hash - nearby EIPs spread out) */
+static inline uint32_t profile_slot(uint32_t eip) {
+    return (eip * 2654435761u) >> (32 - PROFILE_SLOT_BITS);
+}
+
+/* Count one sample at eip */
+static void profile_record(ProfileCpu* pc, uint32_t eip) {
+    pc->samples++;
+    uint32_t slot = profile_slot(eip);
+    for (uint32_t probe = 0; probe < PROFILE_PROBES; probe++) {
+        uint32_t i = (slot + probe) & PROFILE_MASK;
+        if (pc->eips[i] == eip) {
+            pc->counts[i]++;
+            return;
+        }
+        if (pc->eips[i] == 0) {
+            pc->counts[i] = 1;            /* Count before the EIP - readers skip 0 */
+            __atomic_store_n(&pc->eips[i], eip, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+    pc->dropped++;
+}
+
+/* APIC timer tick - the first one on each CPU is the IPI that starts it */
+static void profile_tick(InterruptFrame* frame) {
+    lapic_eoi();
+    ProfileCpu* pc = &profile_cpus[cpu_index()];
+    if (!pc->armed) {
+        pc->armed = 1;
+        lapic_timer_start(APIC_PROFILE_VECTOR, PROFILE_HZ);
+        return;
+    }
+    profile_record(pc, frame->eip);
+}
+
+/* Send every CPU's histogram */
+static void profile_dump(void) {
+    serial_write("P begin ");
+    serial_write_dec(cpu_count, 0);
+    serial_write("\n");
+    for (uint32_t cpu = 0; cpu < cpu_count; cpu++) {
+        ProfileCpu* pc = &profile_cpus[cpu];
+        serial_write("P cpu ");
+        serial_write_dec(cpu, 0);
+        serial_write(" ");
+        serial_write_dec(__atomic_load_n(&pc->samples, __ATOMIC_RELAXED), 0);
+        serial_write(" ");
+        serial_write_dec(__atomic_load_n(&pc->dropped, __ATOMIC_RELAXED), 0);
+        serial_write("\n");
+        for (uint32_t i = 0; i < PROFILE_SLOTS; i++) {
+            uint32_t eip = __atomic_load_n(&pc->eips[i], __ATOMIC_ACQUIRE);
+            if (eip == 0) {
+                continue;
+            }
+            serial_write("P ");
+            serial_write_dec(cpu, 0);
+            serial_write(" ");
+            serial_write_hex(eip);
+            serial_write(" ");
+            serial_write_dec(__atomic_load_n(&pc->counts[i], __ATOMIC_RELAXED), 0);
+            serial_write("\n");
+        }
+    }
+    serial_write("P end\n");
+}
+
+/* Dump the histograms, forever */
+static void profile_dump_thread(void* arg) {
+    (void)arg;
+    while (1) {
+        thread_sleep(PROFILE_DUMP_INTERVAL_NS);
+        profile_dump();
+    }
+}
+
+/* Start sampling */
+void profile_start(void) {
+    if (!serial_present()) {
+        return;                           /* Nowhere to send the profile */
+    }
+    if (!lapic_available() || lapic_timer_hz() / PROFILE_HZ == 0) {
+        serial_write("profile: no local APIC timer\n");
+        return;
+    }
+    interrupt_install_handler(APIC_PROFILE_VECTOR, profile_tick);
+
+    /* Each CPU has to program its own timer - ask them to */
+    for (uint32_t cpu = 0; cpu < cpu_count; cpu++) {
+        lapic_send_ipi(cpus[cpu].apic_id, APIC_PROFILE_VECTOR);
+    }
+    thread_create("profile", profile_dump_thread, NULL, SCHED_PRIORITY_LOW);
+
+    serial_write("profile: sampling at ");
+    serial_write_dec(PROFILE_HZ, 0);
+    serial_write(" Hz\n");
+}
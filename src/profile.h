@@ -0,0 +1,32 @@
+/* profile.h - Sampling profiler for NEBULA OS
+ *
+ * Every CPU's local APIC timer interrupts it PROFILE_HZ times a second;
+ * the handler counts the interrupted EIP in that CPU's histogram. No
+ * code needs marking up - hot loops simply collect the most samples. A
+ * low-priority thread dumps the histograms to COM1 now and then, and
+ * tools/symbolize.sh turns the last dump into a per-function report
+ * (make profile does the whole round trip in QEMU).
+ *
+ * Handlers run with interrupts off, so time spent with interrupts
+ * disabled is charged to the instruction that enables them again.
+ *
+ * The profiler is only compiled in with NEBULA_PROFILE (make PROFILE=1);
+ * without it profile_start expands to nothing.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#ifdef NEBULA_PROFILE
+
+/* Start sampling on every online CPU (after smp_init and sched_init) */
+void profile_start(void);
+
+#else
+
+static inline void profile_start(void) {
+}
+
+#endif /* NEBULA_PROFILE */
+
+#endif /* PROFILE_H */
@@ -0,0 +1,89 @@
+/* rtc.c - CMOS real-time clock for JoshOS
+ *
+ * The registers can change in the middle of a read, so the clock is read
+ * until two consecutive reads agree. Values may be BCD and the hour may
+ * be in 12-hour format, depending on status register B.
+ */
+
+#include "rtc.h"
+#include "io.h"
+
+/* CMOS ports */
+#define CMOS_INDEX     0x70
+#define CMOS_DATA      0x71
+
+/* CMOS registers */
+#define RTC_SECONDS    0x00
+#define RTC_MINUTES    0x02
+#define RTC_HOURS      0x04
+#define RTC_DAY        0x07
+#define RTC_MONTH      0x08
+#define RTC_YEAR       0x09
+#define RTC_STATUS_A   0x0A
+#define RTC_STATUS_B   0x0B
+
+/* Status bits */
+#define RTC_UPDATING   0x80               /* Status A: update in progress */
+#define RTC_24_HOUR    0x02               /* Status B: 24-hour mode */
+#define RTC_BINARY     0x04               /* Status B: binary, not BCD */
+#define RTC_HOUR_PM    0x80               /* Hour register: PM in 12-hour mode */
+
+/* Read one CMOS register */
+static uint8_t cmos_read(uint8_t reg) {
+    outb(CMOS_INDEX, reg);
+    return inb(CMOS_DATA);
+}
+
+/* Read all time registers once, after any update in progress */
+static void rtc_read_raw(RtcTime* time) {
+    while (cmos_read(RTC_STATUS_A) & RTC_UPDATING) {
+        /* Wait - an update takes under 2ms */
+    }
+    time->second = cmos_read(RTC_SECONDS);
+    time->minute = cmos_read(RTC_MINUTES);
+    time->hour = cmos_read(RTC_HOURS);
+    time->day = cmos_read(RTC_DAY);
+    time->month = cmos_read(RTC_MONTH);
+    time->year = cmos_read(RTC_YEAR);
+}
+
+/* Convert a BCD byte to binary */
+static inline uint8_t bcd_to_binary(uint8_t value) {
+    return (value & 0x0F) + (value >> 4) * 10;
+}
+
+/* Read the current date and time */
+void rtc_read(RtcTime* time) {
+    RtcTime previous;
+
+    rtc_read_raw(time);
+    do {
+        previous = *time;
+        rtc_read_raw(time);
+    } while (previous.second != time->second || previous.minute != time->minute ||
+             previous.hour != time->hour || previous.day != time->day ||
+             previous.month != time->month || previous.year != time->year);
+
+    uint8_t status = cmos_read(RTC_STATUS_B);
+    uint8_t pm = time->hour & RTC_HOUR_PM;
+    time->hour &= ~RTC_HOUR_PM;
+
+    if (!(status & RTC_BINARY)) {
+        time->second = bcd_to_binary(time->second);
+        time->minute = bcd_to_binary(time->minute);
+        time->hour = bcd_to_binary(time->hour);
+        time->day = bcd_to_binary(time->day);
+        time->month = bcd_to_binary(time->month);
+        time->year = bcd_to_binary(time->year);
+    }
+
+    /* 12-hour mode: 12 AM is 0, 1-11 PM are 13-23 */
+    if (!(status & RTC_24_HOUR)) {
+        time->hour %= 12;
+        if (pm) {
+            time->hour += 12;
+        }
+    }
+
+    time->year += 2000;                   /* Two-digit year register */
+}
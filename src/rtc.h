@@ -0,0 +1,28 @@
+/* rtc.h - CMOS real-time clock for JoshOS
+ *
+ * The RTC is only read once at boot to learn the wall-clock time; from
+ * then on the time is advanced with now_ns.
+ */
+
+#ifndef RTC_H
+#define RTC_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned short     uint16_t;
+typedef unsigned int       uint32_t;
+
+/* Wall-clock time (24-hour) */
+typedef struct {
+    uint8_t second;
+    uint8_t minute;
+    uint8_t hour;
+    uint8_t day;
+    uint8_t month;
+    uint16_t year;
+} RtcTime;
+
+/* Read the current date and time */
+void rtc_read(RtcTime* time);
+
+#endif /* RTC_H */
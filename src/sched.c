@@ -0,0 +1,650 @@
+/* sched.c - Kernel threads and scheduler for JoshOS
+ *
+ * Each CPU has its own run queue: one FIFO per priority, plus a bitmap of
+ * the non-empty ones, so the next thread is found with a single
+ * count-trailing-zeros instead of a scan. Run queues have their own locks,
+ * so CPUs only contend when one wakes a thread onto another's queue or
+ * steals from it. Woken threads go to an idle CPU when there is one;
+ * otherwise a CPU that runs out of work steals from the busiest queue.
+ *
+ * Every scheduler operation runs with interrupts disabled. Switches that
+ * an interrupt asks for (a higher priority thread woke up, the time slice
+ * ran out, or another CPU sent a reschedule IPI) are deferred until the
+ * handler returns through sched_irq_exit, so they happen on the
+ * interrupted thread's stack with its interrupt frame saved underneath.
+ *
+ * A thread that has just blocked can be woken and picked up by another
+ * CPU before its own CPU has finished switching away from it. on_cpu
+ * covers that window: it is cleared only once the switch is complete,
+ * and a CPU about to run a thread waits for it first. For the same reason
+ * schedule decides whether to re-queue the thread it switches away from
+ * by blocking, which the thread sets before any waker can find it, not by
+ * its state, which a waker may already have changed. Wakers take the
+ * thread's wake_lock to move it out of THREAD_BLOCKED, so it is made
+ * ready once however many of them race.
+ */
+
+#include "sched.h"
+#include "slab.h"
+#include "pmm.h"
+#include "gdt.h"
+#include "idt.h"
+#include "cpu.h"
+#include "apic.h"
+#include "percpu.h"
+#include "kstring.h"
+
+/* EFLAGS interrupt flag */
+#define EFLAGS_IF 0x200
+
+/* Thread stack size */
+#define THREAD_STACK_SIZE ((uint32_t) PAGE_SIZE << THREAD_STACK_ORDER)
+
+/* Ready threads - one FIFO per priority plus a non-empty bitmap */
+typedef struct {
+    uint32_t ready_mask;                  /* Bit n set if heads[n] != NULL */
+    Thread* heads[SCHED_PRIORITIES];
+    Thread* tails[SCHED_PRIORITIES];
+} RunQueue;
+
+/* One CPU's scheduler state */
+typedef struct {
+    Spinlock lock;                        /* Guards queue and ready */
+    RunQueue queue;
+    uint32_t ready;                       /* Threads in queue (read unlocked as a hint) */
+    Thread* idle;                         /* Runs when the queue is empty */
+    Thread* prev;                         /* Thread being switched away from */
+    uint8_t need_resched;                 /* Switch at the next opportunity */
+    uint8_t slice_armed;
+    Timer slice_timer;                    /* Time slice between equal priorities */
+} SchedCpu;
+
+/* Scheduler state */
+static SchedCpu sched_cpus[SMP_MAX_CPUS];
+static Spinlock zombie_lock = SPINLOCK_INIT;
+static Thread* zombies = NULL;            /* Exited threads to free */
+static uint32_t next_id = 0;              /* Next thread id */
+static KmemCache* thread_cache = NULL;    /* Thread structures */
+static Thread boot_thread __attribute__((aligned(16))); /* kernel_main's context */
+
+/* FPU/SSE state */
+static uint8_t use_fxsave = 0;            /* FXSAVE/FXRSTOR instead of FNSAVE/FRSTOR */
+static uint8_t clean_fpu[512] __attribute__((aligned(16))); /* State for new threads */
+
+/* Switch stacks (switch.S) */
+extern void switch_context(uint32_t* save_esp, uint32_t load_esp);
+
+/* The thread running on this CPU (one %gs load, so safe from any context) */
+static inline Thread* current_thread(void) {
+    Thread* thread;
+    PERCPU_READ(current, thread);
+    return thread;
+}
+
+/* Add a thread to the back of its priority's queue (lock held) */
+static void run_queue_push(SchedCpu* sc, Thread* thread) {
+    RunQueue* rq = &sc->queue;
+    uint8_t priority = thread->priority;
+    thread->next = NULL;
+    if (rq->tails[priority] != NULL) {
+        rq->tails[priority]->next = thread;
+    } else {
+        rq->heads[priority] = thread;
+    }
+    rq->tails[priority] = thread;
+    rq->ready_mask |= 1u << priority;
+    sc->ready++;
+}
+
+/* Take the first thread of the highest non-empty priority (lock held) */
+static Thread* run_queue_pop(SchedCpu* sc) {
+    RunQueue* rq = &sc->queue;
+    if (rq->ready_mask == 0) {
+        return NULL;
+    }
+    uint32_t priority = __builtin_ctz(rq->ready_mask);
+    Thread* thread = rq->heads[priority];
+    rq->heads[priority] = thread->next;
+    if (rq->heads[priority] == NULL) {
+        rq->tails[priority] = NULL;
+        rq->ready_mask &= ~(1u << priority);
+    }
+    thread->next = NULL;
+    sc->ready--;
+    return thread;
+}
+
+/* Save the FPU/SSE registers into a 512-byte, 16-byte aligned area */
+static inline void fpu_save(uint8_t* area) {
+    if (use_fxsave) {
+        __asm__ volatile ("fxsave %0" : "=m" (*(uint8_t (*)[512]) area));
+    } else {
+        __asm__ volatile ("fnsave %0" : "=m" (*(uint8_t (*)[512]) area));
+    }
+}
+
+/* Load the FPU/SSE registers from an area written by fpu_save */
+static inline void fpu_restore(const uint8_t* area) {
+    if (use_fxsave) {
+        __asm__ volatile ("fxrstor %0" : : "m" (*(const uint8_t (*)[512]) area));
+    } else {
+        __asm__ volatile ("frstor %0" : : "m" (*(const uint8_t (*)[512]) area));
+    }
+}
+
+/* Ask another CPU to look at its run queue */
+static inline void sched_kick(uint32_t cpu) {
+    lapic_send_ipi(cpus[cpu].apic_id, APIC_RESCHEDULE_VECTOR);
+}
+
+/* Check if a CPU is online with nothing to do */
+static inline uint8_t cpu_is_idle(uint32_t cpu) {
+    return cpus[cpu].online && cpus[cpu].current == sched_cpus[cpu].idle && sched_cpus[cpu].ready == 0;
+}
+
+/* Time slice over - let the next thread of the same priority run. Timer
+ * callbacks run on the bootstrap CPU, so other CPUs are sent an IPI */
+static void slice_expired(void* arg) {
+    SchedCpu* sc = (SchedCpu*) arg;
+    uint32_t cpu = sc - sched_cpus;
+    sc->slice_armed = 0;
+    sc->need_resched = 1;
+    if (cpu != cpu_index()) {
+        sched_kick(cpu);
+    }
+}
+
+/* Start a time slice if another thread is waiting at the running priority
+ * (this CPU, interrupts disabled) */
+static void slice_update(SchedCpu* sc, Thread* running) {
+    if (running != sc->idle && (sc->queue.ready_mask & (1u << running->priority))) {
+        if (!sc->slice_armed) {
+            sc->slice_armed = timer_start(&sc->slice_timer, SCHED_TIME_SLICE_NS, 0, slice_expired, sc);
+        }
+    } else if (sc->slice_armed) {
+        timer_cancel(&sc->slice_timer);   /* Running alone - no need to preempt */
+        sc->slice_armed = 0;
+    }
+}
+
+/* Decide whether what is queued here should preempt the running thread */
+static void check_preempt(SchedCpu* sc, Thread* running) {
+    uint32_t mask = sc->queue.ready_mask;
+    if (mask == 0) {
+        return;
+    }
+    uint32_t top = __builtin_ctz(mask);
+    if (running == sc->idle || top < running->priority) {
+        sc->need_resched = 1;
+    } else if (top == running->priority) {
+        slice_update(sc, running);        /* Share the CPU */
+    }
+}
+
+/* Take the best thread from the busiest other CPU, if it can be had
+ * without waiting */
+static Thread* steal_thread(uint32_t self) {
+    uint32_t victim = self;
+    uint32_t most = 0;
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (cpu != self && cpus[cpu].online && sched_cpus[cpu].ready > most) {
+            most = sched_cpus[cpu].ready;
+            victim = cpu;
+        }
+    }
+    if (most == 0) {
+        return NULL;
+    }
+
+    /* trylock - two CPUs stealing from each other must not deadlock */
+    SchedCpu* sc = &sched_cpus[victim];
+    if (!spin_trylock(&sc->lock)) {
+        return NULL;
+    }
+    Thread* thread = run_queue_pop(sc);
+    spin_unlock(&sc->lock);
+    return thread;
+}
+
+/* Check if another CPU has threads waiting */
+static uint8_t work_elsewhere(uint32_t self) {
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (cpu != self && cpus[cpu].online && sched_cpus[cpu].ready > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Finish a switch in the thread that was switched to: the previous
+ * thread's stack is no longer in use */
+static inline void switch_finish(void) {
+    SchedCpu* sc = &sched_cpus[cpu_index()];
+    __atomic_store_n(&sc->prev->on_cpu, 0, __ATOMIC_RELEASE);
+}
+
+/* Pick the next thread and switch to it (interrupts disabled) */
+static void schedule(void) {
+    Cpu* cpu = cpu_self();
+    SchedCpu* sc = &sched_cpus[cpu->index];
+    Thread* prev = cpu->current;
+    sc->need_resched = 0;
+
+    spin_lock(&sc->lock);
+    if (!prev->blocking && prev != sc->idle) {
+        prev->state = THREAD_READY;       /* Preempted or yielding - back of the line */
+        run_queue_push(sc, prev);
+    }
+    prev->blocking = 0;                   /* Only ever read on the CPU it runs on */
+    Thread* next = run_queue_pop(sc);
+    spin_unlock(&sc->lock);
+
+    if (next == NULL) {
+        next = steal_thread(cpu->index);
+    }
+    if (next == NULL) {
+        next = sc->idle;                  /* Never queued - always available here */
+    }
+    cpu->current = next;
+
+    /* A fresh slice for the incoming thread */
+    if (sc->slice_armed) {
+        timer_cancel(&sc->slice_timer);
+        sc->slice_armed = 0;
+    }
+    slice_update(sc, next);
+
+    if (next == prev) {
+        next->state = THREAD_RUNNING;     /* Woken before it got away */
+        return;
+    }
+
+    /* Its last CPU may still be switching away from it */
+    while (__atomic_load_n(&next->on_cpu, __ATOMIC_ACQUIRE)) {
+        __asm__ volatile ("pause");
+    }
+    next->on_cpu = 1;
+    next->state = THREAD_RUNNING;
+    next->cpu = cpu->index;
+    sc->prev = prev;
+    if (next->stack != NULL) {
+        gdt_set_kernel_stack(cpu->index, (uint32_t) next->stack + THREAD_STACK_SIZE);
+    }
+
+    fpu_save(prev->fpu_state);
+    switch_context(&prev->esp, next->esp);
+    switch_finish();                      /* prev is running again, maybe elsewhere */
+    fpu_restore(prev->fpu_state);
+}
+
+/* Where a woken thread should run: its last CPU if idle, else any idle
+ * CPU, else its last CPU anyway */
+static uint32_t select_cpu(const Thread* thread) {
+    uint32_t home = thread->cpu;
+    if (cpu_is_idle(home)) {
+        return home;
+    }
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (cpu_is_idle(cpu)) {
+            return cpu;
+        }
+    }
+    return home;
+}
+
+/* Make a blocked or new thread ready, flagging or requesting a switch if
+ * it should run now (interrupts disabled) - returns 0 if it was not
+ * blocked, e.g. another waker got there first */
+static uint8_t thread_make_ready(Thread* thread) {
+    spin_lock(&thread->wake_lock);
+    uint8_t blocked = thread->state == THREAD_BLOCKED;
+    if (blocked) {
+        thread->state = THREAD_READY;     /* Ours to wake */
+    }
+    spin_unlock(&thread->wake_lock);
+    if (!blocked) {
+        return 0;
+    }
+
+    uint32_t target = select_cpu(thread);
+    SchedCpu* sc = &sched_cpus[target];
+
+    spin_lock(&sc->lock);
+    thread->cpu = target;
+    run_queue_push(sc, thread);
+    spin_unlock(&sc->lock);
+
+    if (target == cpu_index()) {
+        Thread* running = current_thread();
+        if (running != NULL) {
+            check_preempt(sc, running);
+        }
+    } else {
+        Thread* running = cpus[target].current;
+        if (running == sc->idle || thread->priority <= running->priority) {
+            sched_kick(target);           /* It decides for itself */
+        }
+    }
+    return 1;
+}
+
+/* Mark the running thread blocked before a waker can find it (interrupts
+ * disabled) - schedule will switch away without re-queuing it */
+static void thread_block(Thread* self) {
+    spin_lock(&self->wake_lock);
+    self->state = THREAD_BLOCKED;
+    self->blocking = 1;
+    spin_unlock(&self->wake_lock);
+}
+
+/* First code every new thread runs, entered from switch_context */
+static void thread_start(void) {
+    switch_finish();
+    Thread* self = current_thread();
+    fpu_restore(self->fpu_state);         /* Clean state copied at creation */
+    interrupts_enable();                  /* The switch happened with them off */
+    self->entry(self->arg);
+    thread_exit();
+}
+
+/* Free the stacks and structures of exited threads that have been
+ * switched away from for good */
+static void reap_zombies(void) {
+    uint32_t flags = spin_lock_irqsave(&zombie_lock);
+    Thread** link = &zombies;
+    while (*link != NULL) {
+        Thread* thread = *link;
+        if (__atomic_load_n(&thread->on_cpu, __ATOMIC_ACQUIRE)) {
+            link = &thread->next;         /* Still finishing its last switch */
+            continue;
+        }
+        *link = thread->next;
+        page_free(thread->stack, THREAD_STACK_ORDER);
+        kmem_cache_free(thread_cache, thread);
+    }
+    spin_unlock_irqrestore(&zombie_lock, flags);
+}
+
+/* Idle thread - free dead threads, look for work and halt until there is some */
+static void idle_loop(void* arg) {
+    (void)arg;
+    while (1) {
+        reap_zombies();
+        interrupts_disable();
+        uint32_t self = cpu_index();
+        if (sched_cpus[self].queue.ready_mask == 0 && !work_elsewhere(self)) {
+            /* Nothing to run - sti takes effect after hlt starts, so a
+             * wakeup (IRQ or IPI) between the check and the hlt is not missed */
+            __asm__ volatile ("sti; hlt" : : : "memory");
+        } else {
+            interrupts_enable();
+            thread_yield();
+        }
+    }
+}
+
+/* Reschedule IPI - another CPU queued work here or ended our slice */
+static void reschedule_ipi(InterruptFrame* frame) {
+    (void)frame;
+    lapic_eoi();
+    SchedCpu* sc = &sched_cpus[cpu_index()];
+    Thread* running = current_thread();
+    if (running == sc->idle) {
+        sc->need_resched = 1;             /* Look for work, ours or stolen */
+    } else {
+        check_preempt(sc, running);
+    }
+}
+
+/* Set up a thread structure and its initial stack, not yet runnable */
+static Thread* thread_alloc(const char* name, thread_func_t entry, void* arg, uint8_t priority) {
+    Thread* thread = (Thread*) kmem_cache_alloc(thread_cache);
+    uint8_t* stack = (uint8_t*) page_alloc(THREAD_STACK_ORDER);
+    if (thread == NULL || stack == NULL) {
+        if (thread != NULL) kmem_cache_free(thread_cache, thread);
+        if (stack != NULL) page_free(stack, THREAD_STACK_ORDER);
+        return NULL;                      /* Out of memory */
+    }
+
+    kmemcpy(thread->fpu_state, clean_fpu, sizeof(clean_fpu));
+    thread->stack = stack;
+    thread->next = NULL;
+    thread->entry = entry;
+    thread->arg = arg;
+    thread->name = name;
+    thread->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    thread->priority = priority;
+    thread->state = THREAD_BLOCKED;
+    thread->on_cpu = 0;
+    thread->cpu = cpu_index();
+    thread->blocking = 0;
+    thread->wake_lock = (Spinlock) SPINLOCK_INIT;
+    thread->sleep_timer.slot = -1;
+
+    /* Initial stack, as if switch_context had been called from thread_start:
+     * registers, then the return address into thread_start, then a dummy
+     * return address for thread_start itself (16-byte aligned above it) */
+    uint32_t* sp = (uint32_t*)(stack + THREAD_STACK_SIZE);
+    *--sp = 0;                            /* thread_start never returns */
+    *--sp = (uint32_t) thread_start;
+    *--sp = 0;                            /* ebp */
+    *--sp = 0;                            /* ebx */
+    *--sp = 0;                            /* esi */
+    *--sp = 0;                            /* edi */
+    thread->esp = (uint32_t) sp;
+    return thread;
+}
+
+/* Turn the boot context into the first thread and start the idle thread */
+void sched_init(void) {
+    uint32_t flags = interrupts_save();
+
+    use_fxsave = cpu_has(CPU_FEATURE_FXSR);
+    __asm__ volatile ("fninit");
+    fpu_save(clean_fpu);
+
+    thread_cache = kmem_cache_create(sizeof(Thread), 16);
+    kmemset(sched_cpus, 0, sizeof(sched_cpus));
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        sched_cpus[cpu].slice_timer.slot = -1;
+    }
+
+    /* kernel_main keeps running as the boot thread on the boot stack */
+    kmemset(&boot_thread, 0, sizeof(boot_thread));
+    boot_thread.name = "main";
+    boot_thread.id = next_id++;
+    boot_thread.priority = SCHED_PRIORITY_NORMAL;
+    boot_thread.state = THREAD_RUNNING;
+    boot_thread.on_cpu = 1;
+    boot_thread.sleep_timer.slot = -1;
+
+    sched_cpus[0].idle = thread_alloc("idle", idle_loop, NULL, SCHED_PRIORITY_IDLE);
+    cpus[0].current = &boot_thread;
+    cpus[0].online = 1;
+
+    interrupt_install_handler(APIC_RESCHEDULE_VECTOR, reschedule_ipi);
+    interrupts_restore(flags);
+}
+
+/* Turn an application processor's boot context into its idle thread */
+void sched_start_cpu(void) {
+    uint32_t self = cpu_index();
+
+    Thread* idle = (Thread*) kmem_cache_alloc(thread_cache);
+    if (idle == NULL) {
+        while (1) {
+            __asm__ volatile ("cli; hlt");  /* Stay offline */
+        }
+    }
+    kmemset(idle, 0, sizeof(*idle));
+    idle->name = "idle";
+    idle->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    idle->priority = SCHED_PRIORITY_IDLE;
+    idle->state = THREAD_RUNNING;
+    idle->on_cpu = 1;
+    idle->cpu = self;
+    idle->sleep_timer.slot = -1;
+
+    sched_cpus[self].idle = idle;
+    cpus[self].current = idle;
+    __atomic_store_n(&cpus[self].online, 1, __ATOMIC_RELEASE);
+
+    interrupts_enable();
+    idle_loop(NULL);
+    while (1) {
+        /* idle_loop never returns */
+    }
+}
+
+/* Create a ready thread */
+Thread* thread_create(const char* name, thread_func_t entry, void* arg, uint8_t priority) {
+    if (priority >= SCHED_PRIORITIES) {
+        priority = SCHED_PRIORITIES - 1;
+    }
+
+    uint32_t flags = interrupts_save();
+    Thread* thread = thread_alloc(name, entry, arg, priority);
+    if (thread == NULL) {
+        interrupts_restore(flags);
+        return NULL;
+    }
+
+    thread_make_ready(thread);
+    if (sched_cpus[cpu_index()].need_resched && (flags & EFLAGS_IF)) {
+        schedule();                       /* New thread outranks us */
+    }
+    interrupts_restore(flags);
+    return thread;
+}
+
+/* The running thread */
+Thread* thread_current(void) {
+    return current_thread();
+}
+
+/* Change the running thread's priority */
+void thread_set_priority(uint8_t priority) {
+    Thread* self = current_thread();
+    if (self == NULL || priority >= SCHED_PRIORITIES) {
+        return;
+    }
+    uint32_t flags = interrupts_save();
+    SchedCpu* sc = &sched_cpus[cpu_index()];
+    self->priority = priority;
+    uint32_t mask = sc->queue.ready_mask;
+    if (mask != 0 && __builtin_ctz(mask) < priority) {
+        schedule();                       /* Someone now outranks us */
+    } else {
+        slice_update(sc, self);
+    }
+    interrupts_restore(flags);
+}
+
+/* Give the CPU to another ready thread of the same or higher priority */
+void thread_yield(void) {
+    if (current_thread() == NULL) {
+        return;
+    }
+    uint32_t flags = interrupts_save();
+    schedule();
+    interrupts_restore(flags);
+}
+
+/* Timer callback - a sleeping thread's time is up */
+static void sleep_expired(void* arg) {
+    thread_make_ready((Thread*) arg);
+}
+
+/* Block for at least ns nanoseconds */
+void thread_sleep(uint64_t ns) {
+    Thread* self = current_thread();
+    if (self == NULL) {
+        /* No scheduler yet - halt in place */
+        uint64_t end = now_ns() + ns;
+        while (now_ns() < end) {
+            timer_sleep_until(end);
+        }
+        return;
+    }
+
+    /* Blocked before the timer is armed - it may fire on another CPU at
+     * once, and make us ready before schedule has switched away */
+    uint32_t flags = interrupts_save();
+    thread_block(self);
+    if (timer_start(&self->sleep_timer, ns, 0, sleep_expired, self)) {
+        schedule();
+    } else {
+        spin_lock(&self->wake_lock);      /* No timer - nobody will wake us */
+        self->state = THREAD_RUNNING;
+        self->blocking = 0;
+        spin_unlock(&self->wake_lock);
+    }
+    interrupts_restore(flags);
+}
+
+/* End the running thread */
+void thread_exit(void) {
+    interrupts_disable();
+    Thread* self = current_thread();
+    self->state = THREAD_DEAD;
+    self->blocking = 1;
+    spin_lock(&zombie_lock);
+    self->next = zombies;                 /* An idle thread frees it */
+    zombies = self;
+    spin_unlock(&zombie_lock);
+    schedule();
+    while (1) {
+        /* Never scheduled again */
+    }
+}
+
+/* Block on a wait queue (its lock held, interrupts disabled) */
+void thread_wait(WaitQueue* queue) {
+    Thread* self = current_thread();
+    if (self == NULL) {
+        spin_unlock(&queue->lock);
+        __asm__ volatile ("sti; hlt; cli" : : : "memory");
+        spin_lock(&queue->lock);
+        return;
+    }
+
+    self->next = NULL;
+    if (queue->tail != NULL) {
+        queue->tail->next = self;
+    } else {
+        queue->head = self;
+    }
+    queue->tail = self;
+    thread_block(self);
+    spin_unlock(&queue->lock);            /* A waker may now find us */
+
+    schedule();
+    spin_lock(&queue->lock);
+}
+
+/* Make every thread on the queue ready */
+uint32_t thread_wake_all(WaitQueue* queue) {
+    uint32_t woken = 0;
+    uint32_t flags = spin_lock_irqsave(&queue->lock);
+    while (queue->head != NULL) {
+        Thread* thread = queue->head;
+        queue->head = thread->next;
+        woken += thread_make_ready(thread);
+    }
+    queue->tail = NULL;
+    spin_unlock(&queue->lock);
+
+    /* In an interrupt handler (IF was off) the switch waits for sched_irq_exit */
+    if (sched_cpus[cpu_index()].need_resched && (flags & EFLAGS_IF)) {
+        schedule();
+    }
+    interrupts_restore(flags);
+    return woken;
+}
+
+/* Preemption point on the way out of an interrupt */
+void sched_irq_exit(void) {
+    if (current_thread() != NULL && sched_cpus[cpu_index()].need_resched) {
+        schedule();
+    }
+}
@@ -0,0 +1,124 @@
+/* sched.h - Kernel threads and scheduler for JoshOS
+ *
+ * Threads are preemptive and priority scheduled: on each CPU the highest
+ * priority ready thread runs, threads of equal priority share the CPU in
+ * time slices. Lower numbers are higher priorities. Each CPU has its own
+ * run queue; a CPU with nothing to run steals from the busiest one.
+ *
+ * Blocking follows one pattern everywhere: holding the queue's lock,
+ * check the condition and call thread_wait until it holds, e.g.
+ *
+ *     uint32_t flags = wait_queue_lock(&queue);
+ *     while (!condition) thread_wait(&queue);
+ *     wait_queue_unlock(&queue, flags);
+ *
+ * and whoever makes the condition true calls thread_wake_all(&queue),
+ * which is also safe from interrupt handlers and other CPUs.
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "timer.h"
+#include "spinlock.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/* Priorities */
+#define SCHED_PRIORITIES      32          /* One run queue each */
+#define SCHED_PRIORITY_HIGH   8           /* Input handling */
+#define SCHED_PRIORITY_NORMAL 16          /* Default */
+#define SCHED_PRIORITY_LOW    24          /* Background work */
+#define SCHED_PRIORITY_IDLE   31          /* Only the idle thread */
+
+/* Time slice for threads of equal priority */
+#define SCHED_TIME_SLICE_NS   (10 * NS_PER_MS)
+
+/* Thread stacks: 2^order pages from the page allocator */
+#define THREAD_STACK_ORDER    2           /* 16KB */
+
+/* Thread states */
+#define THREAD_READY    0                 /* In a run queue */
+#define THREAD_RUNNING  1                 /* On the CPU */
+#define THREAD_BLOCKED  2                 /* In a wait queue or sleeping */
+#define THREAD_DEAD     3                 /* Exited, waiting to be freed */
+
+/* Thread entry point */
+typedef void (*thread_func_t)(void* arg);
+
+/* Kernel thread */
+typedef struct Thread {
+    uint8_t fpu_state[512];               /* FXSAVE area (must be first: 16-byte aligned) */
+    uint32_t esp;                         /* Saved stack pointer while switched out */
+    uint8_t* stack;                       /* Stack base (NULL for the boot thread) */
+    struct Thread* next;                  /* Run queue / wait queue link */
+    thread_func_t entry;                  /* Start function */
+    void* arg;                            /* Start argument */
+    const char* name;                     /* For debugging */
+    uint32_t id;                          /* Unique thread id */
+    uint8_t priority;                     /* 0 (highest) to SCHED_PRIORITIES - 1 */
+    uint8_t state;                        /* THREAD_* */
+    uint8_t on_cpu;                       /* Stack in use until switched away from */
+    uint8_t cpu;                          /* CPU it last ran or was queued on */
+    uint8_t blocking;                     /* Switching out to wait, sleep or exit - not re-queued */
+    Spinlock wake_lock;                   /* Only one waker takes it out of THREAD_BLOCKED */
+    Timer sleep_timer;                    /* Wakes the thread from thread_sleep */
+} Thread;
+
+/* Threads blocked on some condition */
+typedef struct {
+    Spinlock lock;                        /* Guards the queue and its condition */
+    Thread* head;
+    Thread* tail;
+} WaitQueue;
+
+#define WAIT_QUEUE_INIT { SPINLOCK_INIT, NULL, NULL }
+
+/* Take a wait queue's lock with interrupts disabled */
+static inline uint32_t wait_queue_lock(WaitQueue* queue) {
+    return spin_lock_irqsave(&queue->lock);
+}
+
+/* Release a wait queue's lock */
+static inline void wait_queue_unlock(WaitQueue* queue, uint32_t flags) {
+    spin_unlock_irqrestore(&queue->lock, flags);
+}
+
+/* Turn the boot context into the first thread and start the idle thread
+ * (after timer_init and memory_init) */
+void sched_init(void);
+
+/* Turn an application processor's boot context into its idle thread */
+void sched_start_cpu(void) __attribute__((noreturn));
+
+/* Create a ready thread - returns NULL if out of memory */
+Thread* thread_create(const char* name, thread_func_t entry, void* arg, uint8_t priority);
+
+/* The running thread (NULL before sched_init) */
+Thread* thread_current(void);
+
+/* Change the running thread's priority */
+void thread_set_priority(uint8_t priority);
+
+/* Give the CPU to another ready thread of the same or higher priority */
+void thread_yield(void);
+
+/* Block for at least ns nanoseconds */
+void thread_sleep(uint64_t ns);
+
+/* End the running thread */
+void thread_exit(void) __attribute__((noreturn));
+
+/* Block on a wait queue - its lock must be held, and is again when this
+ * returns. Before sched_init this just halts until an interrupt */
+void thread_wait(WaitQueue* queue);
+
+/* Make every thread on the queue ready - returns how many woke */
+uint32_t thread_wake_all(WaitQueue* queue);
+
+/* Preemption point on the way out of an interrupt (called by idt.c) */
+void sched_irq_exit(void);
+
+#endif /* SCHED_H */
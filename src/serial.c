@@ -0,0 +1,121 @@
+/* serial.c - COM1 serial port for NEBULA OS
+ *
+ * The UART is driven by polling: each byte waits for the transmit holding
+ * register to empty. At 115200 baud that is under 100us per byte, which is
+ * fine for diagnostics but means hot paths must not print directly.
+ *
+ * The loopback self-test in serial_init tells a real UART apart from an
+ * empty port, whose registers read back as 0xFF.
+ */
+
+#include "serial.h"
+#include "io.h"
+#include "spinlock.h"
+#include "timer.h"
+
+/* COM1 registers (offsets from the base port) */
+#define COM1_PORT        0x3F8
+#define UART_DATA        0                /* Transmit/receive, divisor low with DLAB */
+#define UART_IER         1                /* Interrupt enable, divisor high with DLAB */
+#define UART_FCR         2                /* FIFO control */
+#define UART_LCR         3                /* Line control */
+#define UART_MCR         4                /* Modem control */
+#define UART_LSR         5                /* Line status */
+
+#define UART_LCR_8N1     0x03
+#define UART_LCR_DLAB    0x80             /* Divisor latch access */
+#define UART_FCR_ENABLE  0xC7             /* Enable and clear FIFOs, 14-byte threshold */
+#define UART_MCR_NORMAL  0x0F             /* DTR, RTS, OUT1, OUT2 */
+#define UART_MCR_LOOPBACK 0x1E            /* Loopback for the self-test */
+#define UART_LSR_THR_EMPTY 0x20           /* Room for another byte */
+#define UART_DIVISOR     1                /* 115200 / 1 */
+
+static uint8_t uart_present = 0;
+static Spinlock serial_lock = SPINLOCK_INIT;
+
+/* Program COM1 and check it works */
+uint8_t serial_init(void) {
+    outb(COM1_PORT + UART_IER, 0x00);     /* Polled - no interrupts */
+    outb(COM1_PORT + UART_LCR, UART_LCR_DLAB);
+    outb(COM1_PORT + UART_DATA, UART_DIVISOR & 0xFF);
+    outb(COM1_PORT + UART_IER, UART_DIVISOR >> 8);
+    outb(COM1_PORT + UART_LCR, UART_LCR_8N1);
+    outb(COM1_PORT + UART_FCR, UART_FCR_ENABLE);
+    
+    /* Send a byte to ourselves */
+    outb(COM1_PORT + UART_MCR, UART_MCR_LOOPBACK);
+    outb(COM1_PORT + UART_DATA, 0xAE);
+    uart_present = inb(COM1_PORT + UART_DATA) == 0xAE;
+    
+    outb(COM1_PORT + UART_MCR, UART_MCR_NORMAL);
+    return uart_present;
+}
+
+/* Check if there is a UART */
+uint8_t serial_present(void) {
+    return uart_present;
+}
+
+/* Send a byte (lock held or don't care about interleaving) */
+static void uart_send(char c) {
+    while (!(inb(COM1_PORT + UART_LSR) & UART_LSR_THR_EMPTY)) {
+        __asm__ volatile ("pause");
+    }
+    outb(COM1_PORT + UART_DATA, (uint8_t) c);
+}
+
+/* Send one byte */
+void serial_putc(char c) {
+    if (!uart_present) return;
+    uint32_t flags = spin_lock_irqsave(&serial_lock);
+    uart_send(c);
+    spin_unlock_irqrestore(&serial_lock, flags);
+}
+
+/* Send a string */
+void serial_write(const char* text) {
+    if (!uart_present) return;
+    uint32_t flags = spin_lock_irqsave(&serial_lock);
+    for (; *text != '\0'; text++) {
+        if (*text == '\n') {
+            uart_send('\r');
+        }
+        uart_send(*text);
+    }
+    spin_unlock_irqrestore(&serial_lock, flags);
+}
+
+/* Send an unsigned number in decimal */
+void serial_write_dec(uint64_t value, uint8_t width) {
+    char digits[24];
+    uint32_t len = 0;
+    do {
+        uint32_t digit;
+        value = udiv64(value, 10, &digit);
+        digits[len++] = '0' + digit;
+    } while (value != 0);
+    
+    char text[48];
+    uint32_t i = 0;
+    for (; width > len && i < sizeof(text) - sizeof(digits); width--) {
+        text[i++] = ' ';
+    }
+    while (len > 0) {
+        text[i++] = digits[--len];
+    }
+    text[i] = '\0';
+    serial_write(text);
+}
+
+/* Send a number in hex */
+void serial_write_hex(uint32_t value) {
+    static const char hex[] = "0123456789abcdef";
+    char text[11];
+    text[0] = '0';
+    text[1] = 'x';
+    for (int i = 0; i < 8; i++) {
+        text[2 + i] = hex[(value >> (28 - 4 * i)) & 0xF];
+    }
+    text[10] = '\0';
+    serial_write(text);
+}
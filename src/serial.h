@@ -0,0 +1,36 @@
+/* serial.h - COM1 serial port for NEBULA OS
+ *
+ * A polled 16550 UART driver, so the kernel has somewhere to write text
+ * while the screen is in graphics mode. Under QEMU, -serial stdio shows
+ * the output in the terminal.
+ */
+
+#ifndef SERIAL_H
+#define SERIAL_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned short     uint16_t;
+typedef unsigned int       uint32_t;
+typedef unsigned long long uint64_t;
+
+/* Program COM1 for 115200 baud, 8N1 - returns 0 if there is no UART */
+uint8_t serial_init(void);
+
+/* Check if serial_init found a UART (output is dropped otherwise) */
+uint8_t serial_present(void);
+
+/* Send one byte, waiting for room in the transmitter */
+void serial_putc(char c);
+
+/* Send a string ("\n" is sent as "\r\n") - whole strings from different
+ * CPUs don't interleave */
+void serial_write(const char* text);
+
+/* Send an unsigned number in decimal, right-aligned in width columns */
+void serial_write_dec(uint64_t value, uint8_t width);
+
+/* Send a number as 0x followed by eight hex digits */
+void serial_write_hex(uint32_t value);
+
+#endif /* SERIAL_H */
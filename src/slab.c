@@ -0,0 +1,247 @@
+/* slab.c - Object cache (slab) allocator for JoshOS
+ * 
+ * Each slab is a power-of-two sized, naturally aligned chunk of heap
+ * memory with a small header at the front followed by packed objects.
+ * Because slabs are aligned to their size, the slab owning an object is
+ * found by masking the object's address. Freed objects go on their slab's
+ * free list and are reused without touching the general heap free lists.
+ */
+
+#include "slab.h"
+#include "spinlock.h"
+
+/* Slab sizing */
+#define SLAB_MIN_SIZE     4096            /* Smallest slab (one page) */
+#define SLAB_MAX_SIZE     32768           /* Largest slab */
+#define SLAB_MIN_OBJECTS  8               /* Grow slab until this many fit */
+
+/* Slab header - at the start of every slab */
+typedef struct KmemSlab {
+    KmemCache* cache;                     /* Cache this slab belongs to */
+    struct KmemSlab* next;                /* Next slab in cache list */
+    struct KmemSlab* prev;                /* Previous slab in cache list */
+    void* free_list;                      /* Freed objects (linked through object) */
+    uint8_t* fresh;                       /* Next never-used object */
+    uint32_t fresh_left;                  /* Never-used objects remaining */
+    uint32_t in_use;                      /* Objects currently allocated */
+} KmemSlab;
+
+/* Object cache structure */
+struct KmemCache {
+    Spinlock lock;                        /* Guards the lists and counters */
+    uint32_t object_size;                 /* Stride between objects */
+    uint32_t slab_size;                   /* Size (and alignment) of each slab */
+    uint32_t first_offset;                /* Offset of first object in slab */
+    uint32_t objects_per_slab;            /* Objects that fit in one slab */
+    KmemSlab* partial;                    /* Slabs with free and used objects */
+    KmemSlab* full;                       /* Slabs with no free objects */
+    KmemSlab* empty;                      /* At most one cached empty slab */
+    uint32_t slab_count;                  /* Slabs owned by cache */
+    uint32_t in_use;                      /* Objects allocated from cache */
+};
+
+/* Round value up to a multiple of align (power of two) */
+static inline uint32_t align_up(uint32_t value, uint32_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+/* Add slab to the head of a list */
+static void slab_list_push(KmemSlab** list, KmemSlab* slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list != NULL) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+/* Remove slab from a list */
+static void slab_list_remove(KmemSlab** list, KmemSlab* slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;               /* Slab was the head */
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+/* Get a new slab from the heap */
+static KmemSlab* slab_create(KmemCache* cache) {
+    KmemSlab* slab = (KmemSlab*)kmalloc_aligned(cache->slab_size, cache->slab_size);
+    if (slab == NULL) {
+        return NULL;                      /* Heap exhausted */
+    }
+    
+    slab->cache = cache;
+    slab->free_list = NULL;
+    slab->fresh = (uint8_t*)slab + cache->first_offset;
+    slab->fresh_left = cache->objects_per_slab; /* Objects carved lazily */
+    slab->in_use = 0;
+    cache->slab_count++;
+    return slab;
+}
+
+/* Create a cache of objects of size bytes */
+KmemCache* kmem_cache_create(uint32_t size, uint32_t align) {
+    /* Free objects store a link pointer */
+    if (size < sizeof(void*)) {
+        size = sizeof(void*);
+    }
+    
+    /* Default alignment: cache line for large objects, word otherwise */
+    if (align == 0) {
+        align = (size >= KMEM_CACHE_LINE) ? KMEM_CACHE_LINE : sizeof(void*);
+    }
+    if (align & (align - 1)) {
+        return NULL;                      /* Alignment must be a power of two */
+    }
+    
+    KmemCache* cache = (KmemCache*)kmalloc(sizeof(KmemCache));
+    if (cache == NULL) {
+        return NULL;                      /* Out of memory */
+    }
+    
+    cache->object_size = align_up(size, align);
+    cache->first_offset = align_up(sizeof(KmemSlab), align);
+    
+    /* Use the smallest slab that holds a reasonable number of objects */
+    cache->slab_size = SLAB_MIN_SIZE;
+    while (cache->slab_size < SLAB_MAX_SIZE &&
+           cache->slab_size < cache->first_offset + SLAB_MIN_OBJECTS * cache->object_size) {
+        cache->slab_size <<= 1;
+    }
+    if (cache->first_offset + cache->object_size > cache->slab_size) {
+        kfree(cache);
+        return NULL;                      /* Object too large for a slab */
+    }
+    cache->objects_per_slab = (cache->slab_size - cache->first_offset) / cache->object_size;
+    
+    cache->lock = (Spinlock) SPINLOCK_INIT;
+    cache->partial = NULL;
+    cache->full = NULL;
+    cache->empty = NULL;
+    cache->slab_count = 0;
+    cache->in_use = 0;
+    return cache;
+}
+
+/* Free every slab in a list */
+static void slab_list_release(KmemSlab* slab) {
+    while (slab != NULL) {
+        KmemSlab* next = slab->next;
+        kfree(slab);
+        slab = next;
+    }
+}
+
+/* Destroy a cache and return all of its slabs to the heap */
+void kmem_cache_destroy(KmemCache* cache) {
+    if (cache == NULL) {
+        return;
+    }
+    slab_list_release(cache->partial);
+    slab_list_release(cache->full);
+    slab_list_release(cache->empty);
+    kfree(cache);
+}
+
+/* Allocate one object (cache locked) */
+static void* cache_alloc(KmemCache* cache) {
+    KmemSlab* slab = cache->partial;
+    
+    /* No partial slab - reuse the cached empty one or make a new one */
+    if (slab == NULL) {
+        if (cache->empty != NULL) {
+            slab = cache->empty;
+            cache->empty = NULL;
+        } else {
+            slab = slab_create(cache);
+            if (slab == NULL) {
+                return NULL;              /* Out of memory */
+            }
+        }
+        slab_list_push(&cache->partial, slab);
+    }
+    
+    /* Prefer recently freed objects (still warm in cache) */
+    void* obj;
+    if (slab->free_list != NULL) {
+        obj = slab->free_list;
+        slab->free_list = *(void**)obj;   /* Pop free list */
+    } else {
+        obj = slab->fresh;
+        slab->fresh += cache->object_size;
+        slab->fresh_left--;
+    }
+    
+    slab->in_use++;
+    cache->in_use++;
+    
+    /* Move slab to full list when nothing is left in it */
+    if (slab->free_list == NULL && slab->fresh_left == 0) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+    
+    return obj;
+}
+
+/* Return an object to its slab (cache locked) */
+static void cache_free(KmemCache* cache, void* obj) {
+    /* Slabs are aligned to their size - mask to find the header */
+    KmemSlab* slab = (KmemSlab*)((uintptr_t)obj & ~(uintptr_t)(cache->slab_size - 1));
+    if (slab->cache != cache) {
+        return;                           /* Object not from this cache */
+    }
+    
+    /* A full slab becomes partial again */
+    if (slab->free_list == NULL && slab->fresh_left == 0) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+    
+    *(void**)obj = slab->free_list;       /* Push onto free list */
+    slab->free_list = obj;
+    slab->in_use--;
+    cache->in_use--;
+    
+    /* Keep one empty slab around, give any others back to the heap */
+    if (slab->in_use == 0) {
+        slab_list_remove(&cache->partial, slab);
+        if (cache->empty == NULL) {
+            cache->empty = slab;
+        } else {
+            cache->slab_count--;
+            kfree(slab);
+        }
+    }
+}
+
+/* Allocate one object from a cache */
+void* kmem_cache_alloc(KmemCache* cache) {
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+    void* obj = cache_alloc(cache);
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return obj;
+}
+
+/* Return an object to the cache it came from */
+void kmem_cache_free(KmemCache* cache, void* obj) {
+    if (obj == NULL) {
+        return;                           /* Nothing to free */
+    }
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+    cache_free(cache, obj);
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+/* Get cache statistics */
+void kmem_cache_get_stats(KmemCache* cache, uint32_t* slabs, uint32_t* in_use, uint32_t* capacity) {
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+    *slabs = cache->slab_count;
+    *in_use = cache->in_use;
+    *capacity = cache->slab_count * cache->objects_per_slab;
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
@@ -0,0 +1,34 @@
+/* slab.h - Object cache (slab) allocator for JoshOS
+ * 
+ * Hands out fixed-size objects packed into slabs carved from the kernel
+ * heap, for code that allocates many objects of the same type. Each cache
+ * has its own lock, so different caches never contend.
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "memory.h"
+
+/* Cache line size - objects of at least this size are aligned to it */
+#define KMEM_CACHE_LINE 64
+
+/* Object cache - one per object type */
+typedef struct KmemCache KmemCache;
+
+/* Create a cache of objects of size bytes (align 0 picks a default) */
+KmemCache* kmem_cache_create(uint32_t size, uint32_t align);
+
+/* Destroy a cache and return all of its slabs to the heap */
+void kmem_cache_destroy(KmemCache* cache);
+
+/* Allocate one object from a cache */
+void* kmem_cache_alloc(KmemCache* cache);
+
+/* Return an object to the cache it came from */
+void kmem_cache_free(KmemCache* cache, void* obj);
+
+/* Get cache statistics */
+void kmem_cache_get_stats(KmemCache* cache, uint32_t* slabs, uint32_t* in_use, uint32_t* capacity);
+
+#endif /* SLAB_H */
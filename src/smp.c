@@ -0,0 +1,125 @@
+/* smp.c - Multiprocessor bring-up for JoshOS
+ *
+ * CPUs are started one at a time: the trampoline's stack slot and the
+ * index of the CPU being started are shared, so the next STARTUP waits
+ * until the previous CPU has reported in.
+ */
+
+#include "smp.h"
+#include "acpi.h"
+#include "apic.h"
+#include "cpu.h"
+#include "gdt.h"
+#include "idt.h"
+#include "paging.h"
+#include "pmm.h"
+#include "sched.h"
+#include "timer.h"
+#include "kstring.h"
+
+/* Where the trampoline is copied - page aligned, below 1MB, unused by the BIOS */
+#define SMP_TRAMPOLINE     0x8000
+
+/* Startup timing (Intel MP specification) */
+#define SMP_INIT_DELAY_NS  (10 * NS_PER_MS)
+#define SMP_SIPI_DELAY_NS  (200 * NS_PER_US)
+#define SMP_BOOT_TIMEOUT_NS (100 * NS_PER_MS)
+
+/* Trampoline from ap_trampoline.S */
+extern const uint8_t ap_trampoline[];
+extern const uint8_t ap_trampoline_end[];
+extern const uint32_t ap_stack;
+extern const uint32_t ap_entry;
+
+/* Index of the CPU being started */
+static volatile uint32_t booting_index = 0;
+
+/* Busy-wait - interrupts are still off, so the TSC is the only clock */
+static void smp_delay(uint64_t ns) {
+    uint64_t end = now_ns() + ns;
+    while (now_ns() < end) {
+        __asm__ volatile ("pause");
+    }
+}
+
+/* Address of a trampoline variable in the copy at SMP_TRAMPOLINE */
+static inline volatile uint32_t* trampoline_slot(const uint32_t* variable) {
+    return (volatile uint32_t*)(SMP_TRAMPOLINE + ((const uint8_t*) variable - ap_trampoline));
+}
+
+/* First C code on an application processor, on its own stack */
+static void smp_ap_main(void) {
+    uint32_t index = booting_index;
+
+    gdt_load();
+    paging_init_ap();                     /* Same tables and PAT as the BSP */
+    percpu_init(index);
+    idt_load();
+    cpu_init_ap();
+    lapic_enable();
+
+    sched_start_cpu();                    /* Becomes this CPU's idle thread */
+}
+
+/* Start one application processor - returns 1 once it is online */
+static uint8_t smp_start_cpu(uint32_t index) {
+    Cpu* cpu = &cpus[index];
+
+    uint8_t* stack = (uint8_t*) page_alloc(THREAD_STACK_ORDER);
+    if (stack == NULL) {
+        return 0;
+    }
+    booting_index = index;
+    *trampoline_slot(&ap_stack) = (uint32_t) stack + ((uint32_t) PAGE_SIZE << THREAD_STACK_ORDER);
+    *trampoline_slot(&ap_entry) = (uint32_t) smp_ap_main;
+
+    /* INIT, then STARTUP twice - the second only if the first was missed */
+    lapic_send_init(cpu->apic_id);
+    smp_delay(SMP_INIT_DELAY_NS);
+    for (uint32_t attempt = 0; attempt < 2; attempt++) {
+        lapic_send_startup(cpu->apic_id, SMP_TRAMPOLINE >> 12);
+        uint64_t deadline = now_ns() + (attempt == 0 ? SMP_SIPI_DELAY_NS : SMP_BOOT_TIMEOUT_NS);
+        while (now_ns() < deadline) {
+            if (__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE)) {
+                return 1;
+            }
+            __asm__ volatile ("pause");
+        }
+    }
+
+    /* Never came up - the stack may still be in use by a half-started CPU,
+     * so it is leaked rather than freed */
+    return 0;
+}
+
+/* Start every other CPU */
+uint32_t smp_init(void) {
+    MadtInfo madt;
+    if (timer_tsc_hz() == 0 || !acpi_read_madt(&madt) || !lapic_init(madt.lapic_base)) {
+        return cpu_count;                 /* Uniprocessor */
+    }
+
+    /* The bootstrap CPU keeps index 0 whatever its place in the MADT */
+    uint32_t bsp_id = lapic_id();
+    cpus[0].apic_id = bsp_id;
+    for (uint32_t i = 0; i < madt.cpu_count; i++) {
+        if (madt.apic_ids[i] != bsp_id && cpu_count < SMP_MAX_CPUS) {
+            cpus[cpu_count].apic_id = madt.apic_ids[i];
+            cpus[cpu_count].online = 0;
+            cpu_count++;
+        }
+    }
+
+    kmemcpy((void*) SMP_TRAMPOLINE, ap_trampoline, ap_trampoline_end - ap_trampoline);
+
+    /* Compact the table so cpus[0..cpu_count) are all online */
+    uint32_t found = cpu_count;
+    cpu_count = 1;
+    for (uint32_t i = 1; i < found; i++) {
+        cpus[cpu_count].apic_id = cpus[i].apic_id;
+        if (smp_start_cpu(cpu_count)) {
+            cpu_count++;
+        }
+    }
+    return cpu_count;
+}
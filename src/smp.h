@@ -0,0 +1,19 @@
+/* smp.h - Multiprocessor bring-up for JoshOS
+ *
+ * The bootstrap CPU reads the MADT, then starts each other CPU with the
+ * INIT/STARTUP/STARTUP sequence through a real-mode trampoline. Every
+ * application processor loads the kernel GDT and IDT, enables its FPU
+ * and local APIC, and becomes an idle thread the scheduler can hand
+ * work to. Without an APIC or an MADT the kernel runs on one CPU.
+ */
+
+#ifndef SMP_H
+#define SMP_H
+
+#include "percpu.h"
+
+/* Start every other CPU (after sched_init, with a calibrated TSC) -
+ * returns the number of CPUs online */
+uint32_t smp_init(void);
+
+#endif /* SMP_H */
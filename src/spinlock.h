@@ -0,0 +1,64 @@
+/* spinlock.h - Ticket spinlocks for JoshOS
+ *
+ * A ticket lock hands the lock out in arrival order, so no CPU can be
+ * starved by others repeatedly winning the race. Spinning is done with
+ * pause so a hyperthreaded sibling is not slowed down.
+ *
+ * Locks that an interrupt handler may also take must be held with
+ * interrupts disabled (spin_lock_irqsave), or the handler could spin
+ * forever on a lock its own CPU holds.
+ */
+
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "idt.h"
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned short     uint16_t;
+typedef unsigned int       uint32_t;
+
+/* Ticket lock */
+typedef struct {
+    uint16_t next;                        /* Next ticket to hand out */
+    uint16_t owner;                       /* Ticket now holding the lock */
+} Spinlock;
+
+#define SPINLOCK_INIT { 0, 0 }
+
+/* Take the lock, spinning until it is our turn */
+static inline void spin_lock(Spinlock* lock) {
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        __asm__ volatile ("pause");
+    }
+}
+
+/* Take the lock only if nobody holds or waits for it - returns 1 on success */
+static inline uint8_t spin_trylock(Spinlock* lock) {
+    uint16_t owner = __atomic_load_n(&lock->owner, __ATOMIC_RELAXED);
+    uint16_t expected = owner;
+    return __atomic_compare_exchange_n(&lock->next, &expected, (uint16_t)(owner + 1), 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/* Release the lock to the next ticket */
+static inline void spin_unlock(Spinlock* lock) {
+    __atomic_store_n(&lock->owner, (uint16_t)(lock->owner + 1), __ATOMIC_RELEASE);
+}
+
+/* Disable interrupts and take the lock - returns the flags to restore */
+static inline uint32_t spin_lock_irqsave(Spinlock* lock) {
+    uint32_t flags = interrupts_save();
+    spin_lock(lock);
+    return flags;
+}
+
+/* Release the lock and restore the interrupt state */
+static inline void spin_unlock_irqrestore(Spinlock* lock, uint32_t flags) {
+    spin_unlock(lock);
+    interrupts_restore(flags);
+}
+
+#endif /* SPINLOCK_H */
@@ -0,0 +1,343 @@
+/* timer.c - Time keeping and one-shot/periodic timers for JoshOS
+ *
+ * now_ns converts TSC cycles with a fixed-point multiplier chosen at
+ * calibration (ns = cycles * mult >> shift), so reading the time costs
+ * an rdtsc and two multiplies. Without a TSC the PIT falls back to a
+ * 1kHz periodic tick that is counted in the interrupt handler.
+ *
+ * Pending timers live in a binary min-heap ordered by deadline, so the
+ * next deadline is always heap[0] and arming or cancelling is O(log n).
+ * The PIT one-shot is re-armed for heap[0] whenever the earliest deadline
+ * changes and after every timer interrupt; deadlines further out than the
+ * PIT can count (about 55ms) take one intermediate interrupt per period.
+ *
+ * The PIT interrupts only the bootstrap CPU, so every callback runs there;
+ * the heap itself is shared and taken under timer_lock from any CPU.
+ */
+
+#include "timer.h"
+#include "cpu.h"
+#include "idt.h"
+#include "io.h"
+#include "spinlock.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+/* PIT ports and constants */
+#define PIT_CHANNEL0     0x40
+#define PIT_CHANNEL2     0x42
+#define PIT_COMMAND      0x43
+#define PIT_GATE_PORT    0x61             /* Channel 2 gate and output */
+#define PIT_HZ           1193182          /* Input clock */
+#define PIT_MAX_COUNT    0xFFFF
+
+/* PIT command bytes: channel, lobyte/hibyte access, mode */
+#define PIT_CH0_ONESHOT  0x30             /* Mode 0: interrupt on terminal count */
+#define PIT_CH0_PERIODIC 0x34             /* Mode 2: rate generator */
+#define PIT_CH2_ONESHOT  0xB0
+
+/* Port 0x61 bits */
+#define PIT_GATE2        0x01             /* Channel 2 gate */
+#define PIT_SPEAKER      0x02             /* Speaker data enable */
+#define PIT_OUT2         0x20             /* Channel 2 output */
+
+/* Calibration - best of a few 10ms PIT windows */
+#define CALIBRATE_COUNT  11932            /* PIT ticks in 10ms */
+#define CALIBRATE_RUNS   3
+
+/* Fallback tick rate without a TSC */
+#define FALLBACK_HZ      1000
+
+/* Timer IRQ line */
+#define TIMER_IRQ        0
+
+/* Time base */
+static uint64_t tsc_hz = 0;               /* 0 if running on the PIT tick */
+static uint64_t tsc_base = 0;             /* TSC at timer_init */
+static uint32_t tsc_mult = 0;             /* ns = cycles * mult >> shift */
+static uint32_t tsc_shift = 0;
+static volatile uint64_t pit_ticks = 0;   /* Fallback tick count */
+
+/* Pending timers (min-heap on deadline) */
+static Timer* heap[TIMER_MAX_PENDING];
+static uint32_t heap_size = 0;
+static Spinlock timer_lock = SPINLOCK_INIT;
+
+/* Read the time stamp counter */
+uint64_t timer_read_tsc(void) {
+    uint32_t low, high;
+    __asm__ volatile ("rdtsc" : "=a" (low), "=d" (high));
+    return ((uint64_t) high << 32) | low;
+}
+
+/* Calibrated TSC rate */
+uint64_t timer_tsc_hz(void) {
+    return tsc_hz;
+}
+
+/* Count TSC cycles across one PIT channel 2 countdown */
+static uint64_t calibrate_once(void) {
+    /* Gate off and speaker off while the count is loaded */
+    uint8_t gate = inb(PIT_GATE_PORT) & ~(PIT_GATE2 | PIT_SPEAKER);
+    outb(PIT_GATE_PORT, gate);
+    outb(PIT_COMMAND, PIT_CH2_ONESHOT);
+    outb(PIT_CHANNEL2, CALIBRATE_COUNT & 0xFF);
+    outb(PIT_CHANNEL2, CALIBRATE_COUNT >> 8);
+
+    /* Raising the gate starts the countdown; OUT2 goes high at zero */
+    outb(PIT_GATE_PORT, gate | PIT_GATE2);
+    uint64_t start = timer_read_tsc();
+    while (!(inb(PIT_GATE_PORT) & PIT_OUT2)) {
+        /* Spin */
+    }
+    uint64_t end = timer_read_tsc();
+
+    outb(PIT_GATE_PORT, gate);
+    return end - start;
+}
+
+/* Measure the TSC rate and pick the fixed-point conversion to ns */
+static void calibrate_tsc(void) {
+    uint64_t best = TIMER_NEVER;
+    for (uint32_t run = 0; run < CALIBRATE_RUNS; run++) {
+        uint64_t cycles = calibrate_once(); /* Interruptions only add cycles */
+        if (cycles < best) {
+            best = cycles;
+        }
+    }
+    tsc_hz = udiv64(best * PIT_HZ, CALIBRATE_COUNT, NULL);
+    if (tsc_hz == 0 || (tsc_hz >> 32) != 0) {
+        tsc_hz = 0;                       /* Unusable - fall back to the PIT */
+        return;
+    }
+
+    /* Largest shift whose multiplier still fits in 32 bits */
+    tsc_shift = 32;
+    while (tsc_shift > 0 && (udiv64(NS_PER_SEC << tsc_shift, (uint32_t) tsc_hz, NULL) >> 32) != 0) {
+        tsc_shift--;
+    }
+    tsc_mult = (uint32_t) udiv64(NS_PER_SEC << tsc_shift, (uint32_t) tsc_hz, NULL);
+}
+
+static void timers_expire(void);
+static void pit_arm_next(void);
+
+/* IRQ 0 - run whatever is due and arm the PIT for the next deadline */
+static void timer_irq(InterruptFrame* frame) {
+    (void)frame;
+    if (tsc_hz == 0) {
+        pit_ticks++;                      /* Periodic fallback */
+    }
+    timers_expire();
+    spin_lock(&timer_lock);
+    pit_arm_next();
+    spin_unlock(&timer_lock);
+}
+
+/* Calibrate the TSC and take over IRQ 0 */
+void timer_init(void) {
+    if (cpu_has(CPU_FEATURE_TSC)) {
+        calibrate_tsc();
+    }
+
+    if (tsc_hz == 0) {
+        /* No usable TSC - periodic tick instead of one-shot */
+        uint32_t count = PIT_HZ / FALLBACK_HZ;
+        outb(PIT_COMMAND, PIT_CH0_PERIODIC);
+        outb(PIT_CHANNEL0, count & 0xFF);
+        outb(PIT_CHANNEL0, count >> 8);
+    }
+    tsc_base = timer_read_tsc();
+
+    irq_install_handler(TIMER_IRQ, timer_irq);
+}
+
+/* Nanoseconds since timer_init */
+uint64_t now_ns(void) {
+    if (tsc_hz == 0) {
+        return pit_ticks * (NS_PER_SEC / FALLBACK_HZ);
+    }
+    uint64_t cycles = timer_read_tsc() - tsc_base;
+    uint64_t low = (uint64_t)(uint32_t) cycles * tsc_mult;
+    uint64_t high = (cycles >> 32) * tsc_mult;
+    return (low >> tsc_shift) + (high << (32 - tsc_shift));
+}
+
+/* Swap two heap slots, keeping each timer's slot index current */
+static inline void heap_swap(uint32_t a, uint32_t b) {
+    Timer* t = heap[a];
+    heap[a] = heap[b];
+    heap[b] = t;
+    heap[a]->slot = a;
+    heap[b]->slot = b;
+}
+
+/* Move a timer towards the root while it is earlier than its parent */
+static void heap_sift_up(uint32_t slot) {
+    while (slot > 0) {
+        uint32_t parent = (slot - 1) / 2;
+        if (heap[parent]->deadline <= heap[slot]->deadline) {
+            break;
+        }
+        heap_swap(slot, parent);
+        slot = parent;
+    }
+}
+
+/* Move a timer towards the leaves while a child is earlier */
+static void heap_sift_down(uint32_t slot) {
+    while (1) {
+        uint32_t child = slot * 2 + 1;
+        if (child >= heap_size) {
+            break;
+        }
+        if (child + 1 < heap_size && heap[child + 1]->deadline < heap[child]->deadline) {
+            child++;                      /* Earlier of the two children */
+        }
+        if (heap[slot]->deadline <= heap[child]->deadline) {
+            break;
+        }
+        heap_swap(slot, child);
+        slot = child;
+    }
+}
+
+/* Take a timer out of the heap */
+static void heap_remove(Timer* timer) {
+    uint32_t slot = timer->slot;
+    heap_size--;
+    if (slot != heap_size) {
+        heap[slot] = heap[heap_size];     /* Fill the hole with the last timer */
+        heap[slot]->slot = slot;
+        heap_sift_down(slot);
+        heap_sift_up(slot);
+    }
+    timer->slot = -1;
+}
+
+/* Put a timer into the heap */
+static uint8_t heap_insert(Timer* timer) {
+    if (heap_size >= TIMER_MAX_PENDING) {
+        return 0;                         /* Full */
+    }
+    timer->slot = heap_size;
+    heap[heap_size++] = timer;
+    heap_sift_up(timer->slot);
+    return 1;
+}
+
+/* Check if a timer is in the heap */
+static inline uint8_t timer_pending(const Timer* timer) {
+    return timer->slot >= 0 && (uint32_t) timer->slot < heap_size && heap[timer->slot] == timer;
+}
+
+/* Arm a timer to fire after delay_ns, then every period_ns */
+uint8_t timer_start(Timer* timer, uint64_t delay_ns, uint64_t period_ns,
+                    timer_callback_t callback, void* arg) {
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    if (timer_pending(timer)) {
+        heap_remove(timer);               /* Re-arming a pending timer */
+    }
+    timer->deadline = now_ns() + delay_ns;
+    timer->period = period_ns;
+    timer->callback = callback;
+    timer->arg = arg;
+    uint8_t ok = heap_insert(timer);
+    if (ok && heap[0] == timer) {
+        pit_arm_next();                   /* New earliest deadline */
+    }
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return ok;
+}
+
+/* Disarm a timer - an early interrupt for it is harmless, so the PIT is
+ * left alone */
+void timer_cancel(Timer* timer) {
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    if (timer_pending(timer)) {
+        heap_remove(timer);
+    }
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+/* Run the callbacks of all expired timers (interrupts disabled) - the
+ * lock is dropped around each callback so it can re-arm timers */
+static void timers_expire(void) {
+    uint64_t now = now_ns();
+
+    spin_lock(&timer_lock);
+    while (heap_size > 0 && heap[0]->deadline <= now) {
+        Timer* timer = heap[0];
+        heap_remove(timer);
+        if (timer->period != 0) {
+            /* Stay on the original grid, but skip periods we slept through */
+            timer->deadline += timer->period;
+            if (timer->deadline <= now) {
+                timer->deadline = now + timer->period;
+            }
+            heap_insert(timer);
+        }
+        timer_callback_t callback = timer->callback;
+        void* arg = timer->arg;
+        spin_unlock(&timer_lock);
+        callback(arg);                    /* May re-arm or cancel itself */
+        spin_lock(&timer_lock);
+    }
+    spin_unlock(&timer_lock);
+}
+
+/* Deadline of the earliest pending timer */
+uint64_t timer_next_deadline(void) {
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    uint64_t next = heap_size > 0 ? heap[0]->deadline : TIMER_NEVER;
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return next;
+}
+
+/* Program a PIT one-shot that fires after delay_ns (clamped to the PIT range) */
+static void pit_arm(uint64_t delay_ns) {
+    uint32_t count = PIT_MAX_COUNT;
+    uint64_t max_ns = udiv64((uint64_t) PIT_MAX_COUNT * NS_PER_SEC, PIT_HZ, NULL);
+    if (delay_ns < max_ns) {
+        count = (uint32_t) udiv64(delay_ns * PIT_HZ + NS_PER_SEC - 1, (uint32_t) NS_PER_SEC, NULL);
+        if (count == 0) {
+            count = 1;
+        }
+    }
+    outb(PIT_COMMAND, PIT_CH0_ONESHOT);
+    outb(PIT_CHANNEL0, count & 0xFF);
+    outb(PIT_CHANNEL0, count >> 8);
+}
+
+/* Arm the PIT for the earliest pending timer (timer_lock held) */
+static void pit_arm_next(void) {
+    if (tsc_hz == 0 || heap_size == 0) {
+        return;                           /* Periodic tick, or nothing to wait for */
+    }
+    uint64_t now = now_ns();
+    uint64_t deadline = heap[0]->deadline;
+    pit_arm(deadline > now ? deadline - now : 0);
+}
+
+/* Sleep until deadline_ns, the next timer or any other interrupt */
+void timer_sleep_until(uint64_t deadline_ns) {
+    uint32_t flags = interrupts_save();
+
+    uint64_t now = now_ns();
+    if (deadline_ns <= now) {
+        interrupts_restore(flags);        /* Already due */
+        return;
+    }
+
+    /* Pending timers already have the PIT armed - only an earlier
+     * deadline of our own needs it moved */
+    spin_lock(&timer_lock);
+    if (tsc_hz != 0 && (heap_size == 0 || deadline_ns < heap[0]->deadline)) {
+        pit_arm(deadline_ns - now);
+    }
+    spin_unlock(&timer_lock);
+    __asm__ volatile ("sti; hlt" : : : "memory");
+    interrupts_restore(flags);
+}
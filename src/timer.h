@@ -0,0 +1,80 @@
+/* timer.h - Time keeping and one-shot/periodic timers for JoshOS
+ *
+ * Time is read from the TSC, calibrated against the PIT at boot. There
+ * is no periodic tick: the PIT is programmed in one-shot mode for the
+ * earliest pending deadline only.
+ *
+ * Timer callbacks run in the IRQ 0 handler with interrupts disabled, so
+ * they must be short and must not block - wake a thread to do real work.
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned short     uint16_t;
+typedef unsigned int       uint32_t;
+typedef signed int         int32_t;
+typedef unsigned long long uint64_t;
+
+/* Time constants */
+#define NS_PER_US      1000ULL
+#define NS_PER_MS      1000000ULL
+#define NS_PER_SEC     1000000000ULL
+#define TIMER_NEVER    0xFFFFFFFFFFFFFFFFULL /* No deadline */
+
+/* Maximum number of timers pending at once */
+#define TIMER_MAX_PENDING 64
+
+/* Timer callback */
+typedef void (*timer_callback_t)(void* arg);
+
+/* A pending callback - owned by the caller, must stay alive while pending */
+typedef struct {
+    uint64_t deadline;                    /* Absolute expiry (now_ns time base) */
+    uint64_t period;                      /* Re-arm interval, 0 for one-shot */
+    timer_callback_t callback;            /* Called on expiry */
+    void* arg;                            /* Passed to callback */
+    int32_t slot;                         /* Heap position, -1 when not pending */
+} Timer;
+
+/* Calibrate the TSC and take over IRQ 0 (after idt_init and cpu_init) */
+void timer_init(void);
+
+/* Nanoseconds since timer_init */
+uint64_t now_ns(void);
+
+/* Raw time stamp counter and its calibrated rate (0 if there is no TSC) */
+uint64_t timer_read_tsc(void);
+uint64_t timer_tsc_hz(void);
+
+/* Arm a timer to fire after delay_ns, then every period_ns (0 = once) -
+ * returns 0 if too many timers are pending */
+uint8_t timer_start(Timer* timer, uint64_t delay_ns, uint64_t period_ns,
+                    timer_callback_t callback, void* arg);
+
+/* Disarm a timer (no-op if it is not pending) */
+void timer_cancel(Timer* timer);
+
+/* Deadline of the earliest pending timer, or TIMER_NEVER */
+uint64_t timer_next_deadline(void);
+
+/* Halt until deadline_ns, the next timer or any other interrupt,
+ * whichever comes first (threads should use thread_sleep) */
+void timer_sleep_until(uint64_t deadline_ns);
+
+/* 64 by 32 bit unsigned division (no libgcc in the kernel) */
+static inline uint64_t udiv64(uint64_t n, uint32_t d, uint32_t* remainder) {
+    uint32_t high = (uint32_t)(n >> 32);
+    uint32_t low = (uint32_t) n;
+    uint32_t q_high = high / d;
+    uint32_t q_low, r = high % d;
+    __asm__ ("divl %4" : "=a" (q_low), "=d" (r) : "a" (low), "d" (r), "rm" (d));
+    if (remainder != 0) {
+        *remainder = r;
+    }
+    return ((uint64_t) q_high << 32) | q_low;
+}
+
+#endif /* TIMER_H */
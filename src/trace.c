@@ -0,0 +1,128 @@
+/* trace.c - Trace ring draining for NEBULA OS
+ *
+ * Every few milliseconds the drain thread walks each CPU's ring from its
+ * tail and sends the finished records to COM1, one line each:
+ *
+ *     T <cpu> <B|E> <event> <cycles>
+ *
+ * where cycles is the TSC delta from the previous record of the same CPU
+ * (the first record of a CPU gives the absolute TSC). A BEGIN followed
+ * by the matching END therefore shows the time spent directly. When the
+ * serial line can't keep up, the producers lap the drain and overwrite
+ * records; that is reported as "T <cpu> lost <count>".
+ *
+ * A record is read like a seqlock: its seq must be the expected position
+ * before and after copying it, or a producer overwrote it meanwhile.
+ */
+
+#include "trace.h"
+#include "sched.h"
+#include "serial.h"
+#include "timer.h"
+
+/* Pause between drain passes */
+#define TRACE_DRAIN_INTERVAL_NS (10 * NS_PER_MS)
+
+/* Records sent per CPU per pass, so one busy CPU can't starve the rest */
+#define TRACE_DRAIN_BATCH 256
+
+TraceRing trace_rings[SMP_MAX_CPUS];
+
+/* Event names, indexed by TRACE_* */
+static const char* trace_names[TRACE_EVENT_COUNT] = {
+    "kmalloc",
+    "kfree",
+    "render_ui",
+    "ui_update",
+    "draw_background",
+    "draw_top_bar",
+    "draw_sidebar",
+    "draw_app_grid",
+    "draw_app_icon",
+    "draw_app_tile",
+    "draw_info_panel",
+    "draw_dock",
+    "draw_dock_icon",
+    "present",
+};
+
+/* Take the oldest finished record - returns 0 if there is none yet */
+static uint8_t ring_take(TraceRing* ring, TraceRecord* out) {
+    while (1) {
+        uint32_t pos = ring->tail;
+        TraceRecord* record = &ring->records[pos & TRACE_RING_MASK];
+        uint32_t seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos + 1) {
+            *out = *record;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&record->seq, __ATOMIC_RELAXED) == pos + 1) {
+                ring->tail = pos + 1;
+                return 1;
+            }
+        } else if (seq == 0 || (int32_t)(seq - (pos + 1)) < 0) {
+            /* Being written, or not reached yet. A slot stuck at 0 while
+             * the ring has moved a lap on was overwritten mid-read */
+            uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+            if (head - pos <= TRACE_RING_SIZE) {
+                return 0;
+            }
+        }
+        
+        /* Lapped - skip to the oldest record still in the ring */
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        uint32_t oldest = head - TRACE_RING_SIZE + 1;
+        if ((int32_t)(oldest - pos) <= 0) {
+            oldest = pos + 1;             /* Torn copy of this record only */
+        }
+        ring->lost += oldest - pos;
+        ring->tail = oldest;
+    }
+}
+
+/* Send one record as a line */
+static void trace_print(uint32_t cpu, TraceRing* ring, const TraceRecord* record) {
+    uint64_t tsc = ((uint64_t) record->tsc_high << 32) | record->tsc_low;
+    uint64_t last = ((uint64_t) ring->last_high << 32) | ring->last_low;
+    ring->last_high = record->tsc_high;
+    ring->last_low = record->tsc_low;
+    
+    serial_write("T ");
+    serial_write_dec(cpu, 0);
+    serial_write(record->phase == TRACE_PHASE_BEGIN ? " B " : " E ");
+    serial_write(record->id < TRACE_EVENT_COUNT ? trace_names[record->id] : "?");
+    serial_write(" ");
+    serial_write_dec(last != 0 ? tsc - last : tsc, 0);
+    serial_write("\n");
+}
+
+/* Drain every ring to serial, forever */
+static void trace_drain_thread(void* arg) {
+    (void)arg;
+    while (1) {
+        for (uint32_t cpu = 0; cpu < cpu_count; cpu++) {
+            TraceRing* ring = &trace_rings[cpu];
+            TraceRecord record;
+            uint32_t lost = ring->lost;
+            for (uint32_t n = 0; n < TRACE_DRAIN_BATCH && ring_take(ring, &record); n++) {
+                trace_print(cpu, ring, &record);
+            }
+            if (ring->lost != lost) {
+                serial_write("T ");
+                serial_write_dec(cpu, 0);
+                serial_write(" lost ");
+                serial_write_dec(ring->lost - lost, 0);
+                serial_write("\n");
+            }
+        }
+        thread_sleep(TRACE_DRAIN_INTERVAL_NS);
+    }
+}
+
+/* Start draining */
+void trace_start(void) {
+    if (!serial_present()) {
+        return;                           /* Nowhere to send it - the rings just wrap */
+    }
+    serial_write("trace: started\n");
+    thread_create("trace", trace_drain_thread, NULL, SCHED_PRIORITY_LOW);
+}
@@ -0,0 +1,110 @@
+/* trace.h - Hot-path tracing for NEBULA OS
+ *
+ * TRACE_BEGIN(id) and TRACE_END(id) append a record - TSC timestamp,
+ * event id and phase - to the calling CPU's trace ring. Recording is an
+ * atomic increment to claim a slot and a handful of stores; nothing is
+ * formatted or sent on the hot path. A low-priority thread drains the
+ * rings to COM1 in the background (see trace.c for the output format).
+ *
+ * Tracing is only compiled in with NEBULA_TRACE (make TRACE=1); without
+ * it the macros and trace_start expand to nothing.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Standard integer types */
+typedef unsigned char      uint8_t;
+typedef unsigned short     uint16_t;
+typedef unsigned int       uint32_t;
+
+/* Traced events - names for the output are in trace.c */
+enum {
+    TRACE_KMALLOC,
+    TRACE_KFREE,
+    TRACE_RENDER_UI,
+    TRACE_UI_UPDATE,
+    TRACE_DRAW_BACKGROUND,
+    TRACE_DRAW_TOP_BAR,
+    TRACE_DRAW_SIDEBAR,
+    TRACE_DRAW_APP_GRID,
+    TRACE_DRAW_APP_ICON,
+    TRACE_DRAW_APP_TILE,
+    TRACE_DRAW_INFO_PANEL,
+    TRACE_DRAW_DOCK,
+    TRACE_DRAW_DOCK_ICON,
+    TRACE_PRESENT,
+    TRACE_EVENT_COUNT
+};
+
+/* Record phases */
+#define TRACE_PHASE_BEGIN 0
+#define TRACE_PHASE_END   1
+
+#ifdef NEBULA_TRACE
+
+#include "percpu.h"
+
+/* Records per CPU - must be a power of two */
+#define TRACE_RING_SIZE 1024
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+/* One record - seq is written last, so a reader can tell a finished
+ * record from one being written or overwritten */
+typedef struct {
+    uint32_t seq;                         /* Ring position + 1, 0 while being written */
+    uint16_t id;                          /* TRACE_* */
+    uint8_t phase;                        /* TRACE_PHASE_* */
+    uint8_t reserved;
+    uint32_t tsc_low;
+    uint32_t tsc_high;
+} TraceRecord;
+
+/* A CPU's ring - written by that CPU (threads and interrupts alike),
+ * read by the drain thread; full rings overwrite their oldest records */
+typedef struct {
+    uint32_t head;                        /* Next position to write */
+    uint32_t tail;                        /* Next position to drain (drain thread only) */
+    uint32_t lost;                        /* Records overwritten before being drained */
+    uint32_t last_high, last_low;         /* TSC of the last drained record */
+    TraceRecord records[TRACE_RING_SIZE];
+} TraceRing;
+
+extern TraceRing trace_rings[SMP_MAX_CPUS];
+
+/* Append a record to the calling CPU's ring */
+static inline void trace_record(uint16_t id, uint8_t phase) {
+    /* A thread moved to another CPU right after reading the index just
+     * shares that ring for one record - the claim is atomic either way */
+    TraceRing* ring = &trace_rings[cpu_index()];
+    uint32_t pos = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    TraceRecord* record = &ring->records[pos & TRACE_RING_MASK];
+    uint32_t low, high;
+    __asm__ volatile ("rdtsc" : "=a" (low), "=d" (high));
+    
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    record->id = id;
+    record->phase = phase;
+    record->tsc_low = low;
+    record->tsc_high = high;
+    __atomic_store_n(&record->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* Start the thread that drains the rings to serial (after sched_init) */
+void trace_start(void);
+
+#define TRACE_BEGIN(id) trace_record((id), TRACE_PHASE_BEGIN)
+#define TRACE_END(id)   trace_record((id), TRACE_PHASE_END)
+
+#else
+
+static inline void trace_start(void) {
+}
+
+#define TRACE_BEGIN(id) do { } while (0)
+#define TRACE_END(id)   do { } while (0)
+
+#endif /* NEBULA_TRACE */
+
+#endif /* TRACE_H */
@@ -0,0 +1,224 @@
+/* assets_gen.c - Asset bundle generator for NEBULA OS
+ *
+ * Runs on the build machine and writes the asset bundle GRUB loads as a
+ * boot module to stdout (see src/assets.h for the format). The bundle
+ * holds the 8x8 font from src/font_8x8.h and the interface layout below:
+ * the sidebar menu labels and the app tiles' names and icons, in screen
+ * order. Changing them only means rebuilding the bundle, not the kernel.
+ *
+ * With -z every asset is stored as an LZ4 block when that makes it
+ * smaller; the kernel expands it the first time it is used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "font_8x8.h"
+
+/* Bundle format - must match assets.h */
+#define ASSET_MAGIC    0x5341424E
+#define ASSET_VERSION  1
+#define ASSET_FLAG_LZ4 0x01
+#define HEADER_SIZE    12                 /* sizeof(AssetHeader) */
+#define ENTRY_SIZE     16                 /* sizeof(AssetEntry) */
+
+/* Asset ids - order must match ASSET_* in assets.h */
+enum {
+    ASSET_FONT_8X8,
+    ASSET_UI_MENU,
+    ASSET_UI_APPS,
+    ASSET_COUNT
+};
+
+/* Sidebar menu labels, top to bottom */
+static const char* menu_items[] = {
+    "Home", "Applications", "Files", "Files", "Settings", "Files", "Terminal",
+};
+#define MENU_COUNT (sizeof(menu_items) / sizeof(menu_items[0]))
+
+/* App tiles in grid order - icon numbers as drawn by app_tile_foreground */
+static const struct {
+    const char* name;
+    unsigned char icon;
+} apps[] = {
+    { "Browser", 0 },
+    { "Settings", 1 },
+    { "Files", 2 },
+    { "Media", 3 },
+    { "Notes", 4 },
+    { "Cloud", 5 },
+};
+#define APP_COUNT (sizeof(apps) / sizeof(apps[0]))
+
+/* LZ4 block rules */
+#define LZ4_MIN_MATCH   4
+#define LZ4_LAST_LITERALS 5               /* The block ends with this many literals */
+#define LZ4_MATCH_LIMIT 12                /* No match starts this close to the end */
+#define LZ4_MAX_OFFSET  65535
+#define LZ4_HASH_BITS   12
+
+/* Growable byte buffer */
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+} Buffer;
+
+static void put(Buffer* buf, const void* data, size_t size) {
+    if (buf->size + size > buf->capacity) {
+        buf->capacity = (buf->size + size) * 2;
+        buf->data = realloc(buf->data, buf->capacity);
+        if (buf->data == NULL) {
+            fprintf(stderr, "assets_gen: out of memory\n");
+            exit(1);
+        }
+    }
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+}
+
+static void put_byte(Buffer* buf, unsigned char byte) {
+    put(buf, &byte, 1);
+}
+
+/* Little endian, whatever the build machine is */
+static void put_u16(Buffer* buf, unsigned value) {
+    put_byte(buf, value & 0xFF);
+    put_byte(buf, (value >> 8) & 0xFF);
+}
+
+static void put_u32(Buffer* buf, unsigned long value) {
+    put_u16(buf, value & 0xFFFF);
+    put_u16(buf, (value >> 16) & 0xFFFF);
+}
+
+/* Length bytes after a token nibble of 15 */
+static void put_length(Buffer* buf, size_t length) {
+    while (length >= 255) {
+        put_byte(buf, 255);
+        length -= 255;
+    }
+    put_byte(buf, (unsigned char) length);
+}
+
+/* One sequence - literals, then a match unless it is the last one */
+static void put_sequence(Buffer* buf, const unsigned char* literals, size_t count,
+                         size_t offset, size_t match) {
+    size_t extra = match ? match - LZ4_MIN_MATCH : 0;
+    put_byte(buf, (unsigned char)(((count < 15 ? count : 15) << 4) | (extra < 15 ? extra : 15)));
+    if (count >= 15) {
+        put_length(buf, count - 15);
+    }
+    put(buf, literals, count);
+    if (match) {
+        put_u16(buf, (unsigned) offset);
+        if (extra >= 15) {
+            put_length(buf, extra - 15);
+        }
+    }
+}
+
+/* Greedy LZ4 block compression - one hash table of 4-byte prefixes */
+static void lz4_compress(const unsigned char* src, size_t size, Buffer* out) {
+    static long table[1 << LZ4_HASH_BITS];
+    for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+        table[i] = -1;
+    }
+
+    size_t anchor = 0, pos = 0;
+    while (pos + LZ4_MATCH_LIMIT <= size) {
+        unsigned long word = src[pos] | (src[pos + 1] << 8) | (src[pos + 2] << 16) |
+                             ((unsigned long) src[pos + 3] << 24);
+        unsigned hash = (unsigned)((word * 2654435761UL) & 0xFFFFFFFFUL) >> (32 - LZ4_HASH_BITS);
+        long candidate = table[hash];
+        table[hash] = (long) pos;
+
+        if (candidate < 0 || pos - candidate > LZ4_MAX_OFFSET ||
+            memcmp(src + candidate, src + pos, LZ4_MIN_MATCH) != 0) {
+            pos++;
+            continue;
+        }
+        size_t match = LZ4_MIN_MATCH;
+        while (pos + match < size - LZ4_LAST_LITERALS && src[candidate + match] == src[pos + match]) {
+            match++;
+        }
+        put_sequence(out, src + anchor, pos - anchor, pos - candidate, match);
+        pos += match;
+        anchor = pos;
+    }
+    put_sequence(out, src + anchor, size - anchor, 0, 0);
+}
+
+/* Asset payloads */
+static void build_font(Buffer* buf) {
+    unsigned count = sizeof(font_8x8) / sizeof(font_8x8[0]);
+    put_byte(buf, FONT_8X8_FIRST);
+    put_byte(buf, (unsigned char) count);
+    put_byte(buf, 8);                     /* Width */
+    put_byte(buf, 8);                     /* Height */
+    put(buf, font_8x8, sizeof(font_8x8));
+}
+
+static void build_menu(Buffer* buf) {
+    put_u32(buf, MENU_COUNT);
+    for (size_t i = 0; i < MENU_COUNT; i++) {
+        put(buf, menu_items[i], strlen(menu_items[i]) + 1);
+    }
+}
+
+static void build_apps(Buffer* buf) {
+    put_u32(buf, APP_COUNT);
+    for (size_t i = 0; i < APP_COUNT; i++) {
+        put_byte(buf, apps[i].icon);
+        put(buf, apps[i].name, strlen(apps[i].name) + 1);
+    }
+}
+
+int main(int argc, char** argv) {
+    int compress = argc > 1 && strcmp(argv[1], "-z") == 0;
+    void (*builders[ASSET_COUNT])(Buffer*) = { build_font, build_menu, build_apps };
+
+    /* Data follows the header and index, each asset 4-byte aligned */
+    Buffer data = { NULL, 0, 0 };
+    Buffer index = { NULL, 0, 0 };
+    size_t data_start = HEADER_SIZE + ASSET_COUNT * ENTRY_SIZE;
+    for (int id = 0; id < ASSET_COUNT; id++) {
+        Buffer raw = { NULL, 0, 0 };
+        Buffer packed = { NULL, 0, 0 };
+        builders[id](&raw);
+
+        const Buffer* stored = &raw;
+        unsigned flags = 0;
+        if (compress) {
+            lz4_compress(raw.data, raw.size, &packed);
+            if (packed.size < raw.size) {
+                stored = &packed;
+                flags = ASSET_FLAG_LZ4;
+            }
+        }
+
+        while (data.size % 4 != 0) {
+            put_byte(&data, 0);
+        }
+        put_u32(&index, data_start + data.size);
+        put_u32(&index, stored->size);
+        put_u32(&index, raw.size);
+        put_u32(&index, flags);
+        put(&data, stored->data, stored->size);
+        fprintf(stderr, "asset %d: %zu bytes%s\n", id, stored->size,
+                flags & ASSET_FLAG_LZ4 ? " (lz4)" : "");
+        free(raw.data);
+        free(packed.data);
+    }
+
+    Buffer bundle = { NULL, 0, 0 };
+    put_u32(&bundle, ASSET_MAGIC);
+    put_u16(&bundle, ASSET_VERSION);
+    put_u16(&bundle, ASSET_COUNT);
+    put_u32(&bundle, data_start + data.size);
+    put(&bundle, index.data, index.size);
+    put(&bundle, data.data, data.size);
+    fwrite(bundle.data, 1, bundle.size, stdout);
+    return 0;
+}
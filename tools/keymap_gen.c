@@ -0,0 +1,145 @@
+/* keymap_gen.c - Keymap table generator for NEBULA OS
+ * 
+ * Runs on the build machine and writes keymap_tables.h to stdout. For
+ * each layout it emits one flat 256-entry table per combination of
+ * Shift, Ctrl and Caps Lock, indexed by key code (scancode set 1 with
+ * the release bit clear; E0-prefixed keys at 0x80 + code). The kernel
+ * then decodes a key with a single load:
+ * 
+ *     keymap_tables[layout][modifiers & KEYMAP_MOD_MASK][code]
+ * 
+ * Layouts are written below as the characters on each physical row, so
+ * adding one is a matter of typing its rows - Caps Lock and Ctrl
+ * variants are derived here, not by the kernel.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+/* Modifier bits - must match KEY_MOD_* in event.h */
+#define MOD_SHIFT 0x01
+#define MOD_CTRL  0x02
+#define MOD_CAPS  0x04
+#define STATES    8
+
+/* Extended (E0-prefixed) key codes */
+#define EXTENDED  0x80
+
+/* Characters of one physical row, unshifted and shifted */
+typedef struct {
+    unsigned char first;                  /* Scancode of the leftmost key */
+    const char* normal;
+    const char* shifted;
+} Row;
+
+/* One keyboard layout */
+typedef struct {
+    const char* name;
+    Row rows[6];
+} Layout;
+
+/* Layouts - order must match KEYBOARD_LAYOUT_* in keyboard.h */
+static const Layout layouts[] = {
+    { "US QWERTY", {
+        { 0x02, "1234567890-=",  "!@#$%^&*()_+" },
+        { 0x10, "qwertyuiop[]",  "QWERTYUIOP{}" },
+        { 0x1E, "asdfghjkl;'`",  "ASDFGHJKL:\"~" },
+        { 0x2B, "\\zxcvbnm,./",  "|ZXCVBNM<>?" },
+        { 0, NULL, NULL },
+    } },
+    { "US Dvorak", {
+        { 0x02, "1234567890[]",  "!@#$%^&*(){}" },
+        { 0x10, "',.pyfgcrl/=",  "\"<>PYFGCRL?+" },
+        { 0x1E, "aoeuidhtns-`",  "AOEUIDHTNS_~" },
+        { 0x2B, "\\;qjkxbmwvz", "|:QJKXBMWVZ" },
+        { 0, NULL, NULL },
+    } },
+};
+#define LAYOUT_COUNT (sizeof(layouts) / sizeof(layouts[0]))
+
+/* Keys that type the same character in every layout and state */
+static const struct {
+    unsigned char code;
+    char ascii;
+} fixed_keys[] = {
+    { 0x01, 27 },                         /* Escape */
+    { 0x0E, '\b' },                       /* Backspace */
+    { 0x0F, '\t' },                       /* Tab */
+    { 0x1C, '\n' },                       /* Enter */
+    { 0x39, ' ' },                        /* Space */
+    { 0x37, '*' },                        /* Keypad * */
+    { 0x4A, '-' },                        /* Keypad - */
+    { 0x4E, '+' },                        /* Keypad + */
+    { EXTENDED | 0x1C, '\n' },            /* Keypad Enter */
+    { EXTENDED | 0x35, '/' },             /* Keypad / */
+    { EXTENDED | 0x53, 127 },             /* Delete */
+};
+#define FIXED_COUNT (sizeof(fixed_keys) / sizeof(fixed_keys[0]))
+
+/* Names of the states, for comments in the output */
+static const char* state_names[STATES] = {
+    "No modifiers", "Shift", "Ctrl", "Shift+Ctrl",
+    "Caps Lock", "Shift+Caps Lock", "Ctrl+Caps Lock", "Shift+Ctrl+Caps Lock",
+};
+
+/* Character a key types in a modifier state (0 = none) */
+static char key_char(char normal, char shifted, int state) {
+    int is_letter = normal >= 'a' && normal <= 'z';
+    int shift = (state & MOD_SHIFT) != 0;
+    if (is_letter && (state & MOD_CAPS)) {
+        shift = !shift;                   /* Caps Lock only affects letters */
+    }
+    char c = shift ? shifted : normal;
+    
+    if (state & MOD_CTRL) {
+        /* Control characters for the letters and @[\]^_; nothing else */
+        if (is_letter) return (char)(normal & 0x1F);
+        if (c >= '@' && c <= '_') return (char)(c & 0x1F);
+        return 0;
+    }
+    return c;
+}
+
+/* Fill the 256-entry table of a layout in one state */
+static void build_table(const Layout* layout, int state, char table[256]) {
+    memset(table, 0, 256);
+    for (const Row* row = layout->rows; row->normal != NULL; row++) {
+        size_t len = strlen(row->normal);
+        for (size_t i = 0; i < len; i++) {
+            table[row->first + i] = key_char(row->normal[i], row->shifted[i], state);
+        }
+    }
+    for (size_t i = 0; i < FIXED_COUNT; i++) {
+        table[fixed_keys[i].code] = fixed_keys[i].ascii;
+    }
+}
+
+/* Print one table as a C initializer */
+static void print_table(const char table[256]) {
+    printf("        {");
+    for (int i = 0; i < 256; i++) {
+        if (i % 16 == 0) printf("\n            ");
+        printf("%4d,", table[i]);
+    }
+    printf("\n        },\n");
+}
+
+int main(void) {
+    printf("/* keymap_tables.h - generated by tools/keymap_gen.c, do not edit */\n\n");
+    printf("#define KEYMAP_LAYOUTS  %u\n", (unsigned) LAYOUT_COUNT);
+    printf("#define KEYMAP_STATES   %d\n", STATES);
+    printf("#define KEYMAP_MOD_MASK 0x%02X\n\n", STATES - 1);
+    printf("static const char keymap_tables[KEYMAP_LAYOUTS][KEYMAP_STATES][256] = {\n");
+    for (size_t l = 0; l < LAYOUT_COUNT; l++) {
+        printf("    /* %s */\n    {\n", layouts[l].name);
+        for (int state = 0; state < STATES; state++) {
+            char table[256];
+            build_table(&layouts[l], state, table);
+            printf("        /* %s */\n", state_names[state]);
+            print_table(table);
+        }
+        printf("    },\n");
+    }
+    printf("};\n");
+    return 0;
+}
@@ -0,0 +1,116 @@
+#!/bin/sh
+# symbolize.sh - Per-function report from a sampling profile for NEBULA OS
+#
+# Usage: symbolize.sh <nm> <kernel.bin> <profile.log>
+#
+# Reads the serial log of a PROFILE=1 kernel, takes the last complete
+# "P begin" ... "P end" dump (counts are cumulative) and charges each
+# sampled EIP to the closest text symbol at or below it, as listed by
+# nm for the same kernel. Prints the per-CPU sample totals, then the
+# functions by samples, most first.
+
+if [ $# -ne 3 ]; then
+    echo "usage: $0 <nm> <kernel.bin> <profile.log>" >&2
+    exit 2
+fi
+NM=$1
+KERNEL=$2
+LOG=$3
+
+if [ ! -f "$KERNEL" ] || [ ! -f "$LOG" ]; then
+    echo "symbolize: need both $KERNEL and $LOG" >&2
+    exit 1
+fi
+
+"$NM" -n "$KERNEL" | awk '
+    # Hex string (with or without 0x) to a number - plain awk has no strtonum
+    function hex(s,    i, n, c) {
+        sub(/^0x/, "", s)
+        s = tolower(s)
+        n = 0
+        for (i = 1; i <= length(s); i++) {
+            c = index("0123456789abcdef", substr(s, i, 1))
+            n = n * 16 + c - 1
+        }
+        return n
+    }
+
+    # Index of the last symbol at or below addr, 0 if none
+    function lookup(addr,    lo, hi, mid) {
+        lo = 1
+        hi = nsyms
+        if (nsyms == 0 || addr < sym_addr[1]) {
+            return 0
+        }
+        while (lo < hi) {
+            mid = int((lo + hi + 1) / 2)
+            if (sym_addr[mid] <= addr) {
+                lo = mid
+            } else {
+                hi = mid - 1
+            }
+        }
+        return lo
+    }
+
+    # Symbols from nm (already sorted by address)
+    FNR == NR {
+        if ($2 ~ /^[tTwW]$/) {
+            nsyms++
+            sym_addr[nsyms] = hex($1)
+            sym_name[nsyms] = $3
+        }
+        next
+    }
+
+    # Profile log - keep the newest finished dump
+    { sub(/\r$/, "") }
+    $1 != "P" { next }
+    $2 == "begin" {
+        split("", pending)
+        split("", pending_cpu)
+        in_dump = 1
+        next
+    }
+    !in_dump { next }
+    $2 == "cpu" {
+        pending_cpu[$3] = $4 " samples, " $5 " dropped"
+        next
+    }
+    $2 == "end" {
+        split("", final)
+        split("", final_cpu)
+        for (eip in pending) final[eip] = pending[eip]
+        for (cpu in pending_cpu) final_cpu[cpu] = pending_cpu[cpu]
+        complete = 1
+        in_dump = 0
+        next
+    }
+    NF == 4 {
+        pending[$3] += $4
+    }
+
+    END {
+        if (!complete) {
+            print "symbolize: no complete profile dump in the log" > "/dev/stderr"
+            exit 1
+        }
+        for (cpu = 0; cpu in final_cpu; cpu++) {
+            printf "cpu %s: %s\n", cpu, final_cpu[cpu]
+        }
+        fflush("")                        # Before the sorted lines
+        total = 0
+        for (eip in final) {
+            i = lookup(hex(eip))
+            name = i ? sym_name[i] : "?"
+            by_name[name] += final[eip]
+            total += final[eip]
+        }
+        if (total == 0) {
+            exit 0
+        }
+        for (name in by_name) {
+            printf "%8d %6.2f%%  %s\n", by_name[name], 100 * by_name[name] / total, name | "sort -rn"
+        }
+    }
+' - "$LOG"